@@ -0,0 +1,135 @@
+#pragma once
+#include <codegen/interfaces/IBackend.h>
+#include <utils/String.h>
+
+namespace codegen {
+    class CodeCache;
+    class CodeKey;
+
+    /**
+     * @brief Executes calls to a function with native code produced by the host's C compiler. The
+     *        code of the function is printed as a self-contained C translation unit, which is
+     *        compiled to a shared object that's loaded with dlopen.
+     *
+     *        Each vreg becomes a local variable of the C type that it was first referred to with,
+     *        labels become goto targets and the stack allocations share one array laid out by the
+     *        function's StackLayout. Calls to other functions, and the addresses of functions and
+     *        global values, go through a context that's passed to the generated code, so the
+     *        generated source contains no addresses from the host process other than pointer
+     *        immediates, which are written as literals. A tail_call of the function to itself
+     *        jumps back to the start of its code with the new arguments, so self tail recursion
+     *        runs in constant stack space. Every other call, including tail calls to other
+     *        functions, goes through bind::Function::call, so recursion is otherwise limited by
+     *        the host stack.
+     *
+     *        Every instruction produces the same value as when it's interpreted by TestExecuter.
+     *        Unlike the interpreter's registers, a local only holds the bytes of its own type, so
+     *        the bytes that a narrow operation leaves unchanged in the interpreter aren't kept when
+     *        the vreg is referred to with a wider type. Any number of threads may call the
+     *        function at the same time.
+     *
+     *        Unless the code has pointer immediates, the compiled code doesn't depend on the
+     *        process it was compiled in, so it can be stored in a CodeCache and loaded by later
+     *        processes without being generated again. See CodeCache::IsCacheable.
+     */
+    class CCallHandler : public ICallHandler {
+        public:
+            /**
+             * @brief Generates, compiles and loads the code of a function. 'compiler' is the command
+             *        which invokes the C compiler, 'flags' are passed to it in addition to the flags
+             *        which are required to build a shared object
+             */
+            CCallHandler(CodeHolder* ch, const String& compiler, const String& flags);
+
+            /**
+             * @brief Same as above, the compiled code is also stored in the cache with the
+             *        specified key if the cache is not null
+             */
+            CCallHandler(CodeHolder* ch, const String& compiler, const String& flags, CodeCache* cache, const CodeKey* key);
+
+            /**
+             * @brief Loads code that was compiled from the same code by another handler, which was
+             *        stored in a file by a CodeCache. No source is generated
+             */
+            CCallHandler(CodeHolder* ch, const String& libraryPath);
+            virtual ~CCallHandler();
+
+            virtual void call(void* retDest, void** args);
+
+            /**
+             * @brief Returns the C source that the function was compiled from, which is empty if the
+             *        code was loaded from a cache
+             */
+            const String& getSource() const;
+
+        protected:
+            void collectSymbols(CodeHolder* ch);
+            void generate(CodeHolder* ch);
+            void compile(const String& compiler, const String& flags, CodeCache* cache, const CodeKey* key);
+            void load(const String& libraryPath);
+
+            String m_source;
+
+            // Addresses of the functions and values that the generated code refers to
+            void** m_symbols;
+            u32 m_symbolCount;
+
+            void* m_library;
+            void* m_entry;
+    };
+
+    /**
+     * @brief Backend which compiles functions with the host's C compiler, see CCallHandler. The
+     *        compiler is invoked as 'cc' with the flags '-O2' unless they're changed. Only hosts
+     *        which support dlopen are supported, transform() fails on any other host and throws if
+     *        the generated code fails to compile or load.
+     *
+     *        If a CodeCache is set, the code of each function is looked up in the cache with a key
+     *        computed from the post-processed code and getIdentity(). Code which is found is loaded
+     *        without being generated or compiled, and code which isn't is stored after it's
+     *        compiled. Entries which fail to load are compiled again and replaced.
+     */
+    class CBackend : public IBackend {
+        public:
+            CBackend();
+            virtual ~CBackend();
+
+            virtual bool transform(CodeHolder* processedCode);
+
+            /**
+             * @brief Sets the command used to invoke the C compiler
+             */
+            void setCompiler(const String& compiler);
+            const String& getCompiler() const;
+
+            /**
+             * @brief Sets the flags passed to the C compiler, in addition to the flags which are
+             *        required to build a shared object
+             */
+            void setCompilerFlags(const String& flags);
+            const String& getCompilerFlags() const;
+
+            /**
+             * @brief Sets the cache that compiled code is stored in and loaded from, or disables
+             *        caching if it's null. The cache must outlive the backend
+             */
+            void setCodeCache(CodeCache* cache);
+            CodeCache* getCodeCache() const;
+
+            /**
+             * @brief Returns a string which identifies the backend, the version of the code that it
+             *        generates and the compiler options, which is part of the key of cached code
+             */
+            String getIdentity() const;
+
+            /**
+             * @brief Returns true if the host is able to load the code generated by this backend
+             */
+            static bool IsSupported();
+
+        protected:
+            String m_compiler;
+            String m_flags;
+            CodeCache* m_cache;
+    };
+};
@@ -0,0 +1,136 @@
+#pragma once
+#include <codegen/types.h>
+#include <utils/String.h>
+#include <utils/Array.h>
+#include <atomic>
+
+namespace bind {
+    class FunctionType;
+};
+
+namespace codegen {
+    class CodeHolder;
+
+    /**
+     * @brief Key of a CodeCache entry. Holds everything that was added to it, along with a 64 bit
+     *        FNV-1a hash of it which names the entry
+     */
+    class CodeKey {
+        public:
+            CodeKey();
+
+            void add(const void* data, u32 size);
+            void add(u64 value);
+            void add(const String& str);
+
+            /**
+             * @brief Adds the symbol IDs of a signature's return, 'this' and argument types, but not the
+             *        symbol ID of the signature itself
+             */
+            void add(FunctionType* signature);
+
+            u64 getHash() const;
+
+            /**
+             * @brief Returns everything that was added to the key, in order
+             */
+            const Array<u8>& getData() const;
+
+            bool operator==(const CodeKey& rhs) const;
+            bool operator!=(const CodeKey& rhs) const;
+
+        protected:
+            u64 m_hash;
+            Array<u8> m_data;
+    };
+
+    /**
+     * @brief Persistent cache of the native code generated by a backend, which lets a backend skip
+     *        code generation for functions that it has compiled before, in this process or in an
+     *        earlier one. Each entry is a file in the cache's directory which is named after the
+     *        hash of its key, and entries are memory mapped rather than read when they're loaded or
+     *        stored.
+     *
+     *        The key that an entry was stored with follows its data in the file, and an entry is only
+     *        found by lookups with the same key, so keys with the same hash never get each other's
+     *        entries. Whatever reads an entry's file must ignore the bytes that follow the data, as
+     *        the dynamic loader does for shared objects.
+     *
+     *        Entries are written to a temporary file which is then moved into place, so any number
+     *        of threads and processes may share a cache directory. An entry is never replaced by one
+     *        with a different key, so an entry that was found by lookup() holds the data stored with
+     *        that key until clear() is called. Entries are never removed, except by clear().
+     */
+    class CodeCache {
+        public:
+            /**
+             * @brief Opens the cache in the specified directory, which is created if it doesn't exist
+             */
+            CodeCache(const String& directory);
+            ~CodeCache();
+
+            /**
+             * @brief Computes the key for the code of a function. The key covers the opcodes,
+             *        operands, types (by symbol ID) and immediates of the final post-processed code,
+             *        the signatures of the function and of the functions it calls, and the identity
+             *        of the backend. The backend identity must describe every option which changes
+             *        the backend's output.
+             *
+             *        Functions called by the code and values referred to by value_ptr are identified
+             *        by their names, so that an entry can be used by another process. Types are
+             *        identified by their symbol IDs, so an entry is only found by processes which
+             *        register them in the same order.
+             */
+            static CodeKey Key(CodeHolder* ch, const String& backendIdentity);
+
+            /**
+             * @brief Returns false if the code of a function depends on the process it's generated in,
+             *        and so must not be stored in or loaded from a cache. That's the case when any
+             *        operand is an immediate which isn't a number, such as a pointer, or when a
+             *        value_ptr refers to a value which isn't registered
+             */
+            static bool IsCacheable(CodeHolder* ch);
+
+            const String& getDirectory() const;
+
+            /**
+             * @brief Returns the path of the file which holds the entry for the specified key
+             */
+            String getPath(const CodeKey& key) const;
+
+            /**
+             * @brief Returns true if the cache holds an entry which was stored with the specified
+             *        key, and counts it as a hit or a miss
+             */
+            bool lookup(const CodeKey& key);
+
+            /**
+             * @brief Stores an entry, replacing any existing entry with the same key. Returns false
+             *        if the entry couldn't be written, or if an entry with a different key but the
+             *        same hash already exists
+             */
+            bool store(const CodeKey& key, const void* data, u64 size);
+
+            /**
+             * @brief Stores the contents of a file as an entry, returns false if the file couldn't
+             *        be read or the entry couldn't be stored
+             */
+            bool storeFile(const CodeKey& key, const String& path);
+
+            /**
+             * @brief Removes every entry from the cache's directory. Must not be called while any
+             *        other thread or process is using the cache
+             */
+            void clear();
+
+            u32 getHitCount() const;
+            u32 getMissCount() const;
+
+        protected:
+            bool holdsKey(const String& path, const CodeKey& key) const;
+
+            String m_directory;
+            std::atomic<u32> m_hits;
+            std::atomic<u32> m_misses;
+    };
+};
@@ -4,6 +4,8 @@
 #include <codegen/LabelMap.h>
 #include <codegen/ControlFlowGraph.h>
 #include <codegen/LivenessData.h>
+#include <codegen/StackLayout.h>
+#include <codegen/RegisterAllocation.h>
 #include <utils/Array.h>
 
 namespace codegen {
@@ -17,12 +19,18 @@ namespace codegen {
             void rebuildLabels();
             void rebuildCFG();
             void rebuildLiveness();
+            void rebuildStackLayout();
 
             FunctionBuilder* owner;
 
             LabelMap labels;
             ControlFlowGraph cfg;
             LivenessData liveness;
+            StackLayout stackLayout;
+
+            /** Filled in by a register allocation step, see RegisterAllocatorStep */
+            RegisterAllocation registers;
+
             Array<Instruction> code;
     };
 }
\ No newline at end of file
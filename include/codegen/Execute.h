@@ -1,10 +1,10 @@
 #pragma once
 #include <codegen/types.h>
 #include <codegen/Value.h>
+#include <codegen/TestBytecode.h>
 #include <bind/interfaces/ICallHandler.h>
 #include <utils/Array.h>
 #include <type_traits>
-#include <unordered_map>
 
 namespace bind {
     class Function;
@@ -12,21 +12,145 @@ namespace bind {
 
 namespace codegen {
     class CodeHolder;
+    class TestProfiler;
 
+    /**
+     * @brief Executes calls to a function with TestExecuter. The code is lowered once when the
+     *        handler is created and never modified afterwards, every call executes it with a new
+     *        TestExecuter whose frame comes from the calling thread's TestFramePool. Any number of
+     *        threads may call the function at the same time.
+     *
+     *        The handler must outlive every call to the function that has started. Interpreted code
+     *        checks the function's handler before each call it makes to another function, so the
+     *        handler may be replaced between calls.
+     */
     class TestExecuterCallHandler : public ICallHandler {
         public:
             TestExecuterCallHandler(CodeHolder* ch);
             virtual ~TestExecuterCallHandler();
 
             virtual void call(void* retDest, void** args);
+
+            /**
+             * @brief Returns the lowered code of the specified function if its call handler is a
+             *        TestExecuterCallHandler, or a LazyCallHandler which has been compiled to one,
+             *        otherwise null. Interpreted code uses this to call other interpreted functions
+             *        directly instead of going through bind::Function::call.
+             */
+            static const TestBytecode* GetCode(Function* fn);
         
         protected:
-            CodeHolder* m_code;
+            const TestBytecode* m_code;
     };
 
+    enum class TestDispatchMode : u8 {
+        /** One switch statement dispatches every instruction */
+        Switch,
+
+        /**
+         * Each handler jumps directly to the handler for the next instruction (requires the GCC/Clang
+         * labels-as-values extension, falls back to Switch when it's unavailable)
+         */
+        Threaded
+    };
+
+    enum class TestExecutionStatus : u8 {
+        /** The function returned */
+        Completed,
+
+        /** The budget ran out before the function returned, see TestExecuter::resume */
+        Suspended
+    };
+
+    /**
+     * @brief Per-thread pool of memory for TestExecuter frames. Frames are carved out of large
+     *        segments which are kept for the lifetime of the thread, so once a thread's pool is
+     *        warm creating a TestExecuter allocates nothing.
+     *
+     *        This is also the call stack of interpreted code. Direct calls between interpreted
+     *        functions allocate the callee's frame here instead of recursing on the host stack, so
+     *        recursion depth is only limited by memory. Each segment is twice the size of the one
+     *        before it (up to a limit), so deep recursion only needs a handful of segments and the
+     *        frames of consecutive calls stay next to each other in memory.
+     */
+    class TestFramePool {
+        public:
+            TestFramePool();
+            ~TestFramePool();
+
+            /**
+             * @brief Allocates a frame of the specified size, aligned to 16 bytes. The frame's
+             *        contents are not initialized.
+             *
+             * @param size Size of the frame in bytes
+             */
+            void* allocate(u32 size);
+
+            /**
+             * @brief Releases a frame allocated by this pool. Frames are expected to be released in
+             *        the reverse of the order they were allocated in, a frame that's released early is
+             *        only reclaimed once every frame allocated after it has been released too.
+             *
+             * @param frame Frame to release
+             */
+            void release(void* frame);
+
+            /**
+             * @brief Returns the total size of the frames that haven't been reclaimed, in bytes
+             */
+            u64 getUsedSize() const;
+
+            /**
+             * @brief Returns the total size of the memory owned by the pool, in bytes
+             */
+            u64 getCapacity() const;
+
+            /**
+             * @brief Frees the segments that no frames are allocated from, except for the first.
+             *        Memory is otherwise kept after deep recursion returns, in case it's needed again
+             */
+            void trim();
+
+            /**
+             * @brief Returns the pool that belongs to the calling thread
+             */
+            static TestFramePool* Get();
+
+        protected:
+            // The frame's offset in its segment is implied by the header's address
+            struct frame_header {
+                frame_header* prev;
+                u32 segment;
+                bool released;
+            };
+
+            // Keeps the frames that follow the headers aligned to 16 bytes
+            static constexpr u32 HeaderSize = (sizeof(frame_header) + 15) & ~15u;
+
+            struct segment {
+                u8* memory;
+                u32 capacity;
+                u32 used;
+            };
+
+            utils::Array<segment> m_segments;
+            u32 m_currentSegment;
+            frame_header* m_top;
+    };
+
+    /**
+     * @brief Interpreter for TestBytecode. Everything that changes while code executes (registers,
+     *        stack space, the call stack and any suspended execution) belongs to the executer, the
+     *        code itself is only read. Many executers may execute the same TestBytecode at the same
+     *        time, on any threads.
+     *
+     *        A single executer is not thread safe. Its frames are allocated from the TestFramePool of
+     *        the thread that created it, so it must only be used on that thread.
+     */
     class TestExecuter {
         public:
             TestExecuter(CodeHolder* ch);
+            TestExecuter(const TestBytecode* code);
             ~TestExecuter();
 
             void setArg(u32 index, bool value);
@@ -42,19 +166,131 @@ namespace codegen {
             void setArg(u32 index, f64 value);
             void setArg(u32 index, void* value);
             void setThisPtr(void* thisPtr);
+            void setArgs(void** args);
             void setReturnValuePointer(void* retDest);
+            void setDispatchMode(TestDispatchMode mode);
+            TestDispatchMode getDispatchMode() const;
             void execute();
 
+            /*
+             * Budgeted execution: The function is executed until it returns or until the budget runs
+             * out, whichever comes first. When the budget runs out the state of the interpreter is
+             * kept so that execution can be continued later with resume, which makes it possible to
+             * interleave many executers on one thread. Calls made to interpreted functions directly
+             * are suspended along with the caller, but calls made through bind::Function::call
+             * always run to completion.
+             *
+             * The return value pointer and the arguments must not be changed while suspended. Calling
+             * execute or executeBatch while suspended discards the suspended execution.
+             */
+
+            /**
+             * @brief Executes the function until it returns or the specified number of instructions
+             *        have been executed
+             */
+            TestExecutionStatus execute(u64 instructionBudget);
+
+            /**
+             * @brief Executes the function until it returns or the specified amount of time has passed.
+             *        The time is only checked periodically, so it may be exceeded slightly
+             */
+            TestExecutionStatus executeFor(u64 nanoseconds);
+
+            /**
+             * @brief Continues a suspended execution until the function returns or the specified
+             *        number of instructions have been executed
+             */
+            TestExecutionStatus resume(u64 instructionBudget);
+
+            /**
+             * @brief Continues a suspended execution until the function returns or the specified
+             *        amount of time has passed
+             */
+            TestExecutionStatus resumeFor(u64 nanoseconds);
+
+            /**
+             * @brief Returns true if execution was suspended and hasn't been resumed to completion or
+             *        cancelled yet
+             */
+            bool isSuspended() const;
+
+            /**
+             * @brief Discards a suspended execution
+             */
+            void cancel();
+
+            /*
+             * Batch execution: The function is executed once per lane, the arguments for each lane are
+             * read from columns of values (one element per lane). Arguments which don't have a column
+             * take the value passed to setArg for every lane. Lanes are independent invocations, the
+             * order in which their memory accesses are made relative to one another is unspecified.
+             */
+            void setBatchArg(u32 index, const bool* values);
+            void setBatchArg(u32 index, const u8* values);
+            void setBatchArg(u32 index, const u16* values);
+            void setBatchArg(u32 index, const u32* values);
+            void setBatchArg(u32 index, const u64* values);
+            void setBatchArg(u32 index, const i8* values);
+            void setBatchArg(u32 index, const i16* values);
+            void setBatchArg(u32 index, const i32* values);
+            void setBatchArg(u32 index, const i64* values);
+            void setBatchArg(u32 index, const f32* values);
+            void setBatchArg(u32 index, const f64* values);
+            void setBatchArg(u32 index, void* const* values);
+
+            /**
+             * @brief Sets the array which receives the return value of each lane of a batch
+             */
+            void setBatchReturnValues(void* retDest);
+
+            /**
+             * @brief Executes the function for the specified number of lanes. Lanes are executed in
+             *        groups, with each instruction being executed for the whole group at once and the
+             *        registers stored as structure-of-arrays. When the lanes of a group disagree about a
+             *        branch, or an instruction can't be executed that way, the rest of the function is
+             *        executed for each lane of the group separately.
+             *
+             * @param laneCount Number of lanes to execute
+             */
+            void executeBatch(u32 laneCount);
+
+            /**
+             * @brief Returns the number of lanes executed together by executeBatch
+             */
+            static u32 GetBatchWidth();
+
+            /**
+             * @brief Sets the profiler that collects statistics about the code executed by this
+             *        executer, or null to disable profiling. Without a profiler, execution pays no
+             *        cost for profiling. Batches executed with a profiler execute each lane separately
+             *
+             * @param profiler Profiler to use, which must outlive any execution that uses it
+             */
+            void setProfiler(TestProfiler* profiler);
+            TestProfiler* getProfiler() const;
+
+            /**
+             * @brief Returns true if TestDispatchMode::Threaded is supported by the compiler that built
+             *        this library
+             */
+            static bool IsThreadedDispatchAvailable();
+
+            /**
+             * @brief Executes a single conversion, vector operation, fmod or dmod on the specified
+             *        register file. Native backends use this for the operations that they don't
+             *        generate code for, the result is the same as when it's interpreted
+             */
+            static void ExecuteOperation(const TestInstruction& inst, u64* registers);
+
+            /**
+             * @brief Returns the value of the specified vreg. Vregs share register slots once the
+             *        values they hold are no longer needed, so this is only meaningful while the vreg
+             *        is live. Throws if the vreg doesn't exist in the code or was removed from it
+             */
             template <typename T>
             std::enable_if_t<std::is_fundamental_v<T> || std::is_pointer_v<T> || std::is_reference_v<T>, T>
             getRegister(vreg_id regId) const {
-                if constexpr (std::is_fundamental_v<T> || std::is_pointer_v<T>) {
-                    return *(T*)&m_registers[regId];
-                }
-                
-                if constexpr (std::is_reference_v<T>) {
-                    return *(std::remove_reference_t<T>*)&m_registers[regId];
-                }
+                return getSlot<T>(getRegisterSlot(regId));
             }
 
             template <typename T>
@@ -66,27 +302,87 @@ namespace codegen {
             template <typename T>
             std::enable_if_t<std::is_fundamental_v<T> || std::is_pointer_v<T> || std::is_reference_v<T>, void>
             setRegister(vreg_id regId, T value) const {
+                setSlot<T>(getRegisterSlot(regId), value);
+            }
+
+        protected:
+            struct call_frame;
+
+            u32 getRegisterSlot(vreg_id regId) const;
+
+            template <typename T>
+            std::enable_if_t<std::is_fundamental_v<T> || std::is_pointer_v<T> || std::is_reference_v<T>, T>
+            getSlot(u32 slot) const {
                 if constexpr (std::is_fundamental_v<T> || std::is_pointer_v<T>) {
-                    *(T*)&m_registers[regId] = value;
+                    return *(T*)&m_registers[slot];
                 }
                 
                 if constexpr (std::is_reference_v<T>) {
-                    *(std::remove_reference_t<T>*)&m_registers[regId] = value;
+                    return *(std::remove_reference_t<T>*)&m_registers[slot];
                 }
             }
 
-        protected:
-            CodeHolder* m_code;
-            FunctionBuilder* m_fb;
+            template <typename T>
+            std::enable_if_t<std::is_fundamental_v<T> || std::is_pointer_v<T> || std::is_reference_v<T>, void>
+            setSlot(u32 slot, T value) const {
+                if constexpr (std::is_fundamental_v<T> || std::is_pointer_v<T>) {
+                    *(T*)&m_registers[slot] = value;
+                }
+                
+                if constexpr (std::is_reference_v<T>) {
+                    *(std::remove_reference_t<T>*)&m_registers[slot] = value;
+                }
+            }
+
+            struct batch_column {
+                const u8* values;
+                u32 stride;
+            };
+
+            void dispatch();
+            TestExecutionStatus dispatchWithBudget(u64 instructionBudget, u64 nanoseconds);
+            bool isBudgetExhausted();
+            void releaseCallStack();
+            void reserveTailCallParams(u32 count);
+            void setBatchColumn(u32 index, const void* values, u32 stride);
+            void runBatch(u64* registers, u32 firstLane, u32 laneCount);
+            void runBatchLanes(const u64* registers, u32 firstLane, u32 laneCount, u32 instructionIdx);
+
+            template <bool Threaded, bool Instrumented>
+            void run();
+
+            const TestBytecode* m_code;
+            bool m_ownsCode;
             Function* m_func;
 
-            u8* m_stack;
+            TestFramePool* m_pool;
+            u8* m_frame;
             u64* m_registers;
             void* m_returnPtr;
-            u32 m_stackOffset;
-            i32 m_instructionIdx;
-            std::unordered_map<stack_id, u32> m_stackAddrs;
-            std::unordered_map<label_id, i32> m_labelAddrs;
-            utils::Array<u64> m_nextCallParams;
+
+            // Frames of the interpreted functions that were called directly and haven't returned yet
+            call_frame* m_callStack;
+
+            // State of the function that was executing when the budget ran out, m_suspendedCode is
+            // null if execution isn't suspended
+            const TestBytecode* m_suspendedCode;
+            u64* m_suspendedRegisters;
+            void* m_suspendedReturnPtr;
+
+            // Instructions left before the budget is checked, and the time at which a time budget
+            // runs out (0 for instruction budgets)
+            bool m_budgeted;
+            u64 m_budget;
+            u64 m_deadline;
+
+            // Parameters of a tail call, held while the caller's frame is replaced by the callee's
+            u64* m_tailCallParams;
+            u32 m_tailCallParamCapacity;
+
+            utils::Array<batch_column> m_batchArgs;
+            u8* m_batchReturnValues;
+            u32 m_instructionIdx;
+            TestDispatchMode m_dispatchMode;
+            TestProfiler* m_profiler;
     };
 };
\ No newline at end of file
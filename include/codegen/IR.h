@@ -42,6 +42,7 @@ namespace codegen {
         public:
             Instruction();
             Instruction(OpCode code);
+            Instruction(const Instruction& rhs);
 
             OpCode op;
             Value operands[3];
@@ -231,6 +231,23 @@ namespace codegen {
         ineq,      // op0 = op1 != op2 (signed integer)
         uneq,      // op0 = op1 != op2 (unsigned integer)
         fneq,      // op0 = op1 != op2 (32 bit floating point)
-        dneq       // op0 = op1 != op2 (64 bit floating point)
+        dneq,      // op0 = op1 != op2 (64 bit floating point)
+
+        // Calls a function and returns whatever it returns from the current
+        // function, without returning to the current function first. Backends
+        // should reuse the current function's stack frame for the callee, so
+        // that any number of consecutive tail calls run in constant stack
+        // space. Emitted by TailCallEliminationStep in place of a call which is
+        // immediately followed by a return of its result
+        //
+        // The callee must return the same type as the current function, and
+        // nothing may refer to the current function's stack allocations once
+        // the call is made
+        //
+        // Operand 0 will be the same as operand 0 of call
+        // Operand 1 will be empty, the return value is written wherever the
+        // current function would have written its own
+        // Operand 2 will be the same as operand 2 of call
+        tail_call
     };
 };
\ No newline at end of file
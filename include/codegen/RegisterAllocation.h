@@ -0,0 +1,96 @@
+#pragma once
+#include <codegen/types.h>
+#include <utils/Array.h>
+#include <unordered_map>
+
+namespace codegen {
+    /** Physical register ID of vregs which haven't been assigned one */
+    constexpr u32 NoPhysicalRegister = 0xFFFFFFFF;
+
+    /**
+     * @brief The physical registers of a target which a register allocator may assign to vregs.
+     *        The IDs are chosen by the target, ie. they may be the encodings of the registers.
+     *        Registers which the target reserves for its own use should not be included
+     */
+    struct PhysicalRegisterSet {
+        /** Registers which may hold integer and pointer values */
+        Array<u32> gprs;
+
+        /** Registers which may hold floating point values */
+        Array<u32> fprs;
+    };
+
+    struct RegisterAssignment {
+        vreg_id reg_id;
+
+        /** First instruction at which the vreg holds a value */
+        address begin;
+
+        /** Last instruction at which the vreg holds a value */
+        address end;
+
+        bool is_fp;
+
+        /** ID of the register from the PhysicalRegisterSet that the vreg is assigned to */
+        u32 physical;
+    };
+
+    struct RegisterAllocationStats {
+        /** Number of functions that registers were allocated for */
+        u32 functionCount;
+
+        /** Number of vregs that were assigned a physical register */
+        u32 assignedCount;
+
+        /** Number of vregs that were spilled to the stack */
+        u32 spilledCount;
+
+        /** Number of stores of spilled vregs which were inserted */
+        u32 spillStoreCount;
+
+        /** Number of loads of spilled vregs which were inserted */
+        u32 reloadCount;
+
+        /** Number of times that the allocator was run, each spill requires another run */
+        u32 roundCount;
+
+        void add(const RegisterAllocationStats& o);
+    };
+
+    /**
+     * @brief The physical registers that a register allocator assigned to the vregs of a function.
+     *        Each vreg which is referred to by the code holds the same physical register for its
+     *        whole lifetime, any vregs which didn't fit were replaced with stack allocations and
+     *        short-lived vregs which hold their values for a single instruction.
+     *
+     *        NullRegister is never assigned a physical register, values written to it are discarded
+     */
+    class RegisterAllocation {
+        public:
+            RegisterAllocation();
+
+            void clear();
+            void add(const RegisterAssignment& assignment);
+
+            /**
+             * @brief Returns true if registers have been allocated for the code
+             */
+            bool isAllocated() const;
+
+            /**
+             * @brief Returns the assignment of the specified vreg, or null if it wasn't assigned a
+             *        physical register
+             */
+            const RegisterAssignment* get(vreg_id reg) const;
+
+            /**
+             * @brief Returns the ID of the physical register that the specified vreg is assigned to,
+             *        or NoPhysicalRegister if it wasn't assigned one
+             */
+            u32 getPhysicalRegister(vreg_id reg) const;
+
+            Array<RegisterAssignment> assignments;
+            std::unordered_map<vreg_id, u32> assignmentMap;
+            RegisterAllocationStats stats;
+    };
+};
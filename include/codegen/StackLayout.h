@@ -0,0 +1,69 @@
+#pragma once
+#include <codegen/types.h>
+#include <utils/Array.h>
+#include <unordered_map>
+
+namespace codegen {
+    class CodeHolder;
+
+    struct StackAllocation {
+        stack_id id;
+        u32 size;
+        u32 alignment;
+
+        /** First instruction at which the allocation may be in use */
+        address begin;
+
+        /** Last instruction at which the allocation may be in use */
+        address end;
+
+        /** Offset of the allocation from the start of the function's stack space, in bytes */
+        u32 offset;
+
+        bool isConcurrent(const StackAllocation& o) const;
+    };
+
+    /**
+     * @brief Assigns an offset in the function's stack space to each stack_alloc ID. An allocation
+     *        is considered live from any 'stack_alloc' until every path through the CFG from it
+     *        reaches a 'stack_free' for the same ID, and allocations which are never live at the
+     *        same time share space.
+     *
+     *        Backends should use this instead of giving every stack ID its own space, since
+     *        generated code with many nested scopes would otherwise need frames several times
+     *        larger than necessary.
+     */
+    class StackLayout {
+        public:
+            StackLayout();
+            StackLayout(CodeHolder* ch);
+            void rebuild(CodeHolder* ch);
+
+            /**
+             * @brief Returns the allocation for the specified stack ID, or null if the code never
+             *        allocates it
+             */
+            const StackAllocation* get(stack_id id) const;
+
+            /**
+             * @brief Returns the number of bytes of stack space required by all of the allocations
+             */
+            u32 getSize() const;
+
+            /**
+             * @brief Returns the alignment that the stack space must have for every allocation to
+             *        be aligned
+             */
+            u32 getAlignment() const;
+
+            Array<StackAllocation> allocations;
+            std::unordered_map<stack_id, u32> allocMap;
+
+        protected:
+            void computeLifetimes(CodeHolder* ch);
+            void assignOffsets();
+
+            u32 m_size;
+            u32 m_alignment;
+    };
+};
@@ -0,0 +1,439 @@
+#pragma once
+#include <codegen/types.h>
+#include <codegen/Immediate.h>
+#include <codegen/SourceMap.h>
+#include <utils/Array.h>
+#include <atomic>
+#include <mutex>
+
+namespace bind {
+    class Function;
+    class ICallHandler;
+};
+
+namespace codegen {
+    class CodeHolder;
+
+    /*
+     * Binary operations, each of which is lowered to three forms depending on the kinds
+     * of its operands:
+     *     <name>_rr: op0 = reg(op1) <op> reg(op2)
+     *     <name>_ri: op0 = reg(op1) <op> imm
+     *     <name>_ir: op0 = imm <op> reg(op2)
+     */
+    #define CODEGEN_TEST_BINARY_OPS(F, X) \
+        F(X, shl) F(X, shr) F(X, land) F(X, band) F(X, lor) F(X, bor) F(X, _xor) \
+        F(X, iadd) F(X, uadd) F(X, fadd) F(X, dadd) \
+        F(X, isub) F(X, usub) F(X, fsub) F(X, dsub) \
+        F(X, imul) F(X, umul) F(X, fmul) F(X, dmul) \
+        F(X, idiv) F(X, udiv) F(X, fdiv) F(X, ddiv) \
+        F(X, imod) F(X, umod) F(X, fmod) F(X, dmod)
+
+    /*
+     * Comparisons, which are lowered to the same three forms as binary operations. A comparison
+     * whose result is only used by the branch that immediately follows it is fused with that
+     * branch, which produces one of three more forms that jump to the instruction index in op0
+     * when the comparison is false:
+     *     <name>_rr_br: if (!(reg(op1) <op> reg(op2))) goto op0
+     *     <name>_ri_br: if (!(reg(op1) <op> imm)) goto op0
+     *     <name>_ir_br: if (!(imm <op> reg(op2))) goto op0
+     */
+    #define CODEGEN_TEST_COMPARE_OPS(F, X) \
+        F(X, ilt) F(X, ult) F(X, flt) F(X, dlt) \
+        F(X, ilte) F(X, ulte) F(X, flte) F(X, dlte) \
+        F(X, igt) F(X, ugt) F(X, fgt) F(X, dgt) \
+        F(X, igte) F(X, ugte) F(X, fgte) F(X, dgte) \
+        F(X, ieq) F(X, ueq) F(X, feq) F(X, deq) \
+        F(X, ineq) F(X, uneq) F(X, fneq) F(X, dneq)
+
+    /*
+     * Integer binary operations and comparisons whose results depend on bits above the width of
+     * their operands. Registers only hold meaningful data in the bytes covered by the type of the
+     * value that they hold, so these are lowered to an 8, 16 or 32 bit form for narrower operands
+     * which reads the operands at that width:
+     *     <name>8_rr, <name>16_rr, <name>32_rr, ...
+     *
+     * Each width has all of the forms of the operation, the unsuffixed forms operate on the full
+     * register and are used for 64 bit operands. '_not' and 'branch' have narrow forms for the
+     * same reason.
+     */
+    #define CODEGEN_TEST_NARROW_BINARY_OPS(F, X) \
+        F(X, shl) F(X, shr) F(X, land) F(X, lor) \
+        F(X, idiv) F(X, udiv) F(X, imod) F(X, umod)
+
+    #define CODEGEN_TEST_NARROW_COMPARE_OPS(F, X) \
+        F(X, ilt) F(X, ult) F(X, ilte) F(X, ulte) \
+        F(X, igt) F(X, ugt) F(X, igte) F(X, ugte) \
+        F(X, ieq) F(X, ueq) F(X, ineq) F(X, uneq)
+
+    /*
+     * Unary operations, each of which is lowered to two forms depending on the kind of
+     * its operand:
+     *     <name>_r: op0 = <op> reg(op1)
+     *     <name>_i: op0 = <op> imm
+     *
+     * Except for 'param' and 'param_ptr', which write to the argument slot index in op1 of the
+     * frame's argument block rather than a register. 'param' passes a pointer to the value to the
+     * callee, 'param_ptr' is used for arguments which are already pointers to the data being passed
+     * (non-primitive arguments) and passes the value itself.
+     */
+    #define CODEGEN_TEST_UNARY_OPS(F, X) \
+        F(X, mov) F(X, _not) F(X, inv) F(X, ineg) F(X, fneg) F(X, dneg) F(X, param) F(X, param_ptr) \
+        F(X, store8) F(X, store16) F(X, store32) F(X, store64) \
+        F(X, ret8) F(X, ret16) F(X, ret32) F(X, ret64)
+
+    /*
+     * Vector operations which accept either a vector or a scalar as the source operand
+     *     <name>_v: op1 is a pointer to a vector
+     *     <name>_s: op1 is a scalar
+     */
+    #define CODEGEN_TEST_VECTOR_OPS(F, X) \
+        F(X, vset) F(X, vadd) F(X, vsub) F(X, vmul) F(X, vdiv) F(X, vmod)
+
+    /*
+     * Conversions, each of which is lowered to one form per pair of source and destination types
+     * so that neither type has to be looked up when the conversion is executed:
+     *     cvt_<from>_<to>: op0 = (to)reg(op1)
+     *
+     * The types are listed in the same order as TestValueType.
+     */
+    #define CODEGEN_TEST_CVT_TYPES(F, X, from) \
+        F(X, from, i8) F(X, from, i16) F(X, from, i32) F(X, from, i64) \
+        F(X, from, u8) F(X, from, u16) F(X, from, u32) F(X, from, u64) \
+        F(X, from, f32) F(X, from, f64)
+
+    #define CODEGEN_TEST_CVT_OPS(F, X) \
+        CODEGEN_TEST_CVT_TYPES(F, X, i8) CODEGEN_TEST_CVT_TYPES(F, X, i16) \
+        CODEGEN_TEST_CVT_TYPES(F, X, i32) CODEGEN_TEST_CVT_TYPES(F, X, i64) \
+        CODEGEN_TEST_CVT_TYPES(F, X, u8) CODEGEN_TEST_CVT_TYPES(F, X, u16) \
+        CODEGEN_TEST_CVT_TYPES(F, X, u32) CODEGEN_TEST_CVT_TYPES(F, X, u64) \
+        CODEGEN_TEST_CVT_TYPES(F, X, f32) CODEGEN_TEST_CVT_TYPES(F, X, f64)
+
+    #define CODEGEN_TEST_BINARY_FORMS(X, name) X(name##_rr) X(name##_ri) X(name##_ir)
+    #define CODEGEN_TEST_COMPARE_FORMS(X, name) CODEGEN_TEST_BINARY_FORMS(X, name) X(name##_rr_br) X(name##_ri_br) X(name##_ir_br)
+    #define CODEGEN_TEST_UNARY_FORMS(X, name) X(name##_r) X(name##_i)
+    #define CODEGEN_TEST_VECTOR_FORMS(X, name) X(name##_v) X(name##_s)
+    #define CODEGEN_TEST_CVT_FORMS(X, from, to) X(cvt_##from##_##to)
+    #define CODEGEN_TEST_NARROW_BINARY_FORMS(X, name) \
+        CODEGEN_TEST_BINARY_FORMS(X, name##8) CODEGEN_TEST_BINARY_FORMS(X, name##16) CODEGEN_TEST_BINARY_FORMS(X, name##32)
+    #define CODEGEN_TEST_NARROW_COMPARE_FORMS(X, name) \
+        CODEGEN_TEST_COMPARE_FORMS(X, name##8) CODEGEN_TEST_COMPARE_FORMS(X, name##16) CODEGEN_TEST_COMPARE_FORMS(X, name##32)
+
+    /*
+     * Every opcode understood by TestExecuter, in order. Operands that refer to registers hold
+     * register indices, operands that refer to labels hold instruction indices. For 'call', op0
+     * holds the number of parameters that were passed and meta points to the TestCallSite. For
+     * 'call_r', op0 holds the function value being called, imm holds the number of parameters that
+     * were passed and meta points to the TestCallSite. 'tail_call' and 'tail_call_r' have the same
+     * operands as 'call' and 'call_r', and are always followed by a 'ret'. For 'value_ptr', imm
+     * holds the address of the value, which is resolved when the code is lowered.
+     *
+     * The indexed loads and stores are the fused form of a pointer offset by a register followed
+     * by a load or store through the resulting pointer:
+     *     load<N>_x:  op0 = *(reg(op1) + reg(op2) + imm)
+     *     store<N>_x: *(reg(op1) + reg(op2) + imm) = reg(op0)
+     */
+    #define CODEGEN_TEST_OPS(X) \
+        X(noop) \
+        X(stack_ptr) X(value_ptr) X(ret_ptr) \
+        X(load8) X(load16) X(load32) X(load64) \
+        X(load8_x) X(load16_x) X(load32_x) X(load64_x) \
+        X(store8_x) X(store16_x) X(store32_x) X(store64_x) \
+        X(jump) X(branch8) X(branch16) X(branch32) X(branch) \
+        CODEGEN_TEST_CVT_OPS(CODEGEN_TEST_CVT_FORMS, X) \
+        X(call) X(call_r) X(tail_call) X(tail_call_r) X(ret) \
+        X(iinc) X(uinc) X(finc) X(dinc) X(idec) X(udec) X(fdec) X(ddec) \
+        X(vneg) X(vdot) X(vmag) X(vmagsq) X(vnorm) X(vcross) \
+        CODEGEN_TEST_UNARY_OPS(CODEGEN_TEST_UNARY_FORMS, X) \
+        X(_not8_r) X(_not8_i) X(_not16_r) X(_not16_i) X(_not32_r) X(_not32_i) \
+        CODEGEN_TEST_VECTOR_OPS(CODEGEN_TEST_VECTOR_FORMS, X) \
+        CODEGEN_TEST_BINARY_OPS(CODEGEN_TEST_BINARY_FORMS, X) \
+        CODEGEN_TEST_NARROW_BINARY_OPS(CODEGEN_TEST_NARROW_BINARY_FORMS, X) \
+        CODEGEN_TEST_COMPARE_OPS(CODEGEN_TEST_COMPARE_FORMS, X) \
+        CODEGEN_TEST_NARROW_COMPARE_OPS(CODEGEN_TEST_NARROW_COMPARE_FORMS, X)
+
+    enum class TestOp : u16 {
+        #define X(name) name,
+        CODEGEN_TEST_OPS(X)
+        #undef X
+        OpCount
+    };
+
+    /**
+     * @brief Primitive value types, used to bake the element type of vector operations into
+     *        the instruction stream
+     */
+    enum class TestValueType : u8 {
+        None,
+        Int8,
+        Int16,
+        Int32,
+        Int64,
+        UInt8,
+        UInt16,
+        UInt32,
+        UInt64,
+        Float32,
+        Float64
+    };
+
+    /** Marks stack IDs and label IDs which aren't defined by the lowered code */
+    constexpr u32 TestUnresolvedOffset = 0xFFFFFFFF;
+
+    /**
+     * @brief Pre-decoded instruction executed by TestExecuter
+     */
+    struct TestInstruction {
+        /** Opcode, specialized for the kinds and widths of the operands */
+        TestOp op;
+
+        /** Element type for vector operations */
+        TestValueType type;
+
+        /** Component count for vector operations */
+        u8 componentCount;
+
+        /** Register indices, instruction indices, stack IDs or offsets (depending on op) */
+        u32 operands[3];
+
+        /** Immediate operand, if any */
+        Immediate imm;
+
+        /** Opcode-specific metadata resolved at lowering time */
+        const void* meta;
+    };
+
+    enum class TestCallKind : u8 {
+        /** The callee is executed by TestExecuter, calls push a frame and jump to its code */
+        Direct,
+
+        /** The callee is called through bind::Function::call */
+        Host
+    };
+
+    class TestBytecode;
+
+    /**
+     * @brief A function that was called by a call site, and how calls to it are made. Sites keep one
+     *        target for each function they've called, which is updated in place when the function's
+     *        call handler changes. Threads read targets without locking, see 'version'
+     */
+    struct TestCallTarget {
+        /** Function that was called, this never changes */
+        Function* function;
+
+        /**
+         * Incremented before and after the fields below are updated, so it's odd while they are.
+         * Readers check that it's even and unchanged after they've read them
+         */
+        std::atomic<u32> version;
+
+        /** Either TestCallKind::Direct or TestCallKind::Host */
+        std::atomic<TestCallKind> kind;
+
+        /** Lowered code of the function if kind is TestCallKind::Direct, otherwise null */
+        std::atomic<const TestBytecode*> code;
+
+        /**
+         * Call handler of the function when the target was resolved, the target is only used while
+         * the function still has it. Null for calls of lowered code to itself, which always run
+         * the same code
+         */
+        std::atomic<const ICallHandler*> handler;
+
+        /**
+         * Generation of the function's interpreted code when the target was resolved. It changes
+         * whenever a TestExecuterCallHandler for the function is created or destroyed, so that a
+         * target isn't used with a new handler that was allocated at the same address
+         */
+        std::atomic<u32> generation;
+    };
+
+    /**
+     * @brief A call made by lowered code. For 'call' the callee is known when the code is lowered,
+     *        for 'call_r' only its signature is and the callee is found when the call is executed
+     */
+    struct TestCallSite {
+        /** Function being called, or null if it's called through a function value */
+        Function* function;
+
+        /**
+         * True if the callee's return value is written to the register that receives it, false if
+         * that register holds a pointer to the memory the return value is written to
+         */
+        bool returnsInRegister;
+
+        /** True if a 'this' pointer is passed before the arguments */
+        bool passesThis;
+
+        /** Masks applied to each parameter before it's passed to the callee, by argument index */
+        Array<u64> argMasks;
+
+        /**
+         * Monomorphic inline cache. Holds the target of the most recent call, which is reused as
+         * long as the same function keeps being called and its call handler isn't replaced
+         */
+        std::atomic<const TestCallTarget*> cachedTarget;
+
+        /**
+         * Target of each function that has been called by the site. They're owned by the site and
+         * never freed before it is, so threads which still hold one that was replaced can keep
+         * reading it
+         */
+        Array<TestCallTarget*> knownTargets;
+
+        /**
+         * Held while the site's targets are resolved. Each site has its own, and calls which find
+         * their target in cachedTarget don't take it
+         */
+        std::mutex targetsLock;
+    };
+
+    /**
+     * @brief Range of IR instructions that make up one basic block of lowered code
+     */
+    struct TestBlockInfo {
+        /** Index of the first IR instruction in the block */
+        u32 begin;
+
+        /** Index of the IR instruction after the last one in the block */
+        u32 end;
+
+        /**
+         * Index of the first lowered instruction of the block, or TestUnresolvedOffset if nothing in
+         * the block needed to be lowered. The block is entered each time this instruction is executed
+         */
+        u32 firstInstruction;
+    };
+
+    /**
+     * @brief Compact, pre-decoded form of a function for TestExecuter. The decoding work
+     *        which would otherwise be repeated for every executed instruction (operand kinds,
+     *        operand types, label addresses) is done once when the function is lowered.
+     *
+     *        Lowered code doesn't refer to the CodeHolder it was lowered from and is never
+     *        modified by executing it, so it can be shared by any number of threads. The only
+     *        exception is the call sites, whose resolution state and inline caches are updated
+     *        atomically by the threads that execute the calls.
+     */
+    class TestBytecode {
+        public:
+            /**
+             * @brief Lowers the (finalized) code in the specified CodeHolder
+             *
+             * @param ch CodeHolder containing the code to lower
+             */
+            TestBytecode(CodeHolder* ch);
+            TestBytecode(const TestBytecode&) = delete;
+            ~TestBytecode();
+
+            /** Function that the code belongs to */
+            Function* function;
+
+            /** Number of register slots required to execute the code */
+            u32 registerCount;
+
+            /** Size of the stack space required to execute the code, in bytes */
+            u32 stackSize;
+
+            /** Maximum number of parameters passed to a single call */
+            u32 maxCallParams;
+
+            /**
+             * Size of a frame for this code, in bytes. Frames hold the registers, followed by the
+             * argument block for the next call, followed by the stack space. The argument block
+             * holds the parameter values followed by the argument pointers that bind::Function::call
+             * expects, with one extra slot in front for the 'this' pointer.
+             */
+            u32 frameSize;
+
+            /** Offset of the parameter values from the start of a frame, in bytes */
+            u32 paramsOffset;
+
+            /** Offset of the argument pointers from the start of a frame, in bytes */
+            u32 argPointersOffset;
+
+            /** Offset of the stack space from the start of a frame, in bytes */
+            u32 stackOffset;
+
+            /** Register slot that holds the 'this' pointer, or NullRegister */
+            vreg_id thisRegister;
+
+            /** Register slots that hold the function arguments, by argument index */
+            Array<vreg_id> argRegisters;
+
+            /**
+             * Number of bytes copied from each argument pointer of a call into its register, by argument
+             * index. Arguments with a size of 0 are passed by the pointer itself
+             */
+            Array<u8> argSizes;
+
+            /** Whether the function takes a 'this' pointer, which precedes the argument pointers of a call */
+            bool takesThis;
+
+            /**
+             * Offsets of each stack allocation from the start of the stack space, indexed by stack ID
+             * (FunctionBuilder allocates these sequentially). IDs which were never allocated map to
+             * TestUnresolvedOffset. Offsets come from CodeHolder::stackLayout, so allocations which
+             * are never live at the same time may share an offset.
+             */
+            Array<u32> stackOffsets;
+
+            /** Lowered code */
+            Array<TestInstruction> code;
+
+            /** Calls made by the code, the 'meta' field of each 'call' instruction points to one of these */
+            TestCallSite* callSites;
+
+            /** Number of elements in callSites */
+            u32 callSiteCount;
+
+            /**
+             * Index of the IR instruction that each instruction was lowered from. Instructions which
+             * were fused map to the first IR instruction, the implicit return at the end of the code
+             * maps to TestUnresolvedOffset
+             */
+            Array<u32> sourceIndices;
+
+            /** Basic blocks of the IR the code was lowered from, see ControlFlowGraph */
+            Array<TestBlockInfo> blocks;
+
+            /** Index of the block that contains each instruction, or TestUnresolvedOffset */
+            Array<u32> blockIndices;
+
+            /** Copy of the source map of the FunctionBuilder that generated the code, indexed by IR instruction */
+            SourceMap sourceMap;
+
+            /**
+             * Register slot assigned to each vreg, indexed by vreg ID. Vregs whose values are never
+             * needed at the same time share a slot, so registerCount is usually far smaller than the
+             * number of vregs. Vregs which don't appear in the code map to TestUnresolvedOffset
+             */
+            Array<u32> registerMap;
+
+            /**
+             * @brief Clears the registers and stack space of a frame for this code. The argument block is
+             * left as it is, it's always written before it's read
+             *
+             * @param frame Frame of frameSize bytes
+             */
+            void clearFrame(u8* frame) const;
+
+            /**
+             * @brief Writes the 'this' pointer and arguments of a call into their registers, which must be cleared
+             *
+             * @param registers Register slots of the frame the function will be executed with
+             * @param args Argument pointers, as passed to bind::Function::call
+             */
+            void loadArguments(u64* registers, void** args) const;
+
+            /**
+             * @brief Returns the name of the specified opcode
+             */
+            static const char* OpName(TestOp op);
+
+        protected:
+            void lower(CodeHolder* ch);
+            void compactRegisters(CodeHolder* ch, const Array<vreg_id>& foldedBases, vreg_id scratch);
+    };
+};
@@ -0,0 +1,138 @@
+#pragma once
+#include <codegen/types.h>
+#include <codegen/TestBytecode.h>
+#include <utils/Array.h>
+#include <utils/String.h>
+#include <chrono>
+#include <unordered_map>
+
+namespace codegen {
+    /**
+     * @brief Execution counts and times collected for a single function
+     */
+    class TestFunctionProfile {
+        public:
+            TestFunctionProfile(const TestBytecode* code);
+
+            /**
+             * @brief Returns the number of times the specified basic block was entered
+             *
+             * @param blockIdx Index of the block in TestBytecode::blocks
+             */
+            u64 getBlockCount(u32 blockIdx) const;
+
+            /**
+             * @brief Returns the number of instructions executed in the specified basic block
+             *
+             * @param blockIdx Index of the block in TestBytecode::blocks
+             */
+            u64 getBlockInstructionCount(u32 blockIdx) const;
+
+            /**
+             * @brief Returns the location in the source code that the specified instruction was
+             *        generated from, or null if there isn't one
+             *
+             * @param instructionIdx Index of the instruction in TestBytecode::code
+             */
+            const SourceLocation* getSourceLocation(u32 instructionIdx) const;
+
+            /** Code that was profiled */
+            const TestBytecode* code;
+
+            /** Number of times each instruction was executed, by index in TestBytecode::code */
+            Array<u64> instructionCounts;
+
+            /**
+             * Time spent in each basic block, in nanoseconds, by index in TestBytecode::blocks. This
+             * is only collected when timing is enabled
+             */
+            Array<u64> blockTimes;
+
+            /** Total number of instructions executed */
+            u64 totalCount;
+    };
+
+    /**
+     * @brief Collects execution statistics for code run by a TestExecuter which it has been passed
+     *        to. Executers with no profiler use a separate interpreter loop which does none of this.
+     *
+     *        Calls to interpreted functions which are made directly by the interpreter are profiled
+     *        along with the caller, while calls made through bind::Function::call are only profiled
+     *        if the executer that handles them has a profiler.
+     *
+     *        A profiler must only be used by one thread at a time.
+     */
+    class TestProfiler {
+        public:
+            TestProfiler();
+            ~TestProfiler();
+
+            /**
+             * @brief Enables or disables measuring the time spent in each basic block. Timing has a
+             *        significant cost per instruction, so it's disabled by default
+             */
+            void setTimingEnabled(bool enabled);
+            bool isTimingEnabled() const;
+
+            /**
+             * @brief Discards everything that has been collected
+             */
+            void reset();
+
+            /**
+             * @brief Returns the profile for the specified code, creating it if it doesn't exist yet
+             */
+            TestFunctionProfile* getProfile(const TestBytecode* code);
+
+            /**
+             * @brief Returns the profile for the specified code, or null if that code hasn't been
+             *        executed
+             */
+            const TestFunctionProfile* findProfile(const TestBytecode* code) const;
+
+            /**
+             * @brief Returns the profiles for every function executed so far, in the order that
+             *        they were first executed
+             */
+            const Array<TestFunctionProfile*>& getProfiles() const;
+
+            /**
+             * @brief Returns a human readable report of the collected statistics, grouped by
+             *        function and then by basic block. Each block and instruction is annotated with
+             *        the source location it was generated from, if one is known
+             */
+            String generateReport() const;
+
+            /**
+             * @brief Records the execution of an instruction. Called by TestExecuter
+             */
+            void onInstruction(TestFunctionProfile* profile, u32 instructionIdx);
+
+            /**
+             * @brief Stops timing the current block. Called by TestExecuter when execution returns
+             *        to the host
+             */
+            void onStop();
+
+        protected:
+            void enterBlock(TestFunctionProfile* profile, u32 blockIdx);
+
+            Array<TestFunctionProfile*> m_profiles;
+            std::unordered_map<const TestBytecode*, TestFunctionProfile*> m_profileMap;
+            bool m_timingEnabled;
+
+            TestFunctionProfile* m_currentProfile;
+            u32 m_currentBlock;
+            std::chrono::steady_clock::time_point m_blockStart;
+    };
+
+    inline void TestProfiler::onInstruction(TestFunctionProfile* profile, u32 instructionIdx) {
+        profile->instructionCounts[instructionIdx]++;
+        profile->totalCount++;
+
+        if (!m_timingEnabled) return;
+
+        u32 block = profile->code->blockIndices[instructionIdx];
+        if (profile != m_currentProfile || block != m_currentBlock) enterBlock(profile, block);
+    }
+};
@@ -0,0 +1,54 @@
+#pragma once
+#include <codegen/types.h>
+#include <codegen/TestBytecode.h>
+
+namespace codegen {
+    /**
+     * @brief Instruction set extensions that vector kernels can be selected for
+     */
+    enum class TestSimdLevel : u8 {
+        /** No kernels, vector operations use the generic element loops */
+        None,
+
+        /** 128 bit kernels for every f32 and f64 shape */
+        SSE2,
+
+        /** SSE2, plus 256 bit kernels for f64x3 and f64x4 */
+        AVX2
+    };
+
+    /**
+     * @brief Specialized implementation of a vector operation for one element type and component
+     *        count. The arguments are the values of the instruction's operand registers, with the
+     *        same meanings that they have for the generic handler of the operation.
+     */
+    typedef void (*TestVectorKernel)(u64& op0, u64 op1, u64 op2);
+
+    /**
+     * @brief Kernels for the f32x2/3/4 and f64x2/3/4 shapes of the vector operations. They're
+     *        selected when code is lowered and stored in the 'meta' field of the instruction, so
+     *        the element type and component count aren't examined when the instruction executes.
+     *
+     *        Kernels may add components in a different order than the generic handlers do, so the
+     *        results of vdot, vmag, vmagsq and vnorm can differ from them in the last bit.
+     */
+    class TestVectorKernels {
+        public:
+            /**
+             * @brief Returns the highest level supported by the CPU that this process is running
+             *        on. This is detected the first time it's called
+             */
+            static TestSimdLevel GetSupportedLevel();
+
+            /**
+             * @brief Returns the kernel for the specified vector operation, element type and
+             *        component count at the specified level, or null if there isn't one
+             *
+             * @param op Vector opcode, either form of vset, vadd, vsub, vmul or vdiv, or vneg, vdot,
+             *           vmag, vmagsq, vnorm or vcross
+             * @param level Level to select the kernel for, which must be supported by the CPU if the
+             *              kernel is going to be called
+             */
+            static TestVectorKernel Get(TestOp op, TestValueType type, u8 componentCount, TestSimdLevel level);
+    };
+};
@@ -0,0 +1,152 @@
+#pragma once
+#include <codegen/types.h>
+#include <utils/Array.h>
+
+namespace codegen {
+    /**
+     * @brief General purpose registers, numbered the way they're encoded
+     */
+    enum class X86_64Reg : u8 {
+        rax, rcx, rdx, rbx, rsp, rbp, rsi, rdi,
+        r8, r9, r10, r11, r12, r13, r14, r15
+    };
+
+    /**
+     * @brief Condition codes, numbered the way they're encoded. Flipping the lowest bit of a
+     *        condition produces its inverse
+     */
+    enum class X86_64Cond : u8 {
+        o, no, b, ae, e, ne, be, a, s, ns, p, np, l, ge, le, g
+    };
+
+    /**
+     * @brief Encodes the subset of x86-64 that X86_64Backend generates. Memory operands are always
+     *        a base register plus a 32 bit displacement. Operand sizes are in bytes, integer
+     *        operations which don't take a size operate on 64 bits.
+     *
+     *        Jumps to code that hasn't been emitted yet are emitted with a placeholder offset,
+     *        the functions which emit them return the position of the offset so that it can be
+     *        filled in with patch() once the destination is known.
+     */
+    class X86_64Assembler {
+        public:
+            X86_64Assembler();
+
+            const u8* data() const;
+            u32 size() const;
+
+            void push(X86_64Reg r);
+            void pop(X86_64Reg r);
+            void ret();
+            void call(X86_64Reg target);
+
+            /** @brief Emits 'call rel32', returns the position of the offset */
+            u32 call();
+
+            /** @brief Emits 'jmp rel32', returns the position of the offset */
+            u32 jmp();
+
+            /** @brief Emits 'j<cond> rel32', returns the position of the offset */
+            u32 jcc(X86_64Cond cond);
+
+            /** @brief Points the jump whose offset is at 'at' to 'target' */
+            void patch(u32 at, u32 target);
+
+            void mov(X86_64Reg dst, X86_64Reg src);
+            void mov(X86_64Reg dst, u64 imm);
+
+            /** @brief Loads 'size' bytes and zero extends them to 64 bits */
+            void load(X86_64Reg dst, X86_64Reg base, i32 disp, u32 size = sizeof(u64));
+
+            /** @brief Loads 'size' bytes and sign extends them to 64 bits */
+            void loadSigned(X86_64Reg dst, X86_64Reg base, i32 disp, u32 size);
+
+            /** @brief Stores the low 'size' bytes of a register */
+            void store(X86_64Reg base, i32 disp, X86_64Reg src, u32 size = sizeof(u64));
+
+            void lea(X86_64Reg dst, X86_64Reg base, i32 disp);
+            void add(X86_64Reg dst, X86_64Reg src);
+            void add(X86_64Reg dst, X86_64Reg base, i32 disp);
+            void sub(X86_64Reg dst, X86_64Reg src);
+            void add(X86_64Reg dst, i32 imm);
+            void sub(X86_64Reg dst, i32 imm);
+            void imul(X86_64Reg dst, X86_64Reg src);
+            void and_(X86_64Reg dst, X86_64Reg src);
+            void or_(X86_64Reg dst, X86_64Reg src);
+            void xor_(X86_64Reg dst, X86_64Reg src);
+            void cmp(X86_64Reg a, X86_64Reg b);
+            void test(X86_64Reg a, X86_64Reg b, u32 size = sizeof(u64));
+
+            /** @brief Shifts by the value of cl */
+            void shl(X86_64Reg r);
+            void shr(X86_64Reg r);
+
+            void neg(X86_64Reg r);
+            void not_(X86_64Reg r);
+
+            /** @brief Flips bit 63 */
+            void btc63(X86_64Reg r);
+
+            /** @brief Sign extends rax into rdx */
+            void cqo();
+
+            /** @brief Divides rdx:rax, the quotient goes to rax and the remainder to rdx */
+            void idiv(X86_64Reg divisor);
+            void div(X86_64Reg divisor);
+
+            /** @brief Sets the low byte of a register (one of rax, rcx, rdx or rbx) to a condition */
+            void setcc(X86_64Cond cond, X86_64Reg r);
+
+            /** @brief Zero extends the low byte of a register to 64 bits */
+            void movzx8(X86_64Reg dst, X86_64Reg src);
+
+            /** @brief Combines the low bytes of two registers (each one of rax, rcx, rdx or rbx) */
+            void and8(X86_64Reg dst, X86_64Reg src);
+            void or8(X86_64Reg dst, X86_64Reg src);
+
+            void inc(X86_64Reg base, i32 disp);
+            void dec(X86_64Reg base, i32 disp);
+
+            /** @brief Stores al to rcx bytes starting at rdi */
+            void repStosb();
+
+            /**
+             * @brief Scalar SSE operations, 'size' selects between the single (4) and double (8)
+             *        precision forms
+             */
+            void movs(u8 xmm, X86_64Reg base, i32 disp, u32 size);
+            void movs(X86_64Reg base, i32 disp, u8 xmm, u32 size);
+            void adds(u8 dst, u8 src, u32 size);
+            void subs(u8 dst, u8 src, u32 size);
+            void muls(u8 dst, u8 src, u32 size);
+            void divs(u8 dst, u8 src, u32 size);
+            void ucomis(u8 a, u8 b, u32 size);
+
+            /** @brief Moves the low 'size' bytes of a general purpose register to an xmm register */
+            void movToXmm(u8 xmm, X86_64Reg src, u32 size);
+
+            /** @brief Converts a signed integer of 'srcSize' bytes (4 or 8) to floating point */
+            void cvtsi2s(u8 xmm, X86_64Reg src, u32 srcSize, u32 size);
+
+            /** @brief Converts floating point to a signed integer of 'dstSize' bytes (4 or 8), truncating */
+            void cvtts2si(X86_64Reg dst, u8 xmm, u32 size, u32 dstSize);
+
+            /** @brief Converts floating point of 'size' bytes to the other precision */
+            void cvts2s(u8 dst, u8 src, u32 size);
+
+        protected:
+            void byte(u8 b);
+            void dword(u32 d);
+            void rex(bool w, u8 reg, u8 base, bool force = false);
+            void modrm(u8 reg, X86_64Reg base, i32 disp);
+            void modrm(u8 reg, X86_64Reg rm);
+
+            /** @brief Emits an instruction with a register and a memory operand */
+            void emitMem(u8 prefix, bool w, u16 opcode, u8 reg, X86_64Reg base, i32 disp);
+
+            /** @brief Emits an instruction with two register operands */
+            void emitReg(u8 prefix, bool w, u16 opcode, u8 reg, X86_64Reg rm);
+
+            Array<u8> m_code;
+    };
+};
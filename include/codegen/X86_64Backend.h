@@ -0,0 +1,70 @@
+#pragma once
+#include <codegen/interfaces/IBackend.h>
+#include <codegen/TestBytecode.h>
+
+namespace codegen {
+    /**
+     * @brief Executes calls to a function with native x86-64 code. The function is lowered to
+     *        TestBytecode, which is then translated to machine code one instruction at a time. The
+     *        generated code keeps the register file in a frame laid out the same way as the frames
+     *        TestExecuter uses, so every instruction has exactly the same effect as when it's
+     *        interpreted. Frames are allocated on the native stack and cleared by the generated
+     *        code, which also loads the arguments into their registers.
+     *
+     *        Vector operations, fmod, dmod and conversions between u64 and floating point are made
+     *        through helper functions, everything else is generated inline. Calls of the function to
+     *        itself jump straight to its code, and always run the same code like they do when it's
+     *        interpreted. A tail_call of the function to itself reuses the frame, so self tail
+     *        recursion runs in constant stack space. Other compiled functions are entered directly
+     *        through a helper, and any other function is called through bind::Function::call.
+     *        Recursion is otherwise limited by the host stack. Any number of threads may call the
+     *        function at the same time.
+     */
+    class X86_64CallHandler : public ICallHandler {
+        public:
+            X86_64CallHandler(CodeHolder* ch);
+            virtual ~X86_64CallHandler();
+
+            virtual void call(void* retDest, void** args);
+
+            /**
+             * @brief Returns the lowered code that the native code was generated from
+             */
+            const TestBytecode* getCode() const;
+
+            /**
+             * @brief Returns the generated machine code
+             */
+            const void* getNativeCode() const;
+
+            /**
+             * @brief Returns the size of the generated machine code, in bytes
+             */
+            u32 getNativeCodeSize() const;
+
+        protected:
+            void generate();
+
+            const TestBytecode* m_code;
+            void* m_native;
+            u32 m_nativeSize;
+    };
+
+    /**
+     * @brief Backend which compiles functions to native x86-64 code, see X86_64CallHandler. Only
+     *        x86-64 hosts which use the System V calling convention are supported, transform()
+     *        fails on any other host.
+     */
+    class X86_64Backend : public IBackend {
+        public:
+            X86_64Backend();
+            virtual ~X86_64Backend();
+
+            virtual bool transform(CodeHolder* processedCode);
+
+            /**
+             * @brief Returns true if the host is able to execute the code generated by this backend
+             */
+            static bool IsSupported();
+    };
+};
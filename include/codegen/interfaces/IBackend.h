@@ -1,10 +1,18 @@
 #pragma once
 #include <codegen/interfaces/IPostProcessStep.h>
+#include <bind/interfaces/ICallHandler.h>
 #include <utils/Array.h>
+#include <atomic>
+#include <mutex>
+
+namespace bind {
+    class Function;
+};
 
 namespace codegen {
     class FunctionBuilder;
     class CodeHolder;
+    class LazyCallHandler;
 
     class IBackend {
         public:
@@ -12,13 +20,85 @@ namespace codegen {
             virtual ~IBackend();
 
             void addPostProcess(IPostProcessStep* process);
+
+            /**
+             * @brief Post-processes and transforms the code of a function. When lazy compilation is
+             *        enabled this only installs a LazyCallHandler on the function, and the code is
+             *        post-processed and transformed the first time that the function is called
+             */
             bool process(FunctionBuilder* input, u32 postProcessMask = 0xFFFFFFFF);
 
+            /**
+             * @brief Enables or disables lazy compilation for functions processed after this is called.
+             *        The FunctionBuilder of a function that's processed lazily must not be destroyed
+             *        before the function is first called, and the backend must outlive the function
+             */
+            void setLazyCompilation(bool lazy);
+            bool isLazyCompilationEnabled() const;
+
             virtual bool onBeforePostProcessing(CodeHolder* ch);
             virtual bool onAfterPostProcessing(CodeHolder* ch);
             virtual bool transform(CodeHolder* processedCode) = 0;
 
         protected:
+            friend class LazyCallHandler;
+
+            /**
+             * @brief Runs the post-processing steps and transform() on the code of a function
+             */
+            bool compile(FunctionBuilder* input, u32 postProcessMask);
+
+            /**
+             * @brief Makes the specified handler handle calls to a function, transform() should use
+             *        this rather than setting the function's call handler itself. If the calling thread
+             *        is compiling the function lazily the handler is given to its LazyCallHandler
+             *        instead, since other threads may be calling the function
+             */
+            void installCallHandler(Function* fn, ICallHandler* handler);
+
             Array<IPostProcessStep*> m_postProcesses;
+            bool m_lazyCompilation;
+
+            // Held by functions that are compiled lazily, the post-processing steps aren't
+            // safe to execute on more than one thread at a time
+            std::mutex m_lazyCompileLock;
+    };
+
+    /**
+     * @brief Call handler that's installed by IBackend::process when lazy compilation is enabled.
+     *        The first call compiles the function with the backend that processed it, then every
+     *        call is forwarded to the handler that the backend's transform() produced.
+     *
+     *        This handler remains installed on the function after it's compiled and owns the
+     *        compiled handler. Threads which call the function while it's being compiled wait for
+     *        the compilation to finish.
+     */
+    class LazyCallHandler : public ICallHandler {
+        public:
+            LazyCallHandler(IBackend* backend, FunctionBuilder* input, u32 postProcessMask);
+            virtual ~LazyCallHandler();
+
+            virtual void call(void* retDest, void** args);
+
+            /**
+             * @brief Returns true if the function has been compiled
+             */
+            bool isCompiled() const;
+
+            /**
+             * @brief Returns the handler that calls are forwarded to, or null if the function has not
+             *        been compiled yet
+             */
+            ICallHandler* getCompiledHandler() const;
+
+        protected:
+            friend class IBackend;
+            ICallHandler* compile();
+
+            IBackend* m_backend;
+            FunctionBuilder* m_input;
+            u32 m_postProcessMask;
+            ICallHandler* m_installed;
+            std::atomic<ICallHandler*> m_handler;
     };
-};
\ No newline at end of file
+};
@@ -0,0 +1,34 @@
+#pragma once
+#include <codegen/optimize/RegisterAllocator.h>
+
+namespace codegen {
+    /**
+     * @brief Allocates registers by coloring an interference graph (Chaitin-Briggs). Vregs whose
+     *        intervals are concurrent interfere, except for the two sides of an 'assign' or 'resolve'
+     *        where the source's interval ends and the destination's begins.
+     *
+     *        Moves between vregs that don't interfere are coalesced when it can't make the graph
+     *        uncolorable (the Briggs test), so that both vregs are given the same register and the
+     *        backend can omit the move. When the graph can't be simplified further, the vreg with the
+     *        lowest spill cost for its degree is removed and colored optimistically. Spill costs count
+     *        each reference ten times more for every loop that it's inside of.
+     *
+     *        Interference is built from the merged intervals computed by RegisterAllocatorStep, not
+     *        from the separate lifetimes in LivenessData, so two vregs which are each live only in a
+     *        hole between the other's lifetimes still interfere. This keeps the result valid for
+     *        consumers of CodeHolder::registers, which only record one range per vreg, at the cost of
+     *        some spills that a lifetime based graph would avoid.
+     *
+     *        This takes more time than LinearScanRegisterAllocatorStep, but usually spills less and
+     *        leaves fewer moves. It's intended for functions which are known to be hot, see
+     *        TieredRegisterAllocatorStep.
+     */
+    class GraphColoringRegisterAllocatorStep : public RegisterAllocatorStep {
+        public:
+            GraphColoringRegisterAllocatorStep(const PhysicalRegisterSet& registers);
+            virtual ~GraphColoringRegisterAllocatorStep();
+
+        protected:
+            virtual void allocate(CodeHolder* code, Array<RegisterInterval>& intervals);
+    };
+};
@@ -0,0 +1,20 @@
+#pragma once
+#include <codegen/optimize/RegisterAllocator.h>
+
+namespace codegen {
+    /**
+     * @brief Allocates registers with a single pass over the intervals in order of their starting
+     *        instruction, in linear time. When every register is taken the interval which ends last
+     *        is spilled, whether that's the one being allocated or one which already holds a register.
+     *        This is fast enough to use for all code, but may spill more than a graph coloring
+     *        allocator would.
+     */
+    class LinearScanRegisterAllocatorStep : public RegisterAllocatorStep {
+        public:
+            LinearScanRegisterAllocatorStep(const PhysicalRegisterSet& registers);
+            virtual ~LinearScanRegisterAllocatorStep();
+
+        protected:
+            virtual void allocate(CodeHolder* code, Array<RegisterInterval>& intervals);
+    };
+};
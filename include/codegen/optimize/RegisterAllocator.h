@@ -0,0 +1,93 @@
+#pragma once
+#include <codegen/interfaces/IPostProcessStep.h>
+#include <codegen/RegisterAllocation.h>
+#include <unordered_set>
+
+namespace codegen {
+    /**
+     * @brief Range of instructions over which a vreg must keep its physical register
+     */
+    struct RegisterInterval {
+        vreg_id reg_id;
+
+        /** First instruction that the vreg is live at or referred to by */
+        address begin;
+
+        /** Last instruction that the vreg is live at or referred to by */
+        address end;
+
+        bool is_fp;
+
+        /** False for vregs which hold a spilled value for a single instruction */
+        bool spillable;
+
+        /** ID of the assigned physical register, or NoPhysicalRegister if the vreg is spilled */
+        u32 physical;
+
+        bool isConcurrent(const RegisterInterval& o) const;
+    };
+
+    /**
+     * @brief Base class for post-process steps which assign the vregs of a function to the physical
+     *        registers of a target. This should be the last step executed, since the result is only
+     *        valid for the code that it was computed for.
+     *
+     *        Subclasses implement allocate(), which assigns a register to each interval or marks it
+     *        as spilled. Every spilled vreg is given a stack allocation, each instruction which
+     *        reads it is preceded by a load into a new vreg and each instruction which assigns it is
+     *        followed by a store from a new vreg. The allocator is then executed again on the
+     *        rewritten code, until nothing is spilled. The result is written to CodeHolder::registers.
+     *        Spilled arguments keep their vregs until they're stored, right after their argument
+     *        instructions.
+     *
+     *        The register set must contain at least MinRegisters registers of each kind, which is
+     *        the most that an instruction with three operands can need once they're spilled. An
+     *        instruction which reads three general purpose registers, such as vcross, needs one
+     *        more for the pointer to the stack slot that the last of them is reloaded from, and
+     *        code which contains one needs MinRegisters + 1 general purpose registers.
+     */
+    class RegisterAllocatorStep : public IPostProcessStep {
+        public:
+            static constexpr u32 MinRegisters = 3;
+
+            RegisterAllocatorStep(const PhysicalRegisterSet& registers);
+            virtual ~RegisterAllocatorStep();
+
+            virtual bool execute(CodeHolder* code, u32 mask = 0xFFFFFFFF);
+
+            const PhysicalRegisterSet& getRegisters() const;
+
+            /**
+             * @brief Returns the totals of the statistics of every function that this step has
+             *        allocated registers for
+             */
+            const RegisterAllocationStats& getStats() const;
+            void resetStats();
+
+        protected:
+            /**
+             * @brief Assigns a physical register from the register set to each interval, or sets its
+             *        physical register to NoPhysicalRegister to spill it. Intervals which are
+             *        concurrent must not be given the same register, and intervals which are not
+             *        spillable must be given one
+             */
+            virtual void allocate(CodeHolder* code, Array<RegisterInterval>& intervals) = 0;
+
+            /**
+             * @brief Computes the interval of each vreg referred to by the code. A vreg's interval
+             *        spans all of its lifetimes, including the holes between them
+             */
+            void computeIntervals(CodeHolder* code, Array<RegisterInterval>& intervals);
+
+            /**
+             * @brief Replaces the vregs of the spilled intervals with stack allocations
+             */
+            void spill(CodeHolder* code, const Array<RegisterInterval>& intervals, RegisterAllocationStats& stats);
+
+            PhysicalRegisterSet m_registers;
+            RegisterAllocationStats m_stats;
+
+            // vregs created to hold spilled values, for the function being allocated
+            std::unordered_set<vreg_id> m_spillTemps;
+    };
+};
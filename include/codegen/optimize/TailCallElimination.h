@@ -0,0 +1,24 @@
+#pragma once
+#include <codegen/interfaces/IPostProcessStep.h>
+
+namespace codegen {
+    /**
+     * @brief Replaces calls which are immediately followed by a return of their result with
+     *        tail_call, so that functions which end by calling another function (or themselves)
+     *        don't use more stack space with each call. A call is only replaced if the callee
+     *        returns the same kind of value as the caller and none of the caller's stack
+     *        allocations are live when the call is made.
+     *
+     *        Only TestBackend reuses the caller's frame for every tail_call. CBackend only does so
+     *        for tail calls of a function to itself, and X86_64Backend makes them as ordinary calls.
+     *        So this isn't part of defaultOptimizations, and should only be added to the
+     *        post-processing of backends which benefit from it.
+     */
+    class TailCallEliminationStep : public IPostProcessStep {
+        public:
+            TailCallEliminationStep();
+            virtual ~TailCallEliminationStep();
+
+            virtual bool execute(CodeHolder* code, u32 mask = 0xFFFFFFFF);
+    };
+};
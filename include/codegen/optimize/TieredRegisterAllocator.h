@@ -0,0 +1,42 @@
+#pragma once
+#include <codegen/optimize/RegisterAllocator.h>
+#include <unordered_set>
+
+namespace bind {
+    class Function;
+};
+
+namespace codegen {
+    /**
+     * @brief Allocates registers for each function with one of two allocators. Functions use the
+     *        default allocator, which should be fast (ie. LinearScanRegisterAllocatorStep), unless
+     *        they've been marked as optimized. Optimized functions, which would typically be those
+     *        known to be hot, use an allocator which takes longer but spills less (ie.
+     *        GraphColoringRegisterAllocatorStep).
+     *
+     *        The allocators are not owned by this step, and their statistics are kept separately.
+     */
+    class TieredRegisterAllocatorStep : public IPostProcessStep {
+        public:
+            TieredRegisterAllocatorStep(RegisterAllocatorStep* defaultAllocator, RegisterAllocatorStep* optimizingAllocator);
+            virtual ~TieredRegisterAllocatorStep();
+
+            virtual bool execute(CodeHolder* code, u32 mask = 0xFFFFFFFF);
+
+            /**
+             * @brief Sets whether the optimizing allocator is used for the specified function. This
+             *        only affects functions compiled after it's called, and must not be called while
+             *        a function is being compiled
+             */
+            void setOptimized(Function* fn, bool optimized = true);
+            bool isOptimized(Function* fn) const;
+
+            RegisterAllocatorStep* getDefaultAllocator() const;
+            RegisterAllocatorStep* getOptimizingAllocator() const;
+
+        protected:
+            RegisterAllocatorStep* m_default;
+            RegisterAllocatorStep* m_optimizing;
+            std::unordered_set<Function*> m_optimized;
+    };
+};
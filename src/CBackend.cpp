@@ -0,0 +1,1113 @@
+#include <codegen/CBackend.h>
+#include <codegen/CodeCache.h>
+#include <codegen/CodeHolder.h>
+#include <codegen/FunctionBuilder.h>
+#include <codegen/IR.h>
+#include <bind/Function.h>
+#include <bind/FunctionType.h>
+#include <bind/PointerType.h>
+#include <bind/DataType.h>
+#include <bind/Registry.h>
+#include <bind/ValuePointer.h>
+#include <utils/Exception.h>
+#include <utils/Array.hpp>
+#include <exception>
+#include <unordered_map>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__linux__) || defined(__APPLE__)
+    #define CODEGEN_C_NATIVE
+    #include <dlfcn.h>
+    #include <unistd.h>
+#endif
+
+namespace codegen {
+    /*
+     * State of one call to generated code. 'symbols' and 'call' are read by the generated code,
+     * which declares them as cg_context, so they must stay at the start
+     */
+    struct c_context {
+        void* const* symbols;
+        u32 (*call)(c_context* ctx, Function* fn, void* ret, void** args);
+        std::exception_ptr error;
+    };
+
+    // Entry point of generated code, returns 0 on success or 1 if a call stored an exception
+    typedef u32 (*c_entry)(c_context* ctx, void* ret, void** args);
+
+    const char* CEntryName = "codegen_c_entry";
+
+    // Must be changed whenever the generated code changes, since it's part of the key of cached code
+    constexpr u32 CBackendVersion = 1;
+
+    const char* cPrelude =
+        "#include <stdint.h>\n"
+        "#include <string.h>\n"
+        "#include <math.h>\n"
+        "\n"
+        "typedef struct cg_context {\n"
+        "    void* const* symbols;\n"
+        "    uint32_t (*call)(struct cg_context* ctx, void* fn, void* ret, void** args);\n"
+        "} cg_context;\n"
+        "\n"
+        "static inline uint32_t cg_f32_bits(float v) { uint32_t r; memcpy(&r, &v, sizeof(r)); return r; }\n"
+        "static inline uint64_t cg_f64_bits(double v) { uint64_t r; memcpy(&r, &v, sizeof(r)); return r; }\n"
+        "static inline float cg_bits_f32(uint32_t v) { float r; memcpy(&r, &v, sizeof(r)); return r; }\n"
+        "static inline double cg_bits_f64(uint64_t v) { double r; memcpy(&r, &v, sizeof(r)); return r; }\n"
+        "\n";
+
+    u32 cCall(c_context* ctx, Function* fn, void* ret, void** args) {
+        try {
+            if (!fn) throw Exception("CCallHandler - Attempted to call a null function value");
+            fn->call(ret, args);
+        } catch (...) {
+            ctx->error = std::current_exception();
+            return 1;
+        }
+
+        return 0;
+    }
+
+    enum class c_kind {
+        Signed,
+        Unsigned,
+        Float,
+        Pointer
+    };
+
+    struct c_type {
+        c_kind kind;
+        u32 size;
+
+        bool operator ==(const c_type& o) const { return kind == o.kind && size == o.size; }
+    };
+
+    // Pointers, function values and anything else which isn't a number are held as byte pointers
+    c_type cType(DataType* tp) {
+        const type_meta& ti = tp->getInfo();
+        if (ti.is_floating_point) {
+            if (ti.size != sizeof(f32) && ti.size != sizeof(f64)) {
+                throw Exception(String::Format("CCallHandler - Unsupported floating point type '%s'", tp->getFullName().c_str()));
+            }
+
+            return { c_kind::Float, ti.size };
+        }
+
+        if (ti.is_integral && !ti.is_pointer) {
+            if (ti.size != sizeof(u8) && ti.size != sizeof(u16) && ti.size != sizeof(u32) && ti.size != sizeof(u64)) {
+                throw Exception(String::Format("CCallHandler - Unsupported integer type '%s'", tp->getFullName().c_str()));
+            }
+
+            return { ti.is_unsigned ? c_kind::Unsigned : c_kind::Signed, ti.size };
+        }
+
+        return { c_kind::Pointer, sizeof(void*) };
+    }
+
+    const char* cTypeName(const c_type& t) {
+        switch (t.kind) {
+            case c_kind::Float: return t.size == sizeof(f32) ? "float" : "double";
+            case c_kind::Pointer: return "uint8_t*";
+            case c_kind::Signed: {
+                switch (t.size) {
+                    case sizeof(i8): return "int8_t";
+                    case sizeof(i16): return "int16_t";
+                    case sizeof(i32): return "int32_t";
+                    default: return "int64_t";
+                }
+            }
+            case c_kind::Unsigned: {
+                switch (t.size) {
+                    case sizeof(u8): return "uint8_t";
+                    case sizeof(u16): return "uint16_t";
+                    case sizeof(u32): return "uint32_t";
+                    default: return "uint64_t";
+                }
+            }
+        }
+
+        return "uint64_t";
+    }
+
+    /*
+     * Converts an expression between the types that a vreg is referred to with. The bits of a
+     * register are reinterpreted the same way they are by the interpreter: integers are truncated
+     * or extended, and the bits of floating point values are moved to and from integers unchanged
+     */
+    String cConvert(const String& expr, const c_type& from, const c_type& to) {
+        if (from.kind == c_kind::Float && !(from == to)) {
+            String bits = String(from.size == sizeof(f32) ? "cg_f32_bits(" : "cg_f64_bits(") + expr + ")";
+            return cConvert(bits, { c_kind::Unsigned, from.size }, to);
+        }
+
+        if (to.kind == c_kind::Float && !(from == to)) {
+            String bits = expr;
+            if (from.kind == c_kind::Pointer) bits = String("(uint64_t)(uintptr_t)(") + expr + ")";
+            if (to.size == sizeof(f32)) return String("cg_bits_f32((uint32_t)(") + bits + "))";
+            return String("cg_bits_f64((uint64_t)(") + bits + "))";
+        }
+
+        if (from.kind == c_kind::Pointer && to.kind != c_kind::Pointer) {
+            return String("((") + cTypeName(to) + ")(uintptr_t)(" + expr + "))";
+        }
+
+        if (to.kind == c_kind::Pointer && from.kind != c_kind::Pointer) {
+            return String("((uint8_t*)(uintptr_t)(") + expr + "))";
+        }
+
+        return String("((") + cTypeName(to) + ")(" + expr + "))";
+    }
+
+    /*
+     * Converts the value of an expression to another type the same way that the cvt instruction
+     * does, pointers are treated as 64 bit unsigned integers
+     */
+    String cCast(const String& expr, const c_type& from, const c_type& to) {
+        String value = expr;
+        if (from.kind == c_kind::Pointer) value = String("((uint64_t)(uintptr_t)(") + expr + "))";
+        if (to.kind == c_kind::Pointer) return String("((uint8_t*)(uintptr_t)(uint64_t)(") + value + "))";
+        return String("((") + cTypeName(to) + ")(" + value + "))";
+    }
+
+    // Bits of the first 'size' bytes of an expression's value, zero extended to 64 bits
+    String cBits(const String& expr, const c_type& from, u32 size) {
+        return String("((uint64_t)") + cConvert(expr, from, { c_kind::Unsigned, size }) + ")";
+    }
+
+    // State of the code generation for one function
+    struct c_generator {
+        CodeHolder* ch;
+        String body;
+
+        // C type of each vreg's local variable, in the order they're declared
+        std::unordered_map<vreg_id, c_type> locals;
+        Array<vreg_id> localOrder;
+
+        Array<void*> symbols;
+        std::unordered_map<void*, u32> symbolMap;
+
+        u32 maxParams;
+
+        // Whether any tail call of the function to itself jumps back to its start
+        bool selfTailCalls;
+    };
+
+    void cDeclare(c_generator& g, const Value& v) {
+        if (!v.isReg() || v.getRegisterId() == NullRegister) return;
+        if (g.locals.count(v.getRegisterId()) > 0) return;
+
+        g.locals[v.getRegisterId()] = cType(v.getType());
+        g.localOrder.push(v.getRegisterId());
+    }
+
+    u32 cSymbol(c_generator& g, void* address) {
+        auto it = g.symbolMap.find(address);
+        if (it != g.symbolMap.end()) return it->second;
+
+        u32 idx = g.symbols.size();
+        g.symbolMap[address] = idx;
+        g.symbols.push(address);
+        return idx;
+    }
+
+    /*
+     * Symbols are numbered in the order they're first referred to, so that code loaded from a
+     * cache gets the same table without generating its source
+     */
+    void cCollectSymbols(c_generator& g) {
+        for (u32 c = 0;c < g.ch->code.size();c++) {
+            const Instruction& i = g.ch->code[c];
+
+            if ((i.op == OpCode::call || i.op == OpCode::tail_call) && i.operands[0].isImm()) {
+                cSymbol(g, i.operands[0].getImm().p);
+            } else if (i.op == OpCode::value_ptr) {
+                ValuePointer* vp = Registry::GetValue(i.operands[1].getImm().u);
+                if (!vp) {
+                    throw Exception(String::Format(
+                        "CCallHandler - Reference to undefined value %llu",
+                        (unsigned long long)i.operands[1].getImm().u
+                    ));
+                }
+
+                cSymbol(g, vp->getAddress());
+            }
+        }
+    }
+
+    String cImmediate(const Value& v) {
+        c_type t = cType(v.getType());
+        const Immediate& imm = v.getImm();
+
+        switch (t.kind) {
+            case c_kind::Float: {
+                if (t.size == sizeof(f32)) return String::Format("cg_bits_f32(0x%08xu)", u32(imm.u));
+                return String::Format("cg_bits_f64(0x%016llxull)", (unsigned long long)imm.u);
+            }
+            case c_kind::Pointer: return String::Format("((uint8_t*)(uintptr_t)0x%llxull)", (unsigned long long)imm.u);
+            default: return String::Format("((%s)0x%llxull)", cTypeName(t), (unsigned long long)imm.u);
+        }
+    }
+
+    // Reads an operand as the specified type
+    String cRead(c_generator& g, const Value& v, const c_type& as) {
+        if (v.isImm()) {
+            c_type t = cType(v.getType());
+            if (t == as) return cImmediate(v);
+            return cConvert(cImmediate(v), t, as);
+        }
+
+        const c_type& local = g.locals[v.getRegisterId()];
+        String name = String::Format("r%u", v.getRegisterId());
+        if (local == as) return name;
+
+        return cConvert(name, local, as);
+    }
+
+    // Reads an operand as the type it's referred to with
+    String cRead(c_generator& g, const Value& v) {
+        return cRead(g, v, cType(v.getType()));
+    }
+
+    void cWrite(c_generator& g, const Value& dst, const String& expr, const c_type& exprType) {
+        const c_type& local = g.locals[dst.getRegisterId()];
+        g.body += String::Format("    r%u = ", dst.getRegisterId()) + cConvert(expr, exprType, local) + ";\n";
+    }
+
+    /*
+     * Operand kind and expression of each binary operation. Integer operations are done with the
+     * width of their first operand, division and modulo at 64 bits so that dividing the minimum
+     * value by -1 wraps instead of trapping, the same as the interpreter
+     */
+    struct c_binary_op {
+        c_kind kind;
+        const char* format;
+
+        // Operations which produce 0 or 1
+        bool isBoolean;
+
+        // Operations which are done at 64 bits regardless of the operand width
+        bool isWide;
+    };
+
+    bool cBinaryOp(OpCode op, c_binary_op& out) {
+        switch (op) {
+            case OpCode::shl: out = { c_kind::Unsigned, "((uint64_t)%s << %s)", false, true }; return true;
+            case OpCode::shr: out = { c_kind::Unsigned, "((uint64_t)%s >> %s)", false, true }; return true;
+            case OpCode::land: out = { c_kind::Unsigned, "(%s && %s)", true, false }; return true;
+            case OpCode::band: out = { c_kind::Unsigned, "(%s & %s)", false, false }; return true;
+            case OpCode::lor: out = { c_kind::Unsigned, "(%s || %s)", true, false }; return true;
+            case OpCode::bor: out = { c_kind::Unsigned, "(%s | %s)", false, false }; return true;
+            case OpCode::_xor: out = { c_kind::Unsigned, "(%s ^ %s)", false, false }; return true;
+            case OpCode::iadd: out = { c_kind::Signed, "(%s + %s)", false, false }; return true;
+            case OpCode::uadd: out = { c_kind::Unsigned, "(%s + %s)", false, false }; return true;
+            case OpCode::fadd: out = { c_kind::Float, "(%s + %s)", false, false }; return true;
+            case OpCode::dadd: out = { c_kind::Float, "(%s + %s)", false, false }; return true;
+            case OpCode::isub: out = { c_kind::Signed, "(%s - %s)", false, false }; return true;
+            case OpCode::usub: out = { c_kind::Unsigned, "(%s - %s)", false, false }; return true;
+            case OpCode::fsub: out = { c_kind::Float, "(%s - %s)", false, false }; return true;
+            case OpCode::dsub: out = { c_kind::Float, "(%s - %s)", false, false }; return true;
+            case OpCode::imul: out = { c_kind::Signed, "(%s * %s)", false, false }; return true;
+            case OpCode::umul: out = { c_kind::Unsigned, "(%s * %s)", false, false }; return true;
+            case OpCode::fmul: out = { c_kind::Float, "(%s * %s)", false, false }; return true;
+            case OpCode::dmul: out = { c_kind::Float, "(%s * %s)", false, false }; return true;
+            case OpCode::idiv: out = { c_kind::Signed, "((int64_t)%s / (int64_t)%s)", false, true }; return true;
+            case OpCode::udiv: out = { c_kind::Unsigned, "(%s / %s)", false, false }; return true;
+            case OpCode::fdiv: out = { c_kind::Float, "(%s / %s)", false, false }; return true;
+            case OpCode::ddiv: out = { c_kind::Float, "(%s / %s)", false, false }; return true;
+            case OpCode::imod: out = { c_kind::Signed, "((int64_t)%s %% (int64_t)%s)", false, true }; return true;
+            case OpCode::umod: out = { c_kind::Unsigned, "(%s %% %s)", false, false }; return true;
+            case OpCode::fmod: out = { c_kind::Float, "fmodf(%s, %s)", false, false }; return true;
+            case OpCode::dmod: out = { c_kind::Float, "fmod(%s, %s)", false, false }; return true;
+            case OpCode::ilt: case OpCode::ilte: case OpCode::igt: case OpCode::igte: case OpCode::ieq: case OpCode::ineq:
+                out = { c_kind::Signed, nullptr, true, false }; break;
+            case OpCode::ult: case OpCode::ulte: case OpCode::ugt: case OpCode::ugte: case OpCode::ueq: case OpCode::uneq:
+                out = { c_kind::Unsigned, nullptr, true, false }; break;
+            case OpCode::flt: case OpCode::flte: case OpCode::fgt: case OpCode::fgte: case OpCode::feq: case OpCode::fneq:
+            case OpCode::dlt: case OpCode::dlte: case OpCode::dgt: case OpCode::dgte: case OpCode::deq: case OpCode::dneq:
+                out = { c_kind::Float, nullptr, true, false }; break;
+            default: return false;
+        }
+
+        switch (op) {
+            case OpCode::ilt: case OpCode::ult: case OpCode::flt: case OpCode::dlt: out.format = "(%s < %s)"; break;
+            case OpCode::ilte: case OpCode::ulte: case OpCode::flte: case OpCode::dlte: out.format = "(%s <= %s)"; break;
+            case OpCode::igt: case OpCode::ugt: case OpCode::fgt: case OpCode::dgt: out.format = "(%s > %s)"; break;
+            case OpCode::igte: case OpCode::ugte: case OpCode::fgte: case OpCode::dgte: out.format = "(%s >= %s)"; break;
+            case OpCode::ieq: case OpCode::ueq: case OpCode::feq: case OpCode::deq: out.format = "(%s == %s)"; break;
+            default: out.format = "(%s != %s)"; break;
+        }
+
+        return true;
+    }
+
+    u32 cFloatSize(OpCode op) {
+        switch (op) {
+            case OpCode::fadd: case OpCode::fsub: case OpCode::fmul: case OpCode::fdiv: case OpCode::fmod:
+            case OpCode::flt: case OpCode::flte: case OpCode::fgt: case OpCode::fgte: case OpCode::feq: case OpCode::fneq:
+                return sizeof(f32);
+            default: return sizeof(f64);
+        }
+    }
+
+    // Element type of the vector that an operand points to
+    c_type cElementType(const Value& v) {
+        return cType(((PointerType*)v.getType())->getDestinationType());
+    }
+
+    void cVector(c_generator& g, const Instruction& i) {
+        const Value& op0 = i.operands[0];
+        const Value& op1 = i.operands[1];
+        const Value& op2 = i.operands[2];
+        c_type ptrType = { c_kind::Pointer, sizeof(void*) };
+
+        switch (i.op) {
+            case OpCode::vset:
+            case OpCode::vadd:
+            case OpCode::vsub:
+            case OpCode::vmul:
+            case OpCode::vdiv:
+            case OpCode::vmod: {
+                c_type et = cElementType(op0);
+                const char* T = cTypeName(et);
+                u32 count = i.options.vset.componentCount;
+
+                g.body += String::Format("    {\n        %s* cg_a = (%s*)", T, T) + cRead(g, op0, ptrType) + ";\n";
+
+                String b;
+                if (op1.getType()->getInfo().is_pointer) {
+                    g.body += String::Format("        %s* cg_b = (%s*)", T, T) + cRead(g, op1, ptrType) + ";\n";
+                    b = "cg_b[cg_k]";
+                } else {
+                    g.body += String::Format("        %s cg_b = ", T) + cRead(g, op1, et) + ";\n";
+                    b = "cg_b";
+                }
+
+                String stmt;
+                switch (i.op) {
+                    case OpCode::vset: stmt = String("cg_a[cg_k] = ") + b; break;
+                    case OpCode::vadd: stmt = String("cg_a[cg_k] += ") + b; break;
+                    case OpCode::vsub: stmt = String("cg_a[cg_k] -= ") + b; break;
+                    case OpCode::vmul: stmt = String("cg_a[cg_k] *= ") + b; break;
+                    case OpCode::vdiv: stmt = String("cg_a[cg_k] /= ") + b; break;
+                    default: {
+                        if (et.kind != c_kind::Float) stmt = String("cg_a[cg_k] %= ") + b;
+                        else stmt = String(et.size == sizeof(f32) ? "cg_a[cg_k] = fmodf(cg_a[cg_k], " : "cg_a[cg_k] = fmod(cg_a[cg_k], ") + b + ")";
+                        break;
+                    }
+                }
+
+                g.body += String::Format("        for (uint32_t cg_k = 0;cg_k < %u;cg_k++) ", count) + stmt + ";\n    }\n";
+                break;
+            }
+            case OpCode::vneg: {
+                c_type et = cElementType(op0);
+                const char* T = cTypeName(et);
+                g.body += String::Format("    {\n        %s* cg_a = (%s*)", T, T) + cRead(g, op0, ptrType) + ";\n";
+                g.body += String::Format("        for (uint32_t cg_k = 0;cg_k < %u;cg_k++) cg_a[cg_k] = (%s)-cg_a[cg_k];\n    }\n", i.options.vneg.componentCount, T);
+                break;
+            }
+            case OpCode::vnorm: {
+                c_type et = cElementType(op0);
+                const char* T = cTypeName(et);
+                u32 count = i.options.vnorm.componentCount;
+                g.body += String::Format("    {\n        %s* cg_a = (%s*)", T, T) + cRead(g, op0, ptrType) + ";\n";
+                g.body += String::Format("        %s cg_s = 0;\n", T);
+                g.body += String::Format("        for (uint32_t cg_k = 0;cg_k < %u;cg_k++) cg_s += cg_a[cg_k] * cg_a[cg_k];\n", count);
+
+                if (et.kind == c_kind::Float) {
+                    g.body += String::Format("        %s cg_f = (%s)1.0 / %s(cg_s);\n", T, T, et.size == sizeof(f32) ? "sqrtf" : "sqrt");
+                    g.body += String::Format("        for (uint32_t cg_k = 0;cg_k < %u;cg_k++) cg_a[cg_k] *= cg_f;\n    }\n", count);
+                } else {
+                    g.body += "        float cg_f = 1.0f / sqrtf((float)cg_s);\n";
+                    g.body += String::Format("        for (uint32_t cg_k = 0;cg_k < %u;cg_k++) cg_a[cg_k] = (%s)((float)cg_a[cg_k] * cg_f);\n    }\n", count, T);
+                }
+                break;
+            }
+            case OpCode::vdot:
+            case OpCode::vmag:
+            case OpCode::vmagsq: {
+                // The result has the vector's element type
+                c_type et = cType(op0.getType());
+                const char* T = cTypeName(et);
+                u32 count = i.options.vdot.componentCount;
+
+                g.body += String::Format("    {\n        %s* cg_a = (%s*)", T, T) + cRead(g, op1, ptrType) + ";\n";
+                if (i.op == OpCode::vdot) g.body += String::Format("        %s* cg_b = (%s*)", T, T) + cRead(g, op2, ptrType) + ";\n";
+                else g.body += String::Format("        %s* cg_b = cg_a;\n", T);
+
+                g.body += String::Format("        %s cg_s = 0;\n", T);
+                g.body += String::Format("        for (uint32_t cg_k = 0;cg_k < %u;cg_k++) cg_s += cg_a[cg_k] * cg_b[cg_k];\n", count);
+
+                if (i.op == OpCode::vmag) {
+                    if (et.kind == c_kind::Float) g.body += String::Format("        cg_s = %s(cg_s);\n", et.size == sizeof(f32) ? "sqrtf" : "sqrt");
+                    else g.body += String::Format("        cg_s = (%s)sqrtf((float)cg_s);\n", T);
+                }
+
+                g.body += "    ";
+                cWrite(g, op0, "cg_s", et);
+                g.body += "    }\n";
+                break;
+            }
+            case OpCode::vcross: {
+                c_type et = cElementType(op0);
+                const char* T = cTypeName(et);
+                g.body += String::Format("    {\n        %s* cg_r = (%s*)", T, T) + cRead(g, op0, ptrType) + ";\n";
+                g.body += String::Format("        %s* cg_a = (%s*)", T, T) + cRead(g, op1, ptrType) + ";\n";
+                g.body += String::Format("        %s* cg_b = (%s*)", T, T) + cRead(g, op2, ptrType) + ";\n";
+                g.body += String::Format("        %s cg_x = cg_a[1] * cg_b[2] - cg_a[2] * cg_b[1];\n", T);
+                g.body += String::Format("        %s cg_y = cg_a[2] * cg_b[0] - cg_a[0] * cg_b[2];\n", T);
+                g.body += String::Format("        %s cg_z = cg_a[0] * cg_b[1] - cg_a[1] * cg_b[0];\n", T);
+                g.body += "        cg_r[0] = cg_x;\n        cg_r[1] = cg_y;\n        cg_r[2] = cg_z;\n    }\n";
+                break;
+            }
+            default: break;
+        }
+    }
+
+    /*
+     * Parameters are written to their slot in cg_params when the call is reached, since whether
+     * they're passed by pointer depends on the callee
+     */
+    /*
+     * Starts the function over with the parameters of a tail call to itself, which were already
+     * written to cg_params, cg_args and cg_this. Every local is reset first, the same as the
+     * registers of a new interpreter frame
+     */
+    void cSelfTailCall(c_generator& g, const Array<const Value*>& params, bool passesThis) {
+        FunctionBuilder* fb = g.ch->owner;
+        auto args = fb->getFunction()->getSignature()->getArgs();
+        c_type u64Type = { c_kind::Unsigned, sizeof(u64) };
+        c_type ptrType = { c_kind::Pointer, sizeof(void*) };
+
+        for (u32 r = 0;r < g.localOrder.size();r++) {
+            g.body += String::Format("    r%u = 0;\n", g.localOrder[r]);
+        }
+
+        if (passesThis) {
+            vreg_id self = fb->getThis().getRegisterId();
+            if (self != NullRegister) {
+                g.body += String::Format("    r%u = ", self) + cConvert("((uint8_t*)cg_this)", ptrType, g.locals[self]) + ";\n";
+            }
+        }
+
+        for (u32 a = 0;a < args.size() && a < params.size();a++) {
+            const type_meta& ai = args[a].type->getInfo();
+            vreg_id reg = fb->getArg(a).getRegisterId();
+            if (reg == NullRegister) continue;
+
+            if (ai.is_primitive || ai.is_pointer) {
+                if (ai.size > sizeof(u64)) continue;
+
+                // Already zero extended from the size of the argument
+                String param = String::Format("cg_params[%u]", a);
+                g.body += String::Format("    r%u = ", reg) + cConvert(param, u64Type, g.locals[reg]) + ";\n";
+            } else {
+                String param = String::Format("((uint8_t*)cg_args[%u])", a + 1);
+                g.body += String::Format("    r%u = ", reg) + cConvert(param, ptrType, g.locals[reg]) + ";\n";
+            }
+        }
+
+        g.body += "    goto cg_start;\n";
+        g.selfTailCalls = true;
+    }
+
+    void cCallInstruction(c_generator& g, const Instruction& i, const Array<const Value*>& params) {
+        const Value& op0 = i.operands[0];
+        const Value& op1 = i.operands[1];
+        const Value& op2 = i.operands[2];
+        c_type ptrType = { c_kind::Pointer, sizeof(void*) };
+        bool isTail = i.op == OpCode::tail_call;
+
+        FunctionType* csig = nullptr;
+        String fn;
+        if (op0.isImm()) {
+            Function* callee = (Function*)op0.getImm().p;
+            csig = callee->getSignature();
+            fn = String::Format("ctx->symbols[%u]", cSymbol(g, callee));
+        } else {
+            // Calls through a function value only know the signature of the callee
+            csig = (FunctionType*)op0.getType();
+            fn = String("(void*)") + cRead(g, op0, ptrType);
+        }
+
+        // Non-primitive arguments are passed as the pointer held by the parameter, primitives are
+        // zero extended, the same as when they're passed through bind::Function::call
+        auto cargs = csig->getArgs();
+        for (u32 p = 0;p < params.size();p++) {
+            const Value& v = *params[p];
+            u32 size = sizeof(u64);
+
+            if (p < cargs.size()) {
+                const type_meta& ai = cargs[p].type->getInfo();
+                if (!ai.is_primitive && !ai.is_pointer) {
+                    g.body += String::Format("    cg_args[%u] = (void*)", p + 1) + cRead(g, v, ptrType) + ";\n";
+                    continue;
+                }
+
+                if (ai.size < sizeof(u64)) size = ai.size;
+            }
+
+            c_type vt = cType(v.getType());
+            if (vt.size < size) size = vt.size;
+
+            g.body += String::Format("    cg_params[%u] = ", p) + cBits(cRead(g, v), vt, size) + ";\n";
+            g.body += String::Format("    cg_args[%u] = &cg_params[%u];\n", p + 1, p);
+        }
+
+        bool passesThis = csig->getThisType() != nullptr;
+        if (passesThis) {
+            if (op2.isEmpty()) g.body += "    cg_this = 0;\n";
+            else g.body += String("    cg_this = (void*)") + cRead(g, op2, ptrType) + ";\n";
+            g.body += "    cg_args[0] = &cg_this;\n";
+        }
+
+        // Tail calls of the function to itself reuse the current call instead of making a new one.
+        // The parameters were staged above, so they may still refer to the current arguments
+        FunctionBuilder* fb = g.ch->owner;
+        if (isTail && op0.isImm() && (Function*)op0.getImm().p == fb->getFunction()) {
+            cSelfTailCall(g, params, passesThis);
+            return;
+        }
+
+        const type_meta& cri = csig->getReturnType()->getInfo();
+        bool returnsInRegister = cri.is_primitive || cri.is_pointer;
+
+        // Tail calls return the callee's return value
+        String ret = "&cg_result";
+        if (isTail) ret = "cg_ret";
+        else if (op1.isReg() && !returnsInRegister) ret = String("(void*)") + cRead(g, op1, ptrType);
+
+        if (!isTail && returnsInRegister) g.body += "    cg_result = 0;\n";
+
+        g.body += String("    if (ctx->call(ctx, ") + fn + ", " + ret + (passesThis ? ", cg_args)) return 1;\n" : ", cg_args + 1)) return 1;\n");
+
+        if (isTail) {
+            g.body += "    return 0;\n";
+            return;
+        }
+
+        if (op1.isReg() && returnsInRegister) cWrite(g, op1, "cg_result", { c_kind::Unsigned, sizeof(u64) });
+    }
+
+    void cInstruction(c_generator& g, const Instruction& i, Array<const Value*>& params) {
+        CodeHolder* ch = g.ch;
+        const Value& op0 = i.operands[0];
+        const Value& op1 = i.operands[1];
+        const Value& op2 = i.operands[2];
+        c_type ptrType = { c_kind::Pointer, sizeof(void*) };
+
+        switch (i.op) {
+            case OpCode::noop:
+            case OpCode::stack_alloc:
+            case OpCode::stack_free:
+            case OpCode::this_ptr:
+            case OpCode::argument:
+            case OpCode::reserve: break;
+            case OpCode::label: {
+                g.body += String::Format("L%u:;\n", label_id(op0.getImm().u));
+                break;
+            }
+            case OpCode::stack_ptr: {
+                stack_id id = stack_id(op1.getImm().u);
+                const StackAllocation* alloc = ch->stackLayout.get(id);
+                if (!alloc) throw Exception(String::Format("CCallHandler - Reference to undefined stack allocation %d", id));
+
+                cWrite(g, op0, String::Format("(cg_stack + %u)", alloc->offset), ptrType);
+                break;
+            }
+            case OpCode::value_ptr: {
+                ValuePointer* vp = Registry::GetValue(op1.getImm().u);
+                if (!vp) {
+                    throw Exception(String::Format("CCallHandler - Reference to undefined value %llu", (unsigned long long)op1.getImm().u));
+                }
+
+                cWrite(g, op0, String::Format("((uint8_t*)ctx->symbols[%u])", cSymbol(g, vp->getAddress())), ptrType);
+                break;
+            }
+            case OpCode::ret_ptr: {
+                cWrite(g, op0, "((uint8_t*)cg_ret)", ptrType);
+                break;
+            }
+            case OpCode::resolve:
+            case OpCode::assign: {
+                c_type t = cType(op1.getType());
+                cWrite(g, op0, cRead(g, op1, t), t);
+                break;
+            }
+            case OpCode::_not: {
+                cWrite(g, op0, String("(!") + cRead(g, op1) + ")", { c_kind::Signed, sizeof(i32) });
+                break;
+            }
+            case OpCode::inv:
+            case OpCode::ineg: {
+                c_type t = cType(op1.getType());
+                if (t.kind == c_kind::Pointer) t = { c_kind::Unsigned, sizeof(u64) };
+                if (i.op == OpCode::ineg) t.kind = c_kind::Signed;
+                cWrite(g, op0, String(i.op == OpCode::inv ? "(~" : "(-") + cRead(g, op1, t) + ")", t);
+                break;
+            }
+            case OpCode::fneg:
+            case OpCode::dneg: {
+                c_type t = { c_kind::Float, i.op == OpCode::fneg ? u32(sizeof(f32)) : u32(sizeof(f64)) };
+                cWrite(g, op0, String("(-") + cRead(g, op1, t) + ")", t);
+                break;
+            }
+            case OpCode::iinc:
+            case OpCode::uinc:
+            case OpCode::finc:
+            case OpCode::dinc:
+            case OpCode::idec:
+            case OpCode::udec:
+            case OpCode::fdec:
+            case OpCode::ddec: {
+                c_type t = cType(op0.getType());
+                switch (i.op) {
+                    case OpCode::iinc: case OpCode::idec: t = { c_kind::Signed, t.size }; break;
+                    case OpCode::uinc: case OpCode::udec: t = { c_kind::Unsigned, t.size }; break;
+                    case OpCode::finc: case OpCode::fdec: t = { c_kind::Float, sizeof(f32) }; break;
+                    default: t = { c_kind::Float, sizeof(f64) }; break;
+                }
+
+                bool inc = i.op == OpCode::iinc || i.op == OpCode::uinc || i.op == OpCode::finc || i.op == OpCode::dinc;
+                cWrite(g, op0, String("(") + cRead(g, op0, t) + (inc ? " + 1)" : " - 1)"), t);
+                break;
+            }
+            case OpCode::load: {
+                c_type t = cType(op0.getType());
+                g.body += String::Format("    {\n        %s cg_v;\n        memcpy(&cg_v, ", cTypeName(t));
+                g.body += cRead(g, op1, ptrType) + String::Format(" + %u, sizeof(cg_v));\n    ", u32(op2.getImm().u));
+                cWrite(g, op0, "cg_v", t);
+                g.body += "    }\n";
+                break;
+            }
+            case OpCode::store: {
+                c_type t = cType(op0.getType());
+                u32 size = op0.getType()->getInfo().size;
+                if (size != sizeof(u8) && size != sizeof(u16) && size != sizeof(u32) && size != sizeof(u64)) break;
+
+                g.body += String::Format("    {\n        %s cg_v = ", cTypeName(t)) + cRead(g, op0, t) + ";\n";
+                g.body += String("        memcpy(") + cRead(g, op1, ptrType) + String::Format(" + %u, &cg_v, sizeof(cg_v));\n    }\n", u32(op2.getImm().u));
+                break;
+            }
+            case OpCode::jump: {
+                g.body += String::Format("    goto L%u;\n", label_id(op0.getImm().u));
+                break;
+            }
+            case OpCode::branch: {
+                // The condition is tested by its bits, the same as the interpreter does
+                c_type t = cType(op0.getType());
+                if (t.kind == c_kind::Float) t.kind = c_kind::Unsigned;
+                g.body += String("    if (!") + cRead(g, op0, t) + String::Format(") goto L%u;\n", label_id(op1.getImm().u));
+                break;
+            }
+            case OpCode::cvt: {
+                DataType* to = Registry::GetType(op2.getImm().u);
+                const type_meta& fi = op1.getType()->getInfo();
+                bool supported = to && (fi.is_integral || fi.is_floating_point || fi.is_pointer);
+                if (supported) {
+                    const type_meta& ti = to->getInfo();
+                    supported = ti.is_integral || ti.is_floating_point || ti.is_pointer;
+                }
+
+                if (!supported) {
+                    throw Exception(String::Format(
+                        "CCallHandler - Unsupported conversion from '%s' to '%s'",
+                        op1.getType()->getFullName().c_str(),
+                        to ? to->getFullName().c_str() : "<invalid type>"
+                    ));
+                }
+
+                c_type from = cType(op1.getType());
+                c_type tt = cType(to);
+                cWrite(g, op0, cCast(cRead(g, op1, from), from, tt), tt);
+                break;
+            }
+            case OpCode::param: {
+                params.push(&op0);
+                break;
+            }
+            case OpCode::call:
+            case OpCode::tail_call: {
+                if (params.size() > g.maxParams) g.maxParams = params.size();
+                cCallInstruction(g, i, params);
+                params.clear();
+                break;
+            }
+            case OpCode::ret: {
+                const type_meta& ri = ch->owner->getFunction()->getSignature()->getReturnType()->getInfo();
+                bool sized = ri.size == sizeof(u8) || ri.size == sizeof(u16) || ri.size == sizeof(u32) || ri.size == sizeof(u64);
+
+                if (!op0.isEmpty() && sized) {
+                    g.body += String("    {\n        uint64_t cg_v = ") + cBits(cRead(g, op0), cType(op0.getType()), ri.size) + ";\n";
+                    g.body += String::Format("        memcpy(cg_ret, &cg_v, %u);\n    }\n", ri.size);
+                }
+
+                g.body += "    return 0;\n";
+                break;
+            }
+            case OpCode::vset:
+            case OpCode::vadd:
+            case OpCode::vsub:
+            case OpCode::vmul:
+            case OpCode::vdiv:
+            case OpCode::vmod:
+            case OpCode::vneg:
+            case OpCode::vnorm:
+            case OpCode::vdot:
+            case OpCode::vmag:
+            case OpCode::vmagsq:
+            case OpCode::vcross: {
+                cVector(g, i);
+                break;
+            }
+            default: {
+                c_binary_op bop;
+                if (!cBinaryOp(i.op, bop)) {
+                    throw Exception(String::Format("CCallHandler - Unsupported operation '%s'", Instruction::Info(i.op).name));
+                }
+
+                c_type t = { bop.kind, sizeof(u64) };
+                if (bop.kind == c_kind::Float) t.size = cFloatSize(i.op);
+                else {
+                    c_type ot = cType(op1.getType());
+                    if (ot.kind != c_kind::Pointer) t.size = ot.size;
+                }
+
+                String a = cRead(g, op1, t);
+                String b = cRead(g, op2, t);
+                String expr = String::Format(bop.format, a.c_str(), b.c_str());
+
+                c_type result = t;
+                if (bop.isBoolean) result = { c_kind::Signed, sizeof(i32) };
+                else if (bop.isWide) result.size = sizeof(u64);
+
+                cWrite(g, op0, expr, result);
+                break;
+            }
+        }
+    }
+
+    CCallHandler::CCallHandler(CodeHolder* ch, const String& compiler, const String& flags)
+        : CCallHandler(ch, compiler, flags, nullptr, nullptr)
+    {
+    }
+
+    CCallHandler::CCallHandler(CodeHolder* ch, const String& compiler, const String& flags, CodeCache* cache, const CodeKey* key)
+        : ICallHandler(ch->owner->getFunction()), m_symbols(nullptr), m_symbolCount(0), m_library(nullptr), m_entry(nullptr)
+    {
+        try {
+            collectSymbols(ch);
+            generate(ch);
+            compile(compiler, flags, cache, key);
+        } catch (...) {
+            if (m_symbols) delete [] m_symbols;
+            m_symbols = nullptr;
+            throw;
+        }
+    }
+
+    CCallHandler::CCallHandler(CodeHolder* ch, const String& libraryPath)
+        : ICallHandler(ch->owner->getFunction()), m_symbols(nullptr), m_symbolCount(0), m_library(nullptr), m_entry(nullptr)
+    {
+        try {
+            collectSymbols(ch);
+            load(libraryPath);
+        } catch (...) {
+            if (m_symbols) delete [] m_symbols;
+            m_symbols = nullptr;
+            throw;
+        }
+    }
+
+    CCallHandler::~CCallHandler() {
+        #ifdef CODEGEN_C_NATIVE
+        if (m_library) dlclose(m_library);
+        #endif
+
+        m_library = nullptr;
+        m_entry = nullptr;
+
+        if (m_symbols) delete [] m_symbols;
+        m_symbols = nullptr;
+        m_symbolCount = 0;
+    }
+
+    void CCallHandler::collectSymbols(CodeHolder* ch) {
+        c_generator g;
+        g.ch = ch;
+        g.maxParams = 0;
+        g.selfTailCalls = false;
+        cCollectSymbols(g);
+
+        m_symbolCount = g.symbols.size();
+        if (m_symbolCount > 0) {
+            m_symbols = new void*[m_symbolCount];
+            for (u32 s = 0;s < m_symbolCount;s++) m_symbols[s] = g.symbols[s];
+        }
+    }
+
+    void CCallHandler::generate(CodeHolder* ch) {
+        FunctionBuilder* fb = ch->owner;
+        FunctionType* sig = m_target->getSignature();
+        auto argInfo = sig->getArgs();
+
+        c_generator g;
+        g.ch = ch;
+        g.maxParams = 0;
+        g.selfTailCalls = false;
+        for (u32 s = 0;s < m_symbolCount;s++) cSymbol(g, m_symbols[s]);
+
+        if (sig->getThisType()) cDeclare(g, fb->getThis());
+        for (u32 a = 0;a < argInfo.size();a++) cDeclare(g, fb->getArg(a));
+
+        for (u32 c = 0;c < ch->code.size();c++) {
+            const Instruction& i = ch->code[c];
+            for (u32 o = 0;o < 3;o++) cDeclare(g, i.operands[o]);
+        }
+
+        Array<const Value*> params;
+        for (u32 c = 0;c < ch->code.size();c++) cInstruction(g, ch->code[c], params);
+
+        String src = cPrelude;
+        src += String::Format("uint32_t %s(cg_context* ctx, void* cg_ret, void** cg_in) {\n", CEntryName);
+
+        for (u32 r = 0;r < g.localOrder.size();r++) {
+            vreg_id reg = g.localOrder[r];
+            src += String::Format("    %s r%u = 0;\n", cTypeName(g.locals[reg]), reg);
+        }
+
+        u32 stackSize = ch->stackLayout.getSize();
+        if (stackSize > 0) {
+            u32 alignment = ch->stackLayout.getAlignment();
+            if (alignment < 16) alignment = 16;
+            src += String::Format("    uint8_t cg_stack[%u] __attribute__((aligned(%u)));\n", stackSize, alignment);
+        }
+
+        src += String::Format("    uint64_t cg_params[%u];\n", g.maxParams > 0 ? g.maxParams : 1);
+        src += String::Format("    void* cg_args[%u];\n", g.maxParams + 1);
+        src += "    void* cg_this = 0;\n";
+        src += "    uint64_t cg_result = 0;\n";
+        src += "    (void)cg_params; (void)cg_args; (void)cg_this; (void)cg_result;\n\n";
+
+        u32 off = 0;
+        if (sig->getThisType()) {
+            Value self = fb->getThis();
+            if (self.getRegisterId() != NullRegister) {
+                src += String::Format("    r%u = ", self.getRegisterId());
+                src += cConvert("((uint8_t*)cg_in[0])", { c_kind::Pointer, sizeof(void*) }, g.locals[self.getRegisterId()]) + ";\n";
+            }
+            off++;
+        }
+
+        for (u32 a = 0;a < argInfo.size();a++) {
+            const type_meta& ai = argInfo[a].type->getInfo();
+            vreg_id reg = fb->getArg(a).getRegisterId();
+            if (reg == NullRegister) continue;
+
+            if (ai.is_primitive || ai.is_pointer) {
+                if (ai.size > sizeof(u64)) continue;
+
+                src += String::Format("    {\n        uint64_t cg_v = 0;\n        memcpy(&cg_v, cg_in[%u], %u);\n", a + off, ai.size);
+                src += String::Format("        r%u = ", reg) + cConvert("cg_v", { c_kind::Unsigned, sizeof(u64) }, g.locals[reg]) + ";\n    }\n";
+            } else {
+                src += String::Format("    r%u = ", reg);
+                src += cConvert(String::Format("((uint8_t*)cg_in[%u])", a + off), { c_kind::Pointer, sizeof(void*) }, g.locals[reg]) + ";\n";
+            }
+        }
+
+        // Tail calls of the function to itself jump back to here with new arguments
+        if (g.selfTailCalls) src += "cg_start:;\n";
+
+        // Falling off the end of the function returns without a value
+        src += "\n";
+        src += g.body;
+        src += "    return 0;\n}\n";
+
+        m_source = src;
+    }
+
+    void CCallHandler::compile(const String& compiler, const String& flags, CodeCache* cache, const CodeKey* key) {
+        #ifdef CODEGEN_C_NATIVE
+        const char* tmp = getenv("TMPDIR");
+        if (!tmp || !tmp[0]) tmp = "/tmp";
+
+        String dirTemplate = String(tmp) + "/codegen-XXXXXX";
+        char dir[1024];
+        if (dirTemplate.size() >= sizeof(dir)) throw Exception("CCallHandler - Temporary directory path is too long");
+        memcpy(dir, dirTemplate.c_str(), dirTemplate.size() + 1);
+
+        if (!mkdtemp(dir)) {
+            throw Exception(String::Format("CCallHandler - Failed to create a temporary directory in '%s'", tmp));
+        }
+
+        String sourcePath = String(dir) + "/function.c";
+        String libraryPath = String(dir) + "/function.so";
+
+        auto cleanup = [&]() {
+            unlink(sourcePath.c_str());
+            unlink(libraryPath.c_str());
+            rmdir(dir);
+        };
+
+        FILE* fp = fopen(sourcePath.c_str(), "wb");
+        if (!fp || fwrite(m_source.c_str(), 1, m_source.size(), fp) != m_source.size()) {
+            if (fp) fclose(fp);
+            cleanup();
+            throw Exception(String::Format("CCallHandler - Failed to write the source of function '%s'", m_target->getSymbolName().c_str()));
+        }
+        fclose(fp);
+
+        // Signed arithmetic must wrap and memory is accessed through pointers of any type, the
+        // same as in the interpreter
+        String command = compiler + " " + flags + " -std=gnu99 -w -fPIC -shared -fwrapv -fno-strict-aliasing -o '" + libraryPath + "' '" + sourcePath + "' -lm 2>&1";
+
+        String output;
+        FILE* proc = popen(command.c_str(), "r");
+        if (!proc) {
+            cleanup();
+            throw Exception(String::Format("CCallHandler - Failed to run the C compiler '%s'", compiler.c_str()));
+        }
+
+        char buf[256];
+        size_t n = 0;
+        while ((n = fread(buf, 1, sizeof(buf) - 1, proc)) > 0) {
+            buf[n] = 0;
+            output += buf;
+        }
+
+        if (pclose(proc) != 0) {
+            cleanup();
+            throw Exception(String::Format(
+                "CCallHandler - Failed to compile function '%s': %s",
+                m_target->getSymbolName().c_str(),
+                output.c_str()
+            ));
+        }
+
+        // Failing to store the code doesn't prevent it from being used
+        if (cache && key) cache->storeFile(*key, libraryPath);
+
+        // The library stays mapped after its file is removed
+        try {
+            load(libraryPath);
+        } catch (...) {
+            cleanup();
+            throw;
+        }
+
+        cleanup();
+        #else
+        throw Exception("CCallHandler - Native code can't be loaded on this host");
+        #endif
+    }
+
+    void CCallHandler::load(const String& libraryPath) {
+        #ifdef CODEGEN_C_NATIVE
+        m_library = dlopen(libraryPath.c_str(), RTLD_NOW | RTLD_LOCAL);
+        if (!m_library) {
+            throw Exception(String::Format(
+                "CCallHandler - Failed to load the code of function '%s': %s",
+                m_target->getSymbolName().c_str(),
+                dlerror()
+            ));
+        }
+
+        m_entry = dlsym(m_library, CEntryName);
+        if (!m_entry) {
+            dlclose(m_library);
+            m_library = nullptr;
+            throw Exception(String::Format("CCallHandler - Failed to find the code of function '%s'", m_target->getSymbolName().c_str()));
+        }
+        #else
+        throw Exception("CCallHandler - Native code can't be loaded on this host");
+        #endif
+    }
+
+    void CCallHandler::call(void* retDest, void** args) {
+        c_context ctx;
+        ctx.symbols = m_symbols;
+        ctx.call = cCall;
+
+        u32 status = ((c_entry)m_entry)(&ctx, retDest, args);
+        if (status != 0) std::rethrow_exception(ctx.error);
+    }
+
+    const String& CCallHandler::getSource() const {
+        return m_source;
+    }
+
+    CBackend::CBackend() : m_compiler("cc"), m_flags("-O2"), m_cache(nullptr) {
+    }
+
+    CBackend::~CBackend() {
+    }
+
+    bool CBackend::transform(CodeHolder* processedCode) {
+        if (!IsSupported()) return false;
+
+        Function* fn = processedCode->owner->getFunction();
+        if (!m_cache || !CodeCache::IsCacheable(processedCode)) {
+            installCallHandler(fn, new CCallHandler(processedCode, m_compiler, m_flags));
+            return true;
+        }
+
+        CodeKey key = CodeCache::Key(processedCode, getIdentity());
+        if (m_cache->lookup(key)) {
+            CCallHandler* cached = nullptr;
+
+            // Entries which can't be loaded, such as ones written by an incompatible host, are replaced
+            try {
+                cached = new CCallHandler(processedCode, m_cache->getPath(key));
+            } catch (...) {
+                IWithLogging* log = processedCode->owner;
+                log->logDebug("CBackend: Failed to load cached code for %s, compiling it again", fn->getSymbolName().c_str());
+            }
+
+            if (cached) {
+                installCallHandler(fn, cached);
+                return true;
+            }
+        }
+
+        installCallHandler(fn, new CCallHandler(processedCode, m_compiler, m_flags, m_cache, &key));
+        return true;
+    }
+
+    void CBackend::setCompiler(const String& compiler) {
+        m_compiler = compiler;
+    }
+
+    const String& CBackend::getCompiler() const {
+        return m_compiler;
+    }
+
+    void CBackend::setCompilerFlags(const String& flags) {
+        m_flags = flags;
+    }
+
+    const String& CBackend::getCompilerFlags() const {
+        return m_flags;
+    }
+
+    void CBackend::setCodeCache(CodeCache* cache) {
+        m_cache = cache;
+    }
+
+    CodeCache* CBackend::getCodeCache() const {
+        return m_cache;
+    }
+
+    String CBackend::getIdentity() const {
+        return String::Format("CBackend %u;", CBackendVersion) + m_compiler + ";" + m_flags;
+    }
+
+    bool CBackend::IsSupported() {
+        #ifdef CODEGEN_C_NATIVE
+        return true;
+        #else
+        return false;
+        #endif
+    }
+};
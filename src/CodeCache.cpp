@@ -0,0 +1,375 @@
+#include <codegen/CodeCache.h>
+#include <codegen/CodeHolder.h>
+#include <codegen/FunctionBuilder.h>
+#include <codegen/IR.h>
+#include <bind/Function.h>
+#include <bind/FunctionType.h>
+#include <bind/DataType.h>
+#include <bind/Registry.h>
+#include <bind/ValuePointer.h>
+#include <utils/Exception.h>
+#include <utils/Array.hpp>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__linux__) || defined(__APPLE__)
+    #define CODEGEN_CODE_CACHE_POSIX
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <dirent.h>
+    #include <errno.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+#endif
+
+namespace codegen {
+    constexpr u64 CodeKeyOffsetBasis = 0xcbf29ce484222325ull;
+    constexpr u64 CodeKeyPrime = 0x100000001b3ull;
+
+    // Entries are named with the hash of their key as 16 hex digits followed by this
+    const char* CodeCacheEntrySuffix = ".bin";
+
+    // Entry files end with the key they were stored with, its size and this
+    constexpr u64 CodeCacheEntryMagic = 0x59454b45444f4347ull;
+    constexpr u64 CodeCacheFooterSize = sizeof(u64) * 2;
+
+    CodeKey::CodeKey() : m_hash(CodeKeyOffsetBasis) {
+    }
+
+    void CodeKey::add(const void* data, u32 size) {
+        const u8* bytes = (const u8*)data;
+        for (u32 i = 0;i < size;i++) {
+            m_hash ^= bytes[i];
+            m_hash *= CodeKeyPrime;
+            m_data.push(bytes[i]);
+        }
+    }
+
+    void CodeKey::add(u64 value) {
+        add(&value, sizeof(u64));
+    }
+
+    void CodeKey::add(const String& str) {
+        add(u64(str.size()));
+        add(str.c_str(), str.size());
+    }
+
+    void CodeKey::add(FunctionType* signature) {
+        // Equivalent signatures may be registered as distinct types, so only their parts are added
+        add(u64(signature->getReturnType()->getSymbolId()));
+
+        DataType* thisType = signature->getThisType();
+        add(thisType ? u64(thisType->getSymbolId()) + 1 : u64(0));
+
+        auto args = signature->getArgs();
+        add(u64(args.size()));
+        for (u32 a = 0;a < args.size();a++) add(u64(args[a].type->getSymbolId()));
+    }
+
+    u64 CodeKey::getHash() const {
+        return m_hash;
+    }
+
+    const Array<u8>& CodeKey::getData() const {
+        return m_data;
+    }
+
+    bool CodeKey::operator==(const CodeKey& rhs) const {
+        if (m_hash != rhs.m_hash || m_data.size() != rhs.m_data.size()) return false;
+        if (m_data.size() == 0) return true;
+        return memcmp(&m_data[0], &rhs.m_data[0], m_data.size()) == 0;
+    }
+
+    bool CodeKey::operator!=(const CodeKey& rhs) const {
+        return !(*this == rhs);
+    }
+
+    bool isVectorOp(OpCode op) {
+        switch (op) {
+            case OpCode::vset:
+            case OpCode::vadd:
+            case OpCode::vsub:
+            case OpCode::vmul:
+            case OpCode::vdiv:
+            case OpCode::vmod:
+            case OpCode::vneg:
+            case OpCode::vdot:
+            case OpCode::vmag:
+            case OpCode::vmagsq:
+            case OpCode::vnorm:
+            case OpCode::vcross: return true;
+            default: return false;
+        }
+    }
+
+    CodeCache::CodeCache(const String& directory) : m_directory(directory), m_hits(0), m_misses(0) {
+        #ifdef CODEGEN_CODE_CACHE_POSIX
+        if (mkdir(directory.c_str(), 0755) != 0 && errno != EEXIST) {
+            throw Exception(String::Format("CodeCache - Failed to create the directory '%s'", directory.c_str()));
+        }
+        #endif
+    }
+
+    CodeCache::~CodeCache() {
+    }
+
+    CodeKey CodeCache::Key(CodeHolder* ch, const String& backendIdentity) {
+        FunctionBuilder* fb = ch->owner;
+        FunctionType* sig = fb->getFunction()->getSignature();
+
+        CodeKey h;
+        h.add(backendIdentity);
+        h.add(sig);
+
+        // Backends find the arguments by their vregs
+        if (sig->getThisType()) h.add(u64(fb->getThis().getRegisterId()));
+        for (u32 a = 0;a < sig->getArgs().size();a++) h.add(u64(fb->getArg(a).getRegisterId()));
+
+        h.add(u64(ch->code.size()));
+        for (u32 c = 0;c < ch->code.size();c++) {
+            const Instruction& i = ch->code[c];
+            h.add(u64(i.op));
+            if (isVectorOp(i.op)) h.add(u64(i.options.vset.componentCount));
+
+            for (u32 o = 0;o < 3;o++) {
+                const Value& v = i.operands[o];
+                if (v.isEmpty()) {
+                    h.add(u64(0));
+                    continue;
+                }
+
+                // Function values are typed by their signature, which is added below
+                bool isCallee = (i.op == OpCode::call || i.op == OpCode::tail_call) && o == 0;
+                if (!isCallee) h.add(u64(v.getType()->getSymbolId()));
+
+                if (v.isReg()) {
+                    h.add(u64(1));
+                    h.add(u64(v.getRegisterId()));
+                    continue;
+                }
+
+                h.add(u64(2));
+
+                // The addresses of functions are different in every process
+                if (isCallee) {
+                    Function* callee = (Function*)v.getImm().p;
+                    h.add(callee->getFullName());
+                    h.add(callee->getSignature());
+
+                    // Calls of the function to itself may be generated differently
+                    h.add(u64(callee == fb->getFunction()));
+                    continue;
+                }
+
+                // Value IDs depend on the order that the process registered values in
+                if (i.op == OpCode::value_ptr && o == 1) {
+                    ValuePointer* vp = Registry::GetValue(v.getImm().u);
+                    h.add(vp ? vp->getFullName() : String());
+                    continue;
+                }
+
+                // Only the bytes of the immediate's type are meaningful
+                u64 imm = v.getImm().u;
+                u32 size = v.getType()->getInfo().size;
+                if (size < sizeof(u64)) imm &= (u64(1) << (size * 8)) - 1;
+                h.add(imm);
+            }
+
+            // The generated code depends on the signature that's called through a function value
+            if ((i.op == OpCode::call || i.op == OpCode::tail_call) && i.operands[0].isReg()) {
+                h.add((FunctionType*)i.operands[0].getType());
+            }
+        }
+
+        return h;
+    }
+
+    bool CodeCache::IsCacheable(CodeHolder* ch) {
+        for (u32 c = 0;c < ch->code.size();c++) {
+            const Instruction& i = ch->code[c];
+            if (i.op == OpCode::value_ptr && !Registry::GetValue(i.operands[1].getImm().u)) return false;
+
+            for (u32 o = 0;o < 3;o++) {
+                const Value& v = i.operands[o];
+                if (!v.isImm()) continue;
+
+                // Callees are keyed by name and signature
+                if ((i.op == OpCode::call || i.op == OpCode::tail_call) && o == 0) continue;
+
+                const type_meta& ti = v.getType()->getInfo();
+                if (ti.is_pointer || !ti.is_primitive) return false;
+            }
+        }
+
+        return true;
+    }
+
+    const String& CodeCache::getDirectory() const {
+        return m_directory;
+    }
+
+    String CodeCache::getPath(const CodeKey& key) const {
+        return m_directory + String::Format("/%016llx%s", (unsigned long long)key.getHash(), CodeCacheEntrySuffix);
+    }
+
+    bool CodeCache::lookup(const CodeKey& key) {
+        if (holdsKey(getPath(key), key)) {
+            m_hits++;
+            return true;
+        }
+
+        m_misses++;
+        return false;
+    }
+
+    bool CodeCache::store(const CodeKey& key, const void* data, u64 size) {
+        #ifdef CODEGEN_CODE_CACHE_POSIX
+        String path = getPath(key);
+        String tmpTemplate = path + ".XXXXXX";
+
+        char tmpPath[1024];
+        if (tmpTemplate.size() >= sizeof(tmpPath)) return false;
+        memcpy(tmpPath, tmpTemplate.c_str(), tmpTemplate.size() + 1);
+
+        int fd = mkstemp(tmpPath);
+        if (fd < 0) return false;
+
+        const Array<u8>& keyData = key.getData();
+        u64 keySize = keyData.size();
+        u64 fileSize = size + keySize + CodeCacheFooterSize;
+
+        bool ok = ftruncate(fd, off_t(fileSize)) == 0;
+        if (ok) {
+            void* mem = mmap(nullptr, fileSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (mem == MAP_FAILED) ok = false;
+            else {
+                u8* out = (u8*)mem;
+                if (size > 0) memcpy(out, data, size);
+                if (keySize > 0) memcpy(out + size, &keyData[0], keySize);
+
+                u64 footer[] = { keySize, CodeCacheEntryMagic };
+                memcpy(out + size + keySize, footer, sizeof(footer));
+
+                ok = msync(mem, fileSize, MS_SYNC) == 0;
+                munmap(mem, fileSize);
+            }
+        }
+
+        if (ok) ok = fchmod(fd, 0644) == 0;
+        close(fd);
+
+        // New entries are linked into place, which fails if another entry was stored first. Only
+        // entries with the same key are replaced, which is done atomically by renaming
+        bool moved = false;
+        if (ok) {
+            if (link(tmpPath, path.c_str()) != 0) {
+                ok = errno == EEXIST && holdsKey(path, key) && rename(tmpPath, path.c_str()) == 0;
+                moved = ok;
+            }
+        }
+
+        if (!moved) unlink(tmpPath);
+
+        return ok;
+        #else
+        return false;
+        #endif
+    }
+
+    bool CodeCache::storeFile(const CodeKey& key, const String& path) {
+        #ifdef CODEGEN_CODE_CACHE_POSIX
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+            close(fd);
+            return false;
+        }
+
+        u64 size = u64(st.st_size);
+        void* mem = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (mem == MAP_FAILED) return false;
+
+        bool ok = store(key, mem, size);
+        munmap(mem, size);
+
+        return ok;
+        #else
+        return false;
+        #endif
+    }
+
+    void CodeCache::clear() {
+        #ifdef CODEGEN_CODE_CACHE_POSIX
+        DIR* dir = opendir(m_directory.c_str());
+        if (!dir) return;
+
+        Array<String> entries;
+        u32 suffixLen = u32(strlen(CodeCacheEntrySuffix));
+
+        struct dirent* ent = nullptr;
+        while ((ent = readdir(dir)) != nullptr) {
+            const char* name = ent->d_name;
+            u32 len = u32(strlen(name));
+            if (len != 16 + suffixLen || strcmp(name + 16, CodeCacheEntrySuffix) != 0) continue;
+
+            bool isKey = true;
+            for (u32 c = 0;c < 16 && isKey;c++) {
+                char ch = name[c];
+                isKey = (ch >= '0' && ch <= '9') || (ch >= 'a' && ch <= 'f');
+            }
+
+            if (isKey) entries.push(m_directory + "/" + name);
+        }
+
+        closedir(dir);
+
+        for (u32 e = 0;e < entries.size();e++) unlink(entries[e].c_str());
+        #endif
+    }
+
+    bool CodeCache::holdsKey(const String& path, const CodeKey& key) const {
+        #ifdef CODEGEN_CODE_CACHE_POSIX
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+
+        struct stat st;
+        const Array<u8>& keyData = key.getData();
+        u64 keySize = keyData.size();
+        if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || u64(st.st_size) < keySize + CodeCacheFooterSize) {
+            close(fd);
+            return false;
+        }
+
+        u64 size = u64(st.st_size);
+        void* mem = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (mem == MAP_FAILED) return false;
+
+        const u8* bytes = (const u8*)mem;
+        u64 footer[2];
+        memcpy(footer, bytes + size - CodeCacheFooterSize, sizeof(footer));
+
+        bool matches = footer[0] == keySize && footer[1] == CodeCacheEntryMagic;
+        if (matches && keySize > 0) {
+            matches = memcmp(bytes + size - CodeCacheFooterSize - keySize, &keyData[0], keySize) == 0;
+        }
+
+        munmap(mem, size);
+        return matches;
+        #else
+        return false;
+        #endif
+    }
+
+    u32 CodeCache::getHitCount() const {
+        return m_hits;
+    }
+
+    u32 CodeCache::getMissCount() const {
+        return m_misses;
+    }
+};
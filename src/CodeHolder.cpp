@@ -11,6 +11,7 @@ namespace codegen {
         labels.rebuild(this);
         cfg.rebuild(this);
         liveness.rebuild(this);
+        stackLayout.rebuild(this);
     }
 
     void CodeHolder::rebuildLabels() {
@@ -24,4 +25,8 @@ namespace codegen {
     void CodeHolder::rebuildLiveness() {
         liveness.rebuild(this);
     }
+
+    void CodeHolder::rebuildStackLayout() {
+        stackLayout.rebuild(this);
+    }
 };
\ No newline at end of file
@@ -93,6 +93,17 @@ namespace codegen {
                     bidx = blockIdxAtAddr(ch->labels.get(end.operands[1].getImm()));
                     blocks[bidx].from.push(b);
                     blk.to.push(bidx);
+
+                    // falls through to the next block when the condition is true
+                    if (b == blocks.size() - 1 || bidx == b + 1) break;
+
+                    blk.to.push(b + 1);
+                    blocks[b + 1].from.push(b);
+                    break;
+                }
+                case OpCode::ret: [[fallthrough]];
+                case OpCode::tail_call: {
+                    // leaves the function
                     break;
                 }
                 default: {
@@ -1,6 +1,9 @@
 #include <codegen/Execute.h>
+#include <codegen/TestProfiler.h>
+#include <codegen/TestVectorKernels.h>
 #include <codegen/CodeHolder.h>
 #include <codegen/FunctionBuilder.h>
+#include <codegen/interfaces/IBackend.h>
 #include <bind/Function.h>
 #include <bind/FunctionType.h>
 #include <bind/PointerType.h>
@@ -9,43 +12,54 @@
 #include <bind/ValuePointer.h>
 #include <utils/Exception.h>
 #include <utils/Array.hpp>
+#include <mutex>
+#include <chrono>
+
+#if defined(__GNUC__) || defined(__clang__)
+    // labels-as-values extension is available
+    #define CODEGEN_TEST_THREADED_DISPATCH
+#endif
 
 namespace codegen {
-    TestExecuterCallHandler::TestExecuterCallHandler(CodeHolder* ch) : ICallHandler(ch->owner->getFunction()), m_code(new CodeHolder(*ch)) {
+    // Generations of the interpreted code of functions, by a hash of the function's address. See
+    // TestCallTarget::generation. Functions which share a generation only cause each other's call
+    // targets to be resolved again
+    constexpr u32 InterpretedCodeGenerationCount = 256;
+    std::atomic<u32> interpretedCodeGenerations[InterpretedCodeGenerationCount];
+
+    inline std::atomic<u32>& interpretedCodeGeneration(const Function* fn) {
+        u64 hash = (u64(fn) >> 4) * 0x9e3779b97f4a7c15ull;
+        return interpretedCodeGenerations[(hash >> 32) % InterpretedCodeGenerationCount];
+    }
+
+    TestExecuterCallHandler::TestExecuterCallHandler(CodeHolder* ch) : ICallHandler(ch->owner->getFunction()), m_code(new TestBytecode(ch)) {
+        interpretedCodeGeneration(m_target)++;
     }
 
     TestExecuterCallHandler::~TestExecuterCallHandler() {
+        interpretedCodeGeneration(m_target)++;
+
         delete m_code;
         m_code = nullptr;
     }
 
-    void TestExecuterCallHandler::call(void* retDest, void** args) {
-        TestExecuter exe(m_code);
-
-        exe.setReturnValuePointer(retDest);
+    const TestBytecode* TestExecuterCallHandler::GetCode(Function* fn) {
+        ICallHandler* handler = fn->getCallHandler();
 
-        FunctionType* sig = m_target->getSignature();
-        auto argInfo = sig->getArgs();
+        // Lazily compiled functions keep their LazyCallHandler, which forwards calls to the compiled one
+        LazyCallHandler* lazy = dynamic_cast<LazyCallHandler*>(handler);
+        if (lazy) handler = lazy->getCompiledHandler();
 
-        u32 off = 0;
-        if (sig->getThisType()) {
-            exe.setThisPtr(args[0]);
-            off++;
-        }
-
-        for (u32 i = 0;i < argInfo.size();i++) {
-            const type_meta& ai = argInfo[i].type->getInfo();
+        TestExecuterCallHandler* interpreted = dynamic_cast<TestExecuterCallHandler*>(handler);
+        if (!interpreted) return nullptr;
+        return interpreted->m_code;
+    }
 
-            if (ai.is_primitive || ai.is_pointer) {
-                if (ai.size == sizeof(u64)) exe.setArg(i, *(u64*)args[i + off]);
-                else if (ai.size == sizeof(u32)) exe.setArg(i, *(u32*)args[i + off]);
-                else if (ai.size == sizeof(u16)) exe.setArg(i, *(u16*)args[i + off]);
-                else if (ai.size == sizeof(u8)) exe.setArg(i, *(u8*)args[i + off]);
-            } else {
-                exe.setArg(i, args[i + off]);
-            }
-        }
+    void TestExecuterCallHandler::call(void* retDest, void** args) {
+        TestExecuter exe(m_code);
 
+        exe.setReturnValuePointer(retDest);
+        exe.setArgs(args);
         exe.execute();
     }
 
@@ -76,6 +90,33 @@ namespace codegen {
         }
     }
 
+    template <typename T>
+    inline T vdot(void* a, void* b, u8 compCnt) {
+        T result = 0;
+        for (u8 c = 0;c < compCnt;c++) result += ((T*)a)[c] * ((T*)b)[c];
+        return result;
+    }
+
+    template <typename T>
+    inline T vmag(void* a, u8 compCnt) {
+        T result = vdot<T>(a, a, compCnt);
+        if constexpr (std::is_floating_point_v<T>) return std::sqrt(result);
+        else return T(sqrtf(f32(result)));
+    }
+
+    template <typename T>
+    inline void setScalar(u64& reg, T value) {
+        if constexpr (std::is_unsigned_v<T>) reg = value;
+        else *((T*)&reg) = value;
+    }
+
+    template <typename From, typename To>
+    inline void convert(u64& dst, u64 src) {
+        setScalar<To>(dst, To(*((From*)&src)));
+    }
+
+    template <typename T> inline void vset(void* a, u64   b, u8 compCnt) { for (u8 i = 0;i < compCnt;i++) ((T*)a)[i] = *((T*)&b); }
+    template <typename T> inline void vset(void* a, void* b, u8 compCnt) { for (u8 i = 0;i < compCnt;i++) ((T*)a)[i] = ((T*)b)[i]; }
     template <typename T> inline void vadd(void* a, u64   b, u8 compCnt) { for (u8 i = 0;i < compCnt;i++) ((T*)a)[i] += *((T*)&b); }
     template <typename T> inline void vadd(void* a, void* b, u8 compCnt) { for (u8 i = 0;i < compCnt;i++) ((T*)a)[i] += ((T*)b)[i]; }
     template <typename T> inline void vsub(void* a, u64   b, u8 compCnt) { for (u8 i = 0;i < compCnt;i++) ((T*)a)[i] -= *((T*)&b); }
@@ -84,6 +125,7 @@ namespace codegen {
     template <typename T> inline void vmul(void* a, void* b, u8 compCnt) { for (u8 i = 0;i < compCnt;i++) ((T*)a)[i] *= ((T*)b)[i]; }
     template <typename T> inline void vdiv(void* a, u64   b, u8 compCnt) { for (u8 i = 0;i < compCnt;i++) ((T*)a)[i] /= *((T*)&b); }
     template <typename T> inline void vdiv(void* a, void* b, u8 compCnt) { for (u8 i = 0;i < compCnt;i++) ((T*)a)[i] /= ((T*)b)[i]; }
+    template <typename T> inline void vneg(void* a, u8 compCnt) { for (u8 i = 0;i < compCnt;i++) ((T*)a)[i] = T(-((T*)a)[i]); }
     template <typename T> inline void vmod(void* a, u64   b, u8 compCnt) {
         if constexpr (std::is_floating_point_v<T>) {
             for (u8 i = 0;i < compCnt;i++) ((T*)a)[i] = std::fmod(((T*)a)[i], *((T*)&b));
@@ -100,1120 +142,1203 @@ namespace codegen {
     }
 
 
-    TestExecuter::TestExecuter(CodeHolder* ch)
-        : m_code(ch), m_fb(ch->owner), m_func(m_fb->getFunction()), m_stack(nullptr), m_registers(nullptr),
-          m_returnPtr(nullptr), m_stackOffset(0), m_instructionIdx(0)
-    {
-        u32 maxStackSize = 0;
-        u32 maxRegister = 0;
-
-        for (u32 c = 0;c < ch->code.size();c++) {
-            Instruction& i = ch->code[c];
-            if (i.op == OpCode::stack_alloc) {
-                auto it = m_stackAddrs.find(i.operands[1].getImm());
-                if (it != m_stackAddrs.end()) continue;
-
-                m_stackAddrs.insert(std::pair<stack_id, u32>(i.operands[1].getImm(), maxStackSize));
-                maxStackSize += (u32)i.operands[0].getImm();
-            } else if (i.op == OpCode::label) {
-                m_labelAddrs.insert(std::pair<label_id, i32>(i.operands[0].getImm(), i32(c + 1)));
-            }
+    // Size of the first segment that frames are allocated from, and the size that segments stop
+    // doubling at. Segments are only larger than the maximum if a single frame requires it
+    constexpr u32 TestFrameSegmentSize = 64 * 1024;
+    constexpr u32 TestFrameMaxSegmentSize = 64 * 1024 * 1024;
+
+    TestFramePool::TestFramePool() : m_currentSegment(0), m_top(nullptr) {
+    }
 
-            auto& info = Instruction::Info(i.op);
-            for (u32 o = 0;o < info.operandCount;o++) {
-                if (i.operands[o].isReg()) {
-                    if (i.operands[o].getRegisterId() > maxRegister) maxRegister = i.operands[o].getRegisterId();
+    TestFramePool::~TestFramePool() {
+        for (u32 s = 0;s < m_segments.size();s++) delete [] m_segments[s].memory;
+        m_segments.clear();
+        m_top = nullptr;
+    }
+
+    void* TestFramePool::allocate(u32 size) {
+        u32 required = HeaderSize + ((size + 15) & ~15u);
+
+        while (true) {
+            if (m_currentSegment == m_segments.size()) {
+                u32 capacity = TestFrameSegmentSize;
+                if (m_segments.size() > 0) {
+                    capacity = m_segments[m_segments.size() - 1].capacity;
+                    if (capacity < TestFrameMaxSegmentSize) capacity *= 2;
                 }
+
+                if (required > capacity) capacity = required;
+                m_segments.push({ new u8[capacity], capacity, 0 });
+                break;
             }
+
+            segment& seg = m_segments[m_currentSegment];
+            if (seg.capacity - seg.used >= required) break;
+
+            if (seg.used == 0) {
+                // Unused segment that's too small for this frame, replace it
+                delete [] seg.memory;
+                seg.capacity = required > TestFrameSegmentSize ? required : TestFrameSegmentSize;
+                seg.memory = new u8[seg.capacity];
+                break;
+            }
+
+            m_currentSegment++;
+        }
+
+        segment& seg = m_segments[m_currentSegment];
+        frame_header* frame = (frame_header*)(seg.memory + seg.used);
+        frame->prev = m_top;
+        frame->segment = m_currentSegment;
+        frame->released = false;
+
+        seg.used += required;
+        m_top = frame;
+
+        return ((u8*)frame) + HeaderSize;
+    }
+
+    void TestFramePool::release(void* frame) {
+        frame_header* header = (frame_header*)(((u8*)frame) - HeaderSize);
+        header->released = true;
+
+        while (m_top && m_top->released) {
+            segment& seg = m_segments[m_top->segment];
+            seg.used = u32(((u8*)m_top) - seg.memory);
+            m_currentSegment = m_top->segment;
+            m_top = m_top->prev;
+        }
+    }
+
+    u64 TestFramePool::getUsedSize() const {
+        u64 size = 0;
+        for (u32 s = 0;s < m_segments.size();s++) size += m_segments[s].used;
+        return size;
+    }
+
+    u64 TestFramePool::getCapacity() const {
+        u64 size = 0;
+        for (u32 s = 0;s < m_segments.size();s++) size += m_segments[s].capacity;
+        return size;
+    }
+
+    void TestFramePool::trim() {
+        while (m_segments.size() > 1 && m_segments.size() > m_currentSegment + 1) {
+            u32 last = m_segments.size() - 1;
+            if (m_segments[last].used > 0) break;
+
+            delete [] m_segments[last].memory;
+            m_segments.remove(last);
+        }
+    }
+
+    TestFramePool* TestFramePool::Get() {
+        static thread_local TestFramePool pool;
+        return &pool;
+    }
+
+
+    /*
+     * Saved state of the caller of an interpreted function which was called directly, stored just
+     * before the callee's frame
+     */
+    struct TestExecuter::call_frame {
+        call_frame* prev;
+        const TestBytecode* code;
+        const TestInstruction* returnAddress;
+        u64* registers;
+        void* returnPtr;
+    };
+
+    // Reads the code of a target into 'code' and returns true if the target can still be used for
+    // calls to fn
+    inline bool readCallTarget(const TestCallTarget* target, Function* fn, const TestBytecode*& code) {
+        if (!target || target->function != fn) return false;
+
+        u32 version = target->version.load(std::memory_order_acquire);
+        const ICallHandler* handler = target->handler.load(std::memory_order_relaxed);
+        u32 generation = target->generation.load(std::memory_order_relaxed);
+        code = target->code.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if ((version & 1) || target->version.load(std::memory_order_relaxed) != version) return false;
+
+        // Calls of lowered code to itself always run the same code
+        if (!handler) return true;
+
+        return handler == fn->getCallHandler() && generation == interpretedCodeGeneration(fn).load(std::memory_order_acquire);
+    }
+
+    // Resolves the target of a call to fn made by the site and caches it, then returns its code. Null
+    // is returned if fn must be called through bind::Function::call
+    const TestBytecode* resolveCallTarget(TestCallSite* site, Function* fn) {
+        // Read before the handler, so that a target resolved while the handler is being replaced
+        // is never current
+        u32 generation = interpretedCodeGeneration(fn).load(std::memory_order_acquire);
+        const ICallHandler* handler = fn->getCallHandler();
+
+        // The call compiles the function, and the site is resolved again by the next call
+        const LazyCallHandler* lazy = dynamic_cast<const LazyCallHandler*>(handler);
+        if (lazy && !lazy->isCompiled()) return nullptr;
+
+        const TestBytecode* code = TestExecuterCallHandler::GetCode(fn);
+        TestCallKind kind = code ? TestCallKind::Direct : TestCallKind::Host;
+
+        std::lock_guard<std::mutex> lock(site->targetsLock);
+
+        // Targets are kept when they're replaced, so a site which alternates between a few
+        // functions only looks each of them up once
+        TestCallTarget* target = nullptr;
+        for (u32 t = 0;t < site->knownTargets.size() && !target;t++) {
+            if (site->knownTargets[t]->function == fn) target = site->knownTargets[t];
         }
 
-        m_stack = new u8[maxStackSize];
-        memset(m_stack, 0, maxStackSize);
+        if (!target) {
+            target = new TestCallTarget();
+            target->function = fn;
+            target->kind.store(kind, std::memory_order_relaxed);
+            target->code.store(code, std::memory_order_relaxed);
+            target->handler.store(handler, std::memory_order_relaxed);
+            target->generation.store(generation, std::memory_order_relaxed);
+            site->knownTargets.push(target);
+        } else if (
+            target->handler.load(std::memory_order_relaxed) != handler ||
+            target->code.load(std::memory_order_relaxed) != code ||
+            target->generation.load(std::memory_order_relaxed) != generation
+        ) {
+            // The function's handler was replaced, other threads may be reading the old one
+            u32 version = target->version.load(std::memory_order_relaxed);
+            target->version.store(version + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+
+            target->kind.store(kind, std::memory_order_relaxed);
+            target->code.store(code, std::memory_order_relaxed);
+            target->handler.store(handler, std::memory_order_relaxed);
+            target->generation.store(generation, std::memory_order_relaxed);
+            target->version.store(version + 2, std::memory_order_release);
+        }
+
+        site->cachedTarget.store(target, std::memory_order_release);
+        return code;
+    }
 
-        m_registers = new u64[maxRegister + 1];
-        memset(m_registers, 0, maxRegister * sizeof(u64));
+    // Returns the code to call fn with directly, or null if it must be called through bind::Function::call
+    inline const TestBytecode* findCallee(TestCallSite* site, Function* fn) {
+        const TestBytecode* code = nullptr;
+        if (readCallTarget(site->cachedTarget.load(std::memory_order_acquire), fn, code)) return code;
+        return resolveCallTarget(site, fn);
+    }
+
+    TestExecuter::TestExecuter(CodeHolder* ch) : TestExecuter(new TestBytecode(ch)) {
+        m_ownsCode = true;
+    }
+
+    TestExecuter::TestExecuter(const TestBytecode* code)
+        : m_code(code), m_ownsCode(false), m_func(code->function), m_pool(TestFramePool::Get()), m_frame(nullptr),
+          m_registers(nullptr), m_returnPtr(nullptr), m_callStack(nullptr), m_suspendedCode(nullptr),
+          m_suspendedRegisters(nullptr), m_suspendedReturnPtr(nullptr), m_budgeted(false), m_budget(0), m_deadline(0),
+          m_tailCallParams(nullptr), m_tailCallParamCapacity(0), m_batchReturnValues(nullptr), m_instructionIdx(0),
+          m_dispatchMode(IsThreadedDispatchAvailable() ? TestDispatchMode::Threaded : TestDispatchMode::Switch), m_profiler(nullptr)
+    {
+        m_frame = (u8*)m_pool->allocate(m_code->frameSize);
+        m_registers = (u64*)m_frame;
+
+        // Pooled memory holds whatever the previous frame left there
+        m_code->clearFrame(m_frame);
     }
 
     TestExecuter::~TestExecuter() {
-        if (m_stack) delete [] m_stack;
-        m_stack = nullptr;
+        releaseCallStack();
 
-        if (m_registers) delete [] m_registers;
+        if (m_frame) m_pool->release(m_frame);
+        m_frame = nullptr;
         m_registers = nullptr;
+
+        if (m_tailCallParams) delete [] m_tailCallParams;
+        m_tailCallParams = nullptr;
+        m_tailCallParamCapacity = 0;
+
+        if (m_ownsCode) delete m_code;
+        m_code = nullptr;
     }
 
-    void TestExecuter::setArg(u32 index, bool  value) { setRegister(m_fb->getArg(index).getRegisterId(), value); }
-    void TestExecuter::setArg(u32 index, u8    value) { setRegister(m_fb->getArg(index).getRegisterId(), value); }
-    void TestExecuter::setArg(u32 index, u16   value) { setRegister(m_fb->getArg(index).getRegisterId(), value); }
-    void TestExecuter::setArg(u32 index, u32   value) { setRegister(m_fb->getArg(index).getRegisterId(), value); }
-    void TestExecuter::setArg(u32 index, u64   value) { setRegister(m_fb->getArg(index).getRegisterId(), value); }
-    void TestExecuter::setArg(u32 index, i8    value) { setRegister(m_fb->getArg(index).getRegisterId(), value); }
-    void TestExecuter::setArg(u32 index, i16   value) { setRegister(m_fb->getArg(index).getRegisterId(), value); }
-    void TestExecuter::setArg(u32 index, i32   value) { setRegister(m_fb->getArg(index).getRegisterId(), value); }
-    void TestExecuter::setArg(u32 index, i64   value) { setRegister(m_fb->getArg(index).getRegisterId(), value); }
-    void TestExecuter::setArg(u32 index, f32   value) { setRegister(m_fb->getArg(index).getRegisterId(), value); }
-    void TestExecuter::setArg(u32 index, f64   value) { setRegister(m_fb->getArg(index).getRegisterId(), value); }
-    void TestExecuter::setArg(u32 index, void* value) { setRegister(m_fb->getArg(index).getRegisterId(), value); }
+    void TestExecuter::setArg(u32 index, bool  value) { setSlot(m_code->argRegisters[index], value); }
+    void TestExecuter::setArg(u32 index, u8    value) { setSlot(m_code->argRegisters[index], value); }
+    void TestExecuter::setArg(u32 index, u16   value) { setSlot(m_code->argRegisters[index], value); }
+    void TestExecuter::setArg(u32 index, u32   value) { setSlot(m_code->argRegisters[index], value); }
+    void TestExecuter::setArg(u32 index, u64   value) { setSlot(m_code->argRegisters[index], value); }
+    void TestExecuter::setArg(u32 index, i8    value) { setSlot(m_code->argRegisters[index], value); }
+    void TestExecuter::setArg(u32 index, i16   value) { setSlot(m_code->argRegisters[index], value); }
+    void TestExecuter::setArg(u32 index, i32   value) { setSlot(m_code->argRegisters[index], value); }
+    void TestExecuter::setArg(u32 index, i64   value) { setSlot(m_code->argRegisters[index], value); }
+    void TestExecuter::setArg(u32 index, f32   value) { setSlot(m_code->argRegisters[index], value); }
+    void TestExecuter::setArg(u32 index, f64   value) { setSlot(m_code->argRegisters[index], value); }
+    void TestExecuter::setArg(u32 index, void* value) { setSlot(m_code->argRegisters[index], value); }
     void TestExecuter::setThisPtr(void* thisPtr) {
-        if (!m_func->getSignature()->getThisType()) return;
-        setRegister(m_fb->getThis().getRegisterId(), thisPtr);
+        if (m_code->thisRegister == NullRegister) return;
+        setSlot(m_code->thisRegister, thisPtr);
     }
+    void TestExecuter::setArgs(void** args) { m_code->loadArguments(m_registers, args); }
     void TestExecuter::setReturnValuePointer(void* retDest) { m_returnPtr = retDest; }
+    void TestExecuter::setDispatchMode(TestDispatchMode mode) { m_dispatchMode = mode; }
+    TestDispatchMode TestExecuter::getDispatchMode() const { return m_dispatchMode; }
+    void TestExecuter::setProfiler(TestProfiler* profiler) { m_profiler = profiler; }
+    TestProfiler* TestExecuter::getProfiler() const { return m_profiler; }
+
+    u32 TestExecuter::getRegisterSlot(vreg_id regId) const {
+        if (regId >= m_code->registerMap.size() || m_code->registerMap[regId] == TestUnresolvedOffset) {
+            throw Exception(String::Format("TestExecuter - vreg %u does not exist in the executed code", regId));
+        }
+
+        return m_code->registerMap[regId];
+    }
+
+    bool TestExecuter::IsThreadedDispatchAvailable() {
+        #ifdef CODEGEN_TEST_THREADED_DISPATCH
+        return true;
+        #else
+        return false;
+        #endif
+    }
 
     void TestExecuter::execute() {
-        for (m_instructionIdx = 0;m_instructionIdx < i32(m_code->code.size());m_instructionIdx++) {
-            Instruction& i = m_code->code[m_instructionIdx];
-
-            Value& op0 = i.operands[0];
-            Value& op1 = i.operands[1];
-            Value& op2 = i.operands[2];
-            DataType* tp0 = op0.getType();
-            DataType* tp1 = op1.getType();
-            DataType* tp2 = op2.getType();
-            const type_meta& ti0 = tp0->getInfo();
-            const type_meta& ti1 = tp1->getInfo();
-            const type_meta& ti2 = tp2->getInfo();
-            #define reg0 m_registers[i.operands[0].getRegisterId()]
-            #define reg1 m_registers[i.operands[1].getRegisterId()]
-            #define reg2 m_registers[i.operands[2].getRegisterId()]
-            #define imm0 i.operands[0].getImm()
-            #define imm1 i.operands[1].getImm()
-            #define imm2 i.operands[2].getImm()
-            u64 v0 = op0.isImm() ? imm0.u : reg0;
-            u64 v1 = op1.isImm() ? imm1.u : reg1;
-            u64 v2 = op2.isImm() ? imm2.u : reg2;
-
-            switch (i.op) {
-                case OpCode::stack_ptr: {
-                    reg0 = reinterpret_cast<u64>(m_stack + m_stackAddrs[stack_id(imm1.u)]);
-                    break;
+        releaseCallStack();
+        m_instructionIdx = 0;
+        dispatch();
+    }
+
+    TestExecutionStatus TestExecuter::execute(u64 instructionBudget) {
+        releaseCallStack();
+        m_instructionIdx = 0;
+        return dispatchWithBudget(instructionBudget, 0);
+    }
+
+    TestExecutionStatus TestExecuter::executeFor(u64 nanoseconds) {
+        releaseCallStack();
+        m_instructionIdx = 0;
+        return dispatchWithBudget(0, nanoseconds);
+    }
+
+    TestExecutionStatus TestExecuter::resume(u64 instructionBudget) {
+        if (!m_suspendedCode) return TestExecutionStatus::Completed;
+        return dispatchWithBudget(instructionBudget, 0);
+    }
+
+    TestExecutionStatus TestExecuter::resumeFor(u64 nanoseconds) {
+        if (!m_suspendedCode) return TestExecutionStatus::Completed;
+        return dispatchWithBudget(0, nanoseconds);
+    }
+
+    bool TestExecuter::isSuspended() const {
+        return m_suspendedCode != nullptr;
+    }
+
+    void TestExecuter::cancel() {
+        releaseCallStack();
+    }
+
+    void TestExecuter::releaseCallStack() {
+        // Directly called functions which haven't returned, either because execution was suspended
+        // or because it was interrupted by an exception
+        while (m_callStack) {
+            call_frame* frame = m_callStack;
+            m_callStack = frame->prev;
+            m_pool->release(frame);
+        }
+
+        m_suspendedCode = nullptr;
+    }
+
+    void TestExecuter::reserveTailCallParams(u32 count) {
+        if (m_tailCallParams) delete [] m_tailCallParams;
+        m_tailCallParamCapacity = count < 16 ? 16 : count;
+        m_tailCallParams = new u64[m_tailCallParamCapacity];
+    }
+
+    // Number of instructions executed between checks of the clock when executing with a time budget
+    constexpr u64 TestTimeBudgetInterval = 1024;
+
+    u64 getTestClockTime() {
+        auto now = std::chrono::steady_clock::now().time_since_epoch();
+        return u64(std::chrono::duration_cast<std::chrono::nanoseconds>(now).count());
+    }
+
+    TestExecutionStatus TestExecuter::dispatchWithBudget(u64 instructionBudget, u64 nanoseconds) {
+        if (nanoseconds > 0) {
+            m_budget = TestTimeBudgetInterval;
+            m_deadline = getTestClockTime() + nanoseconds;
+        } else {
+            m_budget = instructionBudget;
+            m_deadline = 0;
+        }
+
+        m_budgeted = true;
+
+        try {
+            dispatch();
+        } catch (...) {
+            m_budgeted = false;
+            throw;
+        }
+
+        m_budgeted = false;
+        return m_suspendedCode ? TestExecutionStatus::Suspended : TestExecutionStatus::Completed;
+    }
+
+    bool TestExecuter::isBudgetExhausted() {
+        if (m_deadline == 0 || getTestClockTime() >= m_deadline) return true;
+
+        m_budget = TestTimeBudgetInterval;
+        return false;
+    }
+
+    void TestExecuter::dispatch() {
+        // Profiling and budgets are handled by separate instantiations of the interpreter loop, so
+        // that the loop which is used without them doesn't contain any of it
+        if (m_profiler || m_budgeted) {
+            #ifdef CODEGEN_TEST_THREADED_DISPATCH
+            if (m_dispatchMode == TestDispatchMode::Threaded) run<true, true>();
+            else run<false, true>();
+            #else
+            run<false, true>();
+            #endif
+
+            if (m_profiler) m_profiler->onStop();
+            return;
+        }
+
+        #ifdef CODEGEN_TEST_THREADED_DISPATCH
+        if (m_dispatchMode == TestDispatchMode::Threaded) {
+            run<true, false>();
+            return;
+        }
+        #endif
+
+        run<false, false>();
+    }
+
+    // Operand type and expression for each binary operation, shared by the scalar and batch interpreters
+    #define CODEGEN_TEST_BINARY_SEMANTICS(X)                                                                           \
+        X(shl, u64, a << b)                                                                                            \
+        X(shr, u64, a >> b)                                                                                            \
+        X(land, u64, a && b)                                                                                           \
+        X(band, u64, a & b)                                                                                            \
+        X(lor, u64, a || b)                                                                                            \
+        X(bor, u64, a | b)                                                                                             \
+        X(_xor, u64, a ^ b)                                                                                            \
+        X(iadd, i64, a + b)                                                                                            \
+        X(uadd, u64, a + b)                                                                                            \
+        X(fadd, f32, a + b)                                                                                            \
+        X(dadd, f64, a + b)                                                                                            \
+        X(isub, i64, a - b)                                                                                            \
+        X(usub, u64, a - b)                                                                                            \
+        X(fsub, f32, a - b)                                                                                            \
+        X(dsub, f64, a - b)                                                                                            \
+        X(imul, i64, a * b)                                                                                            \
+        X(umul, u64, a * b)                                                                                            \
+        X(fmul, f32, a * b)                                                                                            \
+        X(dmul, f64, a * b)                                                                                            \
+        X(idiv, i64, a / b)                                                                                            \
+        X(udiv, u64, a / b)                                                                                            \
+        X(fdiv, f32, a / b)                                                                                            \
+        X(ddiv, f64, a / b)                                                                                            \
+        X(imod, i64, a % b)                                                                                            \
+        X(umod, u64, a % b)                                                                                            \
+        X(fmod, f32, fmodf(a, b))                                                                                      \
+        X(dmod, f64, ::fmod(a, b))
+
+    // Operand type and expression for each comparison, shared by the scalar and batch interpreters
+    #define CODEGEN_TEST_COMPARE_SEMANTICS(X)                                                                          \
+        X(ilt, i64, a < b)                                                                                             \
+        X(ult, u64, a < b)                                                                                             \
+        X(flt, f32, a < b)                                                                                             \
+        X(dlt, f64, a < b)                                                                                             \
+        X(ilte, i64, a <= b)                                                                                           \
+        X(ulte, u64, a <= b)                                                                                           \
+        X(flte, f32, a <= b)                                                                                           \
+        X(dlte, f64, a <= b)                                                                                           \
+        X(igt, i64, a > b)                                                                                             \
+        X(ugt, u64, a > b)                                                                                             \
+        X(fgt, f32, a > b)                                                                                             \
+        X(dgt, f64, a > b)                                                                                             \
+        X(igte, i64, a >= b)                                                                                           \
+        X(ugte, u64, a >= b)                                                                                           \
+        X(fgte, f32, a >= b)                                                                                           \
+        X(dgte, f64, a >= b)                                                                                           \
+        X(ieq, i64, a == b)                                                                                            \
+        X(ueq, u64, a == b)                                                                                            \
+        X(feq, f32, a == b)                                                                                            \
+        X(deq, f64, a == b)                                                                                            \
+        X(ineq, i64, a != b)                                                                                           \
+        X(uneq, u64, a != b)                                                                                           \
+        X(fneq, f32, a != b)                                                                                           \
+        X(dneq, f64, a != b)
+
+    // 8, 16 and 32 bit forms of an integer operation, with the operand type of each
+    #define CODEGEN_TEST_NARROW_SEMANTICS(X, name, T, expr)                                                            \
+        X(name##8, T##8, expr) X(name##16, T##16, expr) X(name##32, T##32, expr)
+
+    // Operand type and expression for the narrow forms of binary operations. Division is done at
+    // 64 bits so that dividing the minimum value by -1 wraps instead of trapping
+    #define CODEGEN_TEST_NARROW_BINARY_SEMANTICS(X)                                                                    \
+        CODEGEN_TEST_NARROW_SEMANTICS(X, shl, u, a << b)                                                               \
+        CODEGEN_TEST_NARROW_SEMANTICS(X, shr, u, a >> b)                                                               \
+        CODEGEN_TEST_NARROW_SEMANTICS(X, land, u, a && b)                                                              \
+        CODEGEN_TEST_NARROW_SEMANTICS(X, lor, u, a || b)                                                               \
+        CODEGEN_TEST_NARROW_SEMANTICS(X, idiv, i, i64(a) / i64(b))                                                     \
+        CODEGEN_TEST_NARROW_SEMANTICS(X, udiv, u, a / b)                                                               \
+        CODEGEN_TEST_NARROW_SEMANTICS(X, imod, i, i64(a) % i64(b))                                                     \
+        CODEGEN_TEST_NARROW_SEMANTICS(X, umod, u, a % b)
+
+    // Operand type and expression for the narrow forms of comparisons
+    #define CODEGEN_TEST_NARROW_COMPARE_SEMANTICS(X)                                                                   \
+        CODEGEN_TEST_NARROW_SEMANTICS(X, ilt, i, a < b)                                                                \
+        CODEGEN_TEST_NARROW_SEMANTICS(X, ult, u, a < b)                                                                \
+        CODEGEN_TEST_NARROW_SEMANTICS(X, ilte, i, a <= b)                                                              \
+        CODEGEN_TEST_NARROW_SEMANTICS(X, ulte, u, a <= b)                                                              \
+        CODEGEN_TEST_NARROW_SEMANTICS(X, igt, i, a > b)                                                                \
+        CODEGEN_TEST_NARROW_SEMANTICS(X, ugt, u, a > b)                                                                \
+        CODEGEN_TEST_NARROW_SEMANTICS(X, igte, i, a >= b)                                                              \
+        CODEGEN_TEST_NARROW_SEMANTICS(X, ugte, u, a >= b)                                                              \
+        CODEGEN_TEST_NARROW_SEMANTICS(X, ieq, i, a == b)                                                               \
+        CODEGEN_TEST_NARROW_SEMANTICS(X, ueq, u, a == b)                                                               \
+        CODEGEN_TEST_NARROW_SEMANTICS(X, ineq, i, a != b)                                                              \
+        CODEGEN_TEST_NARROW_SEMANTICS(X, uneq, u, a != b)
+
+    // Number of lanes executed together by executeBatch
+    constexpr u32 TestBatchWidth = 64;
+
+    void TestExecuter::setBatchArg(u32 index, const bool* values) { setBatchColumn(index, values, sizeof(bool)); }
+    void TestExecuter::setBatchArg(u32 index, const u8*   values) { setBatchColumn(index, values, sizeof(u8)); }
+    void TestExecuter::setBatchArg(u32 index, const u16*  values) { setBatchColumn(index, values, sizeof(u16)); }
+    void TestExecuter::setBatchArg(u32 index, const u32*  values) { setBatchColumn(index, values, sizeof(u32)); }
+    void TestExecuter::setBatchArg(u32 index, const u64*  values) { setBatchColumn(index, values, sizeof(u64)); }
+    void TestExecuter::setBatchArg(u32 index, const i8*   values) { setBatchColumn(index, values, sizeof(i8)); }
+    void TestExecuter::setBatchArg(u32 index, const i16*  values) { setBatchColumn(index, values, sizeof(i16)); }
+    void TestExecuter::setBatchArg(u32 index, const i32*  values) { setBatchColumn(index, values, sizeof(i32)); }
+    void TestExecuter::setBatchArg(u32 index, const i64*  values) { setBatchColumn(index, values, sizeof(i64)); }
+    void TestExecuter::setBatchArg(u32 index, const f32*  values) { setBatchColumn(index, values, sizeof(f32)); }
+    void TestExecuter::setBatchArg(u32 index, const f64*  values) { setBatchColumn(index, values, sizeof(f64)); }
+    void TestExecuter::setBatchArg(u32 index, void* const* values) { setBatchColumn(index, values, sizeof(void*)); }
+    void TestExecuter::setBatchReturnValues(void* retDest) { m_batchReturnValues = (u8*)retDest; }
+    u32 TestExecuter::GetBatchWidth() { return TestBatchWidth; }
+
+    void TestExecuter::setBatchColumn(u32 index, const void* values, u32 stride) {
+        while (m_batchArgs.size() <= index) m_batchArgs.push({ nullptr, 0 });
+        m_batchArgs[index] = { (const u8*)values, stride };
+    }
+
+    void TestExecuter::executeBatch(u32 laneCount) {
+        releaseCallStack();
+        if (laneCount == 0) return;
+
+        // Structure-of-arrays register file, each register holds one value per lane. It's followed
+        // by a copy of the scalar registers, which lanes executed separately overwrite
+        u32 registerCount = m_code->registerCount;
+        u64* registers = (u64*)m_pool->allocate(registerCount * (TestBatchWidth + 1) * sizeof(u64));
+        u64* initial = registers + registerCount * TestBatchWidth;
+        memcpy(initial, m_registers, registerCount * sizeof(u64));
+        void* returnPtr = m_returnPtr;
+
+        // Values set with setArg/setThisPtr apply to every lane
+        for (u32 r = 0;r < registerCount;r++) {
+            u64* lanes = registers + r * TestBatchWidth;
+            for (u32 l = 0;l < TestBatchWidth;l++) lanes[l] = initial[r];
+        }
+
+        try {
+            for (u32 firstLane = 0;firstLane < laneCount;firstLane += TestBatchWidth) {
+                u32 count = laneCount - firstLane;
+                if (count > TestBatchWidth) count = TestBatchWidth;
+
+                // Only the arguments need to be reset for each group, other registers are always
+                // assigned before they're used
+                if (m_code->thisRegister != NullRegister) {
+                    u64* lanes = registers + m_code->thisRegister * TestBatchWidth;
+                    for (u32 l = 0;l < count;l++) lanes[l] = initial[m_code->thisRegister];
                 }
-                case OpCode::value_ptr: {
-                    ValuePointer* vp = Registry::GetValue(imm1);
-                    reg0 = reinterpret_cast<u64>(vp->getAddress());
-                    break;
+
+                for (u32 a = 0;a < m_code->argRegisters.size();a++) {
+                    u32 reg = m_code->argRegisters[a];
+                    u64* lanes = registers + reg * TestBatchWidth;
+                    const batch_column* col = a < m_batchArgs.size() && m_batchArgs[a].values ? &m_batchArgs[a] : nullptr;
+
+                    if (!col) {
+                        for (u32 l = 0;l < count;l++) lanes[l] = initial[reg];
+                        continue;
+                    }
+
+                    const u8* values = col->values + firstLane * col->stride;
+                    switch (col->stride) {
+                        case sizeof(u8): { for (u32 l = 0;l < count;l++) lanes[l] = ((const u8*)values)[l]; break; }
+                        case sizeof(u16): { for (u32 l = 0;l < count;l++) lanes[l] = ((const u16*)values)[l]; break; }
+                        case sizeof(u32): { for (u32 l = 0;l < count;l++) lanes[l] = ((const u32*)values)[l]; break; }
+                        case sizeof(u64): { for (u32 l = 0;l < count;l++) lanes[l] = ((const u64*)values)[l]; break; }
+                    }
                 }
-                case OpCode::ret_ptr: {
-                    reg0 = reinterpret_cast<u64>(m_returnPtr);
-                    break;
+
+                if (m_profiler) runBatchLanes(registers, firstLane, count, 0);
+                else runBatch(registers, firstLane, count);
+            }
+        } catch (...) {
+            memcpy(m_registers, initial, registerCount * sizeof(u64));
+            m_returnPtr = returnPtr;
+            m_pool->release(registers);
+            throw;
+        }
+
+        memcpy(m_registers, initial, registerCount * sizeof(u64));
+        m_returnPtr = returnPtr;
+        m_pool->release(registers);
+    }
+
+    void TestExecuter::runBatchLanes(const u64* registers, u32 firstLane, u32 laneCount, u32 instructionIdx) {
+        u32 registerCount = m_code->registerCount;
+        u32 returnSize = m_func->getSignature()->getReturnType()->getInfo().size;
+
+        for (u32 l = 0;l < laneCount;l++) {
+            for (u32 r = 0;r < registerCount;r++) m_registers[r] = registers[r * TestBatchWidth + l];
+
+            // Each lane starts with cleared stack space, as if it was called on its own. runBatch
+            // doesn't handle stack_ptr, so the stack space is never used before the lanes separate
+            if (m_code->stackSize > 0) memset(m_frame + m_code->stackOffset, 0, m_code->stackSize);
+
+            m_returnPtr = m_batchReturnValues ? m_batchReturnValues + (firstLane + l) * returnSize : nullptr;
+            m_instructionIdx = instructionIdx;
+            dispatch();
+        }
+    }
+
+    // Shared by run() and ExecuteOperation
+    #define TYPE_SWITCH(stmt)                                                                                          \
+        switch (i->type) {                                                                                             \
+            case TestValueType::Int8: { typedef i8 T; stmt; break; }                                                   \
+            case TestValueType::Int16: { typedef i16 T; stmt; break; }                                                 \
+            case TestValueType::Int32: { typedef i32 T; stmt; break; }                                                 \
+            case TestValueType::Int64: { typedef i64 T; stmt; break; }                                                 \
+            case TestValueType::UInt8: { typedef u8 T; stmt; break; }                                                  \
+            case TestValueType::UInt16: { typedef u16 T; stmt; break; }                                                \
+            case TestValueType::UInt32: { typedef u32 T; stmt; break; }                                                \
+            case TestValueType::UInt64: { typedef u64 T; stmt; break; }                                                \
+            case TestValueType::Float32: { typedef f32 T; stmt; break; }                                               \
+            case TestValueType::Float64: { typedef f64 T; stmt; break; }                                               \
+            default: break;                                                                                            \
+        }
+
+    // Vector operations call the kernel selected for them when they were lowered, if there is one
+    #define VECTOR_KERNEL(generic)                                                                                     \
+        if (i->meta) reinterpret_cast<TestVectorKernel>(i->meta)(reg0, reg1, reg2);                                    \
+        else { generic; }
+
+    #define VECTOR_OP(name)                                                                                            \
+        HANDLER(name##_v) { VECTOR_KERNEL(TYPE_SWITCH(name<T>((void*)reg0, (void*)reg1, i->componentCount))); NEXT; } \
+        HANDLER(name##_s) { VECTOR_KERNEL(TYPE_SWITCH(name<T>((void*)reg0, reg1, i->componentCount))); NEXT; }
+
+    template <bool Threaded, bool Instrumented>
+    void TestExecuter::run() {
+        constexpr u32 callFrameSize = (sizeof(call_frame) + 15) & ~15u;
+
+        // State of the function being executed, which changes when functions are called directly
+        const TestBytecode* bc = m_code;
+        u64* registers = m_registers;
+        void* returnPtr = m_returnPtr;
+
+        if (m_suspendedCode) {
+            // Continue where the budget ran out
+            bc = m_suspendedCode;
+            registers = m_suspendedRegisters;
+            returnPtr = m_suspendedReturnPtr;
+            m_suspendedCode = nullptr;
+        }
+
+        const TestInstruction* code = &bc->code[0];
+        const TestInstruction* ip = code + m_instructionIdx;
+        const TestInstruction* i = nullptr;
+        u8* stack = ((u8*)registers) + bc->stackOffset;
+        u64* params = (u64*)(((u8*)registers) + bc->paramsOffset);
+        void** argPointers = (void**)(((u8*)registers) + bc->argPointersOffset);
+
+        TestFunctionProfile* profile = nullptr;
+        if constexpr (Instrumented) {
+            if (m_profiler) profile = m_profiler->getProfile(bc);
+        }
+
+        #ifdef CODEGEN_TEST_THREADED_DISPATCH
+            // Direct threading: each handler jumps straight to the handler of the next instruction
+            // so that every handler gets its own indirect branch (and branch history)
+            static const void* const handlers[] = {
+                #define X(name) &&op_##name,
+                CODEGEN_TEST_OPS(X)
+                #undef X
+            };
+
+            #define HANDLER(name) case TestOp::name: op_##name:
+            #define NEXT if constexpr (Threaded) { i = ip++; INSTRUMENT; goto *handlers[u16(i->op)]; } else break
+        #else
+            #define HANDLER(name) case TestOp::name:
+            #define NEXT break
+        #endif
+
+        // Checks the budget before each instruction and records it for the profiler, the state
+        // is saved without executing the instruction if the budget has run out
+        #define INSTRUMENT                                                                                             \
+            if constexpr (Instrumented) {                                                                              \
+                if (m_budgeted && m_budget-- == 0 && isBudgetExhausted()) {                                            \
+                    m_suspendedCode = bc;                                                                              \
+                    m_suspendedRegisters = registers;                                                                  \
+                    m_suspendedReturnPtr = returnPtr;                                                                  \
+                    m_instructionIdx = u32(i - code);                                                                  \
+                    return;                                                                                            \
+                }                                                                                                      \
+                                                                                                                       \
+                if (profile) m_profiler->onInstruction(profile, u32(i - code));                                        \
+            }
+
+        #define UPDATE_PROFILE                                                                                         \
+            if constexpr (Instrumented) {                                                                              \
+                if (m_profiler) profile = m_profiler->getProfile(bc);                                                  \
+            }
+
+        #define reg0 registers[i->operands[0]]
+        #define reg1 registers[i->operands[1]]
+        #define reg2 registers[i->operands[2]]
+
+        #define BINARY_OP(name, T, expr)                                                                               \
+            HANDLER(name##_rr) { T a = *((T*)&reg1); T b = *((T*)&reg2); *((T*)&reg0) = (expr); NEXT; }                \
+            HANDLER(name##_ri) { T a = *((T*)&reg1); T b = *((const T*)&i->imm); *((T*)&reg0) = (expr); NEXT; }        \
+            HANDLER(name##_ir) { T a = *((const T*)&i->imm); T b = *((T*)&reg2); *((T*)&reg0) = (expr); NEXT; }
+
+        #define COMPARE_OP(name, T, expr)                                                                              \
+            HANDLER(name##_rr) { T a = *((T*)&reg1); T b = *((T*)&reg2); reg0 = u64(expr); NEXT; }                     \
+            HANDLER(name##_ri) { T a = *((T*)&reg1); T b = *((const T*)&i->imm); reg0 = u64(expr); NEXT; }             \
+            HANDLER(name##_ir) { T a = *((const T*)&i->imm); T b = *((T*)&reg2); reg0 = u64(expr); NEXT; }             \
+            HANDLER(name##_rr_br) { T a = *((T*)&reg1); T b = *((T*)&reg2); if (!(expr)) ip = code + i->operands[0]; NEXT; } \
+            HANDLER(name##_ri_br) { T a = *((T*)&reg1); T b = *((const T*)&i->imm); if (!(expr)) ip = code + i->operands[0]; NEXT; } \
+            HANDLER(name##_ir_br) { T a = *((const T*)&i->imm); T b = *((T*)&reg2); if (!(expr)) ip = code + i->operands[0]; NEXT; }
+
+        #define UNARY_OP(name, src, stmt)                                                                              \
+            HANDLER(name##_r) { u64 v = registers[i->operands[src]]; stmt; NEXT; }                                     \
+            HANDLER(name##_i) { u64 v = i->imm.u; stmt; NEXT; }
+
+        #define CVT_OP(_, from, to)                                                                                    \
+            HANDLER(cvt_##from##_##to) { convert<from, to>(reg0, reg1); NEXT; }
+
+
+        // Returns from run() if the current function was called from the host, otherwise resumes
+        // the caller
+        #define RETURN                                                                                                 \
+            if (!m_callStack) {                                                                                        \
+                m_instructionIdx = u32(ip - code);                                                                     \
+                return;                                                                                                \
+            }                                                                                                          \
+                                                                                                                       \
+            {                                                                                                          \
+                call_frame* caller = m_callStack;                                                                      \
+                m_callStack = caller->prev;                                                                            \
+                bc = caller->code;                                                                                     \
+                code = &bc->code[0];                                                                                   \
+                ip = caller->returnAddress;                                                                            \
+                registers = caller->registers;                                                                         \
+                stack = ((u8*)registers) + bc->stackOffset;                                                            \
+                params = (u64*)(((u8*)registers) + bc->paramsOffset);                                                 \
+                argPointers = (void**)(((u8*)registers) + bc->argPointersOffset);                                      \
+                returnPtr = caller->returnPtr;                                                                         \
+                m_pool->release(caller);                                                                               \
+                UPDATE_PROFILE;                                                                                        \
+            }
+
+        // Saves the caller's state just before a new frame for an interpreted callee, passes the
+        // parameters to it and continues at the start of its code. 'site' must be the call site
+        #define CALL_DIRECT(target, paramCount)                                                                        \
+            {                                                                                                          \
+                const TestBytecode* callee = target;                                                                   \
+                u8* mem = (u8*)m_pool->allocate(callFrameSize + callee->frameSize);                                    \
+                call_frame* caller = (call_frame*)mem;                                                                 \
+                caller->prev = m_callStack;                                                                            \
+                caller->code = bc;                                                                                     \
+                caller->returnAddress = ip;                                                                            \
+                caller->registers = registers;                                                                         \
+                caller->returnPtr = returnPtr;                                                                         \
+                m_callStack = caller;                                                                                  \
+                                                                                                                       \
+                u8* frame = mem + callFrameSize;                                                                       \
+                u64* calleeRegisters = (u64*)frame;                                                                    \
+                callee->clearFrame(frame);                                                                             \
+                                                                                                                       \
+                if (callee->thisRegister != NullRegister) calleeRegisters[callee->thisRegister] = reg2;                \
+                                                                                                                       \
+                u32 argCount = callee->argRegisters.size();                                                            \
+                if (paramCount < argCount) argCount = paramCount;                                                      \
+                for (u32 a = 0;a < argCount;a++) {                                                                     \
+                    calleeRegisters[callee->argRegisters[a]] = params[a] & site->argMasks[a];                          \
+                }                                                                                                      \
+                                                                                                                       \
+                if (site->returnsInRegister) returnPtr = &reg1;                                                        \
+                else returnPtr = reinterpret_cast<void*>(reg1);                                                        \
+                                                                                                                       \
+                bc = callee;                                                                                           \
+                code = &bc->code[0];                                                                                   \
+                ip = code;                                                                                             \
+                registers = calleeRegisters;                                                                           \
+                stack = frame + bc->stackOffset;                                                                       \
+                params = (u64*)(frame + bc->paramsOffset);                                                             \
+                argPointers = (void**)(frame + bc->argPointersOffset);                                                 \
+                UPDATE_PROFILE;                                                                                        \
+                NEXT;                                                                                                  \
+            }
+
+        // Calls a function that isn't interpreted through bind::Function::call. The parameters have
+        // already been written to the argument block, the first slot is reserved for the 'this'
+        // pointer. 'site' must be the call site
+        #define CALL_HOST(fn)                                                                                          \
+            {                                                                                                          \
+                void* retPtr = site->returnsInRegister ? (void*)&reg1 : reinterpret_cast<void*>(reg1);                 \
+                if (site->passesThis) {                                                                                \
+                    argPointers[0] = &reg2;                                                                            \
+                    (fn)->call(retPtr, argPointers);                                                                   \
+                } else (fn)->call(retPtr, argPointers + 1);                                                            \
+            }
+
+        // Replaces the current function's frame with a new one for an interpreted callee, which
+        // returns to the current function's caller. The frame being replaced is always the most
+        // recent allocation from the pool, so the new one usually takes its place. The frame of the
+        // function that the executer was started with is kept, the callee returns to the 'ret' that
+        // follows the tail call instead. 'site' must be the call site
+        #define TAIL_CALL_DIRECT(target, paramCount)                                                                   \
+            {                                                                                                          \
+                const TestBytecode* callee = target;                                                                   \
+                u32 argCount = callee->argRegisters.size();                                                            \
+                if (paramCount < argCount) argCount = paramCount;                                                      \
+                if (m_tailCallParamCapacity < argCount) reserveTailCallParams(argCount);                               \
+                for (u32 a = 0;a < argCount;a++) m_tailCallParams[a] = params[a] & site->argMasks[a];                  \
+                u64 self = reg2;                                                                                       \
+                                                                                                                       \
+                u8* mem = nullptr;                                                                                     \
+                if (m_callStack) {                                                                                     \
+                    call_frame caller = *m_callStack;                                                                  \
+                    m_pool->release(m_callStack);                                                                      \
+                    mem = (u8*)m_pool->allocate(callFrameSize + callee->frameSize);                                    \
+                    *(call_frame*)mem = caller;                                                                        \
+                } else {                                                                                               \
+                    mem = (u8*)m_pool->allocate(callFrameSize + callee->frameSize);                                    \
+                    call_frame* caller = (call_frame*)mem;                                                             \
+                    caller->prev = nullptr;                                                                            \
+                    caller->code = bc;                                                                                 \
+                    caller->returnAddress = ip;                                                                        \
+                    caller->registers = registers;                                                                     \
+                    caller->returnPtr = returnPtr;                                                                     \
+                }                                                                                                      \
+                m_callStack = (call_frame*)mem;                                                                        \
+                                                                                                                       \
+                u8* frame = mem + callFrameSize;                                                                       \
+                u64* calleeRegisters = (u64*)frame;                                                                    \
+                callee->clearFrame(frame);                                                                             \
+                                                                                                                       \
+                if (callee->thisRegister != NullRegister) calleeRegisters[callee->thisRegister] = self;                \
+                for (u32 a = 0;a < argCount;a++) calleeRegisters[callee->argRegisters[a]] = m_tailCallParams[a];       \
+                                                                                                                       \
+                bc = callee;                                                                                           \
+                code = &bc->code[0];                                                                                   \
+                ip = code;                                                                                             \
+                registers = calleeRegisters;                                                                           \
+                stack = frame + bc->stackOffset;                                                                       \
+                params = (u64*)(frame + bc->paramsOffset);                                                             \
+                argPointers = (void**)(frame + bc->argPointersOffset);                                                 \
+                UPDATE_PROFILE;                                                                                        \
+                NEXT;                                                                                                  \
+            }
+
+        // Calls a function that isn't interpreted through bind::Function::call, with the current
+        // function's return value as its return value, then returns. 'site' must be the call site
+        #define TAIL_CALL_HOST(fn)                                                                                     \
+            {                                                                                                          \
+                if (site->passesThis) {                                                                                \
+                    argPointers[0] = &reg2;                                                                            \
+                    (fn)->call(returnPtr, argPointers);                                                                \
+                } else (fn)->call(returnPtr, argPointers + 1);                                                         \
+                RETURN;                                                                                                \
+            }
+
+
+        while (true) {
+            i = ip++;
+            INSTRUMENT;
+
+            #ifdef CODEGEN_TEST_THREADED_DISPATCH
+            if constexpr (Threaded) goto *handlers[u16(i->op)];
+            #endif
+
+            switch (i->op) {
+                HANDLER(noop) NEXT;
+                HANDLER(stack_ptr) {
+                    reg0 = reinterpret_cast<u64>(stack + i->operands[1]);
+                    NEXT;
                 }
-                case OpCode::resolve: {
-                    reg0 = v1;
-                    break;
+                HANDLER(value_ptr) {
+                    reg0 = i->imm.u;
+                    NEXT;
                 }
-                case OpCode::load: {
-                    void* ptr = (reinterpret_cast<u8*>(reg1) + imm2.u);
-                    switch (ti0.size) {
-                        case 1: { reg0 = *(u8*)ptr; break; }
-                        case 2: { reg0 = *(u16*)ptr; break; }
-                        case 4: { reg0 = *(u32*)ptr; break; }
-                        case 8: { reg0 = *(u64*)ptr; break; }
-                    }
-                    break;
+                HANDLER(ret_ptr) {
+                    reg0 = reinterpret_cast<u64>(returnPtr);
+                    NEXT;
                 }
-                case OpCode::store: {
-                    void* ptr = (reinterpret_cast<u8*>(reg1) + imm2.u);
-                    switch (ti0.size) {
-                        case 1: { *(u8*)ptr = u8(v0); break; }
-                        case 2: { *(u16*)ptr = u16(v0); break; }
-                        case 4: { *(u32*)ptr = u32(v0); break; }
-                        case 8: { *(u64*)ptr = u64(v0); break; }
-                    }
-                    break;
+                HANDLER(load8) { reg0 = *(u8*)(reinterpret_cast<u8*>(reg1) + i->operands[2]); NEXT; }
+                HANDLER(load16) { reg0 = *(u16*)(reinterpret_cast<u8*>(reg1) + i->operands[2]); NEXT; }
+                HANDLER(load32) { reg0 = *(u32*)(reinterpret_cast<u8*>(reg1) + i->operands[2]); NEXT; }
+                HANDLER(load64) { reg0 = *(u64*)(reinterpret_cast<u8*>(reg1) + i->operands[2]); NEXT; }
+                HANDLER(load8_x) { reg0 = *(u8*)(reinterpret_cast<u8*>(reg1 + reg2) + i->imm.u); NEXT; }
+                HANDLER(load16_x) { reg0 = *(u16*)(reinterpret_cast<u8*>(reg1 + reg2) + i->imm.u); NEXT; }
+                HANDLER(load32_x) { reg0 = *(u32*)(reinterpret_cast<u8*>(reg1 + reg2) + i->imm.u); NEXT; }
+                HANDLER(load64_x) { reg0 = *(u64*)(reinterpret_cast<u8*>(reg1 + reg2) + i->imm.u); NEXT; }
+                HANDLER(store8_x) { *(u8*)(reinterpret_cast<u8*>(reg1 + reg2) + i->imm.u) = u8(reg0); NEXT; }
+                HANDLER(store16_x) { *(u16*)(reinterpret_cast<u8*>(reg1 + reg2) + i->imm.u) = u16(reg0); NEXT; }
+                HANDLER(store32_x) { *(u32*)(reinterpret_cast<u8*>(reg1 + reg2) + i->imm.u) = u32(reg0); NEXT; }
+                HANDLER(store64_x) { *(u64*)(reinterpret_cast<u8*>(reg1 + reg2) + i->imm.u) = reg0; NEXT; }
+                UNARY_OP(store8, 0, *(u8*)(reinterpret_cast<u8*>(reg1) + i->operands[2]) = u8(v));
+                UNARY_OP(store16, 0, *(u16*)(reinterpret_cast<u8*>(reg1) + i->operands[2]) = u16(v));
+                UNARY_OP(store32, 0, *(u32*)(reinterpret_cast<u8*>(reg1) + i->operands[2]) = u32(v));
+                UNARY_OP(store64, 0, *(u64*)(reinterpret_cast<u8*>(reg1) + i->operands[2]) = v);
+                HANDLER(jump) {
+                    ip = code + i->operands[0];
+                    NEXT;
                 }
-                case OpCode::jump: {
-                    m_instructionIdx = m_labelAddrs[label_id(imm0.u)] - 1;
-                    continue;
+                HANDLER(branch8) {
+                    if (!u8(reg0)) ip = code + i->operands[1];
+                    NEXT;
                 }
-                case OpCode::cvt: {
-                    #pragma warning(push, 0)
-
-                    auto& ai = ti1;
-                    auto& bi = Registry::GetType(imm2)->getInfo();
-                    void* a = &reg0;
-                    u64 b = op1.isImm() ? imm1.u : reg1;
-
-                    if (ai.is_floating_point) {
-                        if (ai.size == sizeof(f32)) {
-                            if (bi.is_floating_point) {
-                                if (bi.size == sizeof(f32)) *((f32*)a) = *((f32*)&b);
-                                else                        *((f32*)a) = *((f64*)&b);
-                            } else if (bi.is_unsigned) {
-                                switch (bi.size) {
-                                    case sizeof(u8 ): { *((f32*)a) = *((u8*)&b); break; }
-                                    case sizeof(u16): { *((f32*)a) = *((u16*)&b); break; }
-                                    case sizeof(u32): { *((f32*)a) = *((u32*)&b); break; }
-                                    case sizeof(u64): { *((f32*)a) = *((u64*)&b); break; }
-                                }
-                            } else {
-                                switch (bi.size) {
-                                    case sizeof(i8 ): { *((f32*)a) = *((i8*)&b); break; }
-                                    case sizeof(i16): { *((f32*)a) = *((i16*)&b); break; }
-                                    case sizeof(i32): { *((f32*)a) = *((i32*)&b); break; }
-                                    case sizeof(i64): { *((f32*)a) = *((i64*)&b); break; }
-                                }
-                            }
-                        } else {
-                            if (bi.is_floating_point) {
-                                if (bi.size == sizeof(f32)) *((f64*)a) = *((f32*)&b);
-                                else *((f64*)a) = *((f64*)&b);
-                            } else if (bi.is_unsigned) {
-                                switch (bi.size) {
-                                    case sizeof(u8 ): { *((f64*)a) = *((u8*)&b); break; }
-                                    case sizeof(u16): { *((f64*)a) = *((u16*)&b); break; }
-                                    case sizeof(u32): { *((f64*)a) = *((u32*)&b); break; }
-                                    case sizeof(u64): { *((f64*)a) = *((u64*)&b); break; }
-                                }
-                            } else {
-                                switch (bi.size) {
-                                    case sizeof(i8 ): { *((f64*)a) = *((i8*)&b); break; }
-                                    case sizeof(i16): { *((f64*)a) = *((i16*)&b); break; }
-                                    case sizeof(i32): { *((f64*)a) = *((i32*)&b); break; }
-                                    case sizeof(i64): { *((f64*)a) = *((i64*)&b); break; }
-                                }
-                            }
-                        }
-                    } else if (ai.is_unsigned) {
-                        switch (ai.size) {
-                            case sizeof(u8): {
-                                if (bi.is_floating_point) {
-                                    if (bi.size == sizeof(f32)) *((u8*)a) = *((f32*)&b);
-                                    else                        *((u8*)a) = *((f64*)&b);
-                                } else if (bi.is_unsigned) {
-                                    switch (bi.size) {
-                                        case sizeof(u8 ): { *((u8*)a) = *((u8*)&b); break; }
-                                        case sizeof(u16): { *((u8*)a) = *((u16*)&b); break; }
-                                        case sizeof(u32): { *((u8*)a) = *((u32*)&b); break; }
-                                        case sizeof(u64): { *((u8*)a) = *((u64*)&b); break; }
-                                    }
-                                } else {
-                                    switch (bi.size) {
-                                        case sizeof(i8 ): { *((u8*)a) = *((i8*)&b); break; }
-                                        case sizeof(i16): { *((u8*)a) = *((i16*)&b); break; }
-                                        case sizeof(i32): { *((u8*)a) = *((i32*)&b); break; }
-                                        case sizeof(i64): { *((u8*)a) = *((i64*)&b); break; }
-                                    }
-                                }
-                                break;
-                            }
-                            case sizeof(u16): {
-                                if (bi.is_floating_point) {
-                                    if (bi.size == sizeof(f32)) *((u16*)a) = *((f32*)&b);
-                                    else                        *((u16*)a) = *((f64*)&b);
-                                } else if (bi.is_unsigned) {
-                                    switch (bi.size) {
-                                        case sizeof(u8 ): { *((u16*)a) = *((u8*)&b); break; }
-                                        case sizeof(u16): { *((u16*)a) = *((u16*)&b); break; }
-                                        case sizeof(u32): { *((u16*)a) = *((u32*)&b); break; }
-                                        case sizeof(u64): { *((u16*)a) = *((u64*)&b); break; }
-                                    }
-                                } else {
-                                    switch (bi.size) {
-                                        case sizeof(i8 ): { *((u16*)a) = *((i8*)&b); break; }
-                                        case sizeof(i16): { *((u16*)a) = *((i16*)&b); break; }
-                                        case sizeof(i32): { *((u16*)a) = *((i32*)&b); break; }
-                                        case sizeof(i64): { *((u16*)a) = *((i64*)&b); break; }
-                                    }
-                                }
-                                break;
-                            }
-                            case sizeof(u32): {
-                                if (bi.is_floating_point) {
-                                    if (bi.size == sizeof(f32)) *((u32*)a) = *((f32*)&b);
-                                    else                        *((u32*)a) = *((f64*)&b);
-                                } else if (bi.is_unsigned) {
-                                    switch (bi.size) {
-                                        case sizeof(u8 ): { *((u32*)a) = *((u8*)&b); break; }
-                                        case sizeof(u16): { *((u32*)a) = *((u16*)&b); break; }
-                                        case sizeof(u32): { *((u32*)a) = *((u32*)&b); break; }
-                                        case sizeof(u64): { *((u32*)a) = *((u64*)&b); break; }
-                                    }
-                                } else {
-                                    switch (bi.size) {
-                                        case sizeof(i8 ): { *((u32*)a) = *((i8*)&b); break; }
-                                        case sizeof(i16): { *((u32*)a) = *((i16*)&b); break; }
-                                        case sizeof(i32): { *((u32*)a) = *((i32*)&b); break; }
-                                        case sizeof(i64): { *((u32*)a) = *((i64*)&b); break; }
-                                    }
-                                }
-                                break;
-                            }
-                            case sizeof(u64): {
-                                if (bi.is_floating_point) {
-                                    if (bi.size == sizeof(f32)) *((u64*)a) = *((f32*)&b);
-                                    else                        *((u64*)a) = *((f64*)&b);
-                                } else if (bi.is_unsigned) {
-                                    switch (bi.size) {
-                                        case sizeof(u8 ): { *((u64*)a) = *((u8*)&b); break; }
-                                        case sizeof(u16): { *((u64*)a) = *((u16*)&b); break; }
-                                        case sizeof(u32): { *((u64*)a) = *((u32*)&b); break; }
-                                        case sizeof(u64): { *((u64*)a) = *((u64*)&b); break; }
-                                    }
-                                } else {
-                                    switch (bi.size) {
-                                        case sizeof(i8 ): { *((u64*)a) = *((i8*)&b); break; }
-                                        case sizeof(i16): { *((u64*)a) = *((i16*)&b); break; }
-                                        case sizeof(i32): { *((u64*)a) = *((i32*)&b); break; }
-                                        case sizeof(i64): { *((u64*)a) = *((i64*)&b); break; }
-                                    }
-                                }
-                                break;
-                            }
-                        }
-                    } else {
-                        switch (ai.size) {
-                            case sizeof(i8): {
-                                if (bi.is_floating_point) {
-                                    if (bi.size == sizeof(f32)) *((i8*)a) = *((f32*)&b);
-                                    else                        *((i8*)a) = *((f64*)&b);
-                                } else if (bi.is_unsigned) {
-                                    switch (bi.size) {
-                                        case sizeof(u8 ): { *((i8*)a) = *((u8*)&b); break; }
-                                        case sizeof(u16): { *((i8*)a) = *((u16*)&b); break; }
-                                        case sizeof(u32): { *((i8*)a) = *((u32*)&b); break; }
-                                        case sizeof(u64): { *((i8*)a) = *((u64*)&b); break; }
-                                    }
-                                } else {
-                                    switch (bi.size) {
-                                        case sizeof(i8 ): { *((i8*)a) = *((i8*)&b); break; }
-                                        case sizeof(i16): { *((i8*)a) = *((i16*)&b); break; }
-                                        case sizeof(i32): { *((i8*)a) = *((i32*)&b); break; }
-                                        case sizeof(i64): { *((i8*)a) = *((i64*)&b); break; }
-                                    }
-                                }
-                                break;
-                            }
-                            case sizeof(i16): {
-                                if (bi.is_floating_point) {
-                                    if (bi.size == sizeof(f32)) *((i16*)a) = *((f32*)&b);
-                                    else                        *((i16*)a) = *((f64*)&b);
-                                } else if (bi.is_unsigned) {
-                                    switch (bi.size) {
-                                        case sizeof(u8 ): { *((i16*)a) = *((u8*)&b); break; }
-                                        case sizeof(u16): { *((i16*)a) = *((u16*)&b); break; }
-                                        case sizeof(u32): { *((i16*)a) = *((u32*)&b); break; }
-                                        case sizeof(u64): { *((i16*)a) = *((u64*)&b); break; }
-                                    }
-                                } else {
-                                    switch (bi.size) {
-                                        case sizeof(i8 ): { *((i16*)a) = *((i8*)&b); break; }
-                                        case sizeof(i16): { *((i16*)a) = *((i16*)&b); break; }
-                                        case sizeof(i32): { *((i16*)a) = *((i32*)&b); break; }
-                                        case sizeof(i64): { *((i16*)a) = *((i64*)&b); break; }
-                                    }
-                                }
-                                break;
-                            }
-                            case sizeof(i32): {
-                                if (bi.is_floating_point) {
-                                    if (bi.size == sizeof(f32)) *((i32*)a) = *((f32*)&b);
-                                    else                        *((i32*)a) = *((f64*)&b);
-                                } else if (bi.is_unsigned) {
-                                    switch (bi.size) {
-                                        case sizeof(u8 ): { *((i32*)a) = *((u8*)&b); break; }
-                                        case sizeof(u16): { *((i32*)a) = *((u16*)&b); break; }
-                                        case sizeof(u32): { *((i32*)a) = *((u32*)&b); break; }
-                                        case sizeof(u64): { *((i32*)a) = *((u64*)&b); break; }
-                                    }
-                                } else {
-                                    switch (bi.size) {
-                                        case sizeof(i8 ): { *((i32*)a) = *((i8*)&b); break; }
-                                        case sizeof(i16): { *((i32*)a) = *((i16*)&b); break; }
-                                        case sizeof(i32): { *((i32*)a) = *((i32*)&b); break; }
-                                        case sizeof(i64): { *((i32*)a) = *((i64*)&b); break; }
-                                    }
-                                }
-                                break;
-                            }
-                            case sizeof(i64): {
-                                if (bi.is_floating_point) {
-                                    if (bi.size == sizeof(f32)) *((i64*)a) = *((f32*)&b);
-                                    else                        *((i64*)a) = *((f64*)&b);
-                                } else if (bi.is_unsigned) {
-                                    switch (bi.size) {
-                                        case sizeof(u8 ): { *((i64*)a) = *((u8*)&b); break; }
-                                        case sizeof(u16): { *((i64*)a) = *((u16*)&b); break; }
-                                        case sizeof(u32): { *((i64*)a) = *((u32*)&b); break; }
-                                        case sizeof(u64): { *((i64*)a) = *((u64*)&b); break; }
-                                    }
-                                } else {
-                                    switch (bi.size) {
-                                        case sizeof(i8 ): { *((i64*)a) = *((i8*)&b); break; }
-                                        case sizeof(i16): { *((i64*)a) = *((i16*)&b); break; }
-                                        case sizeof(i32): { *((i64*)a) = *((i32*)&b); break; }
-                                        case sizeof(i64): { *((i64*)a) = *((i64*)&b); break; }
-                                    }
-                                }
-                                break;
-                            }
-                        }
-                    }
-                    
-                    #pragma warning(pop)
-                    break;
+                HANDLER(branch16) {
+                    if (!u16(reg0)) ip = code + i->operands[1];
+                    NEXT;
                 }
-                case OpCode::param: {
-                    m_nextCallParams.push(v0);
-                    break;
+                HANDLER(branch32) {
+                    if (!u32(reg0)) ip = code + i->operands[1];
+                    NEXT;
                 }
-                case OpCode::call: {
-                    if (op0.isImm()) {
-                        Function* fn = (Function*)op0.getImm().p;
-                        FunctionType* sig = fn->getSignature();
-                        auto args = sig->getArgs();
-                        void* outArgs[32];
-                        void* retPtr = nullptr;
-
-                        u32 argOffset = 0;
-                        if (sig->getThisType()) {
-                            outArgs[0] = &reg2;
-                            argOffset = 1;
-                        }
-
-                        const type_meta& ri = sig->getReturnType()->getInfo();
-                        if (ri.is_primitive || ri.is_pointer) retPtr = &reg1;
-                        else retPtr = reinterpret_cast<void*>(reg1);
-
-                        for (u32 i = 0;i < m_nextCallParams.size();i++) {
-                            if (i >= args.size()) break;
-                            if (!args[i].type->getInfo().is_primitive && !args[i].type->getInfo().is_pointer) {
-                                outArgs[i + argOffset] = reinterpret_cast<void*>(m_nextCallParams[i]);
-                            } else {
-                                outArgs[i + argOffset] = &m_nextCallParams[i];
-                            }
-                        }
-
-                        fn->call(retPtr, outArgs);
-                    } else {
-                        // todo: function values
-                    }
-
-                    m_nextCallParams.clear();
-                    break;
+                HANDLER(branch) {
+                    if (!bool(reg0)) ip = code + i->operands[1];
+                    NEXT;
                 }
-                case OpCode::ret: {
-                    if (!op0.isEmpty()) {
-                        switch (m_func->getSignature()->getReturnType()->getInfo().size) {
-                            case 1: { *(u8*)m_returnPtr = u8(v0); break; }
-                            case 2: { *(u16*)m_returnPtr = u16(v0); break; }
-                            case 4: { *(u32*)m_returnPtr = u32(v0); break; }
-                            case 8: { *(u64*)m_returnPtr = u64(v0); break; }
-                        }
+                CODEGEN_TEST_CVT_OPS(CVT_OP, _)
+                UNARY_OP(param, 0, params[i->operands[1]] = v; argPointers[i->operands[1] + 1] = &params[i->operands[1]]);
+                UNARY_OP(param_ptr, 0, params[i->operands[1]] = v; argPointers[i->operands[1] + 1] = reinterpret_cast<void*>(v));
+                HANDLER(call) {
+                    TestCallSite* site = (TestCallSite*)i->meta;
+                    const TestBytecode* calleeCode = findCallee(site, site->function);
+                    if (calleeCode) {
+                        CALL_DIRECT(calleeCode, i->operands[0]);
                     }
 
-                    return;
+                    CALL_HOST(site->function);
+                    NEXT;
                 }
-                case OpCode::branch: {
-                    if (bool(reg0)) continue;
-                    m_instructionIdx = m_labelAddrs[label_id(imm1.u)] - 1;
-                    break;
-                }
-                case OpCode::_not: { reg0 = !v1; break; }
-                case OpCode::inv: { reg0 = ~v1; break; }
-                case OpCode::shl: { reg0 = v1 << v2; break; }
-                case OpCode::shr: { reg0 = v1 >> v2; break; }
-                case OpCode::land: { reg0 = v1 && v2; break; }
-                case OpCode::band: { reg0 = v1 & v2; break; }
-                case OpCode::lor: { reg0 = v1 || v2; break; }
-                case OpCode::bor: { reg0 = v1 | v2; break; }
-                case OpCode::_xor: { reg0 = v1 ^ v2; break; }
-                case OpCode::assign: { reg0 = v1; break; }
-                case OpCode::vset: {
-                    void* dest = reinterpret_cast<void*>(v0);
-                    DataType* vtp = ((PointerType*)tp0)->getDestinationType();
-                    const type_meta& vi = vtp->getInfo();
-                    u8 compCnt = i.options.vset.componentCount;
-
-                    if (ti1.is_pointer) {
-                        void* src = reinterpret_cast<void*>(v1);
-                        switch (vi.size) {
-                            case 1: { for (u8 c = 0;c < compCnt;c++) ((u8* )dest)[c] = ((u8* )src)[c]; break; }
-                            case 2: { for (u8 c = 0;c < compCnt;c++) ((u16*)dest)[c] = ((u16*)src)[c]; break; }
-                            case 4: { for (u8 c = 0;c < compCnt;c++) ((u32*)dest)[c] = ((u32*)src)[c]; break; }
-                            case 8: { for (u8 c = 0;c < compCnt;c++) ((u64*)dest)[c] = ((u64*)src)[c]; break; }
-                        }
-                    } else {
-                        switch (vi.size) {
-                            case 1: { for (u8 c = 0;c < compCnt;c++) ((u8* )dest)[c] = *((u8 *)&v1); break; }
-                            case 2: { for (u8 c = 0;c < compCnt;c++) ((u16*)dest)[c] = *((u16*)&v1); break; }
-                            case 4: { for (u8 c = 0;c < compCnt;c++) ((u32*)dest)[c] = *((u32*)&v1); break; }
-                            case 8: { for (u8 c = 0;c < compCnt;c++) ((u64*)dest)[c] = *((u64*)&v1); break; }
-                        }
-                    }
+                HANDLER(call_r) {
+                    TestCallSite* site = (TestCallSite*)i->meta;
+                    Function* fn = reinterpret_cast<Function*>(reg0);
+                    if (!fn) throw Exception("TestExecuter - Attempted to call a null function value");
 
-                    break;
-                }
-                case OpCode::vadd: {
-                    void* dest = reinterpret_cast<void*>(v0);
-                    DataType* vtp = ((PointerType*)tp0)->getDestinationType();
-                    const type_meta& vi = vtp->getInfo();
-                    u8 compCnt = i.options.vadd.componentCount;
-
-                    if (ti1.is_pointer) {
-                        void* src = reinterpret_cast<void*>(v1);
-                        if (vi.is_integral) {
-                            if (vi.is_unsigned) {
-                                switch (vi.size) {
-                                    case 1: { vadd<u8 >(dest, src, compCnt); break; }
-                                    case 2: { vadd<u16>(dest, src, compCnt); break; }
-                                    case 4: { vadd<u32>(dest, src, compCnt); break; }
-                                    case 8: { vadd<u64>(dest, src, compCnt); break; }
-                                }
-                            } else {
-                                switch (vi.size) {
-                                    case 1: { vadd<i8 >(dest, src, compCnt); break; }
-                                    case 2: { vadd<i16>(dest, src, compCnt); break; }
-                                    case 4: { vadd<i32>(dest, src, compCnt); break; }
-                                    case 8: { vadd<i64>(dest, src, compCnt); break; }
-                                }
-                            }
-                        } else {
-                            switch (vi.size) {
-                                case 4: { vadd<f32>(dest, src, compCnt); break; }
-                                case 8: { vadd<f64>(dest, src, compCnt); break; }
-                            }
-                        }
-                    } else {
-                        if (vi.is_integral) {
-                            if (vi.is_unsigned) {
-                                switch (vi.size) {
-                                    case 1: { vadd<u8 >(dest, v1, compCnt); break; }
-                                    case 2: { vadd<u16>(dest, v1, compCnt); break; }
-                                    case 4: { vadd<u32>(dest, v1, compCnt); break; }
-                                    case 8: { vadd<u64>(dest, v1, compCnt); break; }
-                                }
-                            } else {
-                                switch (vi.size) {
-                                    case 1: { vadd<i8 >(dest, v1, compCnt); break; }
-                                    case 2: { vadd<i16>(dest, v1, compCnt); break; }
-                                    case 4: { vadd<i32>(dest, v1, compCnt); break; }
-                                    case 8: { vadd<i64>(dest, v1, compCnt); break; }
-                                }
-                            }
-                        } else {
-                            switch (vi.size) {
-                                case 4: { vadd<f32>(dest, v1, compCnt); break; }
-                                case 8: { vadd<f64>(dest, v1, compCnt); break; }
-                            }
-                        }
+                    const TestBytecode* calleeCode = findCallee(site, fn);
+                    if (calleeCode) {
+                        CALL_DIRECT(calleeCode, u32(i->imm.u));
                     }
 
-                    break;
+                    CALL_HOST(fn);
+                    NEXT;
                 }
-                case OpCode::vsub: {
-                    void* dest = reinterpret_cast<void*>(v0);
-                    DataType* vtp = ((PointerType*)tp0)->getDestinationType();
-                    const type_meta& vi = vtp->getInfo();
-                    u8 compCnt = i.options.vsub.componentCount;
-
-                    if (ti1.is_pointer) {
-                        void* src = reinterpret_cast<void*>(v1);
-                        if (vi.is_integral) {
-                            if (vi.is_unsigned) {
-                                switch (vi.size) {
-                                    case 1: { vsub<u8 >(dest, src, compCnt); break; }
-                                    case 2: { vsub<u16>(dest, src, compCnt); break; }
-                                    case 4: { vsub<u32>(dest, src, compCnt); break; }
-                                    case 8: { vsub<u64>(dest, src, compCnt); break; }
-                                }
-                            } else {
-                                switch (vi.size) {
-                                    case 1: { vsub<i8 >(dest, src, compCnt); break; }
-                                    case 2: { vsub<i16>(dest, src, compCnt); break; }
-                                    case 4: { vsub<i32>(dest, src, compCnt); break; }
-                                    case 8: { vsub<i64>(dest, src, compCnt); break; }
-                                }
-                            }
-                        } else {
-                            switch (vi.size) {
-                                case 4: { vsub<f32>(dest, src, compCnt); break; }
-                                case 8: { vsub<f64>(dest, src, compCnt); break; }
-                            }
-                        }
-                    } else {
-                        if (vi.is_integral) {
-                            if (vi.is_unsigned) {
-                                switch (vi.size) {
-                                    case 1: { vsub<u8 >(dest, v1, compCnt); break; }
-                                    case 2: { vsub<u16>(dest, v1, compCnt); break; }
-                                    case 4: { vsub<u32>(dest, v1, compCnt); break; }
-                                    case 8: { vsub<u64>(dest, v1, compCnt); break; }
-                                }
-                            } else {
-                                switch (vi.size) {
-                                    case 1: { vsub<i8 >(dest, v1, compCnt); break; }
-                                    case 2: { vsub<i16>(dest, v1, compCnt); break; }
-                                    case 4: { vsub<i32>(dest, v1, compCnt); break; }
-                                    case 8: { vsub<i64>(dest, v1, compCnt); break; }
-                                }
-                            }
-                        } else {
-                            switch (vi.size) {
-                                case 4: { vsub<f32>(dest, v1, compCnt); break; }
-                                case 8: { vsub<f64>(dest, v1, compCnt); break; }
-                            }
-                        }
+                HANDLER(tail_call) {
+                    TestCallSite* site = (TestCallSite*)i->meta;
+                    const TestBytecode* calleeCode = findCallee(site, site->function);
+                    if (calleeCode) {
+                        TAIL_CALL_DIRECT(calleeCode, i->operands[0]);
                     }
 
-                    break;
+                    TAIL_CALL_HOST(site->function);
+                    NEXT;
                 }
-                case OpCode::vmul: {
-                    void* dest = reinterpret_cast<void*>(v0);
-                    DataType* vtp = ((PointerType*)tp0)->getDestinationType();
-                    const type_meta& vi = vtp->getInfo();
-                    u8 compCnt = i.options.vmul.componentCount;
-
-                    if (ti1.is_pointer) {
-                        void* src = reinterpret_cast<void*>(v1);
-                        if (vi.is_integral) {
-                            if (vi.is_unsigned) {
-                                switch (vi.size) {
-                                    case 1: { vmul<u8 >(dest, src, compCnt); break; }
-                                    case 2: { vmul<u16>(dest, src, compCnt); break; }
-                                    case 4: { vmul<u32>(dest, src, compCnt); break; }
-                                    case 8: { vmul<u64>(dest, src, compCnt); break; }
-                                }
-                            } else {
-                                switch (vi.size) {
-                                    case 1: { vmul<i8 >(dest, src, compCnt); break; }
-                                    case 2: { vmul<i16>(dest, src, compCnt); break; }
-                                    case 4: { vmul<i32>(dest, src, compCnt); break; }
-                                    case 8: { vmul<i64>(dest, src, compCnt); break; }
-                                }
-                            }
-                        } else {
-                            switch (vi.size) {
-                                case 4: { vmul<f32>(dest, src, compCnt); break; }
-                                case 8: { vmul<f64>(dest, src, compCnt); break; }
-                            }
-                        }
-                    } else {
-                        if (vi.is_integral) {
-                            if (vi.is_unsigned) {
-                                switch (vi.size) {
-                                    case 1: { vmul<u8 >(dest, v1, compCnt); break; }
-                                    case 2: { vmul<u16>(dest, v1, compCnt); break; }
-                                    case 4: { vmul<u32>(dest, v1, compCnt); break; }
-                                    case 8: { vmul<u64>(dest, v1, compCnt); break; }
-                                }
-                            } else {
-                                switch (vi.size) {
-                                    case 1: { vmul<i8 >(dest, v1, compCnt); break; }
-                                    case 2: { vmul<i16>(dest, v1, compCnt); break; }
-                                    case 4: { vmul<i32>(dest, v1, compCnt); break; }
-                                    case 8: { vmul<i64>(dest, v1, compCnt); break; }
-                                }
-                            }
-                        } else {
-                            switch (vi.size) {
-                                case 4: { vmul<f32>(dest, v1, compCnt); break; }
-                                case 8: { vmul<f64>(dest, v1, compCnt); break; }
-                            }
-                        }
-                    }
+                HANDLER(tail_call_r) {
+                    TestCallSite* site = (TestCallSite*)i->meta;
+                    Function* fn = reinterpret_cast<Function*>(reg0);
+                    if (!fn) throw Exception("TestExecuter - Attempted to call a null function value");
 
-                    break;
-                }
-                case OpCode::vdiv: {
-                    void* dest = reinterpret_cast<void*>(v0);
-                    DataType* vtp = ((PointerType*)tp0)->getDestinationType();
-                    const type_meta& vi = vtp->getInfo();
-                    u8 compCnt = i.options.vdiv.componentCount;
-
-                    if (ti1.is_pointer) {
-                        void* src = reinterpret_cast<void*>(v1);
-                        if (vi.is_integral) {
-                            if (vi.is_unsigned) {
-                                switch (vi.size) {
-                                    case 1: { vdiv<u8 >(dest, src, compCnt); break; }
-                                    case 2: { vdiv<u16>(dest, src, compCnt); break; }
-                                    case 4: { vdiv<u32>(dest, src, compCnt); break; }
-                                    case 8: { vdiv<u64>(dest, src, compCnt); break; }
-                                }
-                            } else {
-                                switch (vi.size) {
-                                    case 1: { vdiv<i8 >(dest, src, compCnt); break; }
-                                    case 2: { vdiv<i16>(dest, src, compCnt); break; }
-                                    case 4: { vdiv<i32>(dest, src, compCnt); break; }
-                                    case 8: { vdiv<i64>(dest, src, compCnt); break; }
-                                }
-                            }
-                        } else {
-                            switch (vi.size) {
-                                case 4: { vdiv<f32>(dest, src, compCnt); break; }
-                                case 8: { vdiv<f64>(dest, src, compCnt); break; }
-                            }
-                        }
-                    } else {
-                        if (vi.is_integral) {
-                            if (vi.is_unsigned) {
-                                switch (vi.size) {
-                                    case 1: { vdiv<u8 >(dest, v1, compCnt); break; }
-                                    case 2: { vdiv<u16>(dest, v1, compCnt); break; }
-                                    case 4: { vdiv<u32>(dest, v1, compCnt); break; }
-                                    case 8: { vdiv<u64>(dest, v1, compCnt); break; }
-                                }
-                            } else {
-                                switch (vi.size) {
-                                    case 1: { vdiv<i8 >(dest, v1, compCnt); break; }
-                                    case 2: { vdiv<i16>(dest, v1, compCnt); break; }
-                                    case 4: { vdiv<i32>(dest, v1, compCnt); break; }
-                                    case 8: { vdiv<i64>(dest, v1, compCnt); break; }
-                                }
-                            }
-                        } else {
-                            switch (vi.size) {
-                                case 4: { vdiv<f32>(dest, v1, compCnt); break; }
-                                case 8: { vdiv<f64>(dest, v1, compCnt); break; }
-                            }
-                        }
+                    const TestBytecode* calleeCode = findCallee(site, fn);
+                    if (calleeCode) {
+                        TAIL_CALL_DIRECT(calleeCode, u32(i->imm.u));
                     }
 
-                    break;
+                    TAIL_CALL_HOST(fn);
+                    NEXT;
                 }
-                case OpCode::vmod: {
-                    void* dest = reinterpret_cast<void*>(v0);
-                    DataType* vtp = ((PointerType*)tp0)->getDestinationType();
-                    const type_meta& vi = vtp->getInfo();
-                    u8 compCnt = i.options.vmod.componentCount;
-
-                    if (ti1.is_pointer) {
-                        void* src = reinterpret_cast<void*>(v1);
-                        if (vi.is_integral) {
-                            if (vi.is_unsigned) {
-                                switch (vi.size) {
-                                    case 1: { vmod<u8>(dest, src, compCnt); break; }
-                                    case 2: { vmod<u16>(dest, src, compCnt); break; }
-                                    case 4: { vmod<u32>(dest, src, compCnt); break; }
-                                    case 8: { vmod<u64>(dest, src, compCnt); break; }
-                                }
-                            } else {
-                                switch (vi.size) {
-                                    case 1: { vmod<i8>(dest, src, compCnt); break; }
-                                    case 2: { vmod<i16>(dest, src, compCnt); break; }
-                                    case 4: { vmod<i32>(dest, src, compCnt); break; }
-                                    case 8: { vmod<i64>(dest, src, compCnt); break; }
-                                }
-                            }
-                        } else {
-                            switch (vi.size) {
-                                case 4: { vmod<f32>(dest, src, compCnt); break; }
-                                case 8: { vmod<f64>(dest, src, compCnt); break; }
-                            }
-                        }
-                    } else {
-                        if (vi.is_integral) {
-                            if (vi.is_unsigned) {
-                                switch (vi.size) {
-                                    case 1: { vmod<u8>(dest, v1, compCnt); break; }
-                                    case 2: { vmod<u16>(dest, v1, compCnt); break; }
-                                    case 4: { vmod<u32>(dest, v1, compCnt); break; }
-                                    case 8: { vmod<u64>(dest, v1, compCnt); break; }
-                                }
-                            } else {
-                                switch (vi.size) {
-                                    case 1: { vmod<i8>(dest, v1, compCnt); break; }
-                                    case 2: { vmod<i16>(dest, v1, compCnt); break; }
-                                    case 4: { vmod<i32>(dest, v1, compCnt); break; }
-                                    case 8: { vmod<i64>(dest, v1, compCnt); break; }
-                                }
-                            }
-                        } else {
-                            switch (vi.size) {
-                                case 4: { vmod<f32>(dest, v1, compCnt); break; }
-                                case 8: { vmod<f64>(dest, v1, compCnt); break; }
-                            }
-                        }
-                    }
+                HANDLER(ret) { RETURN; NEXT; }
+                UNARY_OP(ret8, 0, *(u8*)returnPtr = u8(v); RETURN);
+                UNARY_OP(ret16, 0, *(u16*)returnPtr = u16(v); RETURN);
+                UNARY_OP(ret32, 0, *(u32*)returnPtr = u32(v); RETURN);
+                UNARY_OP(ret64, 0, *(u64*)returnPtr = v; RETURN);
+                UNARY_OP(mov, 1, reg0 = v);
+                UNARY_OP(_not, 1, reg0 = !v);
+                UNARY_OP(_not8, 1, reg0 = !u8(v));
+                UNARY_OP(_not16, 1, reg0 = !u16(v));
+                UNARY_OP(_not32, 1, reg0 = !u32(v));
+                UNARY_OP(inv, 1, reg0 = ~v);
+                UNARY_OP(ineg, 1, *((i64*)&reg0) = -*((i64*)&v));
+                UNARY_OP(fneg, 1, *((f32*)&reg0) = -*((f32*)&v));
+                UNARY_OP(dneg, 1, *((f64*)&reg0) = -*((f64*)&v));
+                HANDLER(iinc) { (*((i64*)&reg0))++; NEXT; }
+                HANDLER(uinc) { (*((u64*)&reg0))++; NEXT; }
+                HANDLER(finc) { (*((f32*)&reg0))++; NEXT; }
+                HANDLER(dinc) { (*((f64*)&reg0))++; NEXT; }
+                HANDLER(idec) { (*((i64*)&reg0))--; NEXT; }
+                HANDLER(udec) { (*((u64*)&reg0))--; NEXT; }
+                HANDLER(fdec) { (*((f32*)&reg0))--; NEXT; }
+                HANDLER(ddec) { (*((f64*)&reg0))--; NEXT; }
+                VECTOR_OP(vset);
+                VECTOR_OP(vadd);
+                VECTOR_OP(vsub);
+                VECTOR_OP(vmul);
+                VECTOR_OP(vdiv);
+                VECTOR_OP(vmod);
+                HANDLER(vneg) { VECTOR_KERNEL(TYPE_SWITCH(vneg<T>((void*)reg0, i->componentCount))); NEXT; }
+                HANDLER(vdot) { VECTOR_KERNEL(TYPE_SWITCH(setScalar<T>(reg0, vdot<T>((void*)reg1, (void*)reg2, i->componentCount)))); NEXT; }
+                HANDLER(vmag) { VECTOR_KERNEL(TYPE_SWITCH(setScalar<T>(reg0, vmag<T>((void*)reg1, i->componentCount)))); NEXT; }
+                HANDLER(vmagsq) { VECTOR_KERNEL(TYPE_SWITCH(setScalar<T>(reg0, vdot<T>((void*)reg1, (void*)reg1, i->componentCount)))); NEXT; }
+                HANDLER(vnorm) { VECTOR_KERNEL(TYPE_SWITCH(vnorm<T>((void*)reg0, i->componentCount))); NEXT; }
+                HANDLER(vcross) { VECTOR_KERNEL(TYPE_SWITCH(vcross<T>((void*)reg0, (void*)reg1, (void*)reg2))); NEXT; }
+                CODEGEN_TEST_BINARY_SEMANTICS(BINARY_OP)
+                CODEGEN_TEST_NARROW_BINARY_SEMANTICS(BINARY_OP)
+                CODEGEN_TEST_COMPARE_SEMANTICS(COMPARE_OP)
+                CODEGEN_TEST_NARROW_COMPARE_SEMANTICS(COMPARE_OP)
+                default: break;
+            }
+        }
+
+        #undef HANDLER
+        #undef NEXT
+        #undef INSTRUMENT
+        #undef UPDATE_PROFILE
+        #undef reg0
+        #undef reg1
+        #undef reg2
+        #undef BINARY_OP
+        #undef COMPARE_OP
+        #undef UNARY_OP
+        #undef CVT_OP
+        #undef CALL_DIRECT
+        #undef CALL_HOST
+        #undef TAIL_CALL_DIRECT
+        #undef TAIL_CALL_HOST
+        #undef RETURN
+    }
 
+    void TestExecuter::ExecuteOperation(const TestInstruction& inst, u64* registers) {
+        const TestInstruction* i = &inst;
+
+        #define HANDLER(name) case TestOp::name:
+        #define NEXT break
+        #define reg0 registers[i->operands[0]]
+        #define reg1 registers[i->operands[1]]
+        #define reg2 registers[i->operands[2]]
+
+        #define CVT_OP(_, from, to)                                                                                    \
+            HANDLER(cvt_##from##_##to) { convert<from, to>(reg0, reg1); NEXT; }
+
+        switch (i->op) {
+            CODEGEN_TEST_CVT_OPS(CVT_OP, _)
+            VECTOR_OP(vset);
+            VECTOR_OP(vadd);
+            VECTOR_OP(vsub);
+            VECTOR_OP(vmul);
+            VECTOR_OP(vdiv);
+            VECTOR_OP(vmod);
+            HANDLER(vneg) { VECTOR_KERNEL(TYPE_SWITCH(vneg<T>((void*)reg0, i->componentCount))); NEXT; }
+            HANDLER(vdot) { VECTOR_KERNEL(TYPE_SWITCH(setScalar<T>(reg0, vdot<T>((void*)reg1, (void*)reg2, i->componentCount)))); NEXT; }
+            HANDLER(vmag) { VECTOR_KERNEL(TYPE_SWITCH(setScalar<T>(reg0, vmag<T>((void*)reg1, i->componentCount)))); NEXT; }
+            HANDLER(vmagsq) { VECTOR_KERNEL(TYPE_SWITCH(setScalar<T>(reg0, vdot<T>((void*)reg1, (void*)reg1, i->componentCount)))); NEXT; }
+            HANDLER(vnorm) { VECTOR_KERNEL(TYPE_SWITCH(vnorm<T>((void*)reg0, i->componentCount))); NEXT; }
+            HANDLER(vcross) { VECTOR_KERNEL(TYPE_SWITCH(vcross<T>((void*)reg0, (void*)reg1, (void*)reg2))); NEXT; }
+            HANDLER(fmod_rr) { *((f32*)&reg0) = fmodf(*((f32*)&reg1), *((f32*)&reg2)); NEXT; }
+            HANDLER(fmod_ri) { *((f32*)&reg0) = fmodf(*((f32*)&reg1), *((const f32*)&i->imm)); NEXT; }
+            HANDLER(fmod_ir) { *((f32*)&reg0) = fmodf(*((const f32*)&i->imm), *((f32*)&reg2)); NEXT; }
+            HANDLER(dmod_rr) { *((f64*)&reg0) = ::fmod(*((f64*)&reg1), *((f64*)&reg2)); NEXT; }
+            HANDLER(dmod_ri) { *((f64*)&reg0) = ::fmod(*((f64*)&reg1), *((const f64*)&i->imm)); NEXT; }
+            HANDLER(dmod_ir) { *((f64*)&reg0) = ::fmod(*((const f64*)&i->imm), *((f64*)&reg2)); NEXT; }
+            default: {
+                throw Exception(String::Format(
+                    "TestExecuter::ExecuteOperation - '%s' can't be executed on its own",
+                    TestBytecode::OpName(i->op)
+                ));
+            }
+        }
+
+        #undef HANDLER
+        #undef NEXT
+        #undef reg0
+        #undef reg1
+        #undef reg2
+        #undef CVT_OP
+    }
+
+    #undef TYPE_SWITCH
+    #undef VECTOR_KERNEL
+    #undef VECTOR_OP
+
+    void TestExecuter::runBatch(u64* registers, u32 firstLane, u32 laneCount) {
+        const TestInstruction* code = &m_code->code[0];
+        const TestInstruction* ip = code;
+        const TestInstruction* i = nullptr;
+        u32 returnSize = m_func->getSignature()->getReturnType()->getInfo().size;
+        u8* returnValues = m_batchReturnValues ? m_batchReturnValues + firstLane * returnSize : nullptr;
+
+        // Register file is structure-of-arrays, these refer to the value of lane 'l'
+        #define reg0 registers[lane0 + l]
+        #define reg1 registers[lane1 + l]
+        #define reg2 registers[lane2 + l]
+        #define LANES for (u32 l = 0;l < laneCount;l++)
+
+        // Jumps to target if cond is false for every lane, falls through if it's true for every lane and
+        // executes the lanes separately from the current instruction if they disagree
+        #define BRANCH(setup, cond, target)                                                                            \
+            {                                                                                                          \
+                u32 passed = 0;                                                                                        \
+                LANES { setup; if (cond) passed++; }                                                                   \
+                if (passed == 0) ip = code + (target);                                                                 \
+                else if (passed != laneCount) {                                                                        \
+                    runBatchLanes(registers, firstLane, laneCount, u32(i - code));                                     \
+                    return;                                                                                            \
+                }                                                                                                      \
+            }
+
+        #define BINARY_OP(name, T, expr)                                                                               \
+            case TestOp::name##_rr: { LANES { T a = *((T*)&reg1); T b = *((T*)&reg2); *((T*)&reg0) = (expr); } break; }\
+            case TestOp::name##_ri: { LANES { T a = *((T*)&reg1); T b = *((const T*)&i->imm); *((T*)&reg0) = (expr); } break; }\
+            case TestOp::name##_ir: { LANES { T a = *((const T*)&i->imm); T b = *((T*)&reg2); *((T*)&reg0) = (expr); } break; }
+
+        #define COMPARE_OP(name, T, expr)                                                                              \
+            case TestOp::name##_rr: { LANES { T a = *((T*)&reg1); T b = *((T*)&reg2); reg0 = u64(expr); } break; }     \
+            case TestOp::name##_ri: { LANES { T a = *((T*)&reg1); T b = *((const T*)&i->imm); reg0 = u64(expr); } break; }\
+            case TestOp::name##_ir: { LANES { T a = *((const T*)&i->imm); T b = *((T*)&reg2); reg0 = u64(expr); } break; }\
+            case TestOp::name##_rr_br: { BRANCH(T a = *((T*)&reg1); T b = *((T*)&reg2), expr, i->operands[0]); break; }\
+            case TestOp::name##_ri_br: { BRANCH(T a = *((T*)&reg1); T b = *((const T*)&i->imm), expr, i->operands[0]); break; }\
+            case TestOp::name##_ir_br: { BRANCH(T a = *((const T*)&i->imm); T b = *((T*)&reg2), expr, i->operands[0]); break; }
+
+        #define UNARY_OP(name, src, stmt)                                                                              \
+            case TestOp::name##_r: { LANES { u64 v = registers[i->operands[src] * TestBatchWidth + l]; stmt; } break; }\
+            case TestOp::name##_i: { LANES { u64 v = i->imm.u; stmt; } break; }
+
+        #define CVT_OP(_, from, to)                                                                                    \
+            case TestOp::cvt_##from##_##to: { LANES { convert<from, to>(reg0, reg1); } break; }
+
+        #define RETURN_OP(name, T)                                                                                     \
+            case TestOp::name##_r: {                                                                                   \
+                if (returnValues) { LANES { *(T*)(returnValues + l * returnSize) = T(reg0); } }                        \
+                return;                                                                                                \
+            }                                                                                                          \
+            case TestOp::name##_i: {                                                                                   \
+                if (returnValues) { LANES { *(T*)(returnValues + l * returnSize) = T(i->imm.u); } }                    \
+                return;                                                                                                \
+            }
+
+        while (true) {
+            i = ip++;
+
+            // Offsets of the operand registers' lane 0
+            u32 lane0 = i->operands[0] * TestBatchWidth;
+            u32 lane1 = i->operands[1] * TestBatchWidth;
+            u32 lane2 = i->operands[2] * TestBatchWidth;
+
+            switch (i->op) {
+                case TestOp::noop: break;
+                case TestOp::value_ptr: {
+                    LANES { reg0 = i->imm.u; }
                     break;
                 }
-                case OpCode::vneg: {
-                    void* dest = reinterpret_cast<void*>(v0);
-                    DataType* vtp = ((PointerType*)tp0)->getDestinationType();
-                    const type_meta& vi = vtp->getInfo();
-                    u8 compCnt = i.options.vneg.componentCount;
-
-                    if (vi.is_integral) {
-                        switch (vi.size) {
-                            case 1: { for (u8 c = 0;c < compCnt;c++) ((i8 *)dest)[c] = -((i8 *)dest)[c]; break; }
-                            case 2: { for (u8 c = 0;c < compCnt;c++) ((i16*)dest)[c] = -((i16*)dest)[c]; break; }
-                            case 4: { for (u8 c = 0;c < compCnt;c++) ((i32*)dest)[c] = -((i32*)dest)[c]; break; }
-                            case 8: { for (u8 c = 0;c < compCnt;c++) ((i64*)dest)[c] = -((i64*)dest)[c]; break; }
-                        }
-                    } else {
-                        switch (vi.size) {
-                            case 4: { for (u8 c = 0;c < compCnt;c++) ((f32*)dest)[c] = -((f32*)dest)[c]; break; }
-                            case 8: { for (u8 c = 0;c < compCnt;c++) ((f64*)dest)[c] = -((f64*)dest)[c]; break; }
-                        }
-                    }
+                case TestOp::ret_ptr: {
+                    LANES { reg0 = returnValues ? reinterpret_cast<u64>(returnValues + l * returnSize) : 0; }
                     break;
                 }
-                case OpCode::vdot: {
-                    void* a = reinterpret_cast<void*>(v1);
-                    void* b = reinterpret_cast<void*>(v2);
-                    DataType* vtp = ((PointerType*)tp0)->getDestinationType();
-                    const type_meta& vi = vtp->getInfo();
-                    u8 compCnt = i.options.vdot.componentCount;
-
-                    if (vi.is_integral) {
-                        if (vi.is_unsigned) {
-                            switch (vi.size) {
-                                case 1: {
-                                    u8 result = 0;
-                                    for (u8 c = 0;c < compCnt;c++) result += ((u8*)a)[c] * ((u8*)b)[c];
-                                    reg0 = result;
-                                    break;
-                                }
-                                case 2: {
-                                    u16 result = 0;
-                                    for (u8 c = 0;c < compCnt;c++) result += ((u16*)a)[c] * ((u16*)b)[c];
-                                    reg0 = result;
-                                    break;
-                                }
-                                case 4: {
-                                    u32 result = 0;
-                                    for (u8 c = 0;c < compCnt;c++) result += ((u32*)a)[c] * ((u32*)b)[c];
-                                    reg0 = result;
-                                    break;
-                                }
-                                case 8: {
-                                    u64 result = 0;
-                                    for (u8 c = 0;c < compCnt;c++) result += ((u64*)a)[c] * ((u64*)b)[c];
-                                    reg0 = result;
-                                    break;
-                                }
-                            }
-                        } else {
-                            switch (vi.size) {
-                                case 1: {
-                                    i8 result = 0;
-                                    for (u8 c = 0;c < compCnt;c++) result += ((i8*)a)[c] * ((i8*)b)[c];
-                                    *((i8*)&reg0) = result;
-                                    break;
-                                }
-                                case 2: {
-                                    i16 result = 0;
-                                    for (u8 c = 0;c < compCnt;c++) result += ((i16*)a)[c] * ((i16*)b)[c];
-                                    *((i16*)&reg0) = result;
-                                    break;
-                                }
-                                case 4: {
-                                    i32 result = 0;
-                                    for (u8 c = 0;c < compCnt;c++) result += ((i32*)a)[c] * ((i32*)b)[c];
-                                    *((i32*)&reg0) = result;
-                                    break;
-                                }
-                                case 8: {
-                                    i64 result = 0;
-                                    for (u8 c = 0;c < compCnt;c++) result += ((i64*)a)[c] * ((i64*)b)[c];
-                                    *((i64*)&reg0) = result;
-                                    break;
-                                }
-                            }
-                        }
-                    } else {
-                        switch (vi.size) {
-                            case 4: {
-                                f32 result = 0.0f;
-                                for (u8 c = 0;c < compCnt;c++) result += ((f32*)a)[c] * ((f32*)b)[c];
-                                *((f32*)&reg0) = result;
-                                break;
-                            }
-                            case 8: {
-                                f64 result = 0.0;
-                                for (u8 c = 0;c < compCnt;c++) result += ((f64*)a)[c] * ((f64*)b)[c];
-                                *((f64*)&reg0) = result;
-                                break;
-                            }
-                        }
-                    }
-
+                case TestOp::load8: { LANES { reg0 = *(u8*)(reinterpret_cast<u8*>(reg1) + i->operands[2]); } break; }
+                case TestOp::load16: { LANES { reg0 = *(u16*)(reinterpret_cast<u8*>(reg1) + i->operands[2]); } break; }
+                case TestOp::load32: { LANES { reg0 = *(u32*)(reinterpret_cast<u8*>(reg1) + i->operands[2]); } break; }
+                case TestOp::load64: { LANES { reg0 = *(u64*)(reinterpret_cast<u8*>(reg1) + i->operands[2]); } break; }
+                case TestOp::load8_x: { LANES { reg0 = *(u8*)(reinterpret_cast<u8*>(reg1 + reg2) + i->imm.u); } break; }
+                case TestOp::load16_x: { LANES { reg0 = *(u16*)(reinterpret_cast<u8*>(reg1 + reg2) + i->imm.u); } break; }
+                case TestOp::load32_x: { LANES { reg0 = *(u32*)(reinterpret_cast<u8*>(reg1 + reg2) + i->imm.u); } break; }
+                case TestOp::load64_x: { LANES { reg0 = *(u64*)(reinterpret_cast<u8*>(reg1 + reg2) + i->imm.u); } break; }
+                case TestOp::store8_x: { LANES { *(u8*)(reinterpret_cast<u8*>(reg1 + reg2) + i->imm.u) = u8(reg0); } break; }
+                case TestOp::store16_x: { LANES { *(u16*)(reinterpret_cast<u8*>(reg1 + reg2) + i->imm.u) = u16(reg0); } break; }
+                case TestOp::store32_x: { LANES { *(u32*)(reinterpret_cast<u8*>(reg1 + reg2) + i->imm.u) = u32(reg0); } break; }
+                case TestOp::store64_x: { LANES { *(u64*)(reinterpret_cast<u8*>(reg1 + reg2) + i->imm.u) = reg0; } break; }
+                UNARY_OP(store8, 0, *(u8*)(reinterpret_cast<u8*>(reg1) + i->operands[2]) = u8(v));
+                UNARY_OP(store16, 0, *(u16*)(reinterpret_cast<u8*>(reg1) + i->operands[2]) = u16(v));
+                UNARY_OP(store32, 0, *(u32*)(reinterpret_cast<u8*>(reg1) + i->operands[2]) = u32(v));
+                UNARY_OP(store64, 0, *(u64*)(reinterpret_cast<u8*>(reg1) + i->operands[2]) = v);
+                case TestOp::jump: {
+                    ip = code + i->operands[0];
                     break;
                 }
-                case OpCode::vmag: {
-                    void* a = reinterpret_cast<void*>(v1);
-                    DataType* vtp = ((PointerType*)tp0)->getDestinationType();
-                    const type_meta& vi = vtp->getInfo();
-                    u8 compCnt = i.options.vmag.componentCount;
-
-                    if (vi.is_integral) {
-                        if (vi.is_unsigned) {
-                            switch (vi.size) {
-                                case 1: {
-                                    u8 result = 0;
-                                    for (u8 c = 0;c < compCnt;c++) result += ((u8*)a)[c] * ((u8*)a)[c];
-                                    reg0 = (u8)sqrtf((f32)result);
-                                    break;
-                                }
-                                case 2: {
-                                    u16 result = 0;
-                                    for (u8 c = 0;c < compCnt;c++) result += ((u16*)a)[c] * ((u16*)a)[c];
-                                    reg0 = (u16)sqrtf((f32)result);
-                                    break;
-                                }
-                                case 4: {
-                                    u32 result = 0;
-                                    for (u8 c = 0;c < compCnt;c++) result += ((u32*)a)[c] * ((u32*)a)[c];
-                                    reg0 = (u32)sqrtf((f32)result);
-                                    break;
-                                }
-                                case 8: {
-                                    u64 result = 0;
-                                    for (u8 c = 0;c < compCnt;c++) result += ((u64*)a)[c] * ((u64*)a)[c];
-                                    reg0 = (u64)sqrtf((f32)result);
-                                    break;
-                                }
-                            }
-                        } else {
-                            switch (vi.size) {
-                                case 1: {
-                                    i8 result = 0;
-                                    for (u8 c = 0;c < compCnt;c++) result += ((i8*)a)[c] * ((i8*)a)[c];
-                                    *((i8*)&reg0) = (i8)sqrtf((i8)result);
-                                    break;
-                                }
-                                case 2: {
-                                    i16 result = 0;
-                                    for (u8 c = 0;c < compCnt;c++) result += ((i16*)a)[c] * ((i16*)a)[c];
-                                    *((i16*)&reg0) = (i16)sqrtf((i16)result);
-                                    break;
-                                }
-                                case 4: {
-                                    i32 result = 0;
-                                    for (u8 c = 0;c < compCnt;c++) result += ((i32*)a)[c] * ((i32*)a)[c];
-                                    *((i32*)&reg0) = (i32)sqrtf(f32((i32)result));
-                                    break;
-                                }
-                                case 8: {
-                                    i64 result = 0;
-                                    for (u8 c = 0;c < compCnt;c++) result += ((i64*)a)[c] * ((i64*)a)[c];
-                                    *((i64*)&reg0) = (i64)sqrtf(f32((i64)result));
-                                    break;
-                                }
-                            }
-                        }
-                    } else {
-                        switch (vi.size) {
-                            case 4: {
-                                f32 result = 0.0f;
-                                for (u8 c = 0;c < compCnt;c++) result += ((f32*)a)[c] * ((f32*)a)[c];
-                                *((f32*)&reg0) = sqrtf(result);
-                                break;
-                            }
-                            case 8: {
-                                f64 result = 0.0;
-                                for (u8 c = 0;c < compCnt;c++) result += ((f64*)a)[c] * ((f64*)a)[c];
-                                *((f64*)&reg0) = sqrt(result);
-                                break;
-                            }
-                        }
-                    }
-
+                case TestOp::branch8: {
+                    BRANCH(, u8(reg0), i->operands[1]);
                     break;
                 }
-                case OpCode::vmagsq: {
-                    void* a = reinterpret_cast<void*>(v1);
-                    DataType* vtp = ((PointerType*)tp0)->getDestinationType();
-                    const type_meta& vi = vtp->getInfo();
-                    u8 compCnt = i.options.vmagsq.componentCount;
-
-                    if (vi.is_integral) {
-                        if (vi.is_unsigned) {
-                            switch (vi.size) {
-                                case 1: {
-                                    u8 result = 0;
-                                    for (u8 c = 0;c < compCnt;c++) result += ((u8*)a)[c] * ((u8*)a)[c];
-                                    reg0 = result;
-                                    break;
-                                }
-                                case 2: {
-                                    u16 result = 0;
-                                    for (u8 c = 0;c < compCnt;c++) result += ((u16*)a)[c] * ((u16*)a)[c];
-                                    reg0 = result;
-                                    break;
-                                }
-                                case 4: {
-                                    u32 result = 0;
-                                    for (u8 c = 0;c < compCnt;c++) result += ((u32*)a)[c] * ((u32*)a)[c];
-                                    reg0 = result;
-                                    break;
-                                }
-                                case 8: {
-                                    u64 result = 0;
-                                    for (u8 c = 0;c < compCnt;c++) result += ((u64*)a)[c] * ((u64*)a)[c];
-                                    reg0 = result;
-                                    break;
-                                }
-                            }
-                        } else {
-                            switch (vi.size) {
-                                case 1: {
-                                    i8 result = 0;
-                                    for (u8 c = 0;c < compCnt;c++) result += ((i8*)a)[c] * ((i8*)a)[c];
-                                    *((i8*)&reg0) = result;
-                                    break;
-                                }
-                                case 2: {
-                                    i16 result = 0;
-                                    for (u8 c = 0;c < compCnt;c++) result += ((i16*)a)[c] * ((i16*)a)[c];
-                                    *((i16*)&reg0) = result;
-                                    break;
-                                }
-                                case 4: {
-                                    i32 result = 0;
-                                    for (u8 c = 0;c < compCnt;c++) result += ((i32*)a)[c] * ((i32*)a)[c];
-                                    *((i32*)&reg0) = result;
-                                    break;
-                                }
-                                case 8: {
-                                    i64 result = 0;
-                                    for (u8 c = 0;c < compCnt;c++) result += ((i64*)a)[c] * ((i64*)a)[c];
-                                    *((i64*)&reg0) = result;
-                                    break;
-                                }
-                            }
-                        }
-                    } else {
-                        switch (vi.size) {
-                            case 4: {
-                                f32 result = 0.0f;
-                                for (u8 c = 0;c < compCnt;c++) result += ((f32*)a)[c] * ((f32*)a)[c];
-                                *((f32*)&reg0) = result;
-                                break;
-                            }
-                            case 8: {
-                                f64 result = 0.0;
-                                for (u8 c = 0;c < compCnt;c++) result += ((f64*)a)[c] * ((f64*)a)[c];
-                                *((f64*)&reg0) = result;
-                                break;
-                            }
-                        }
-                    }
-
+                case TestOp::branch16: {
+                    BRANCH(, u16(reg0), i->operands[1]);
                     break;
                 }
-                case OpCode::vnorm: {
-                    void* a = reinterpret_cast<void*>(v0);
-                    DataType* vtp = ((PointerType*)tp0)->getDestinationType();
-                    const type_meta& vi = vtp->getInfo();
-                    u8 compCnt = i.options.vnorm.componentCount;
-
-                    if (vi.is_integral) {
-                        if (vi.is_unsigned) {
-                            switch (vi.size) {
-                                case 1: { vnorm<u8>(a, compCnt); break; }
-                                case 2: { vnorm<u16>(a, compCnt); break; }
-                                case 4: { vnorm<u32>(a, compCnt); break; }
-                                case 8: { vnorm<u64>(a, compCnt); break; }
-                            }
-                        } else {
-                            switch (vi.size) {
-                                case 1: { vnorm<i8>(a, compCnt); break; }
-                                case 2: { vnorm<i16>(a, compCnt); break; }
-                                case 4: { vnorm<i32>(a, compCnt); break; }
-                                case 8: { vnorm<i64>(a, compCnt); break; }
-                            }
-                        }
-                    } else {
-                        switch (vi.size) {
-                            case 4: { vnorm<f32>(a, compCnt); break; }
-                            case 8: { vnorm<f64>(a, compCnt); break; }
-                        }
-                    }
-
+                case TestOp::branch32: {
+                    BRANCH(, u32(reg0), i->operands[1]);
                     break;
                 }
-                case OpCode::vcross: {
-                    void* r = reinterpret_cast<void*>(v0);
-                    void* a = reinterpret_cast<void*>(v1);
-                    void* b = reinterpret_cast<void*>(v2);
-                    DataType* vtp = ((PointerType*)tp0)->getDestinationType();
-                    const type_meta& vi = vtp->getInfo();
-                    u8 compCnt = i.options.vcross.componentCount;
-
-                    if (vi.is_integral) {
-                        if (vi.is_unsigned) {
-                            switch (vi.size) {
-                                case 1: { vcross<u8>(r, a, b); break; }
-                                case 2: { vcross<u16>(r, a, b); break; }
-                                case 4: { vcross<u32>(r, a, b); break; }
-                                case 8: { vcross<u64>(r, a, b); break; }
-                            }
-                        } else {
-                            switch (vi.size) {
-                                case 1: { vcross<i8>(r, a, b); break; }
-                                case 2: { vcross<i16>(r, a, b); break; }
-                                case 4: { vcross<i32>(r, a, b); break; }
-                                case 8: { vcross<i64>(r, a, b); break; }
-                            }
-                        }
-                    } else {
-                        switch (vi.size) {
-                            case 4: { vcross<f32>(r, a, b); break; }
-                            case 8: { vcross<f64>(r, a, b); break; }
-                        }
-                    }
-
+                case TestOp::branch: {
+                    BRANCH(, bool(reg0), i->operands[1]);
                     break;
                 }
-                case OpCode::iadd: { *((i64*)&reg0) = *((i64*)&v1) + *((i64*)&v2); break; }
-                case OpCode::uadd: { *((u64*)&reg0) = *((u64*)&v1) + *((u64*)&v2); break; }
-                case OpCode::fadd: { *((f32*)&reg0) = *((f32*)&v1) + *((f32*)&v2); break; }
-                case OpCode::dadd: { *((f64*)&reg0) = *((f64*)&v1) + *((f64*)&v2); break; }
-                case OpCode::isub: { *((i64*)&reg0) = *((i64*)&v1) - *((i64*)&v2); break; }
-                case OpCode::usub: { *((u64*)&reg0) = *((u64*)&v1) - *((u64*)&v2); break; }
-                case OpCode::fsub: { *((f32*)&reg0) = *((f32*)&v1) - *((f32*)&v2); break; }
-                case OpCode::dsub: { *((f64*)&reg0) = *((f64*)&v1) - *((f64*)&v2); break; }
-                case OpCode::imul: { *((i64*)&reg0) = *((i64*)&v1) * *((i64*)&v2); break; }
-                case OpCode::umul: { *((u64*)&reg0) = *((u64*)&v1) * *((u64*)&v2); break; }
-                case OpCode::fmul: { *((f32*)&reg0) = *((f32*)&v1) * *((f32*)&v2); break; }
-                case OpCode::dmul: { *((f64*)&reg0) = *((f64*)&v1) * *((f64*)&v2); break; }
-                case OpCode::idiv: { *((i64*)&reg0) = *((i64*)&v1) / *((i64*)&v2); break; }
-                case OpCode::udiv: { *((u64*)&reg0) = *((u64*)&v1) / *((u64*)&v2); break; }
-                case OpCode::fdiv: { *((f32*)&reg0) = *((f32*)&v1) / *((f32*)&v2); break; }
-                case OpCode::ddiv: { *((f64*)&reg0) = *((f64*)&v1) / *((f64*)&v2); break; }
-                case OpCode::imod: { *((i64*)&reg0) = *((i64*)&v1) % *((i64*)&v2); break; }
-                case OpCode::umod: { *((u64*)&reg0) = *((u64*)&v1) % *((u64*)&v2); break; }
-                case OpCode::fmod: { *((f32*)&reg0) = fmodf(*((f32*)&v1), *((f32*)&v2)); break; }
-                case OpCode::dmod: { *((f64*)&reg0) = fmod (*((f64*)&v1), *((f64*)&v2)); break; }
-                case OpCode::ineg: { *((i64*)&reg0) = -*((i64*)&reg0); break; }
-                case OpCode::fneg: { *((f32*)&reg0) = -*((f32*)&reg0); break; }
-                case OpCode::dneg: { *((f64*)&reg0) = -*((f64*)&reg0); break; }
-                case OpCode::iinc: { (*((i64*)&reg0))++; break; }
-                case OpCode::uinc: { (*((u64*)&reg0))++; break; }
-                case OpCode::finc: { (*((f32*)&reg0))++; break; }
-                case OpCode::dinc: { (*((f64*)&reg0))++; break; }
-                case OpCode::idec: { (*((i64*)&reg0))--; break; }
-                case OpCode::udec: { (*((u64*)&reg0))--; break; }
-                case OpCode::fdec: { (*((f32*)&reg0))--; break; }
-                case OpCode::ddec: { (*((f64*)&reg0))--; break; }
-                case OpCode::ilt: { *((i64*)&reg0) = *((i64*)&v1) < *((i64*)&v2); break; }
-                case OpCode::ult: { *((u64*)&reg0) = *((u64*)&v1) < *((u64*)&v2); break; }
-                case OpCode::flt: { *((f32*)&reg0) = *((f32*)&v1) < *((f32*)&v2); break; }
-                case OpCode::dlt: { *((f64*)&reg0) = *((f64*)&v1) < *((f64*)&v2); break; }
-                case OpCode::ilte: { *((i64*)&reg0) = *((i64*)&v1) <= *((i64*)&v2); break; }
-                case OpCode::ulte: { *((u64*)&reg0) = *((u64*)&v1) <= *((u64*)&v2); break; }
-                case OpCode::flte: { *((f32*)&reg0) = *((f32*)&v1) <= *((f32*)&v2); break; }
-                case OpCode::dlte: { *((f64*)&reg0) = *((f64*)&v1) <= *((f64*)&v2); break; }
-                case OpCode::igt: { *((i64*)&reg0) = *((i64*)&v1) > *((i64*)&v2); break; }
-                case OpCode::ugt: { *((u64*)&reg0) = *((u64*)&v1) > *((u64*)&v2); break; }
-                case OpCode::fgt: { *((f32*)&reg0) = *((f32*)&v1) > *((f32*)&v2); break; }
-                case OpCode::dgt: { *((f64*)&reg0) = *((f64*)&v1) > *((f64*)&v2); break; }
-                case OpCode::igte: { *((i64*)&reg0) = *((i64*)&v1) >= *((i64*)&v2); break; }
-                case OpCode::ugte: { *((u64*)&reg0) = *((u64*)&v1) >= *((u64*)&v2); break; }
-                case OpCode::fgte: { *((f32*)&reg0) = *((f32*)&v1) >= *((f32*)&v2); break; }
-                case OpCode::dgte: { *((f64*)&reg0) = *((f64*)&v1) >= *((f64*)&v2); break; }
-                case OpCode::ieq: { *((i64*)&reg0) = *((i64*)&v1) == *((i64*)&v2); break; }
-                case OpCode::ueq: { *((u64*)&reg0) = *((u64*)&v1) == *((u64*)&v2); break; }
-                case OpCode::feq: { *((f32*)&reg0) = *((f32*)&v1) == *((f32*)&v2); break; }
-                case OpCode::deq: { *((f64*)&reg0) = *((f64*)&v1) == *((f64*)&v2); break; }
-                case OpCode::ineq: { *((i64*)&reg0) = *((i64*)&v1) != *((i64*)&v2); break; }
-                case OpCode::uneq: { *((u64*)&reg0) = *((u64*)&v1) != *((u64*)&v2); break; }
-                case OpCode::fneq: { *((f32*)&reg0) = *((f32*)&v1) != *((f32*)&v2); break; }
-                case OpCode::dneq: { *((f64*)&reg0) = *((f64*)&v1) != *((f64*)&v2); break; }
-                default: break;
+                case TestOp::ret: return;
+                RETURN_OP(ret8, u8);
+                RETURN_OP(ret16, u16);
+                RETURN_OP(ret32, u32);
+                RETURN_OP(ret64, u64);
+                UNARY_OP(mov, 1, reg0 = v);
+                UNARY_OP(_not, 1, reg0 = !v);
+                UNARY_OP(_not8, 1, reg0 = !u8(v));
+                UNARY_OP(_not16, 1, reg0 = !u16(v));
+                UNARY_OP(_not32, 1, reg0 = !u32(v));
+                UNARY_OP(inv, 1, reg0 = ~v);
+                UNARY_OP(ineg, 1, *((i64*)&reg0) = -*((i64*)&v));
+                UNARY_OP(fneg, 1, *((f32*)&reg0) = -*((f32*)&v));
+                UNARY_OP(dneg, 1, *((f64*)&reg0) = -*((f64*)&v));
+                case TestOp::iinc: { LANES { (*((i64*)&reg0))++; } break; }
+                case TestOp::uinc: { LANES { (*((u64*)&reg0))++; } break; }
+                case TestOp::finc: { LANES { (*((f32*)&reg0))++; } break; }
+                case TestOp::dinc: { LANES { (*((f64*)&reg0))++; } break; }
+                case TestOp::idec: { LANES { (*((i64*)&reg0))--; } break; }
+                case TestOp::udec: { LANES { (*((u64*)&reg0))--; } break; }
+                case TestOp::fdec: { LANES { (*((f32*)&reg0))--; } break; }
+                case TestOp::ddec: { LANES { (*((f64*)&reg0))--; } break; }
+                CODEGEN_TEST_BINARY_SEMANTICS(BINARY_OP)
+                CODEGEN_TEST_NARROW_BINARY_SEMANTICS(BINARY_OP)
+                CODEGEN_TEST_COMPARE_SEMANTICS(COMPARE_OP)
+                CODEGEN_TEST_NARROW_COMPARE_SEMANTICS(COMPARE_OP)
+                CODEGEN_TEST_CVT_OPS(CVT_OP, _)
+                default: {
+                    // Stack allocations, calls and vector operations are executed for
+                    // each lane separately
+                    runBatchLanes(registers, firstLane, laneCount, u32(i - code));
+                    return;
+                }
             }
         }
+
+        #undef reg0
+        #undef reg1
+        #undef reg2
+        #undef LANES
+        #undef BRANCH
+        #undef BINARY_OP
+        #undef COMPARE_OP
+        #undef UNARY_OP
+        #undef RETURN_OP
+        #undef CVT_OP
     }
-};
\ No newline at end of file
+
+    #undef CODEGEN_TEST_BINARY_SEMANTICS
+    #undef CODEGEN_TEST_COMPARE_SEMANTICS
+    #undef CODEGEN_TEST_NARROW_SEMANTICS
+    #undef CODEGEN_TEST_NARROW_BINARY_SEMANTICS
+    #undef CODEGEN_TEST_NARROW_COMPARE_SEMANTICS
+};
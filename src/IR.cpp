@@ -109,7 +109,9 @@ namespace codegen {
         { "ineq"          , 3, { OperandType::Register , OperandType::Value    , OperandType::Value     }, 0   , 0, 0, 0, 0 },
         { "uneq"          , 3, { OperandType::Register , OperandType::Value    , OperandType::Value     }, 0   , 0, 0, 0, 0 },
         { "fneq"          , 3, { OperandType::Register , OperandType::Value    , OperandType::Value     }, 0   , 0, 0, 0, 0 },
-        { "dneq"          , 3, { OperandType::Register , OperandType::Value    , OperandType::Value     }, 0   , 0, 0, 0, 0 }
+        { "dneq"          , 3, { OperandType::Register , OperandType::Value    , OperandType::Value     }, 0   , 0, 0, 0, 0 },
+
+        { "tail_call"     , 1, { OperandType::Function , OperandType::Unused   , OperandType::Unused    }, 0xFF, 1, 0, 0, 0 }
     };
 
     String getPropPath(DataType* tp, u32 offset) {
@@ -141,6 +143,12 @@ namespace codegen {
     Instruction::Instruction(OpCode code) : op(code) {
     }
 
+    Instruction::Instruction(const Instruction& rhs) : op(rhs.op), options(rhs.options) {
+        operands[0].reset(rhs.operands[0]);
+        operands[1].reset(rhs.operands[1]);
+        operands[2].reset(rhs.operands[2]);
+    }
+
     const Value* Instruction::assigns() const {
         u8 assignsIdx = opcodeInfo[u32(op)].assignsOperandIndex;
         if (assignsIdx == 0xFF) return nullptr;
@@ -166,6 +174,7 @@ namespace codegen {
         operands[0].reset(rhs.operands[0]);
         operands[1].reset(rhs.operands[1]);
         operands[2].reset(rhs.operands[2]);
+        options = rhs.options;
         return *this;
     }
 
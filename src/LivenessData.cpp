@@ -9,6 +9,10 @@
 #include <utils/Array.hpp>
 
 namespace codegen {
+    bool RegisterLifetime::isConcurrent(const RegisterLifetime& o) const {
+        return begin <= o.end && o.begin <= end;
+    }
+
     LivenessData::LivenessData() {}
     
     LivenessData::LivenessData(CodeHolder* ch) {
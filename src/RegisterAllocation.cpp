@@ -0,0 +1,43 @@
+#include <codegen/RegisterAllocation.h>
+
+#include <utils/Array.hpp>
+
+namespace codegen {
+    void RegisterAllocationStats::add(const RegisterAllocationStats& o) {
+        functionCount += o.functionCount;
+        assignedCount += o.assignedCount;
+        spilledCount += o.spilledCount;
+        spillStoreCount += o.spillStoreCount;
+        reloadCount += o.reloadCount;
+        roundCount += o.roundCount;
+    }
+
+    RegisterAllocation::RegisterAllocation() : stats({ 0, 0, 0, 0, 0, 0 }) {
+    }
+
+    void RegisterAllocation::clear() {
+        assignments.clear();
+        assignmentMap.clear();
+        stats = { 0, 0, 0, 0, 0, 0 };
+    }
+
+    void RegisterAllocation::add(const RegisterAssignment& assignment) {
+        assignmentMap[assignment.reg_id] = assignments.size();
+        assignments.push(assignment);
+    }
+
+    bool RegisterAllocation::isAllocated() const {
+        return stats.functionCount > 0;
+    }
+
+    const RegisterAssignment* RegisterAllocation::get(vreg_id reg) const {
+        auto it = assignmentMap.find(reg);
+        if (it == assignmentMap.end()) return nullptr;
+        return &assignments[it->second];
+    }
+
+    u32 RegisterAllocation::getPhysicalRegister(vreg_id reg) const {
+        const RegisterAssignment* a = get(reg);
+        return a ? a->physical : NoPhysicalRegister;
+    }
+};
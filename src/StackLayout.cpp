@@ -0,0 +1,184 @@
+#include <codegen/StackLayout.h>
+#include <codegen/CodeHolder.h>
+#include <codegen/LabelMap.h>
+#include <codegen/IR.h>
+#include <utils/Array.hpp>
+#include <algorithm>
+
+namespace codegen {
+    bool StackAllocation::isConcurrent(const StackAllocation& o) const {
+        return begin <= o.end && o.begin <= end;
+    }
+
+    u32 getStackAllocAlignment(u32 size) {
+        u32 alignment = 1;
+        while (alignment < size && alignment < 16) alignment <<= 1;
+        return alignment;
+    }
+
+    StackLayout::StackLayout() : m_size(0), m_alignment(1) {}
+
+    StackLayout::StackLayout(CodeHolder* ch) : m_size(0), m_alignment(1) {
+        rebuild(ch);
+    }
+
+    void StackLayout::rebuild(CodeHolder* ch) {
+        allocations.clear();
+        allocMap.clear();
+        m_size = 0;
+        m_alignment = 1;
+
+        for (address c = 0;c < ch->code.size();c++) {
+            const Instruction& i = ch->code[c];
+            if (i.op != OpCode::stack_alloc) continue;
+
+            u32 size = u32(i.operands[0].getImm().u);
+            stack_id id = stack_id(i.operands[1].getImm().u);
+
+            auto it = allocMap.find(id);
+            if (it != allocMap.end()) {
+                // The same ID may be allocated more than once, ie. inside of a loop
+                StackAllocation& a = allocations[it->second];
+                if (size > a.size) {
+                    a.size = size;
+                    a.alignment = getStackAllocAlignment(size);
+                }
+
+                continue;
+            }
+
+            allocMap[id] = allocations.size();
+            allocations.push({ id, size, getStackAllocAlignment(size), c, c, 0 });
+        }
+
+        if (allocations.size() == 0) return;
+
+        computeLifetimes(ch);
+        assignOffsets();
+    }
+
+    const StackAllocation* StackLayout::get(stack_id id) const {
+        auto it = allocMap.find(id);
+        if (it == allocMap.end()) return nullptr;
+        return &allocations[it->second];
+    }
+
+    u32 StackLayout::getSize() const {
+        return m_size;
+    }
+
+    u32 StackLayout::getAlignment() const {
+        return m_alignment;
+    }
+
+    void StackLayout::computeLifetimes(CodeHolder* ch) {
+        const Array<BasicBlock>& blocks = ch->cfg.blocks;
+        u32 allocCount = allocations.size();
+
+        // Which allocations may be live at the start of each block, by block * allocCount + alloc.
+        // An allocation is live after a 'stack_alloc' until a 'stack_free' for it, a 'ret' or a 'tail_call'
+        Array<u8> liveIn;
+        Array<u8> liveOut;
+        for (u32 i = 0;i < blocks.size() * allocCount;i++) {
+            liveIn.push(0);
+            liveOut.push(0);
+        }
+
+        Array<u8> live;
+        for (u32 a = 0;a < allocCount;a++) live.push(0);
+
+        auto step = [this, &live](const Instruction& i) {
+            if (i.op == OpCode::stack_alloc) live[allocMap[stack_id(i.operands[1].getImm().u)]] = 1;
+            else if (i.op == OpCode::stack_free) {
+                auto it = allocMap.find(stack_id(i.operands[0].getImm().u));
+                if (it != allocMap.end()) live[it->second] = 0;
+            } else if (i.op == OpCode::ret || i.op == OpCode::tail_call) {
+                for (u32 a = 0;a < live.size();a++) live[a] = 0;
+            }
+        };
+
+        bool changed = true;
+        while (changed) {
+            changed = false;
+
+            for (u32 b = 0;b < blocks.size();b++) {
+                for (u32 a = 0;a < allocCount;a++) {
+                    u8 in = 0;
+                    for (u32 p = 0;p < blocks[b].from.size() && !in;p++) in = liveOut[blocks[b].from[p] * allocCount + a];
+                    liveIn[b * allocCount + a] = in;
+                    live[a] = in;
+                }
+
+                for (address c = blocks[b].begin;c < blocks[b].end;c++) step(ch->code[c]);
+
+                for (u32 a = 0;a < allocCount;a++) {
+                    if (liveOut[b * allocCount + a] == live[a]) continue;
+                    liveOut[b * allocCount + a] = live[a];
+                    changed = true;
+                }
+            }
+        }
+
+        // Each lifetime covers every instruction that the allocation may be live at or referred to by
+        auto extend = [](StackAllocation& a, address at) {
+            if (at < a.begin) a.begin = at;
+            if (at > a.end) a.end = at;
+        };
+
+        for (u32 b = 0;b < blocks.size();b++) {
+            for (u32 a = 0;a < allocCount;a++) live[a] = liveIn[b * allocCount + a];
+
+            for (address c = blocks[b].begin;c < blocks[b].end;c++) {
+                const Instruction& i = ch->code[c];
+
+                if (i.op == OpCode::stack_ptr || i.op == OpCode::stack_free) {
+                    auto it = allocMap.find(stack_id(i.operands[i.op == OpCode::stack_ptr ? 1 : 0].getImm().u));
+                    if (it != allocMap.end()) extend(allocations[it->second], c);
+                }
+
+                for (u32 a = 0;a < allocCount;a++) {
+                    if (live[a]) extend(allocations[a], c);
+                }
+
+                step(i);
+            }
+        }
+    }
+
+    void StackLayout::assignOffsets() {
+        Array<u32> order;
+        for (u32 a = 0;a < allocations.size();a++) order.push(a);
+
+        std::sort(order.begin(), order.end(), [this](u32 a, u32 b) {
+            const StackAllocation& aa = allocations[a];
+            const StackAllocation& ab = allocations[b];
+            if (aa.begin != ab.begin) return aa.begin < ab.begin;
+            return aa.size > ab.size;
+        });
+
+        // Each allocation takes the lowest offset that doesn't overlap the memory of any allocation
+        // already placed which is live at the same time
+        for (u32 o = 0;o < order.size();o++) {
+            StackAllocation& a = allocations[order[o]];
+            u32 offset = 0;
+
+            bool moved = true;
+            while (moved) {
+                moved = false;
+
+                for (u32 p = 0;p < o;p++) {
+                    const StackAllocation& placed = allocations[order[p]];
+                    if (!a.isConcurrent(placed)) continue;
+                    if (offset >= placed.offset + placed.size || placed.offset >= offset + a.size) continue;
+
+                    offset = (placed.offset + placed.size + a.alignment - 1) & ~(a.alignment - 1);
+                    moved = true;
+                }
+            }
+
+            a.offset = offset;
+            if (offset + a.size > m_size) m_size = offset + a.size;
+            if (a.alignment > m_alignment) m_alignment = a.alignment;
+        }
+    }
+};
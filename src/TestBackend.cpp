@@ -13,7 +13,7 @@ namespace codegen {
     }
 
     bool TestBackend::transform(CodeHolder* processedCode) {
-        processedCode->owner->getFunction()->setCallHandler(new TestExecuterCallHandler(processedCode));
+        installCallHandler(processedCode->owner->getFunction(), new TestExecuterCallHandler(processedCode));
         return true;
     }
 };
\ No newline at end of file
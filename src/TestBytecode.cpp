@@ -0,0 +1,1008 @@
+#include <codegen/TestBytecode.h>
+#include <codegen/TestVectorKernels.h>
+#include <codegen/CodeHolder.h>
+#include <codegen/FunctionBuilder.h>
+#include <codegen/IR.h>
+#include <codegen/LivenessData.h>
+#include <bind/Function.h>
+#include <bind/FunctionType.h>
+#include <bind/PointerType.h>
+#include <bind/DataType.h>
+#include <bind/Registry.h>
+#include <bind/ValuePointer.h>
+#include <utils/Exception.h>
+#include <utils/Array.hpp>
+#include <string.h>
+
+namespace codegen {
+    const char* testOpNames[] = {
+        #define X(name) #name,
+        CODEGEN_TEST_OPS(X)
+        #undef X
+    };
+
+    TestValueType getTestValueType(const type_meta& ti) {
+        if (ti.is_floating_point) {
+            if (ti.size == sizeof(f32)) return TestValueType::Float32;
+            if (ti.size == sizeof(f64)) return TestValueType::Float64;
+            return TestValueType::None;
+        }
+
+        if (!ti.is_integral && !ti.is_pointer) return TestValueType::None;
+
+        if (ti.is_unsigned || ti.is_pointer) {
+            switch (ti.size) {
+                case sizeof(u8): return TestValueType::UInt8;
+                case sizeof(u16): return TestValueType::UInt16;
+                case sizeof(u32): return TestValueType::UInt32;
+                case sizeof(u64): return TestValueType::UInt64;
+            }
+        } else {
+            switch (ti.size) {
+                case sizeof(i8): return TestValueType::Int8;
+                case sizeof(i16): return TestValueType::Int16;
+                case sizeof(i32): return TestValueType::Int32;
+                case sizeof(i64): return TestValueType::Int64;
+            }
+        }
+
+        return TestValueType::None;
+    }
+
+    TestOp getTestConversionOp(TestValueType from, TestValueType to) {
+        constexpr u16 typeCount = u16(TestValueType::Float64);
+        static_assert(u16(TestOp::cvt_f64_f64) - u16(TestOp::cvt_i8_i8) == typeCount * typeCount - 1);
+
+        // The conversion ops are ordered by source type, then destination type, like TestValueType
+        return TestOp(u16(TestOp::cvt_i8_i8) + (u16(from) - 1) * typeCount + (u16(to) - 1));
+    }
+
+    const void* selectVectorKernel(const TestInstruction& inst) {
+        // Kernels are selected for the CPU that the code is lowered on
+        TestSimdLevel level = TestVectorKernels::GetSupportedLevel();
+        return reinterpret_cast<const void*>(TestVectorKernels::Get(inst.op, inst.type, inst.componentCount, level));
+    }
+
+    TestOp getTestBinaryOp(OpCode op) {
+        switch (op) {
+            #define X(_, name) case OpCode::name: return TestOp::name##_rr;
+            CODEGEN_TEST_BINARY_OPS(X, _)
+            CODEGEN_TEST_COMPARE_OPS(X, _)
+            #undef X
+            default: break;
+        }
+
+        return TestOp::noop;
+    }
+
+    /*
+     * Comparisons are declared after everything else, six forms each: three unfused forms
+     * followed by the same three forms fused with a branch
+     */
+    bool isUnfusedTestCompareOp(TestOp op) {
+        if (op < TestOp::ilt_rr || op >= TestOp::OpCount) return false;
+        return (u16(op) - u16(TestOp::ilt_rr)) % 6 < 3;
+    }
+
+    TestOp getTestVectorOp(OpCode op) {
+        switch (op) {
+            #define X(_, name) case OpCode::name: return TestOp::name##_v;
+            CODEGEN_TEST_VECTOR_OPS(X, _)
+            #undef X
+            default: break;
+        }
+
+        return TestOp::noop;
+    }
+
+    /*
+     * Specialized forms of an opcode are always declared consecutively, starting with the
+     * register form
+     */
+    inline TestOp testOpForm(TestOp base, u32 form) {
+        return TestOp(u16(base) + form);
+    }
+
+    /*
+     * Width-specialized opcodes are declared in order of increasing width, each width taking
+     * up 'formCount' consecutive opcodes
+     */
+    TestOp getTestSizedOp(TestOp op8, u32 size, u32 formCount = 1) {
+        switch (size) {
+            case sizeof(u8): return op8;
+            case sizeof(u16): return TestOp(u16(op8) + formCount);
+            case sizeof(u32): return TestOp(u16(op8) + formCount * 2);
+            case sizeof(u64): return TestOp(u16(op8) + formCount * 3);
+        }
+
+        return TestOp::noop;
+    }
+
+    /*
+     * Returns the narrow form of an integer operation for operands of the specified type, or the
+     * operation itself if it doesn't have one or the operands are 64 bits wide
+     */
+    TestOp getTestNarrowOp(TestOp op, const type_meta& ti) {
+        if ((!ti.is_integral && !ti.is_pointer) || ti.size >= sizeof(u64)) return op;
+
+        switch (op) {
+            #define X(_, name) case TestOp::name##_rr: return getTestSizedOp(TestOp::name##8_rr, ti.size, 3);
+            CODEGEN_TEST_NARROW_BINARY_OPS(X, _)
+            #undef X
+            #define X(_, name) case TestOp::name##_rr: return getTestSizedOp(TestOp::name##8_rr, ti.size, 6);
+            CODEGEN_TEST_NARROW_COMPARE_OPS(X, _)
+            #undef X
+            case TestOp::_not_r: return getTestSizedOp(TestOp::_not8_r, ti.size, 2);
+            case TestOp::branch: return getTestSizedOp(TestOp::branch8, ti.size);
+            default: break;
+        }
+
+        return op;
+    }
+
+    /*
+     * Returns a mask of the operands of an instruction which hold register indices, bit N is set
+     * if operand N does
+     */
+    u8 getTestRegisterOperands(TestOp op) {
+        if (op >= TestOp::ilt_rr) {
+            // compare forms: _rr, _ri, _ir, _rr_br, _ri_br, _ir_br
+            static const u8 masks[] = { 0b111, 0b011, 0b101, 0b110, 0b010, 0b100 };
+            return masks[(u16(op) - u16(TestOp::ilt_rr)) % 6];
+        }
+
+        if (op >= TestOp::shl_rr) {
+            // binary forms: _rr, _ri, _ir
+            static const u8 masks[] = { 0b111, 0b011, 0b101 };
+            return masks[(u16(op) - u16(TestOp::shl_rr)) % 3];
+        }
+
+        if (op >= TestOp::cvt_i8_i8 && op <= TestOp::cvt_f64_f64) return 0b011;
+
+        switch (op) {
+            case TestOp::stack_ptr:
+            case TestOp::value_ptr:
+            case TestOp::ret_ptr:
+            case TestOp::branch8: case TestOp::branch16: case TestOp::branch32: case TestOp::branch:
+            case TestOp::iinc: case TestOp::uinc: case TestOp::finc: case TestOp::dinc:
+            case TestOp::idec: case TestOp::udec: case TestOp::fdec: case TestOp::ddec:
+            case TestOp::vneg:
+            case TestOp::vnorm:
+            case TestOp::mov_i: case TestOp::_not_i: case TestOp::inv_i:
+            case TestOp::_not8_i: case TestOp::_not16_i: case TestOp::_not32_i:
+            case TestOp::ineg_i: case TestOp::fneg_i: case TestOp::dneg_i:
+            case TestOp::param_r:
+            case TestOp::param_ptr_r:
+            case TestOp::ret8_r: case TestOp::ret16_r: case TestOp::ret32_r: case TestOp::ret64_r: return 0b001;
+            case TestOp::load8: case TestOp::load16: case TestOp::load32: case TestOp::load64:
+            case TestOp::vmag:
+            case TestOp::vmagsq:
+            case TestOp::mov_r: case TestOp::_not_r: case TestOp::inv_r:
+            case TestOp::_not8_r: case TestOp::_not16_r: case TestOp::_not32_r:
+            case TestOp::ineg_r: case TestOp::fneg_r: case TestOp::dneg_r:
+            case TestOp::store8_r: case TestOp::store16_r: case TestOp::store32_r: case TestOp::store64_r:
+            case TestOp::vset_v: case TestOp::vadd_v: case TestOp::vsub_v: case TestOp::vmul_v: case TestOp::vdiv_v: case TestOp::vmod_v:
+            case TestOp::vset_s: case TestOp::vadd_s: case TestOp::vsub_s: case TestOp::vmul_s: case TestOp::vdiv_s: case TestOp::vmod_s: return 0b011;
+            case TestOp::store8_i: case TestOp::store16_i: case TestOp::store32_i: case TestOp::store64_i: return 0b010;
+            case TestOp::call: case TestOp::tail_call: return 0b110;
+            case TestOp::load8_x: case TestOp::load16_x: case TestOp::load32_x: case TestOp::load64_x:
+            case TestOp::store8_x: case TestOp::store16_x: case TestOp::store32_x: case TestOp::store64_x:
+            case TestOp::call_r: case TestOp::tail_call_r:
+            case TestOp::vdot:
+            case TestOp::vcross: return 0b111;
+            default: break;
+        }
+
+        return 0;
+    }
+
+    TestBytecode::TestBytecode(CodeHolder* ch)
+        : function(ch->owner->getFunction()), registerCount(0), stackSize(0), maxCallParams(0), frameSize(0),
+          paramsOffset(0), argPointersOffset(0), stackOffset(0), thisRegister(NullRegister), takesThis(false), callSites(nullptr), callSiteCount(0)
+    {
+        lower(ch);
+    }
+
+    TestBytecode::~TestBytecode() {
+        for (u32 c = 0;c < callSiteCount;c++) {
+            const Array<TestCallTarget*>& targets = callSites[c].knownTargets;
+            for (u32 t = 0;t < targets.size();t++) delete targets[t];
+        }
+
+        if (callSites) delete [] callSites;
+        callSites = nullptr;
+        callSiteCount = 0;
+    }
+
+    void TestBytecode::clearFrame(u8* frame) const {
+        memset(frame, 0, registerCount * sizeof(u64));
+        if (stackSize > 0) memset(frame + stackOffset, 0, stackSize);
+    }
+
+    void TestBytecode::loadArguments(u64* registers, void** args) const {
+        u32 off = 0;
+        if (takesThis) {
+            if (thisRegister != NullRegister) registers[thisRegister] = reinterpret_cast<u64>(args[0]);
+            off++;
+        }
+
+        for (u32 a = 0;a < argRegisters.size();a++) {
+            u64& reg = registers[argRegisters[a]];
+            if (argSizes[a] > 0) memcpy(&reg, args[a + off], argSizes[a]);
+            else reg = reinterpret_cast<u64>(args[a + off]);
+        }
+    }
+
+    const char* TestBytecode::OpName(TestOp op) {
+        if (op >= TestOp::OpCount) return "invalid";
+        return testOpNames[u32(op)];
+    }
+
+    void TestBytecode::lower(CodeHolder* ch) {
+        FunctionBuilder* fb = ch->owner;
+        FunctionType* sig = function->getSignature();
+        const type_meta& ri = sig->getReturnType()->getInfo();
+
+        if (sig->getThisType()) {
+            thisRegister = fb->getThis().getRegisterId();
+            takesThis = true;
+        }
+
+        auto args = sig->getArgs();
+        for (u32 a = 0;a < args.size();a++) {
+            argRegisters.push(fb->getArg(a).getRegisterId());
+
+            // Primitives and pointers are read from the argument pointers, everything else is referred to by them
+            const type_meta& ai = args[a].type->getInfo();
+            if (!ai.is_primitive && !ai.is_pointer) {
+                argSizes.push(0);
+                continue;
+            }
+
+            if (ai.size == 0 || ai.size > sizeof(u64)) {
+                throw Exception(String::Format(
+                    "TestBytecode::lower - Argument %d of function '%s' has type '%s', which doesn't fit in a register",
+                    a,
+                    function->getFullName().c_str(),
+                    args[a].type->getFullName().c_str()
+                ));
+            }
+
+            argSizes.push(u8(ai.size));
+        }
+
+        vreg_id maxRegister = thisRegister;
+        for (u32 a = 0;a < argRegisters.size();a++) {
+            if (argRegisters[a] > maxRegister) maxRegister = argRegisters[a];
+        }
+
+        // Allocations which are never live at the same time share stack space
+        const StackLayout& sl = ch->stackLayout;
+        for (u32 a = 0;a < sl.allocations.size();a++) {
+            const StackAllocation& alloc = sl.allocations[a];
+            while (stackOffsets.size() <= alloc.id) stackOffsets.push(TestUnresolvedOffset);
+            stackOffsets[alloc.id] = alloc.offset;
+        }
+
+        stackSize = sl.getSize();
+
+        label_id maxLabel = 0;
+        for (u32 c = 0;c < ch->code.size();c++) {
+            const Instruction& i = ch->code[c];
+
+            if (i.op == OpCode::label) {
+                label_id id = label_id(i.operands[0].getImm().u);
+                if (id > maxLabel) maxLabel = id;
+                continue;
+            }
+
+            for (u32 o = 0;o < 3;o++) {
+                if (i.operands[o].isReg() && i.operands[o].getRegisterId() > maxRegister) {
+                    maxRegister = i.operands[o].getRegisterId();
+                }
+            }
+        }
+
+        // One extra register is reserved for materializing immediates which can't be encoded
+        // directly into the instruction that uses them
+        vreg_id scratch = maxRegister + 1;
+        registerCount = maxRegister + 2;
+
+        // Fusing two instructions is only possible when the value passed between them isn't
+        // needed by anything else, so count the reads and writes of each register
+        Array<u32> reads;
+        Array<u32> writes;
+        reads.reserve(registerCount);
+        writes.reserve(registerCount);
+        for (u32 r = 0;r < registerCount;r++) {
+            reads.push(0);
+            writes.push(0);
+        }
+
+        for (u32 c = 0;c < ch->code.size();c++) {
+            const Instruction& i = ch->code[c];
+            u8 assignsIdx = Instruction::Info(i.op).assignsOperandIndex;
+
+            // Increments and decrements read the register they assign, and the register assigned
+            // by a call may hold a pointer to the storage for the return value
+            bool readsAssigned = i.op == OpCode::call || (i.op >= OpCode::iinc && i.op <= OpCode::ddec);
+
+            for (u32 o = 0;o < 3;o++) {
+                if (!i.operands[o].isReg()) continue;
+                vreg_id reg = i.operands[o].getRegisterId();
+
+                if (o == assignsIdx) {
+                    writes[reg]++;
+                    if (readsAssigned) reads[reg]++;
+                } else reads[reg]++;
+            }
+        }
+
+        // Pointers that are produced by adding a constant to another register and are only used
+        // as the address of loads and stores in the same block are folded into the offsets of
+        // those loads and stores, which makes the 'uadd' that produced them unnecessary
+        struct folded_address {
+            vreg_id base;
+            u64 offset;
+        };
+
+        // Indexed by register, registers that aren't folded have a null base
+        Array<folded_address> foldedAddresses;
+        foldedAddresses.reserve(registerCount);
+        for (u32 r = 0;r < registerCount;r++) foldedAddresses.push({ NullRegister, 0 });
+
+        for (u32 c = 0;c < ch->code.size();c++) {
+            const Instruction& i = ch->code[c];
+            if (i.op != OpCode::uadd || !i.operands[0].isReg() || !i.operands[1].isReg() || !i.operands[2].isImm()) continue;
+
+            vreg_id ptr = i.operands[0].getRegisterId();
+            vreg_id base = i.operands[1].getRegisterId();
+            u64 offset = i.operands[2].getImm().u;
+            if (ptr == base || writes[ptr] != 1 || offset > 0xFFFFFFFF) continue;
+
+            u32 foldedUses = 0;
+            bool canFold = true;
+            for (u32 u = c + 1;u < ch->code.size();u++) {
+                const Instruction& use = ch->code[u];
+                if (use.op == OpCode::label) break;
+
+                if (
+                    (use.op == OpCode::load || use.op == OpCode::store) &&
+                    use.operands[1].isReg() && use.operands[1].getRegisterId() == ptr
+                ) {
+                    if (offset + use.operands[2].getImm().u > 0xFFFFFFFF) canFold = false;
+                    foldedUses++;
+                }
+
+                if (use.op == OpCode::jump || use.op == OpCode::branch || use.op == OpCode::ret || use.op == OpCode::tail_call) break;
+
+                // The base must still hold the same value at each use
+                const Value* assigned = use.assigns();
+                if (assigned && assigned->isReg() && assigned->getRegisterId() == base) break;
+            }
+
+            if (canFold && foldedUses == reads[ptr]) foldedAddresses[ptr] = { base, offset };
+        }
+
+        auto foldAddress = [&foldedAddresses](vreg_id& ptr, u32& offset) {
+            const folded_address& fa = foldedAddresses[ptr];
+            if (fa.base == NullRegister) return;
+
+            ptr = fa.base;
+            offset += u32(fa.offset);
+        };
+
+        // Instructions before this index can't be fused with the ones after it because a label
+        // refers to the instruction at this index
+        u32 fusionBarrier = 0;
+
+        // Returns the previous instruction if it's a 'uadd' of two registers which produced the
+        // specified pointer and nothing else needs that pointer
+        auto getIndexedAddress = [this, &fusionBarrier, &reads](vreg_id ptr) -> TestInstruction* {
+            if (code.size() <= fusionBarrier || reads[ptr] != 1) return nullptr;
+
+            TestInstruction& prev = code.last();
+            if (prev.op != TestOp::uadd_rr || prev.operands[0] != ptr) return nullptr;
+
+            return &prev;
+        };
+
+        // Number of parameters passed to the next call so far
+        u32 pendingParams = 0;
+
+        // Indices of the 'param' instructions for the next call
+        Array<u32> params;
+
+        // Indices of the 'call' and 'call_r' instructions, call sites are created once all of them
+        // are known
+        Array<u32> calls;
+
+        // Signature of the callee of each call in 'calls'
+        Array<FunctionType*> callSignatures;
+
+        struct label_ref {
+            u32 instructionIdx;
+            u32 operandIdx;
+            label_id label;
+        };
+
+        // Label IDs are allocated sequentially, so they can index a flat table of instruction indices
+        Array<u32> labelIndices;
+        labelIndices.reserve(maxLabel + 1);
+        for (u32 l = 0;l <= maxLabel;l++) labelIndices.push(TestUnresolvedOffset);
+        Array<label_ref> labelRefs;
+
+        // Index of the IR instruction being lowered
+        u32 sourceIdx = 0;
+
+        auto materialize = [this, scratch, &sourceIdx](const Value& v) {
+            if (v.isReg()) return u32(v.getRegisterId());
+
+            TestInstruction m = {};
+            m.op = TestOp::mov_i;
+            m.operands[0] = scratch;
+            m.imm = v.getImm();
+            code.push(m);
+            sourceIndices.push(sourceIdx);
+
+            return u32(scratch);
+        };
+
+        for (u32 c = 0;c < ch->code.size();c++) {
+            const Instruction& i = ch->code[c];
+            const Value& op0 = i.operands[0];
+            const Value& op1 = i.operands[1];
+            const Value& op2 = i.operands[2];
+            sourceIdx = c;
+
+            TestInstruction out = {};
+            out.op = TestOp::noop;
+
+            if (i.op == OpCode::uadd && op0.isReg() && foldedAddresses[op0.getRegisterId()].base != NullRegister) continue;
+
+            switch (i.op) {
+                case OpCode::noop:
+                case OpCode::stack_alloc:
+                case OpCode::stack_free:
+                case OpCode::this_ptr:
+                case OpCode::argument:
+                case OpCode::reserve: continue;
+                case OpCode::label: {
+                    labelIndices[label_id(op0.getImm().u)] = code.size();
+                    fusionBarrier = code.size();
+                    continue;
+                }
+                case OpCode::stack_ptr: {
+                    stack_id id = stack_id(op1.getImm().u);
+                    if (id >= stackOffsets.size() || stackOffsets[id] == TestUnresolvedOffset) {
+                        throw Exception(String::Format("TestBytecode::lower - Reference to undefined stack allocation %d", id));
+                    }
+
+                    // the offset into the stack space is baked into the instruction
+                    out.op = TestOp::stack_ptr;
+                    out.operands[0] = op0.getRegisterId();
+                    out.operands[1] = stackOffsets[id];
+                    break;
+                }
+                case OpCode::value_ptr: {
+                    ValuePointer* vp = Registry::GetValue(op1.getImm().u);
+                    if (!vp) {
+                        throw Exception(String::Format("TestBytecode::lower - Reference to undefined value %llu", (unsigned long long)op1.getImm().u));
+                    }
+
+                    // the value's address is baked into the instruction
+                    out.op = TestOp::value_ptr;
+                    out.operands[0] = op0.getRegisterId();
+                    out.imm.u = reinterpret_cast<u64>(vp->getAddress());
+                    break;
+                }
+                case OpCode::ret_ptr: {
+                    out.op = TestOp::ret_ptr;
+                    out.operands[0] = op0.getRegisterId();
+                    break;
+                }
+                case OpCode::resolve:
+                case OpCode::assign:
+                case OpCode::_not:
+                case OpCode::inv:
+                case OpCode::ineg:
+                case OpCode::fneg:
+                case OpCode::dneg: {
+                    TestOp base = TestOp::mov_r;
+                    if (i.op == OpCode::_not) base = getTestNarrowOp(TestOp::_not_r, op1.getType()->getInfo());
+                    else if (i.op == OpCode::inv) base = TestOp::inv_r;
+                    else if (i.op == OpCode::ineg) base = TestOp::ineg_r;
+                    else if (i.op == OpCode::fneg) base = TestOp::fneg_r;
+                    else if (i.op == OpCode::dneg) base = TestOp::dneg_r;
+
+                    out.operands[0] = op0.getRegisterId();
+                    if (op1.isReg()) {
+                        out.op = base;
+                        out.operands[1] = op1.getRegisterId();
+                    } else {
+                        out.op = testOpForm(base, 1);
+                        out.imm = op1.getImm();
+                    }
+                    break;
+                }
+                case OpCode::load: {
+                    u32 size = op0.getType()->getInfo().size;
+                    vreg_id ptr = op1.getRegisterId();
+                    u32 offset = u32(op2.getImm().u);
+                    foldAddress(ptr, offset);
+
+                    TestInstruction* add = getIndexedAddress(ptr);
+                    if (add) {
+                        // operands 1 and 2 already hold the pointer and the index
+                        add->op = getTestSizedOp(TestOp::load8_x, size);
+                        add->operands[0] = op0.getRegisterId();
+                        add->imm.u = offset;
+                        continue;
+                    }
+
+                    out.op = getTestSizedOp(TestOp::load8, size);
+                    out.operands[0] = op0.getRegisterId();
+                    out.operands[1] = ptr;
+                    out.operands[2] = offset;
+                    break;
+                }
+                case OpCode::store: {
+                    u32 size = op0.getType()->getInfo().size;
+                    TestOp base = getTestSizedOp(TestOp::store8_r, size, 2);
+                    if (base == TestOp::noop) break;
+
+                    vreg_id ptr = op1.getRegisterId();
+                    u32 offset = u32(op2.getImm().u);
+                    foldAddress(ptr, offset);
+
+                    TestInstruction* add = op0.isReg() ? getIndexedAddress(ptr) : nullptr;
+                    if (add) {
+                        // operands 1 and 2 already hold the pointer and the index
+                        add->op = getTestSizedOp(TestOp::store8_x, size);
+                        add->operands[0] = op0.getRegisterId();
+                        add->imm.u = offset;
+                        continue;
+                    }
+
+                    out.operands[1] = ptr;
+                    out.operands[2] = offset;
+                    if (op0.isReg()) {
+                        out.op = base;
+                        out.operands[0] = op0.getRegisterId();
+                    } else {
+                        out.op = testOpForm(base, 1);
+                        out.imm = op0.getImm();
+                    }
+                    break;
+                }
+                case OpCode::jump: {
+                    out.op = TestOp::jump;
+                    labelRefs.push({ code.size(), 0, label_id(op0.getImm().u) });
+                    break;
+                }
+                case OpCode::cvt: {
+                    DataType* to = Registry::GetType(op2.getImm().u);
+                    TestValueType fromType = getTestValueType(op1.getType()->getInfo());
+                    TestValueType toType = to ? getTestValueType(to->getInfo()) : TestValueType::None;
+                    if (fromType == TestValueType::None || toType == TestValueType::None) {
+                        throw Exception(String::Format(
+                            "TestBytecode::lower - Unsupported conversion from '%s' to '%s'",
+                            op1.getType()->getFullName().c_str(),
+                            to ? to->getFullName().c_str() : "<invalid type>"
+                        ));
+                    }
+
+                    out.operands[1] = materialize(op1);
+                    out.op = getTestConversionOp(fromType, toType);
+                    out.operands[0] = op0.getRegisterId();
+                    break;
+                }
+                case OpCode::param: {
+                    // parameters are written straight to their slot in the frame's argument block,
+                    // whether they're passed by pointer is decided once the call is reached
+                    params.push(code.size());
+                    out.operands[1] = pendingParams++;
+                    if (pendingParams > maxCallParams) maxCallParams = pendingParams;
+
+                    if (op0.isReg()) {
+                        out.op = TestOp::param_r;
+                        out.operands[0] = op0.getRegisterId();
+                    } else {
+                        out.op = TestOp::param_i;
+                        out.imm = op0.getImm();
+                    }
+                    break;
+                }
+                case OpCode::call:
+                case OpCode::tail_call: {
+                    bool isTail = i.op == OpCode::tail_call;
+                    out.operands[1] = op1.isReg() ? op1.getRegisterId() : NullRegister;
+                    out.operands[2] = op2.isReg() ? op2.getRegisterId() : NullRegister;
+
+                    FunctionType* csig = nullptr;
+                    if (op0.isImm()) {
+                        out.op = isTail ? TestOp::tail_call : TestOp::call;
+                        out.operands[0] = pendingParams;
+                        out.imm = op0.getImm();
+                        csig = ((Function*)out.imm.p)->getSignature();
+                    } else {
+                        // Calls through a function value only know the signature of the callee
+                        out.op = isTail ? TestOp::tail_call_r : TestOp::call_r;
+                        out.operands[0] = op0.getRegisterId();
+                        out.imm.u = pendingParams;
+                        csig = (FunctionType*)op0.getType();
+                    }
+
+                    calls.push(code.size());
+                    callSignatures.push(csig);
+
+                    // Non-primitive arguments are passed as the pointer held by the parameter
+                    auto cargs = csig->getArgs();
+                    for (u32 p = 0;p < params.size() && p < cargs.size();p++) {
+                        const type_meta& ai = cargs[p].type->getInfo();
+                        if (ai.is_primitive || ai.is_pointer) continue;
+
+                        TestInstruction& param = code[params[p]];
+                        param.op = param.op == TestOp::param_r ? TestOp::param_ptr_r : TestOp::param_ptr_i;
+                    }
+
+                    pendingParams = 0;
+                    params.clear();
+
+                    if (isTail) {
+                        // Tail calls made by the function that an executer was started with can't
+                        // reuse its frame, the callee returns to this instead
+                        code.push(out);
+                        sourceIndices.push(c);
+                        out = {};
+                        out.op = TestOp::ret;
+                    }
+                    break;
+                }
+                case OpCode::ret: {
+                    out.op = TestOp::ret;
+                    if (op0.isEmpty()) break;
+
+                    TestOp base = getTestSizedOp(TestOp::ret8_r, ri.size, 2);
+                    if (base == TestOp::noop) break;
+
+                    if (op0.isReg()) {
+                        out.op = base;
+                        out.operands[0] = op0.getRegisterId();
+                    } else {
+                        out.op = testOpForm(base, 1);
+                        out.imm = op0.getImm();
+                    }
+                    break;
+                }
+                case OpCode::branch: {
+                    vreg_id cond = op0.getRegisterId();
+                    if (code.size() > fusionBarrier && reads[cond] == 1) {
+                        TestInstruction& prev = code.last();
+                        if (isUnfusedTestCompareOp(prev.op) && prev.operands[0] == cond) {
+                            prev.op = testOpForm(prev.op, 3);
+                            labelRefs.push({ code.size() - 1, 0, label_id(op1.getImm().u) });
+                            continue;
+                        }
+                    }
+
+                    out.op = getTestNarrowOp(TestOp::branch, op0.getType()->getInfo());
+                    out.operands[0] = op0.getRegisterId();
+                    labelRefs.push({ code.size(), 1, label_id(op1.getImm().u) });
+                    break;
+                }
+                case OpCode::iinc: { out.op = TestOp::iinc; out.operands[0] = op0.getRegisterId(); break; }
+                case OpCode::uinc: { out.op = TestOp::uinc; out.operands[0] = op0.getRegisterId(); break; }
+                case OpCode::finc: { out.op = TestOp::finc; out.operands[0] = op0.getRegisterId(); break; }
+                case OpCode::dinc: { out.op = TestOp::dinc; out.operands[0] = op0.getRegisterId(); break; }
+                case OpCode::idec: { out.op = TestOp::idec; out.operands[0] = op0.getRegisterId(); break; }
+                case OpCode::udec: { out.op = TestOp::udec; out.operands[0] = op0.getRegisterId(); break; }
+                case OpCode::fdec: { out.op = TestOp::fdec; out.operands[0] = op0.getRegisterId(); break; }
+                case OpCode::ddec: { out.op = TestOp::ddec; out.operands[0] = op0.getRegisterId(); break; }
+                case OpCode::vset:
+                case OpCode::vadd:
+                case OpCode::vsub:
+                case OpCode::vmul:
+                case OpCode::vdiv:
+                case OpCode::vmod: {
+                    DataType* vtp = ((PointerType*)op0.getType())->getDestinationType();
+                    out.operands[1] = materialize(op1);
+                    out.op = getTestVectorOp(i.op);
+                    if (!op1.getType()->getInfo().is_pointer) out.op = testOpForm(out.op, 1);
+                    out.type = getTestValueType(vtp->getInfo());
+                    out.componentCount = i.options.vset.componentCount;
+                    out.operands[0] = op0.getRegisterId();
+                    out.meta = selectVectorKernel(out);
+                    break;
+                }
+                case OpCode::vneg:
+                case OpCode::vnorm: {
+                    DataType* vtp = ((PointerType*)op0.getType())->getDestinationType();
+                    out.op = i.op == OpCode::vneg ? TestOp::vneg : TestOp::vnorm;
+                    out.type = getTestValueType(vtp->getInfo());
+                    out.componentCount = i.options.vneg.componentCount;
+                    out.operands[0] = op0.getRegisterId();
+                    out.meta = selectVectorKernel(out);
+                    break;
+                }
+                case OpCode::vdot:
+                case OpCode::vmag:
+                case OpCode::vmagsq: {
+                    // result has the vector's element type
+                    if (i.op == OpCode::vdot) out.op = TestOp::vdot;
+                    else if (i.op == OpCode::vmag) out.op = TestOp::vmag;
+                    else out.op = TestOp::vmagsq;
+
+                    out.type = getTestValueType(op0.getType()->getInfo());
+                    out.componentCount = i.options.vdot.componentCount;
+                    out.operands[0] = op0.getRegisterId();
+                    out.operands[1] = op1.getRegisterId();
+                    if (i.op == OpCode::vdot) out.operands[2] = op2.getRegisterId();
+                    out.meta = selectVectorKernel(out);
+                    break;
+                }
+                case OpCode::vcross: {
+                    DataType* vtp = ((PointerType*)op0.getType())->getDestinationType();
+                    out.op = TestOp::vcross;
+                    out.type = getTestValueType(vtp->getInfo());
+                    out.componentCount = i.options.vcross.componentCount;
+                    out.operands[0] = op0.getRegisterId();
+                    out.operands[1] = op1.getRegisterId();
+                    out.operands[2] = op2.getRegisterId();
+                    out.meta = selectVectorKernel(out);
+                    break;
+                }
+                default: {
+                    TestOp base = getTestBinaryOp(i.op);
+                    if (base == TestOp::noop) break;
+                    base = getTestNarrowOp(base, op1.getType()->getInfo());
+
+                    out.operands[0] = op0.getRegisterId();
+                    if (op1.isReg() && op2.isReg()) {
+                        out.op = base;
+                        out.operands[1] = op1.getRegisterId();
+                        out.operands[2] = op2.getRegisterId();
+                    } else if (op2.isReg()) {
+                        out.op = testOpForm(base, 2);
+                        out.operands[2] = op2.getRegisterId();
+                        out.imm = op1.getImm();
+                    } else {
+                        out.op = testOpForm(base, 1);
+                        out.operands[1] = materialize(op1);
+                        out.imm = op2.getImm();
+                    }
+                    break;
+                }
+            }
+
+            code.push(out);
+            sourceIndices.push(c);
+        }
+
+        // Falling off the end of the function returns without a value
+        TestInstruction end = {};
+        end.op = TestOp::ret;
+        code.push(end);
+        sourceIndices.push(TestUnresolvedOffset);
+
+        // Map the lowered code to the basic blocks it came from, so that execution can be profiled
+        // per block
+        for (u32 b = 0;b < ch->cfg.blocks.size();b++) {
+            const BasicBlock& blk = ch->cfg.blocks[b];
+            blocks.push({ blk.begin, blk.end, TestUnresolvedOffset });
+        }
+
+        blockIndices.reserve(code.size());
+        for (u32 c = 0, b = 0;c < code.size();c++) {
+            u32 src = sourceIndices[c];
+            while (b < blocks.size() && blocks[b].end <= src) b++;
+
+            if (b == blocks.size() || src < blocks[b].begin) {
+                blockIndices.push(TestUnresolvedOffset);
+                continue;
+            }
+
+            blockIndices.push(b);
+            if (blocks[b].firstInstruction == TestUnresolvedOffset) blocks[b].firstInstruction = c;
+        }
+
+        sourceMap = *fb->getSourceMap();
+
+        if (calls.size() > 0) {
+            callSiteCount = calls.size();
+            callSites = new TestCallSite[callSiteCount];
+
+            for (u32 c = 0;c < calls.size();c++) {
+                TestInstruction& call = code[calls[c]];
+                TestCallSite& site = callSites[c];
+                site.function = call.op == TestOp::call || call.op == TestOp::tail_call ? (Function*)call.imm.p : nullptr;
+                site.cachedTarget.store(nullptr, std::memory_order_relaxed);
+
+                FunctionType* csig = callSignatures[c];
+                const type_meta& cri = csig->getReturnType()->getInfo();
+                site.returnsInRegister = cri.is_primitive || cri.is_pointer;
+                site.passesThis = csig->getThisType() != nullptr;
+
+                // Arguments are zero extended, the same as when they're passed through bind::Function::call
+                auto cargs = csig->getArgs();
+                for (u32 a = 0;a < cargs.size();a++) {
+                    const type_meta& ai = cargs[a].type->getInfo();
+                    if ((ai.is_primitive || ai.is_pointer) && ai.size < sizeof(u64)) {
+                        site.argMasks.push((u64(1) << (ai.size * 8)) - 1);
+                    } else site.argMasks.push(~u64(0));
+                }
+
+                // Calls to this function can be resolved immediately
+                if (site.function && site.function == function) {
+                    TestCallTarget* self = new TestCallTarget();
+                    self->function = function;
+                    self->kind.store(TestCallKind::Direct, std::memory_order_relaxed);
+                    self->code.store(this, std::memory_order_relaxed);
+                    site.knownTargets.push(self);
+                    site.cachedTarget.store(self, std::memory_order_relaxed);
+                }
+
+                call.meta = &site;
+            }
+        }
+
+        Array<vreg_id> foldedBases;
+        foldedBases.reserve(foldedAddresses.size());
+        for (u32 r = 0;r < foldedAddresses.size();r++) foldedBases.push(foldedAddresses[r].base);
+        compactRegisters(ch, foldedBases, scratch);
+
+        // Frames are allocated with 16 byte alignment, the stack space is kept aligned the same way
+        paramsOffset = registerCount * sizeof(u64);
+        argPointersOffset = paramsOffset + maxCallParams * sizeof(u64);
+        stackOffset = (argPointersOffset + (maxCallParams + 1) * sizeof(void*) + 15) & ~15u;
+        frameSize = (stackOffset + stackSize + 15) & ~15u;
+
+        for (u32 r = 0;r < labelRefs.size();r++) {
+            const label_ref& ref = labelRefs[r];
+            if (ref.label >= labelIndices.size() || labelIndices[ref.label] == TestUnresolvedOffset) {
+                throw Exception(String::Format("TestBytecode::lower - Reference to undefined label %d", ref.label));
+            }
+
+            code[ref.instructionIdx].operands[ref.operandIdx] = labelIndices[ref.label];
+        }
+    }
+
+    void TestBytecode::compactRegisters(CodeHolder* ch, const Array<vreg_id>& foldedBases, vreg_id scratch) {
+        // Inclusive range of IR instructions over which each vreg holds a value. A vreg keeps the
+        // same slot for all of its live ranges, so this covers all of them along with every
+        // instruction that mentions the vreg
+        struct live_interval {
+            u32 begin;
+            u32 end;
+        };
+
+        Array<live_interval> intervals;
+        intervals.reserve(scratch);
+        for (u32 r = 0;r < scratch;r++) intervals.push({ TestUnresolvedOffset, 0 });
+
+        auto extend = [&intervals](vreg_id reg, u32 at) {
+            live_interval& iv = intervals[reg];
+            if (iv.begin == TestUnresolvedOffset) {
+                iv.begin = iv.end = at;
+                return;
+            }
+
+            if (at < iv.begin) iv.begin = at;
+            if (at > iv.end) iv.end = at;
+        };
+
+        // Arguments hold their values from the start of the function
+        if (thisRegister != NullRegister) extend(thisRegister, 0);
+        for (u32 a = 0;a < argRegisters.size();a++) extend(argRegisters[a], 0);
+
+        for (u32 l = 0;l < ch->liveness.lifetimes.size();l++) {
+            const RegisterLifetime& lt = ch->liveness.lifetimes[l];
+            if (lt.reg_id == NullRegister || lt.reg_id >= scratch) continue;
+
+            extend(lt.reg_id, lt.begin);
+            extend(lt.reg_id, lt.end);
+        }
+
+        for (u32 c = 0;c < ch->code.size();c++) {
+            const Instruction& i = ch->code[c];
+            for (u32 o = 0;o < 3;o++) {
+                if (i.operands[o].isReg()) extend(i.operands[o].getRegisterId(), c);
+            }
+        }
+
+        // Loads and stores through a folded address read its base register instead
+        for (u32 r = 0;r < foldedBases.size() && r < scratch;r++) {
+            if (foldedBases[r] == NullRegister || intervals[r].begin == TestUnresolvedOffset) continue;
+            extend(foldedBases[r], intervals[r].end);
+        }
+
+        // A vreg that's live when a loop jumps back to its start, or which is assigned inside a
+        // loop and used after it, must hold its value for the whole loop
+        struct loop_range {
+            u32 begin;
+            u32 end;
+        };
+
+        Array<loop_range> loops;
+        for (u32 c = 0;c < ch->code.size();c++) {
+            const Instruction& i = ch->code[c];
+
+            u32 target = TestUnresolvedOffset;
+            if (i.op == OpCode::jump) target = ch->labels.get(i.operands[0].getImm());
+            else if (i.op == OpCode::branch) target = ch->labels.get(i.operands[1].getImm());
+
+            if (target <= c) loops.push({ target, c });
+        }
+
+        bool changed = loops.size() > 0;
+        while (changed) {
+            changed = false;
+
+            for (u32 r = 0;r < intervals.size();r++) {
+                live_interval& iv = intervals[r];
+                if (iv.begin == TestUnresolvedOffset) continue;
+
+                for (u32 l = 0;l < loops.size();l++) {
+                    const loop_range& loop = loops[l];
+
+                    if (iv.begin < loop.begin && iv.end >= loop.begin && iv.end < loop.end) {
+                        iv.end = loop.end;
+                        changed = true;
+                    }
+
+                    if (iv.begin > loop.begin && iv.begin <= loop.end && iv.end > loop.end) {
+                        iv.begin = loop.begin;
+                        changed = true;
+                    }
+                }
+            }
+        }
+
+        // Each vreg takes the lowest slot which isn't held by a vreg whose interval overlaps its
+        // own. Slot 0 is left for NullRegister, which instructions write values they discard to
+        Array<vreg_id> order;
+        for (u32 r = 0;r < intervals.size();r++) {
+            if (r != NullRegister && intervals[r].begin != TestUnresolvedOffset) order.push(r);
+        }
+
+        order.sort([&intervals](vreg_id a, vreg_id b) {
+            return intervals[a].begin < intervals[b].begin;
+        });
+
+        registerMap.clear();
+        registerMap.reserve(scratch + 1);
+        for (u32 r = 0;r <= scratch;r++) registerMap.push(TestUnresolvedOffset);
+        registerMap[NullRegister] = NullRegister;
+
+        // End of the interval of the vreg which most recently took each slot, by slot - 1
+        Array<u32> slotEnds;
+        for (u32 o = 0;o < order.size();o++) {
+            const live_interval& iv = intervals[order[o]];
+
+            u32 slot = 0;
+            while (slot < slotEnds.size() && slotEnds[slot] >= iv.begin) slot++;
+
+            if (slot == slotEnds.size()) slotEnds.push(iv.end);
+            else slotEnds[slot] = iv.end;
+
+            registerMap[order[o]] = slot + 1;
+        }
+
+        // The scratch register is used outside of any interval, so it gets a slot of its own
+        registerMap[scratch] = slotEnds.size() + 1;
+        registerCount = slotEnds.size() + 2;
+
+        for (u32 c = 0;c < code.size();c++) {
+            TestInstruction& inst = code[c];
+            u8 mask = getTestRegisterOperands(inst.op);
+
+            for (u32 o = 0;o < 3;o++) {
+                if ((mask & (1 << o)) == 0 || inst.operands[o] == NullRegister) continue;
+                inst.operands[o] = registerMap[inst.operands[o]];
+            }
+        }
+
+        if (thisRegister != NullRegister) thisRegister = registerMap[thisRegister];
+        for (u32 a = 0;a < argRegisters.size();a++) argRegisters[a] = registerMap[argRegisters[a]];
+    }
+};
@@ -0,0 +1,162 @@
+#include <codegen/TestProfiler.h>
+#include <bind/Function.h>
+#include <utils/Array.hpp>
+
+namespace codegen {
+    TestFunctionProfile::TestFunctionProfile(const TestBytecode* _code) : code(_code), totalCount(0) {
+        instructionCounts.reserve(code->code.size());
+        for (u32 i = 0;i < code->code.size();i++) instructionCounts.push(0);
+
+        blockTimes.reserve(code->blocks.size());
+        for (u32 b = 0;b < code->blocks.size();b++) blockTimes.push(0);
+    }
+
+    u64 TestFunctionProfile::getBlockCount(u32 blockIdx) const {
+        u32 first = code->blocks[blockIdx].firstInstruction;
+        if (first == TestUnresolvedOffset) return 0;
+
+        return instructionCounts[first];
+    }
+
+    u64 TestFunctionProfile::getBlockInstructionCount(u32 blockIdx) const {
+        u64 count = 0;
+        for (u32 i = code->blocks[blockIdx].firstInstruction;i < code->code.size();i++) {
+            if (code->blockIndices[i] != blockIdx) break;
+            count += instructionCounts[i];
+        }
+
+        return count;
+    }
+
+    const SourceLocation* TestFunctionProfile::getSourceLocation(u32 instructionIdx) const {
+        u32 src = code->sourceIndices[instructionIdx];
+        if (src == TestUnresolvedOffset) return nullptr;
+
+        const SourceMap::Entry* entry = code->sourceMap.get(src);
+        if (!entry) return nullptr;
+
+        return &entry->src;
+    }
+
+    TestProfiler::TestProfiler() : m_timingEnabled(false), m_currentProfile(nullptr), m_currentBlock(TestUnresolvedOffset) {
+    }
+
+    TestProfiler::~TestProfiler() {
+        reset();
+    }
+
+    void TestProfiler::setTimingEnabled(bool enabled) {
+        onStop();
+        m_timingEnabled = enabled;
+    }
+
+    bool TestProfiler::isTimingEnabled() const {
+        return m_timingEnabled;
+    }
+
+    void TestProfiler::reset() {
+        for (u32 i = 0;i < m_profiles.size();i++) delete m_profiles[i];
+        m_profiles.clear();
+        m_profileMap.clear();
+        m_currentProfile = nullptr;
+        m_currentBlock = TestUnresolvedOffset;
+    }
+
+    TestFunctionProfile* TestProfiler::getProfile(const TestBytecode* code) {
+        auto it = m_profileMap.find(code);
+        if (it != m_profileMap.end()) return it->second;
+
+        TestFunctionProfile* profile = new TestFunctionProfile(code);
+        m_profiles.push(profile);
+        m_profileMap[code] = profile;
+        return profile;
+    }
+
+    const TestFunctionProfile* TestProfiler::findProfile(const TestBytecode* code) const {
+        auto it = m_profileMap.find(code);
+        if (it == m_profileMap.end()) return nullptr;
+        return it->second;
+    }
+
+    const Array<TestFunctionProfile*>& TestProfiler::getProfiles() const {
+        return m_profiles;
+    }
+
+    String TestProfiler::generateReport() const {
+        String report;
+
+        for (u32 p = 0;p < m_profiles.size();p++) {
+            const TestFunctionProfile* profile = m_profiles[p];
+            const TestBytecode* code = profile->code;
+
+            u64 totalTime = 0;
+            for (u32 b = 0;b < profile->blockTimes.size();b++) totalTime += profile->blockTimes[b];
+
+            report += String::Format(
+                "%s: %llu instructions executed",
+                code->function->getFullName().c_str(),
+                (unsigned long long)profile->totalCount
+            );
+            if (m_timingEnabled) report += String::Format(", %.3f us", f64(totalTime) / 1000.0);
+            report += "\n";
+
+            for (u32 b = 0;b < code->blocks.size();b++) {
+                const TestBlockInfo& block = code->blocks[b];
+                if (block.firstInstruction == TestUnresolvedOffset) continue;
+
+                report += String::Format(
+                    "    block %u [%u, %u): entered %llu times, %llu instructions executed",
+                    b, block.begin, block.end,
+                    (unsigned long long)profile->getBlockCount(b),
+                    (unsigned long long)profile->getBlockInstructionCount(b)
+                );
+                if (m_timingEnabled) report += String::Format(", %.3f us", f64(profile->blockTimes[b]) / 1000.0);
+                report += "\n";
+
+                for (u32 i = block.firstInstruction;i < code->code.size() && code->blockIndices[i] == b;i++) {
+                    report += String::Format(
+                        "        %4u %-12s %llu",
+                        i, TestBytecode::OpName(code->code[i].op),
+                        (unsigned long long)profile->instructionCounts[i]
+                    );
+
+                    const SourceLocation* src = profile->getSourceLocation(i);
+                    if (src) {
+                        report += String::Format(
+                            " ; resource %u, %u:%u - %u:%u",
+                            src->resourceId, src->startLine, src->startColumn, src->endLine, src->endColumn
+                        );
+                    }
+
+                    report += "\n";
+                }
+            }
+        }
+
+        return report;
+    }
+
+    void TestProfiler::onStop() {
+        if (!m_currentProfile) return;
+
+        if (m_currentBlock != TestUnresolvedOffset) {
+            auto now = std::chrono::steady_clock::now();
+            m_currentProfile->blockTimes[m_currentBlock] += std::chrono::duration_cast<std::chrono::nanoseconds>(now - m_blockStart).count();
+        }
+
+        m_currentProfile = nullptr;
+        m_currentBlock = TestUnresolvedOffset;
+    }
+
+    void TestProfiler::enterBlock(TestFunctionProfile* profile, u32 blockIdx) {
+        auto now = std::chrono::steady_clock::now();
+
+        if (m_currentProfile && m_currentBlock != TestUnresolvedOffset) {
+            m_currentProfile->blockTimes[m_currentBlock] += std::chrono::duration_cast<std::chrono::nanoseconds>(now - m_blockStart).count();
+        }
+
+        m_currentProfile = profile;
+        m_currentBlock = blockIdx;
+        m_blockStart = now;
+    }
+};
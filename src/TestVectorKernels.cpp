@@ -0,0 +1,364 @@
+#include <codegen/TestVectorKernels.h>
+#include <cmath>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(_M_X64)
+    #define CODEGEN_TEST_SIMD_X86
+    #include <immintrin.h>
+
+    #if defined(_MSC_VER) && !defined(__clang__)
+        #include <intrin.h>
+
+        // MSVC allows intrinsics from any instruction set to be used in any function
+        #define CODEGEN_TARGET_AVX2
+    #else
+        #define CODEGEN_TARGET_AVX2 __attribute__((target("avx2")))
+    #endif
+#endif
+
+namespace codegen {
+    #ifdef CODEGEN_TEST_SIMD_X86
+    enum class vector_op {
+        set,
+        add,
+        sub,
+        mul,
+        div
+    };
+
+    //
+    // SSE2
+    //
+    // Vectors with fewer than 4 f32 components are loaded with zeroes in the unused lanes, f64
+    // vectors are held in two 128 bit registers
+    //
+
+    template <u8 N> inline __m128 loadF32(u64 p);
+    template <> inline __m128 loadF32<2>(u64 p) { return _mm_castpd_ps(_mm_load_sd((const f64*)p)); }
+    template <> inline __m128 loadF32<3>(u64 p) {
+        return _mm_movelh_ps(_mm_castpd_ps(_mm_load_sd((const f64*)p)), _mm_load_ss((const f32*)p + 2));
+    }
+    template <> inline __m128 loadF32<4>(u64 p) { return _mm_loadu_ps((const f32*)p); }
+
+    template <u8 N> inline void storeF32(u64 p, __m128 v);
+    template <> inline void storeF32<2>(u64 p, __m128 v) { _mm_store_sd((f64*)p, _mm_castps_pd(v)); }
+    template <> inline void storeF32<3>(u64 p, __m128 v) {
+        _mm_store_sd((f64*)p, _mm_castps_pd(v));
+        _mm_store_ss((f32*)p + 2, _mm_movehl_ps(v, v));
+    }
+    template <> inline void storeF32<4>(u64 p, __m128 v) { _mm_storeu_ps((f32*)p, v); }
+
+    struct f64_pair {
+        __m128d lo;
+        __m128d hi;
+    };
+
+    template <u8 N> inline f64_pair loadF64(u64 p);
+    template <> inline f64_pair loadF64<2>(u64 p) { return { _mm_loadu_pd((const f64*)p), _mm_setzero_pd() }; }
+    template <> inline f64_pair loadF64<3>(u64 p) { return { _mm_loadu_pd((const f64*)p), _mm_load_sd((const f64*)p + 2) }; }
+    template <> inline f64_pair loadF64<4>(u64 p) { return { _mm_loadu_pd((const f64*)p), _mm_loadu_pd((const f64*)p + 2) }; }
+
+    template <u8 N> inline void storeF64(u64 p, const f64_pair& v) {
+        _mm_storeu_pd((f64*)p, v.lo);
+        if constexpr (N == 3) _mm_store_sd((f64*)p + 2, v.hi);
+        if constexpr (N == 4) _mm_storeu_pd((f64*)p + 2, v.hi);
+    }
+
+    template <vector_op O>
+    inline __m128 applyF32(__m128 a, __m128 b) {
+        if constexpr (O == vector_op::set) return b;
+        if constexpr (O == vector_op::add) return _mm_add_ps(a, b);
+        if constexpr (O == vector_op::sub) return _mm_sub_ps(a, b);
+        if constexpr (O == vector_op::mul) return _mm_mul_ps(a, b);
+        if constexpr (O == vector_op::div) return _mm_div_ps(a, b);
+    }
+
+    template <vector_op O>
+    inline __m128d applyF64(__m128d a, __m128d b) {
+        if constexpr (O == vector_op::set) return b;
+        if constexpr (O == vector_op::add) return _mm_add_pd(a, b);
+        if constexpr (O == vector_op::sub) return _mm_sub_pd(a, b);
+        if constexpr (O == vector_op::mul) return _mm_mul_pd(a, b);
+        if constexpr (O == vector_op::div) return _mm_div_pd(a, b);
+    }
+
+    template <u8 N>
+    inline f32 dotF32(u64 a, u64 b) {
+        __m128 m = _mm_mul_ps(loadF32<N>(a), loadF32<N>(b));
+        __m128 s = _mm_add_ps(m, _mm_movehl_ps(m, m));
+        s = _mm_add_ss(s, _mm_shuffle_ps(s, s, _MM_SHUFFLE(1, 1, 1, 1)));
+        return _mm_cvtss_f32(s);
+    }
+
+    template <u8 N>
+    inline f64 dotF64(u64 a, u64 b) {
+        f64_pair va = loadF64<N>(a);
+        f64_pair vb = loadF64<N>(b);
+        __m128d s = _mm_add_pd(_mm_mul_pd(va.lo, vb.lo), _mm_mul_pd(va.hi, vb.hi));
+        s = _mm_add_sd(s, _mm_unpackhi_pd(s, s));
+        return _mm_cvtsd_f64(s);
+    }
+
+    // Scalars are held in the low bytes of a register
+    template <typename T>
+    inline T getScalar(u64 reg) {
+        T value;
+        memcpy(&value, &reg, sizeof(T));
+        return value;
+    }
+
+    template <typename T>
+    inline void setResult(u64& reg, T value) {
+        memcpy(&reg, &value, sizeof(T));
+    }
+
+    template <vector_op O, u8 N>
+    void sse2F32Vector(u64& op0, u64 op1, u64) {
+        storeF32<N>(op0, applyF32<O>(loadF32<N>(op0), loadF32<N>(op1)));
+    }
+
+    template <vector_op O, u8 N>
+    void sse2F32Scalar(u64& op0, u64 op1, u64) {
+        storeF32<N>(op0, applyF32<O>(loadF32<N>(op0), _mm_set1_ps(getScalar<f32>(op1))));
+    }
+
+    template <vector_op O, u8 N>
+    void sse2F64Vector(u64& op0, u64 op1, u64) {
+        f64_pair a = loadF64<N>(op0);
+        f64_pair b = loadF64<N>(op1);
+        storeF64<N>(op0, { applyF64<O>(a.lo, b.lo), applyF64<O>(a.hi, b.hi) });
+    }
+
+    template <vector_op O, u8 N>
+    void sse2F64Scalar(u64& op0, u64 op1, u64) {
+        f64_pair a = loadF64<N>(op0);
+        __m128d b = _mm_set1_pd(getScalar<f64>(op1));
+        storeF64<N>(op0, { applyF64<O>(a.lo, b), applyF64<O>(a.hi, b) });
+    }
+
+    template <u8 N>
+    void sse2F32Neg(u64& op0, u64, u64) {
+        storeF32<N>(op0, _mm_xor_ps(loadF32<N>(op0), _mm_set1_ps(-0.0f)));
+    }
+
+    template <u8 N>
+    void sse2F64Neg(u64& op0, u64, u64) {
+        f64_pair a = loadF64<N>(op0);
+        __m128d sign = _mm_set1_pd(-0.0);
+        storeF64<N>(op0, { _mm_xor_pd(a.lo, sign), _mm_xor_pd(a.hi, sign) });
+    }
+
+    template <u8 N> void sse2F32Dot(u64& op0, u64 op1, u64 op2) { setResult(op0, dotF32<N>(op1, op2)); }
+    template <u8 N> void sse2F32MagSq(u64& op0, u64 op1, u64) { setResult(op0, dotF32<N>(op1, op1)); }
+    template <u8 N> void sse2F32Mag(u64& op0, u64 op1, u64) { setResult(op0, std::sqrt(dotF32<N>(op1, op1))); }
+    template <u8 N> void sse2F64Dot(u64& op0, u64 op1, u64 op2) { setResult(op0, dotF64<N>(op1, op2)); }
+    template <u8 N> void sse2F64MagSq(u64& op0, u64 op1, u64) { setResult(op0, dotF64<N>(op1, op1)); }
+    template <u8 N> void sse2F64Mag(u64& op0, u64 op1, u64) { setResult(op0, std::sqrt(dotF64<N>(op1, op1))); }
+
+    template <u8 N>
+    void sse2F32Norm(u64& op0, u64, u64) {
+        f32 f = 1.0f / std::sqrt(dotF32<N>(op0, op0));
+        storeF32<N>(op0, _mm_mul_ps(loadF32<N>(op0), _mm_set1_ps(f)));
+    }
+
+    template <u8 N>
+    void sse2F64Norm(u64& op0, u64, u64) {
+        f64_pair a = loadF64<N>(op0);
+        __m128d f = _mm_set1_pd(1.0 / std::sqrt(dotF64<N>(op0, op0)));
+        storeF64<N>(op0, { _mm_mul_pd(a.lo, f), _mm_mul_pd(a.hi, f) });
+    }
+
+    void sse2F32Cross(u64& op0, u64 op1, u64 op2) {
+        __m128 a = loadF32<3>(op1);
+        __m128 b = loadF32<3>(op2);
+
+        // a * b.yzx - a.yzx * b gives the cross product in zxy order
+        __m128 ayzx = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1));
+        __m128 byzx = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 0, 2, 1));
+        __m128 c = _mm_sub_ps(_mm_mul_ps(a, byzx), _mm_mul_ps(ayzx, b));
+        storeF32<3>(op0, _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 0, 2, 1)));
+    }
+
+    //
+    // AVX2, f64x3 and f64x4 fit in a single 256 bit register. f64x3 is loaded and stored with a
+    // mask so that memory after the vector is never touched
+    //
+
+    template <u8 N>
+    CODEGEN_TARGET_AVX2 inline __m256i maskF64() {
+        return _mm256_setr_epi64x(-1, -1, -1, N == 4 ? -1 : 0);
+    }
+
+    template <u8 N>
+    CODEGEN_TARGET_AVX2 inline __m256d loadF64x4(u64 p) {
+        if constexpr (N == 4) return _mm256_loadu_pd((const f64*)p);
+        else return _mm256_maskload_pd((const f64*)p, maskF64<N>());
+    }
+
+    template <u8 N>
+    CODEGEN_TARGET_AVX2 inline void storeF64x4(u64 p, __m256d v) {
+        if constexpr (N == 4) _mm256_storeu_pd((f64*)p, v);
+        else _mm256_maskstore_pd((f64*)p, maskF64<N>(), v);
+    }
+
+    template <vector_op O>
+    CODEGEN_TARGET_AVX2 inline __m256d applyF64x4(__m256d a, __m256d b) {
+        if constexpr (O == vector_op::set) return b;
+        if constexpr (O == vector_op::add) return _mm256_add_pd(a, b);
+        if constexpr (O == vector_op::sub) return _mm256_sub_pd(a, b);
+        if constexpr (O == vector_op::mul) return _mm256_mul_pd(a, b);
+        if constexpr (O == vector_op::div) return _mm256_div_pd(a, b);
+    }
+
+    template <u8 N>
+    CODEGEN_TARGET_AVX2 inline f64 dotF64x4(u64 a, u64 b) {
+        __m256d m = _mm256_mul_pd(loadF64x4<N>(a), loadF64x4<N>(b));
+        __m128d s = _mm_add_pd(_mm256_castpd256_pd128(m), _mm256_extractf128_pd(m, 1));
+        s = _mm_add_sd(s, _mm_unpackhi_pd(s, s));
+        return _mm_cvtsd_f64(s);
+    }
+
+    template <vector_op O, u8 N>
+    CODEGEN_TARGET_AVX2 void avx2F64Vector(u64& op0, u64 op1, u64) {
+        storeF64x4<N>(op0, applyF64x4<O>(loadF64x4<N>(op0), loadF64x4<N>(op1)));
+    }
+
+    template <vector_op O, u8 N>
+    CODEGEN_TARGET_AVX2 void avx2F64Scalar(u64& op0, u64 op1, u64) {
+        storeF64x4<N>(op0, applyF64x4<O>(loadF64x4<N>(op0), _mm256_set1_pd(getScalar<f64>(op1))));
+    }
+
+    template <u8 N>
+    CODEGEN_TARGET_AVX2 void avx2F64Neg(u64& op0, u64, u64) {
+        storeF64x4<N>(op0, _mm256_xor_pd(loadF64x4<N>(op0), _mm256_set1_pd(-0.0)));
+    }
+
+    template <u8 N> CODEGEN_TARGET_AVX2 void avx2F64Dot(u64& op0, u64 op1, u64 op2) { setResult(op0, dotF64x4<N>(op1, op2)); }
+    template <u8 N> CODEGEN_TARGET_AVX2 void avx2F64MagSq(u64& op0, u64 op1, u64) { setResult(op0, dotF64x4<N>(op1, op1)); }
+    template <u8 N> CODEGEN_TARGET_AVX2 void avx2F64Mag(u64& op0, u64 op1, u64) { setResult(op0, std::sqrt(dotF64x4<N>(op1, op1))); }
+
+    template <u8 N>
+    CODEGEN_TARGET_AVX2 void avx2F64Norm(u64& op0, u64, u64) {
+        __m256d f = _mm256_set1_pd(1.0 / std::sqrt(dotF64x4<N>(op0, op0)));
+        storeF64x4<N>(op0, _mm256_mul_pd(loadF64x4<N>(op0), f));
+    }
+
+    CODEGEN_TARGET_AVX2 void avx2F64Cross(u64& op0, u64 op1, u64 op2) {
+        __m256d a = loadF64x4<3>(op1);
+        __m256d b = loadF64x4<3>(op2);
+
+        // a * b.yzx - a.yzx * b gives the cross product in zxy order
+        __m256d ayzx = _mm256_permute4x64_pd(a, _MM_SHUFFLE(3, 0, 2, 1));
+        __m256d byzx = _mm256_permute4x64_pd(b, _MM_SHUFFLE(3, 0, 2, 1));
+        __m256d c = _mm256_sub_pd(_mm256_mul_pd(a, byzx), _mm256_mul_pd(ayzx, b));
+        storeF64x4<3>(op0, _mm256_permute4x64_pd(c, _MM_SHUFFLE(3, 0, 2, 1)));
+    }
+
+    //
+    // Selection
+    //
+
+    #define CODEGEN_ELEMENTWISE_KERNELS(prefix, N)                                                                     \
+        case TestOp::vset_v: return prefix##Vector<vector_op::set, N>;                                                 \
+        case TestOp::vadd_v: return prefix##Vector<vector_op::add, N>;                                                 \
+        case TestOp::vsub_v: return prefix##Vector<vector_op::sub, N>;                                                 \
+        case TestOp::vmul_v: return prefix##Vector<vector_op::mul, N>;                                                 \
+        case TestOp::vdiv_v: return prefix##Vector<vector_op::div, N>;                                                 \
+        case TestOp::vset_s: return prefix##Scalar<vector_op::set, N>;                                                 \
+        case TestOp::vadd_s: return prefix##Scalar<vector_op::add, N>;                                                 \
+        case TestOp::vsub_s: return prefix##Scalar<vector_op::sub, N>;                                                 \
+        case TestOp::vmul_s: return prefix##Scalar<vector_op::mul, N>;                                                 \
+        case TestOp::vdiv_s: return prefix##Scalar<vector_op::div, N>;                                                 \
+        case TestOp::vneg: return prefix##Neg<N>;                                                                      \
+        case TestOp::vdot: return prefix##Dot<N>;                                                                      \
+        case TestOp::vmag: return prefix##Mag<N>;                                                                      \
+        case TestOp::vmagsq: return prefix##MagSq<N>;                                                                  \
+        case TestOp::vnorm: return prefix##Norm<N>;
+
+    template <u8 N>
+    TestVectorKernel getSse2F32Kernel(TestOp op) {
+        switch (op) {
+            CODEGEN_ELEMENTWISE_KERNELS(sse2F32, N)
+            case TestOp::vcross: return N == 3 ? sse2F32Cross : nullptr;
+            default: return nullptr;
+        }
+    }
+
+    template <u8 N>
+    TestVectorKernel getSse2F64Kernel(TestOp op) {
+        switch (op) {
+            CODEGEN_ELEMENTWISE_KERNELS(sse2F64, N)
+            default: return nullptr;
+        }
+    }
+
+    template <u8 N>
+    TestVectorKernel getAvx2F64Kernel(TestOp op) {
+        switch (op) {
+            CODEGEN_ELEMENTWISE_KERNELS(avx2F64, N)
+            case TestOp::vcross: return N == 3 ? avx2F64Cross : nullptr;
+            default: return getSse2F64Kernel<N>(op);
+        }
+    }
+
+    #undef CODEGEN_ELEMENTWISE_KERNELS
+
+    TestSimdLevel detectTestSimdLevel() {
+        // SSE2 is part of x86-64
+        #if defined(_MSC_VER) && !defined(__clang__)
+            int info[4];
+            __cpuid(info, 0);
+            if (info[0] < 7) return TestSimdLevel::SSE2;
+
+            // AVX state must be enabled by the OS as well as supported by the CPU
+            __cpuid(info, 1);
+            bool osxsave = (info[2] & (1 << 27)) != 0;
+            bool avx = (info[2] & (1 << 28)) != 0;
+            if (!osxsave || !avx || (_xgetbv(0) & 0x6) != 0x6) return TestSimdLevel::SSE2;
+
+            __cpuidex(info, 7, 0);
+            if ((info[1] & (1 << 5)) != 0) return TestSimdLevel::AVX2;
+        #else
+            __builtin_cpu_init();
+            if (__builtin_cpu_supports("avx2")) return TestSimdLevel::AVX2;
+        #endif
+
+        return TestSimdLevel::SSE2;
+    }
+    #endif
+
+    TestSimdLevel TestVectorKernels::GetSupportedLevel() {
+        #ifdef CODEGEN_TEST_SIMD_X86
+            static const TestSimdLevel level = detectTestSimdLevel();
+            return level;
+        #else
+            return TestSimdLevel::None;
+        #endif
+    }
+
+    TestVectorKernel TestVectorKernels::Get(TestOp op, TestValueType type, u8 componentCount, TestSimdLevel level) {
+        #ifdef CODEGEN_TEST_SIMD_X86
+            if (level == TestSimdLevel::None) return nullptr;
+
+            if (type == TestValueType::Float32) {
+                switch (componentCount) {
+                    case 2: return getSse2F32Kernel<2>(op);
+                    case 3: return getSse2F32Kernel<3>(op);
+                    case 4: return getSse2F32Kernel<4>(op);
+                    default: return nullptr;
+                }
+            }
+
+            if (type == TestValueType::Float64) {
+                switch (componentCount) {
+                    case 2: return getSse2F64Kernel<2>(op);
+                    case 3: return level == TestSimdLevel::AVX2 ? getAvx2F64Kernel<3>(op) : getSse2F64Kernel<3>(op);
+                    case 4: return level == TestSimdLevel::AVX2 ? getAvx2F64Kernel<4>(op) : getSse2F64Kernel<4>(op);
+                    default: return nullptr;
+                }
+            }
+        #endif
+
+        return nullptr;
+    }
+};
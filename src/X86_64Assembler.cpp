@@ -0,0 +1,243 @@
+#include <codegen/X86_64Assembler.h>
+#include <utils/Array.hpp>
+
+namespace codegen {
+    u8 regCode(X86_64Reg r) {
+        return u8(r);
+    }
+
+    X86_64Assembler::X86_64Assembler() {
+    }
+
+    const u8* X86_64Assembler::data() const {
+        return m_code.size() > 0 ? &m_code[0] : nullptr;
+    }
+
+    u32 X86_64Assembler::size() const {
+        return m_code.size();
+    }
+
+    void X86_64Assembler::push(X86_64Reg r) {
+        if (regCode(r) >= 8) byte(0x41);
+        byte(0x50 + (regCode(r) & 7));
+    }
+
+    void X86_64Assembler::pop(X86_64Reg r) {
+        if (regCode(r) >= 8) byte(0x41);
+        byte(0x58 + (regCode(r) & 7));
+    }
+
+    void X86_64Assembler::ret() {
+        byte(0xC3);
+    }
+
+    void X86_64Assembler::call(X86_64Reg target) {
+        emitReg(0, false, 0xFF, 2, target);
+    }
+
+    u32 X86_64Assembler::call() {
+        byte(0xE8);
+        u32 at = m_code.size();
+        dword(0);
+        return at;
+    }
+
+    u32 X86_64Assembler::jmp() {
+        byte(0xE9);
+        u32 at = m_code.size();
+        dword(0);
+        return at;
+    }
+
+    u32 X86_64Assembler::jcc(X86_64Cond cond) {
+        byte(0x0F);
+        byte(0x80 + u8(cond));
+        u32 at = m_code.size();
+        dword(0);
+        return at;
+    }
+
+    void X86_64Assembler::patch(u32 at, u32 target) {
+        i32 rel = i32(target) - i32(at + 4);
+        for (u32 b = 0;b < 4;b++) m_code[at + b] = u8(u32(rel) >> (b * 8));
+    }
+
+    void X86_64Assembler::mov(X86_64Reg dst, X86_64Reg src) {
+        emitReg(0, true, 0x89, regCode(src), dst);
+    }
+
+    void X86_64Assembler::mov(X86_64Reg dst, u64 imm) {
+        if (imm <= 0xFFFFFFFF) {
+            // 32 bit moves zero extend
+            rex(false, 0, regCode(dst));
+            byte(0xB8 + (regCode(dst) & 7));
+            dword(u32(imm));
+            return;
+        }
+
+        if (i64(imm) >= INT32_MIN && i64(imm) <= INT32_MAX) {
+            emitReg(0, true, 0xC7, 0, dst);
+            dword(u32(imm));
+            return;
+        }
+
+        rex(true, 0, regCode(dst));
+        byte(0xB8 + (regCode(dst) & 7));
+        dword(u32(imm));
+        dword(u32(imm >> 32));
+    }
+
+    void X86_64Assembler::load(X86_64Reg dst, X86_64Reg base, i32 disp, u32 size) {
+        switch (size) {
+            case sizeof(u8): { emitMem(0, false, 0x0FB6, regCode(dst), base, disp); break; }
+            case sizeof(u16): { emitMem(0, false, 0x0FB7, regCode(dst), base, disp); break; }
+            case sizeof(u32): { emitMem(0, false, 0x8B, regCode(dst), base, disp); break; }
+            default: { emitMem(0, true, 0x8B, regCode(dst), base, disp); break; }
+        }
+    }
+
+    void X86_64Assembler::loadSigned(X86_64Reg dst, X86_64Reg base, i32 disp, u32 size) {
+        switch (size) {
+            case sizeof(i8): { emitMem(0, true, 0x0FBE, regCode(dst), base, disp); break; }
+            case sizeof(i16): { emitMem(0, true, 0x0FBF, regCode(dst), base, disp); break; }
+            case sizeof(i32): { emitMem(0, true, 0x63, regCode(dst), base, disp); break; }
+            default: { emitMem(0, true, 0x8B, regCode(dst), base, disp); break; }
+        }
+    }
+
+    void X86_64Assembler::store(X86_64Reg base, i32 disp, X86_64Reg src, u32 size) {
+        switch (size) {
+            case sizeof(u8): {
+                // spl, bpl, sil and dil are only addressable with a REX prefix
+                rex(false, regCode(src), regCode(base), regCode(src) >= 4);
+                byte(0x88);
+                modrm(regCode(src), base, disp);
+                break;
+            }
+            case sizeof(u16): { emitMem(0x66, false, 0x89, regCode(src), base, disp); break; }
+            case sizeof(u32): { emitMem(0, false, 0x89, regCode(src), base, disp); break; }
+            default: { emitMem(0, true, 0x89, regCode(src), base, disp); break; }
+        }
+    }
+
+    void X86_64Assembler::lea(X86_64Reg dst, X86_64Reg base, i32 disp) { emitMem(0, true, 0x8D, regCode(dst), base, disp); }
+    void X86_64Assembler::add(X86_64Reg dst, X86_64Reg src) { emitReg(0, true, 0x03, regCode(dst), src); }
+    void X86_64Assembler::add(X86_64Reg dst, X86_64Reg base, i32 disp) { emitMem(0, true, 0x03, regCode(dst), base, disp); }
+    void X86_64Assembler::sub(X86_64Reg dst, X86_64Reg src) { emitReg(0, true, 0x2B, regCode(dst), src); }
+    void X86_64Assembler::add(X86_64Reg dst, i32 imm) { emitReg(0, true, 0x81, 0, dst); dword(u32(imm)); }
+    void X86_64Assembler::sub(X86_64Reg dst, i32 imm) { emitReg(0, true, 0x81, 5, dst); dword(u32(imm)); }
+    void X86_64Assembler::imul(X86_64Reg dst, X86_64Reg src) { emitReg(0, true, 0x0FAF, regCode(dst), src); }
+    void X86_64Assembler::and_(X86_64Reg dst, X86_64Reg src) { emitReg(0, true, 0x23, regCode(dst), src); }
+    void X86_64Assembler::or_(X86_64Reg dst, X86_64Reg src) { emitReg(0, true, 0x0B, regCode(dst), src); }
+    void X86_64Assembler::xor_(X86_64Reg dst, X86_64Reg src) { emitReg(0, true, 0x33, regCode(dst), src); }
+    void X86_64Assembler::cmp(X86_64Reg a, X86_64Reg b) { emitReg(0, true, 0x3B, regCode(a), b); }
+
+    void X86_64Assembler::test(X86_64Reg a, X86_64Reg b, u32 size) {
+        switch (size) {
+            case sizeof(u8): { emitReg(0, false, 0x84, regCode(b), a); break; }
+            case sizeof(u16): { emitReg(0x66, false, 0x85, regCode(b), a); break; }
+            case sizeof(u32): { emitReg(0, false, 0x85, regCode(b), a); break; }
+            default: { emitReg(0, true, 0x85, regCode(b), a); break; }
+        }
+    }
+
+    void X86_64Assembler::shl(X86_64Reg r) { emitReg(0, true, 0xD3, 4, r); }
+    void X86_64Assembler::shr(X86_64Reg r) { emitReg(0, true, 0xD3, 5, r); }
+    void X86_64Assembler::neg(X86_64Reg r) { emitReg(0, true, 0xF7, 3, r); }
+    void X86_64Assembler::not_(X86_64Reg r) { emitReg(0, true, 0xF7, 2, r); }
+
+    void X86_64Assembler::btc63(X86_64Reg r) {
+        emitReg(0, true, 0x0FBA, 7, r);
+        byte(63);
+    }
+
+    void X86_64Assembler::cqo() {
+        byte(0x48);
+        byte(0x99);
+    }
+
+    void X86_64Assembler::idiv(X86_64Reg divisor) { emitReg(0, true, 0xF7, 7, divisor); }
+    void X86_64Assembler::div(X86_64Reg divisor) { emitReg(0, true, 0xF7, 6, divisor); }
+    void X86_64Assembler::setcc(X86_64Cond cond, X86_64Reg r) { emitReg(0, false, 0x0F90 + u8(cond), 0, r); }
+    void X86_64Assembler::movzx8(X86_64Reg dst, X86_64Reg src) { emitReg(0, false, 0x0FB6, regCode(dst), src); }
+    void X86_64Assembler::and8(X86_64Reg dst, X86_64Reg src) { emitReg(0, false, 0x20, regCode(src), dst); }
+    void X86_64Assembler::or8(X86_64Reg dst, X86_64Reg src) { emitReg(0, false, 0x08, regCode(src), dst); }
+    void X86_64Assembler::inc(X86_64Reg base, i32 disp) { emitMem(0, true, 0xFF, 0, base, disp); }
+    void X86_64Assembler::dec(X86_64Reg base, i32 disp) { emitMem(0, true, 0xFF, 1, base, disp); }
+
+    void X86_64Assembler::repStosb() {
+        byte(0xF3);
+        byte(0xAA);
+    }
+
+    u8 ssePrefix(u32 size) {
+        return size == sizeof(f32) ? 0xF3 : 0xF2;
+    }
+
+    void X86_64Assembler::movs(u8 xmm, X86_64Reg base, i32 disp, u32 size) { emitMem(ssePrefix(size), false, 0x0F10, xmm, base, disp); }
+    void X86_64Assembler::movs(X86_64Reg base, i32 disp, u8 xmm, u32 size) { emitMem(ssePrefix(size), false, 0x0F11, xmm, base, disp); }
+    void X86_64Assembler::adds(u8 dst, u8 src, u32 size) { emitReg(ssePrefix(size), false, 0x0F58, dst, X86_64Reg(src)); }
+    void X86_64Assembler::subs(u8 dst, u8 src, u32 size) { emitReg(ssePrefix(size), false, 0x0F5C, dst, X86_64Reg(src)); }
+    void X86_64Assembler::muls(u8 dst, u8 src, u32 size) { emitReg(ssePrefix(size), false, 0x0F59, dst, X86_64Reg(src)); }
+    void X86_64Assembler::divs(u8 dst, u8 src, u32 size) { emitReg(ssePrefix(size), false, 0x0F5E, dst, X86_64Reg(src)); }
+
+    void X86_64Assembler::ucomis(u8 a, u8 b, u32 size) {
+        emitReg(size == sizeof(f32) ? 0 : 0x66, false, 0x0F2E, a, X86_64Reg(b));
+    }
+
+    void X86_64Assembler::movToXmm(u8 xmm, X86_64Reg src, u32 size) {
+        emitReg(0x66, size == sizeof(u64), 0x0F6E, xmm, src);
+    }
+
+    void X86_64Assembler::cvtsi2s(u8 xmm, X86_64Reg src, u32 srcSize, u32 size) {
+        emitReg(ssePrefix(size), srcSize == sizeof(u64), 0x0F2A, xmm, src);
+    }
+
+    void X86_64Assembler::cvtts2si(X86_64Reg dst, u8 xmm, u32 size, u32 dstSize) {
+        emitReg(ssePrefix(size), dstSize == sizeof(u64), 0x0F2C, regCode(dst), X86_64Reg(xmm));
+    }
+
+    void X86_64Assembler::cvts2s(u8 dst, u8 src, u32 size) {
+        emitReg(ssePrefix(size), false, 0x0F5A, dst, X86_64Reg(src));
+    }
+
+    void X86_64Assembler::byte(u8 b) {
+        m_code.push(b);
+    }
+
+    void X86_64Assembler::dword(u32 d) {
+        for (u32 b = 0;b < 4;b++) m_code.push(u8(d >> (b * 8)));
+    }
+
+    void X86_64Assembler::rex(bool w, u8 reg, u8 base, bool force) {
+        u8 prefix = 0x40 | (w ? 0x08 : 0) | ((reg & 8) ? 0x04 : 0) | ((base & 8) ? 0x01 : 0);
+        if (prefix != 0x40 || force) byte(prefix);
+    }
+
+    void X86_64Assembler::modrm(u8 reg, X86_64Reg base, i32 disp) {
+        // Always [base + disp32], rsp and r12 can only be used as a base with a SIB byte
+        byte(0x80 | ((reg & 7) << 3) | (regCode(base) & 7));
+        if ((regCode(base) & 7) == 4) byte(0x24);
+        dword(u32(disp));
+    }
+
+    void X86_64Assembler::modrm(u8 reg, X86_64Reg rm) {
+        byte(0xC0 | ((reg & 7) << 3) | (regCode(rm) & 7));
+    }
+
+    void X86_64Assembler::emitMem(u8 prefix, bool w, u16 opcode, u8 reg, X86_64Reg base, i32 disp) {
+        if (prefix) byte(prefix);
+        rex(w, reg, regCode(base));
+        if (opcode > 0xFF) byte(u8(opcode >> 8));
+        byte(u8(opcode));
+        modrm(reg, base, disp);
+    }
+
+    void X86_64Assembler::emitReg(u8 prefix, bool w, u16 opcode, u8 reg, X86_64Reg rm) {
+        if (prefix) byte(prefix);
+        rex(w, reg, regCode(rm));
+        if (opcode > 0xFF) byte(u8(opcode >> 8));
+        byte(u8(opcode));
+        modrm(reg, rm);
+    }
+};
@@ -0,0 +1,851 @@
+#include <codegen/X86_64Backend.h>
+#include <codegen/X86_64Assembler.h>
+#include <codegen/Execute.h>
+#include <codegen/CodeHolder.h>
+#include <codegen/FunctionBuilder.h>
+#include <bind/Function.h>
+#include <bind/FunctionType.h>
+#include <bind/DataType.h>
+#include <utils/Exception.h>
+#include <utils/Array.hpp>
+#include <exception>
+#include <typeinfo>
+#include <string.h>
+
+#if defined(__x86_64__) && (defined(__linux__) || defined(__APPLE__))
+    // x86-64 with the System V calling convention
+    #define CODEGEN_X86_64_NATIVE
+    #include <sys/mman.h>
+#endif
+
+namespace codegen {
+    /*
+     * State of one call to generated code, which the generated code keeps at the bottom of its
+     * frame on the native stack and passes to the helpers it calls. The generated code writes and
+     * reads the fields directly, so they're at fixed offsets
+     */
+    struct x86_64_context {
+        u64* registers;
+        void* returnPtr;
+        const TestBytecode* code;
+        std::exception_ptr* error;
+    };
+
+    constexpr i32 X86_64RegistersOffset = 0;
+    constexpr i32 X86_64ReturnPtrOffset = 8;
+    constexpr i32 X86_64CodeOffset = 16;
+    constexpr i32 X86_64ErrorOffset = 24;
+    static_assert(sizeof(x86_64_context) == 32);
+
+    // Entry point of generated code, returns 0 on success or 1 if an exception was stored in 'error'
+    typedef u32 (*x86_64_entry)(void* retDest, void** args, std::exception_ptr* error);
+
+    // Jump to an instruction index, the index after the last instruction is the successful exit
+    struct x86_64_jump {
+        u32 at;
+        u32 target;
+    };
+
+    // Number of operations in each family, the families' forms are ordered in TestOp the same way
+    // as they're listed, so an operation and its form can be found with arithmetic
+    #define X(_, name) + 1
+    constexpr u32 X86_64BinaryOpCount = 0 CODEGEN_TEST_BINARY_OPS(X, _);
+    constexpr u32 X86_64NarrowBinaryOpCount = 0 CODEGEN_TEST_NARROW_BINARY_OPS(X, _);
+    constexpr u32 X86_64CompareOpCount = 0 CODEGEN_TEST_COMPARE_OPS(X, _);
+    constexpr u32 X86_64NarrowCompareOpCount = 0 CODEGEN_TEST_NARROW_COMPARE_OPS(X, _);
+    #undef X
+
+    static_assert(u16(TestOp::shl8_rr) - u16(TestOp::shl_rr) == X86_64BinaryOpCount * 3);
+    static_assert(u16(TestOp::ilt_rr) - u16(TestOp::shl8_rr) == X86_64NarrowBinaryOpCount * 9);
+    static_assert(u16(TestOp::ilt8_rr) - u16(TestOp::ilt_rr) == X86_64CompareOpCount * 6);
+    static_assert(u16(TestOp::OpCount) - u16(TestOp::ilt8_rr) == X86_64NarrowCompareOpCount * 18);
+
+    // Comparisons are grouped by relation, with one operation per operand type in each group
+    static_assert(u16(TestOp::ult_rr) - u16(TestOp::ilt_rr) == 6);
+    static_assert(u16(TestOp::ilte_rr) - u16(TestOp::ilt_rr) == 4 * 6);
+    static_assert(u16(TestOp::dneq_rr) - u16(TestOp::ilt_rr) == 23 * 6);
+
+    // '_rr' form of the 64 bit operation that each narrow operation is a narrower form of
+    const TestOp x86_64NarrowBinaryOps[] = {
+        #define X(_, name) TestOp::name##_rr,
+        CODEGEN_TEST_NARROW_BINARY_OPS(X, _)
+        #undef X
+    };
+
+    const TestOp x86_64NarrowCompareOps[] = {
+        #define X(_, name) TestOp::name##_rr,
+        CODEGEN_TEST_NARROW_COMPARE_OPS(X, _)
+        #undef X
+    };
+
+    u32 x86_64Operation(x86_64_context* ctx, const TestInstruction* inst) {
+        try {
+            TestExecuter::ExecuteOperation(*inst, ctx->registers);
+        } catch (...) {
+            *ctx->error = std::current_exception();
+            return 1;
+        }
+
+        return 0;
+    }
+
+    u32 x86_64Call(x86_64_context* ctx, const TestInstruction* inst) {
+        try {
+            u64* registers = ctx->registers;
+            const TestCallSite* site = (const TestCallSite*)inst->meta;
+            void** argPointers = (void**)(((u8*)registers) + ctx->code->argPointersOffset);
+
+            Function* fn = site->function;
+            if (inst->op == TestOp::call_r || inst->op == TestOp::tail_call_r) {
+                fn = reinterpret_cast<Function*>(registers[inst->operands[0]]);
+                if (!fn) throw Exception("X86_64CallHandler - Attempted to call a null function value");
+            }
+
+            // Tail calls return the callee's return value, the 'ret' which follows them returns
+            void* retPtr = ctx->returnPtr;
+            if (inst->op == TestOp::call || inst->op == TestOp::call_r) {
+                if (site->returnsInRegister) retPtr = &registers[inst->operands[1]];
+                else retPtr = reinterpret_cast<void*>(registers[inst->operands[1]]);
+            }
+
+            void** args = argPointers + 1;
+            if (site->passesThis) {
+                argPointers[0] = &registers[inst->operands[2]];
+                args = argPointers;
+            }
+
+            // Other compiled functions are entered directly, and store any exception in the same place
+            const ICallHandler* handler = fn->getCallHandler();
+            if (handler && typeid(*handler) == typeid(X86_64CallHandler)) {
+                x86_64_entry entry = (x86_64_entry)((const X86_64CallHandler*)handler)->getNativeCode();
+                return entry(retPtr, args, ctx->error);
+            }
+
+            fn->call(retPtr, args);
+        } catch (...) {
+            *ctx->error = std::current_exception();
+            return 1;
+        }
+
+        return 0;
+    }
+
+    #ifdef CODEGEN_X86_64_NATIVE
+    typedef X86_64Reg R;
+
+    i32 x86_64Slot(u32 reg) {
+        return i32(reg * sizeof(u64));
+    }
+
+    // Loads an integer operand, extended from 'size' bytes. Immediates are extended the same way
+    // as a register holding them would be when it's loaded
+    void x86_64LoadInt(X86_64Assembler& a, R dst, const TestInstruction& i, u32 operand, bool immediate, u32 size, bool isSigned) {
+        if (!immediate) {
+            if (isSigned) a.loadSigned(dst, R::rbx, x86_64Slot(i.operands[operand]), size);
+            else a.load(dst, R::rbx, x86_64Slot(i.operands[operand]), size);
+            return;
+        }
+
+        u64 v = i.imm.u;
+        if (size < sizeof(u64)) {
+            u64 mask = (u64(1) << (size * 8)) - 1;
+            bool negative = (v >> (size * 8 - 1)) & 1;
+            v &= mask;
+            if (isSigned && negative) v |= ~mask;
+        }
+
+        a.mov(dst, v);
+    }
+
+    // Loads a floating point operand into an xmm register, immediates go through rax
+    void x86_64LoadFloat(X86_64Assembler& a, u8 xmm, const TestInstruction& i, u32 operand, bool immediate, u32 size) {
+        if (!immediate) {
+            a.movs(xmm, R::rbx, x86_64Slot(i.operands[operand]), size);
+            return;
+        }
+
+        a.mov(R::rax, size == sizeof(f32) ? u64(u32(i.imm.u)) : i.imm.u);
+        a.movToXmm(xmm, R::rax, size);
+    }
+
+    // Calls one of the helpers with the context and the instruction, and leaves through the error
+    // exit if it fails
+    void x86_64HelperCall(X86_64Assembler& a, u32 (*helper)(x86_64_context*, const TestInstruction*), const TestInstruction& i, Array<u32>& errorJumps) {
+        a.mov(R::rdi, R::r12);
+        a.mov(R::rsi, reinterpret_cast<u64>(&i));
+        a.mov(R::rax, reinterpret_cast<u64>(helper));
+        a.call(R::rax);
+        a.test(R::rax, R::rax, sizeof(u32));
+        errorJumps.push(a.jcc(X86_64Cond::ne));
+    }
+
+    // 'op' is the '_rr' form of the 64 bit operation, 'form' is 0 for '_rr', 1 for '_ri' and 2 for '_ir'
+    void x86_64Binary(X86_64Assembler& a, const TestInstruction& i, TestOp op, u32 form, u32 size) {
+        bool immA = form == 2;
+        bool immB = form == 1;
+        i32 dst = x86_64Slot(i.operands[0]);
+
+        u32 floatSize = 0;
+        switch (op) {
+            case TestOp::fadd_rr: case TestOp::fsub_rr: case TestOp::fmul_rr: case TestOp::fdiv_rr: floatSize = sizeof(f32); break;
+            case TestOp::dadd_rr: case TestOp::dsub_rr: case TestOp::dmul_rr: case TestOp::ddiv_rr: floatSize = sizeof(f64); break;
+            default: break;
+        }
+
+        if (floatSize) {
+            x86_64LoadFloat(a, 0, i, 1, immA, floatSize);
+            x86_64LoadFloat(a, 1, i, 2, immB, floatSize);
+
+            switch (op) {
+                case TestOp::fadd_rr: case TestOp::dadd_rr: a.adds(0, 1, floatSize); break;
+                case TestOp::fsub_rr: case TestOp::dsub_rr: a.subs(0, 1, floatSize); break;
+                case TestOp::fmul_rr: case TestOp::dmul_rr: a.muls(0, 1, floatSize); break;
+                default: a.divs(0, 1, floatSize); break;
+            }
+
+            a.movs(R::rbx, dst, 0, floatSize);
+            return;
+        }
+
+        bool isSigned = op == TestOp::idiv_rr || op == TestOp::imod_rr;
+        x86_64LoadInt(a, R::rax, i, 1, immA, size, isSigned);
+        x86_64LoadInt(a, R::rcx, i, 2, immB, size, isSigned);
+
+        switch (op) {
+            case TestOp::shl_rr: { a.shl(R::rax); break; }
+            case TestOp::shr_rr: { a.shr(R::rax); break; }
+            case TestOp::land_rr:
+            case TestOp::lor_rr: {
+                a.test(R::rax, R::rax);
+                a.setcc(X86_64Cond::ne, R::rax);
+                a.test(R::rcx, R::rcx);
+                a.setcc(X86_64Cond::ne, R::rcx);
+                if (op == TestOp::land_rr) a.and8(R::rax, R::rcx);
+                else a.or8(R::rax, R::rcx);
+                a.movzx8(R::rax, R::rax);
+                break;
+            }
+            case TestOp::band_rr: { a.and_(R::rax, R::rcx); break; }
+            case TestOp::bor_rr: { a.or_(R::rax, R::rcx); break; }
+            case TestOp::_xor_rr: { a.xor_(R::rax, R::rcx); break; }
+            case TestOp::iadd_rr:
+            case TestOp::uadd_rr: { a.add(R::rax, R::rcx); break; }
+            case TestOp::isub_rr:
+            case TestOp::usub_rr: { a.sub(R::rax, R::rcx); break; }
+            case TestOp::imul_rr:
+            case TestOp::umul_rr: { a.imul(R::rax, R::rcx); break; }
+            case TestOp::idiv_rr:
+            case TestOp::imod_rr: {
+                // Narrow operands were sign extended, so the division is done at 64 bits
+                a.cqo();
+                a.idiv(R::rcx);
+                if (op == TestOp::imod_rr) a.mov(R::rax, R::rdx);
+                break;
+            }
+            case TestOp::udiv_rr:
+            case TestOp::umod_rr: {
+                a.xor_(R::rdx, R::rdx);
+                a.div(R::rcx);
+                if (op == TestOp::umod_rr) a.mov(R::rax, R::rdx);
+                break;
+            }
+            default: {
+                throw Exception(String::Format(
+                    "X86_64CallHandler - Unsupported binary operation '%s'",
+                    TestBytecode::OpName(op)
+                ));
+            }
+        }
+
+        // Narrow operations leave the rest of the destination register unchanged
+        a.store(R::rbx, dst, R::rax, size);
+    }
+
+    // 'op' is the '_rr' form of the 64 bit comparison, 'form' is 0 to 5 in the order '_rr', '_ri',
+    // '_ir', '_rr_br', '_ri_br', '_ir_br'
+    void x86_64Compare(X86_64Assembler& a, const TestInstruction& i, TestOp op, u32 form, u32 size, Array<x86_64_jump>& jumps) {
+        bool branch = form >= 3;
+        bool immA = form % 3 == 2;
+        bool immB = form % 3 == 1;
+
+        // 0: lt, 1: lte, 2: gt, 3: gte, 4: eq, 5: neq
+        u32 relation = (u32(op) - u32(TestOp::ilt_rr)) / 6 / 4;
+
+        // 0: signed, 1: unsigned, 2: f32, 3: f64
+        u32 type = ((u32(op) - u32(TestOp::ilt_rr)) / 6) % 4;
+
+        if (type < 2) {
+            bool isSigned = type == 0;
+            x86_64LoadInt(a, R::rax, i, 1, immA, size, isSigned);
+            x86_64LoadInt(a, R::rcx, i, 2, immB, size, isSigned);
+            a.cmp(R::rax, R::rcx);
+
+            const X86_64Cond signedConds[] = { X86_64Cond::l, X86_64Cond::le, X86_64Cond::g, X86_64Cond::ge, X86_64Cond::e, X86_64Cond::ne };
+            const X86_64Cond unsignedConds[] = { X86_64Cond::b, X86_64Cond::be, X86_64Cond::a, X86_64Cond::ae, X86_64Cond::e, X86_64Cond::ne };
+            X86_64Cond cond = isSigned ? signedConds[relation] : unsignedConds[relation];
+
+            if (branch) {
+                // Jumps when the comparison is false
+                jumps.push({ a.jcc(X86_64Cond(u8(cond) ^ 1)), i.operands[0] });
+                return;
+            }
+
+            a.setcc(cond, R::rax);
+            a.movzx8(R::rax, R::rax);
+            a.store(R::rbx, x86_64Slot(i.operands[0]), R::rax);
+            return;
+        }
+
+        u32 floatSize = type == 2 ? sizeof(f32) : sizeof(f64);
+        x86_64LoadFloat(a, 0, i, 1, immA, floatSize);
+        x86_64LoadFloat(a, 1, i, 2, immB, floatSize);
+
+        // Unordered comparisons set ZF, PF and CF, so 'above' and 'above or equal' are false when
+        // either operand is NaN. Less than is tested as greater than with the operands swapped
+        switch (relation) {
+            case 0: { a.ucomis(1, 0, floatSize); a.setcc(X86_64Cond::a, R::rax); break; }
+            case 1: { a.ucomis(1, 0, floatSize); a.setcc(X86_64Cond::ae, R::rax); break; }
+            case 2: { a.ucomis(0, 1, floatSize); a.setcc(X86_64Cond::a, R::rax); break; }
+            case 3: { a.ucomis(0, 1, floatSize); a.setcc(X86_64Cond::ae, R::rax); break; }
+            case 4: {
+                a.ucomis(0, 1, floatSize);
+                a.setcc(X86_64Cond::e, R::rax);
+                a.setcc(X86_64Cond::np, R::rcx);
+                a.and8(R::rax, R::rcx);
+                break;
+            }
+            default: {
+                a.ucomis(0, 1, floatSize);
+                a.setcc(X86_64Cond::ne, R::rax);
+                a.setcc(X86_64Cond::p, R::rcx);
+                a.or8(R::rax, R::rcx);
+                break;
+            }
+        }
+
+        a.movzx8(R::rax, R::rax);
+
+        if (branch) {
+            a.test(R::rax, R::rax);
+            jumps.push({ a.jcc(X86_64Cond::e), i.operands[0] });
+            return;
+        }
+
+        a.store(R::rbx, x86_64Slot(i.operands[0]), R::rax);
+    }
+
+    // Converts between two of the types of TestValueType, 'from' and 'to' are indices into
+    // CODEGEN_TEST_CVT_TYPES. Returns false for the conversions between u64 and floating point,
+    // which have no instruction and are left to the helper
+    bool x86_64Convert(X86_64Assembler& a, const TestInstruction& i) {
+        const u32 sizes[] = { 1, 2, 4, 8, 1, 2, 4, 8, 4, 8 };
+        u32 index = u32(i.op) - u32(TestOp::cvt_i8_i8);
+        u32 from = index / 10;
+        u32 to = index % 10;
+        bool fromFloat = from >= 8;
+        bool toFloat = to >= 8;
+        if ((from == 7 && toFloat) || (fromFloat && to == 7)) return false;
+
+        i32 dst = x86_64Slot(i.operands[0]);
+        i32 src = x86_64Slot(i.operands[1]);
+        u32 toSize = sizes[to];
+
+        if (fromFloat) a.movs(0, R::rbx, src, sizes[from]);
+        else if (from < 4) a.loadSigned(R::rax, R::rbx, src, sizes[from]);
+        else a.load(R::rax, R::rbx, src, sizes[from]);
+
+        if (toFloat) {
+            if (!fromFloat) a.cvtsi2s(0, R::rax, sizeof(u64), toSize);
+            else if (from != to) a.cvts2s(0, 0, sizes[from]);
+            a.movs(R::rbx, dst, 0, toSize);
+            return true;
+        }
+
+        // Truncated the same way the host compiler does it, 32 bits wide unless the result needs more
+        if (fromFloat) a.cvtts2si(R::rax, 0, sizes[from], toSize == sizeof(u64) || to == 6 ? sizeof(u64) : sizeof(u32));
+
+        // Unsigned results are zero extended to the whole register, the others only write their own bytes
+        if (to >= 4 && toSize < sizeof(u64)) {
+            a.xor_(R::rcx, R::rcx);
+            a.store(R::rbx, dst, R::rcx);
+        }
+
+        a.store(R::rbx, dst, R::rax, toSize);
+        return true;
+    }
+
+    // Zeroes 'size' bytes of the frame starting at rbx + disp, rax must be zero. Clobbers rcx and rdi
+    void x86_64Clear(X86_64Assembler& a, i32 disp, u32 size) {
+        if (size > 256) {
+            a.lea(R::rdi, R::rbx, disp);
+            a.mov(R::rcx, u64(size));
+            a.repStosb();
+            return;
+        }
+
+        u32 o = 0;
+        for (;o + sizeof(u64) <= size;o += sizeof(u64)) a.store(R::rbx, disp + i32(o), R::rax);
+        for (;o < size;o++) a.store(R::rbx, disp + i32(o), R::rax, sizeof(u8));
+    }
+
+    // Clears the frame and writes the 'this' pointer and arguments from the argument pointers in rsi
+    // into their registers, the same way as TestBytecode::clearFrame and loadArguments do
+    void x86_64EnterFrame(X86_64Assembler& a, const TestBytecode* bc) {
+        a.xor_(R::rax, R::rax);
+        x86_64Clear(a, 0, bc->registerCount * sizeof(u64));
+        x86_64Clear(a, i32(bc->stackOffset), bc->stackSize);
+
+        u32 off = 0;
+        if (bc->takesThis) {
+            if (bc->thisRegister != NullRegister) {
+                a.load(R::rax, R::rsi, 0);
+                a.store(R::rbx, x86_64Slot(bc->thisRegister), R::rax);
+            }
+            off++;
+        }
+
+        for (u32 arg = 0;arg < bc->argRegisters.size();arg++) {
+            i32 slot = x86_64Slot(bc->argRegisters[arg]);
+            a.load(R::rcx, R::rsi, i32((arg + off) * sizeof(void*)));
+
+            if (bc->argSizes[arg] == 0) {
+                a.store(R::rbx, slot, R::rcx);
+                continue;
+            }
+
+            a.load(R::rax, R::rcx, 0, bc->argSizes[arg]);
+            a.store(R::rbx, slot, R::rax, bc->argSizes[arg]);
+        }
+    }
+
+    // Computes the address used by the indexed loads and stores in rcx
+    void x86_64IndexedAddress(X86_64Assembler& a, const TestInstruction& i) {
+        a.load(R::rcx, R::rbx, x86_64Slot(i.operands[1]));
+        a.add(R::rcx, R::rbx, x86_64Slot(i.operands[2]));
+
+        if (i.imm.i != i64(i32(i.imm.i))) {
+            a.mov(R::rdx, i.imm.u);
+            a.add(R::rcx, R::rdx);
+        }
+    }
+
+    i32 x86_64IndexedDisplacement(const TestInstruction& i) {
+        return i.imm.i == i64(i32(i.imm.i)) ? i32(i.imm.i) : 0;
+    }
+
+    // Generates the code of one instruction. 'reenter' is where the frame is set up for a new call
+    // of the function with the argument pointers in rsi
+    void x86_64Instruction(X86_64Assembler& a, const TestBytecode* bc, const TestInstruction& i, u32 reenter, Array<x86_64_jump>& jumps, Array<u32>& errorJumps) {
+        TestOp op = i.op;
+        u32 exit = bc->code.size();
+
+        if (op >= TestOp::cvt_i8_i8 && op <= TestOp::cvt_f64_f64) {
+            if (!x86_64Convert(a, i)) x86_64HelperCall(a, x86_64Operation, i, errorJumps);
+            return;
+        }
+
+        if ((op >= TestOp::vneg && op <= TestOp::vcross) || (op >= TestOp::vset_v && op <= TestOp::vmod_s)) {
+            x86_64HelperCall(a, x86_64Operation, i, errorJumps);
+            return;
+        }
+
+        if (op >= TestOp::mov_r && op <= TestOp::_not32_i) {
+            // Unary operations come in '_r' and '_i' pairs
+            bool immediate = (u32(op) - u32(TestOp::mov_r)) % 2 == 1;
+            TestOp base = TestOp(u32(op) - (immediate ? 1 : 0));
+
+            bool writesOp0 = base != TestOp::param_r && base != TestOp::param_ptr_r && base != TestOp::store8_r &&
+                             base != TestOp::store16_r && base != TestOp::store32_r && base != TestOp::store64_r &&
+                             base != TestOp::ret8_r && base != TestOp::ret16_r && base != TestOp::ret32_r &&
+                             base != TestOp::ret64_r;
+            u32 src = writesOp0 ? 1 : 0;
+
+            if (immediate) a.mov(R::rax, i.imm.u);
+            else a.load(R::rax, R::rbx, x86_64Slot(i.operands[src]));
+
+            i32 dst = x86_64Slot(i.operands[0]);
+            u32 size = sizeof(u64);
+            switch (base) {
+                case TestOp::mov_r: break;
+                case TestOp::_not_r:
+                case TestOp::_not8_r:
+                case TestOp::_not16_r:
+                case TestOp::_not32_r: {
+                    u32 width = sizeof(u64);
+                    if (base == TestOp::_not8_r) width = sizeof(u8);
+                    else if (base == TestOp::_not16_r) width = sizeof(u16);
+                    else if (base == TestOp::_not32_r) width = sizeof(u32);
+
+                    a.test(R::rax, R::rax, width);
+                    a.setcc(X86_64Cond::e, R::rax);
+                    a.movzx8(R::rax, R::rax);
+                    break;
+                }
+                case TestOp::inv_r: { a.not_(R::rax); break; }
+                case TestOp::ineg_r: { a.neg(R::rax); break; }
+                case TestOp::fneg_r: {
+                    a.mov(R::rcx, u64(0x80000000));
+                    a.xor_(R::rax, R::rcx);
+                    size = sizeof(f32);
+                    break;
+                }
+                case TestOp::dneg_r: { a.btc63(R::rax); break; }
+                case TestOp::param_r:
+                case TestOp::param_ptr_r: {
+                    i32 param = i32(bc->paramsOffset + i.operands[1] * sizeof(u64));
+                    i32 argPointer = i32(bc->argPointersOffset + (i.operands[1] + 1) * sizeof(void*));
+                    a.store(R::rbx, param, R::rax);
+
+                    if (base == TestOp::param_r) {
+                        a.lea(R::rcx, R::rbx, param);
+                        a.store(R::rbx, argPointer, R::rcx);
+                    } else a.store(R::rbx, argPointer, R::rax);
+                    return;
+                }
+                case TestOp::store8_r:
+                case TestOp::store16_r:
+                case TestOp::store32_r:
+                case TestOp::store64_r: {
+                    size = 1 << ((u32(base) - u32(TestOp::store8_r)) / 2);
+                    a.load(R::rcx, R::rbx, x86_64Slot(i.operands[1]));
+                    a.store(R::rcx, i32(i.operands[2]), R::rax, size);
+                    return;
+                }
+                case TestOp::ret8_r:
+                case TestOp::ret16_r:
+                case TestOp::ret32_r:
+                case TestOp::ret64_r: {
+                    size = 1 << ((u32(base) - u32(TestOp::ret8_r)) / 2);
+                    a.load(R::rcx, R::r12, X86_64ReturnPtrOffset);
+                    a.store(R::rcx, 0, R::rax, size);
+                    jumps.push({ a.jmp(), exit });
+                    return;
+                }
+                default: {
+                    throw Exception(String::Format(
+                        "X86_64CallHandler - Unsupported unary operation '%s'",
+                        TestBytecode::OpName(op)
+                    ));
+                }
+            }
+
+            // Results are written with the same width as the interpreter writes them
+            a.store(R::rbx, dst, R::rax, size);
+            return;
+        }
+
+        if (op >= TestOp::shl_rr && op < TestOp::shl8_rr) {
+            if (op >= TestOp::fmod_rr && op <= TestOp::fmod_ir) {
+                x86_64HelperCall(a, x86_64Operation, i, errorJumps);
+                return;
+            }
+
+            if (op >= TestOp::dmod_rr && op <= TestOp::dmod_ir) {
+                x86_64HelperCall(a, x86_64Operation, i, errorJumps);
+                return;
+            }
+
+            u32 index = u32(op) - u32(TestOp::shl_rr);
+            x86_64Binary(a, i, TestOp(u32(TestOp::shl_rr) + index / 3 * 3), index % 3, sizeof(u64));
+            return;
+        }
+
+        if (op >= TestOp::shl8_rr && op < TestOp::ilt_rr) {
+            // name8 forms, name16 forms, name32 forms for each name
+            u32 index = u32(op) - u32(TestOp::shl8_rr);
+            u32 size = 1 << ((index / 3) % 3);
+            x86_64Binary(a, i, x86_64NarrowBinaryOps[index / 9], index % 3, size);
+            return;
+        }
+
+        if (op >= TestOp::ilt_rr && op < TestOp::ilt8_rr) {
+            u32 index = u32(op) - u32(TestOp::ilt_rr);
+            x86_64Compare(a, i, TestOp(u32(TestOp::ilt_rr) + index / 6 * 6), index % 6, sizeof(u64), jumps);
+            return;
+        }
+
+        if (op >= TestOp::ilt8_rr) {
+            u32 index = u32(op) - u32(TestOp::ilt8_rr);
+            u32 size = 1 << ((index / 6) % 3);
+            x86_64Compare(a, i, x86_64NarrowCompareOps[index / 18], index % 6, size, jumps);
+            return;
+        }
+
+        switch (op) {
+            case TestOp::noop: break;
+            case TestOp::stack_ptr: {
+                a.lea(R::rax, R::rbx, i32(bc->stackOffset + i.operands[1]));
+                a.store(R::rbx, x86_64Slot(i.operands[0]), R::rax);
+                break;
+            }
+            case TestOp::value_ptr: {
+                a.mov(R::rax, i.imm.u);
+                a.store(R::rbx, x86_64Slot(i.operands[0]), R::rax);
+                break;
+            }
+            case TestOp::ret_ptr: {
+                a.load(R::rax, R::r12, X86_64ReturnPtrOffset);
+                a.store(R::rbx, x86_64Slot(i.operands[0]), R::rax);
+                break;
+            }
+            case TestOp::load8:
+            case TestOp::load16:
+            case TestOp::load32:
+            case TestOp::load64: {
+                u32 size = 1 << (u32(op) - u32(TestOp::load8));
+                a.load(R::rcx, R::rbx, x86_64Slot(i.operands[1]));
+                a.load(R::rax, R::rcx, i32(i.operands[2]), size);
+                a.store(R::rbx, x86_64Slot(i.operands[0]), R::rax);
+                break;
+            }
+            case TestOp::load8_x:
+            case TestOp::load16_x:
+            case TestOp::load32_x:
+            case TestOp::load64_x: {
+                u32 size = 1 << (u32(op) - u32(TestOp::load8_x));
+                x86_64IndexedAddress(a, i);
+                a.load(R::rax, R::rcx, x86_64IndexedDisplacement(i), size);
+                a.store(R::rbx, x86_64Slot(i.operands[0]), R::rax);
+                break;
+            }
+            case TestOp::store8_x:
+            case TestOp::store16_x:
+            case TestOp::store32_x:
+            case TestOp::store64_x: {
+                u32 size = 1 << (u32(op) - u32(TestOp::store8_x));
+                x86_64IndexedAddress(a, i);
+                a.load(R::rax, R::rbx, x86_64Slot(i.operands[0]));
+                a.store(R::rcx, x86_64IndexedDisplacement(i), R::rax, size);
+                break;
+            }
+            case TestOp::jump: {
+                jumps.push({ a.jmp(), i.operands[0] });
+                break;
+            }
+            case TestOp::branch8:
+            case TestOp::branch16:
+            case TestOp::branch32:
+            case TestOp::branch: {
+                u32 size = 1 << (u32(op) - u32(TestOp::branch8));
+                a.load(R::rax, R::rbx, x86_64Slot(i.operands[0]), size);
+                a.test(R::rax, R::rax);
+                jumps.push({ a.jcc(X86_64Cond::e), i.operands[1] });
+                break;
+            }
+            case TestOp::call:
+            case TestOp::tail_call: {
+                const TestCallSite* site = (const TestCallSite*)i.meta;
+                if (site->function != bc->function || site->passesThis) {
+                    x86_64HelperCall(a, x86_64Call, i, errorJumps);
+                    break;
+                }
+
+                // Calls of the code to itself always run this code, as they do when it's interpreted
+                a.lea(R::rsi, R::rbx, i32(bc->argPointersOffset + sizeof(void*)));
+
+                if (op == TestOp::tail_call) {
+                    // The frame is reused, so tail recursion runs in constant stack space
+                    a.patch(a.jmp(), reenter);
+                    break;
+                }
+
+                if (site->returnsInRegister) a.lea(R::rdi, R::rbx, x86_64Slot(i.operands[1]));
+                else a.load(R::rdi, R::rbx, x86_64Slot(i.operands[1]));
+                a.load(R::rdx, R::r12, X86_64ErrorOffset);
+                a.patch(a.call(), 0);
+                a.test(R::rax, R::rax, sizeof(u32));
+                errorJumps.push(a.jcc(X86_64Cond::ne));
+                break;
+            }
+            case TestOp::call_r:
+            case TestOp::tail_call_r: {
+                x86_64HelperCall(a, x86_64Call, i, errorJumps);
+                break;
+            }
+            case TestOp::ret: {
+                jumps.push({ a.jmp(), exit });
+                break;
+            }
+            case TestOp::iinc:
+            case TestOp::uinc: { a.inc(R::rbx, x86_64Slot(i.operands[0])); break; }
+            case TestOp::idec:
+            case TestOp::udec: { a.dec(R::rbx, x86_64Slot(i.operands[0])); break; }
+            case TestOp::finc:
+            case TestOp::fdec:
+            case TestOp::dinc:
+            case TestOp::ddec: {
+                bool isDouble = op == TestOp::dinc || op == TestOp::ddec;
+                u32 size = isDouble ? sizeof(f64) : sizeof(f32);
+                f32 oneF = 1.0f;
+                f64 oneD = 1.0;
+                u64 one = 0;
+                if (isDouble) memcpy(&one, &oneD, sizeof(f64));
+                else memcpy(&one, &oneF, sizeof(f32));
+
+                a.movs(0, R::rbx, x86_64Slot(i.operands[0]), size);
+                a.mov(R::rax, one);
+                a.movToXmm(1, R::rax, size);
+                if (op == TestOp::finc || op == TestOp::dinc) a.adds(0, 1, size);
+                else a.subs(0, 1, size);
+                a.movs(R::rbx, x86_64Slot(i.operands[0]), 0, size);
+                break;
+            }
+            default: {
+                throw Exception(String::Format(
+                    "X86_64CallHandler - Unsupported operation '%s'",
+                    TestBytecode::OpName(op)
+                ));
+            }
+        }
+    }
+    #endif
+
+    X86_64CallHandler::X86_64CallHandler(CodeHolder* ch)
+        : ICallHandler(ch->owner->getFunction()), m_code(new TestBytecode(ch)), m_native(nullptr), m_nativeSize(0)
+    {
+        try {
+            generate();
+        } catch (...) {
+            delete m_code;
+            m_code = nullptr;
+            throw;
+        }
+    }
+
+    X86_64CallHandler::~X86_64CallHandler() {
+        #ifdef CODEGEN_X86_64_NATIVE
+        if (m_native) munmap(m_native, m_nativeSize);
+        #endif
+
+        m_native = nullptr;
+        m_nativeSize = 0;
+
+        if (m_code) delete m_code;
+        m_code = nullptr;
+    }
+
+    void X86_64CallHandler::generate() {
+        #ifdef CODEGEN_X86_64_NATIVE
+        X86_64Assembler a;
+        Array<u32> labels;
+        Array<x86_64_jump> jumps;
+        Array<u32> errorJumps;
+
+        // The context and the frame are allocated on the native stack, below the saved registers.
+        // Their size is rounded up so the stack stays aligned to 16 bytes for the helper calls
+        u32 frameSize = (sizeof(x86_64_context) + m_code->frameSize + 15) & ~u32(15);
+
+        a.push(R::rbp);
+        a.mov(R::rbp, R::rsp);
+        a.push(R::rbx);
+        a.push(R::r12);
+
+        // Each page is touched on the way down, so a large frame can't skip over the guard page
+        u32 remaining = frameSize;
+        for (;remaining > 4096;remaining -= 4096) {
+            a.sub(R::rsp, 4096);
+            a.store(R::rsp, 0, R::rax);
+        }
+        a.sub(R::rsp, i32(remaining));
+
+        // r12 holds the context and rbx the registers for the whole function
+        a.mov(R::r12, R::rsp);
+        a.lea(R::rbx, R::r12, sizeof(x86_64_context));
+        a.store(R::r12, X86_64RegistersOffset, R::rbx);
+        a.store(R::r12, X86_64ReturnPtrOffset, R::rdi);
+        a.mov(R::rax, reinterpret_cast<u64>(m_code));
+        a.store(R::r12, X86_64CodeOffset, R::rax);
+        a.store(R::r12, X86_64ErrorOffset, R::rdx);
+
+        u32 reenter = a.size();
+        x86_64EnterFrame(a, m_code);
+
+        for (u32 i = 0;i < m_code->code.size();i++) {
+            labels.push(a.size());
+            x86_64Instruction(a, m_code, m_code->code[i], reenter, jumps, errorJumps);
+        }
+
+        // Successful exit, which is also where falling off the end of the code goes
+        labels.push(a.size());
+        a.mov(R::rax, u64(0));
+        a.lea(R::rsp, R::rbp, -2 * i32(sizeof(u64)));
+        a.pop(R::r12);
+        a.pop(R::rbx);
+        a.pop(R::rbp);
+        a.ret();
+
+        u32 errorExit = a.size();
+        a.mov(R::rax, u64(1));
+        a.lea(R::rsp, R::rbp, -2 * i32(sizeof(u64)));
+        a.pop(R::r12);
+        a.pop(R::rbx);
+        a.pop(R::rbp);
+        a.ret();
+
+        for (const x86_64_jump& j : jumps) a.patch(j.at, labels[j.target]);
+        for (u32 at : errorJumps) a.patch(at, errorExit);
+
+        void* mem = mmap(nullptr, a.size(), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mem == MAP_FAILED) {
+            throw Exception(String::Format(
+                "X86_64CallHandler - Failed to allocate %u bytes of memory for the code of function '%s'",
+                a.size(),
+                m_target->getSymbolName().c_str()
+            ));
+        }
+
+        memcpy(mem, a.data(), a.size());
+
+        if (mprotect(mem, a.size(), PROT_READ | PROT_EXEC) != 0) {
+            munmap(mem, a.size());
+            throw Exception(String::Format(
+                "X86_64CallHandler - Failed to make the code of function '%s' executable",
+                m_target->getSymbolName().c_str()
+            ));
+        }
+
+        m_native = mem;
+        m_nativeSize = a.size();
+        #else
+        throw Exception("X86_64CallHandler - Native code can't be executed on this host");
+        #endif
+    }
+
+    void X86_64CallHandler::call(void* retDest, void** args) {
+        std::exception_ptr error;
+        if (((x86_64_entry)m_native)(retDest, args, &error) != 0) std::rethrow_exception(error);
+    }
+
+    const TestBytecode* X86_64CallHandler::getCode() const {
+        return m_code;
+    }
+
+    const void* X86_64CallHandler::getNativeCode() const {
+        return m_native;
+    }
+
+    u32 X86_64CallHandler::getNativeCodeSize() const {
+        return m_nativeSize;
+    }
+
+    X86_64Backend::X86_64Backend() {
+    }
+
+    X86_64Backend::~X86_64Backend() {
+    }
+
+    bool X86_64Backend::transform(CodeHolder* processedCode) {
+        if (!IsSupported()) return false;
+
+        installCallHandler(processedCode->owner->getFunction(), new X86_64CallHandler(processedCode));
+        return true;
+    }
+
+    bool X86_64Backend::IsSupported() {
+        #ifdef CODEGEN_X86_64_NATIVE
+        return true;
+        #else
+        return false;
+        #endif
+    }
+};
@@ -1,10 +1,15 @@
 #include <codegen/interfaces/IBackend.h>
 #include <codegen/CodeHolder.h>
 #include <codegen/FunctionBuilder.h>
+#include <bind/Function.h>
+#include <utils/Exception.h>
 #include <utils/Array.hpp>
 
 namespace codegen {
-    IBackend::IBackend() {
+    // Stub of the function that the calling thread is compiling lazily
+    thread_local LazyCallHandler* compilingStub = nullptr;
+
+    IBackend::IBackend() : m_lazyCompilation(false) {
     }
 
     IBackend::~IBackend() {
@@ -15,12 +20,30 @@ namespace codegen {
     }
 
     bool IBackend::process(FunctionBuilder* input, u32 postProcessMask) {
+        if (m_lazyCompilation) {
+            Function* fn = input->getFunction();
+            fn->setCallHandler(new LazyCallHandler(this, input, postProcessMask));
+            return true;
+        }
+
+        return compile(input, postProcessMask);
+    }
+
+    void IBackend::setLazyCompilation(bool lazy) {
+        m_lazyCompilation = lazy;
+    }
+
+    bool IBackend::isLazyCompilationEnabled() const {
+        return m_lazyCompilation;
+    }
+
+    bool IBackend::compile(FunctionBuilder* input, u32 postProcessMask) {
         CodeHolder ch(input->getCode());
         ch.owner = input;
         ch.rebuildAll();
 
         if (!onBeforePostProcessing(&ch)) return false;
-        
+
         for (IPostProcessStep* step : m_postProcesses) {
             for (BasicBlock& b : ch.cfg.blocks) {
                 while (step->execute(&ch, &b, postProcessMask));
@@ -34,6 +57,83 @@ namespace codegen {
         return transform(&ch);
     }
 
+    void IBackend::installCallHandler(Function* fn, ICallHandler* handler) {
+        if (compilingStub && compilingStub->m_backend == this && compilingStub->m_target == fn) {
+            compilingStub->m_installed = handler;
+            return;
+        }
+
+        fn->setCallHandler(handler);
+    }
+
     bool IBackend::onBeforePostProcessing(CodeHolder* ch) { return true; }
     bool IBackend::onAfterPostProcessing(CodeHolder* ch) { return true; }
-};
\ No newline at end of file
+
+    LazyCallHandler::LazyCallHandler(IBackend* backend, FunctionBuilder* input, u32 postProcessMask)
+        : ICallHandler(input->getFunction()), m_backend(backend), m_input(input), m_postProcessMask(postProcessMask),
+          m_installed(nullptr), m_handler(nullptr)
+    {
+    }
+
+    LazyCallHandler::~LazyCallHandler() {
+        ICallHandler* handler = m_handler.load(std::memory_order_acquire);
+        if (handler) delete handler;
+    }
+
+    void LazyCallHandler::call(void* retDest, void** args) {
+        ICallHandler* handler = m_handler.load(std::memory_order_acquire);
+        if (!handler) handler = compile();
+
+        handler->call(retDest, args);
+    }
+
+    bool LazyCallHandler::isCompiled() const {
+        return m_handler.load(std::memory_order_acquire) != nullptr;
+    }
+
+    ICallHandler* LazyCallHandler::getCompiledHandler() const {
+        return m_handler.load(std::memory_order_acquire);
+    }
+
+    ICallHandler* LazyCallHandler::compile() {
+        std::lock_guard<std::mutex> lock(m_backend->m_lazyCompileLock);
+
+        // Another thread may have compiled the function while this one was waiting
+        ICallHandler* handler = m_handler.load(std::memory_order_acquire);
+        if (handler) return handler;
+
+        LazyCallHandler* prevStub = compilingStub;
+        compilingStub = this;
+        bool compiled = false;
+
+        try {
+            compiled = m_backend->compile(m_input, m_postProcessMask);
+        } catch (...) {
+            compilingStub = prevStub;
+            throw;
+        }
+
+        compilingStub = prevStub;
+
+        if (!compiled) {
+            throw Exception(String::Format(
+                "LazyCallHandler - Failed to compile function '%s'",
+                m_target->getSymbolName().c_str()
+            ));
+        }
+
+        // The function keeps this handler, which forwards calls to the compiled one
+        handler = m_installed;
+        if (!handler) {
+            throw Exception(String::Format(
+                "LazyCallHandler - Backend did not produce a call handler for function '%s'",
+                m_target->getSymbolName().c_str()
+            ));
+        }
+
+        m_input = nullptr;
+        m_handler.store(handler, std::memory_order_release);
+
+        return handler;
+    }
+};
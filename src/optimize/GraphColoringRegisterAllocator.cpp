@@ -0,0 +1,282 @@
+#include <codegen/optimize/GraphColoringRegisterAllocator.h>
+#include <codegen/CodeHolder.h>
+#include <codegen/IR.h>
+#include <codegen/Value.h>
+#include <codegen/FunctionBuilder.h>
+#include <bind/Function.h>
+
+#include <utils/Array.hpp>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace codegen {
+    constexpr u32 NoColor = 0xFFFFFFFF;
+
+    u64 interferenceKey(u32 a, u32 b) {
+        return a < b ? (u64(a) << 32) | b : (u64(b) << 32) | a;
+    }
+
+    GraphColoringRegisterAllocatorStep::GraphColoringRegisterAllocatorStep(const PhysicalRegisterSet& registers)
+        : RegisterAllocatorStep(registers)
+    {
+    }
+
+    GraphColoringRegisterAllocatorStep::~GraphColoringRegisterAllocatorStep() {
+    }
+
+    void GraphColoringRegisterAllocatorStep::allocate(CodeHolder* ch, Array<RegisterInterval>& intervals) {
+        IWithLogging* log = ch->owner;
+        u32 nodeCount = intervals.size();
+
+        std::unordered_map<vreg_id, u32> nodeMap;
+        for (u32 n = 0;n < nodeCount;n++) nodeMap[intervals[n].reg_id] = n;
+
+        auto nodeOf = [&nodeMap](const Value& v) {
+            if (!v.isReg()) return NoColor;
+            auto it = nodeMap.find(v.getRegisterId());
+            return it == nodeMap.end() ? NoColor : it->second;
+        };
+
+        // Loop depth of each instruction, from the backward jumps
+        Array<u32> depth;
+        for (address c = 0;c < ch->code.size();c++) depth.push(0);
+
+        for (address c = 0;c < ch->code.size();c++) {
+            const Instruction& i = ch->code[c];
+
+            address target = c + 1;
+            if (i.op == OpCode::jump) target = ch->labels.get(i.operands[0].getImm());
+            else if (i.op == OpCode::branch) target = ch->labels.get(i.operands[1].getImm());
+
+            for (address l = target;l <= c;l++) depth[l]++;
+        }
+
+        Array<f64> costs;
+        for (u32 n = 0;n < nodeCount;n++) costs.push(0.0);
+
+        struct move {
+            u32 dst;
+            u32 src;
+        };
+
+        Array<move> moves;
+        std::unordered_set<u64> exempt;
+
+        for (address c = 0;c < ch->code.size();c++) {
+            const Instruction& i = ch->code[c];
+
+            f64 weight = 1.0;
+            for (u32 d = 0;d < depth[c] && d < 8;d++) weight *= 10.0;
+
+            for (u32 o = 0;o < 3;o++) {
+                u32 n = nodeOf(i.operands[o]);
+                if (n != NoColor) costs[n] += weight;
+            }
+
+            if (i.op != OpCode::assign && i.op != OpCode::resolve) continue;
+
+            u32 dst = nodeOf(i.operands[0]);
+            u32 src = nodeOf(i.operands[1]);
+            if (dst == NoColor || src == NoColor || dst == src) continue;
+            if (intervals[dst].is_fp != intervals[src].is_fp) continue;
+
+            moves.push({ dst, src });
+
+            // The source's value is copied to the destination as the source dies, so they may share a register
+            if (intervals[src].end == c && intervals[dst].begin == c) exempt.insert(interferenceKey(dst, src));
+        }
+
+        // Build the interference graph
+        Array<std::unordered_set<u32>> adjacent;
+        for (u32 n = 0;n < nodeCount;n++) adjacent.push({});
+
+        Array<u32> order;
+        for (u32 n = 0;n < nodeCount;n++) order.push(n);
+        order.sort([&intervals](u32 a, u32 b) {
+            return intervals[a].begin < intervals[b].begin;
+        });
+
+        for (u32 a = 0;a < order.size();a++) {
+            const RegisterInterval& ia = intervals[order[a]];
+
+            for (u32 b = a + 1;b < order.size();b++) {
+                const RegisterInterval& ib = intervals[order[b]];
+                if (ib.begin > ia.end) break;
+                if (ia.is_fp != ib.is_fp) continue;
+                if (exempt.count(interferenceKey(order[a], order[b])) > 0) continue;
+
+                adjacent[order[a]].insert(order[b]);
+                adjacent[order[b]].insert(order[a]);
+            }
+        }
+
+        auto colorCount = [this, &intervals](u32 n) {
+            return intervals[n].is_fp ? m_registers.fprs.size() : m_registers.gprs.size();
+        };
+
+        // Coalesce moves, a node is merged into another by pointing its alias at it
+        Array<u32> alias;
+        for (u32 n = 0;n < nodeCount;n++) alias.push(n);
+
+        auto find = [&alias](u32 n) {
+            while (alias[n] != n) n = alias[n];
+            return n;
+        };
+
+        u32 coalesced = 0;
+        bool changed = moves.size() > 0;
+        while (changed) {
+            changed = false;
+
+            for (u32 m = 0;m < moves.size();m++) {
+                u32 a = find(moves[m].dst);
+                u32 b = find(moves[m].src);
+                if (a == b || adjacent[a].count(b) > 0) continue;
+
+                // vregs which hold spilled values must stay short
+                if (!intervals[a].spillable || !intervals[b].spillable) continue;
+
+                // Briggs: the merged node must have fewer than K neighbors of significant degree
+                u32 k = colorCount(a);
+                u32 significant = 0;
+                std::unordered_set<u32> neighbors = adjacent[a];
+                for (u32 n : adjacent[b]) neighbors.insert(n);
+
+                for (u32 n : neighbors) {
+                    u32 degree = adjacent[n].size();
+                    if (adjacent[n].count(a) > 0 && adjacent[n].count(b) > 0) degree--;
+                    if (degree >= k) significant++;
+                }
+
+                if (significant >= k) continue;
+
+                for (u32 n : adjacent[b]) {
+                    adjacent[n].erase(b);
+                    adjacent[n].insert(a);
+                    adjacent[a].insert(n);
+                }
+
+                adjacent[b].clear();
+                alias[b] = a;
+                costs[a] += costs[b];
+                coalesced++;
+                changed = true;
+            }
+        }
+
+        // Simplify, nodes are removed from the graph and pushed onto the stack in the order that
+        // they'll be colored in reverse
+        Array<u32> degrees;
+        Array<u8> removed;
+        u32 remaining = 0;
+        for (u32 n = 0;n < nodeCount;n++) {
+            degrees.push(adjacent[n].size());
+            removed.push(find(n) != n);
+            if (!removed[n]) remaining++;
+        }
+
+        Array<u32> stack;
+        auto remove = [&](u32 n) {
+            stack.push(n);
+            removed[n] = 1;
+            remaining--;
+            for (u32 a : adjacent[n]) {
+                if (!removed[a]) degrees[a]--;
+            }
+        };
+
+        while (remaining > 0) {
+            bool simplified = false;
+            for (u32 n = 0;n < nodeCount;n++) {
+                if (removed[n] || degrees[n] >= colorCount(n)) continue;
+                remove(n);
+                simplified = true;
+            }
+
+            if (simplified) continue;
+
+            // Every remaining node has at least K neighbors, the cheapest to spill is pushed and
+            // colored optimistically
+            u32 candidate = NoColor;
+            for (u32 n = 0;n < nodeCount;n++) {
+                if (removed[n]) continue;
+                if (candidate == NoColor) {
+                    candidate = n;
+                    continue;
+                }
+
+                const RegisterInterval& in = intervals[n];
+                const RegisterInterval& ic = intervals[candidate];
+                if (in.spillable != ic.spillable) {
+                    if (in.spillable) candidate = n;
+                    continue;
+                }
+
+                if (costs[n] / f64(degrees[n]) < costs[candidate] / f64(degrees[candidate])) candidate = n;
+            }
+
+            remove(candidate);
+        }
+
+        // Select
+        Array<u32> colors;
+        for (u32 n = 0;n < nodeCount;n++) colors.push(NoColor);
+
+        for (u32 s = stack.size();s > 0;s--) {
+            u32 n = stack[s - 1];
+            u32 k = colorCount(n);
+
+            Array<u8> used;
+            for (u32 c = 0;c < k;c++) used.push(0);
+            for (u32 a : adjacent[n]) {
+                if (colors[a] != NoColor) used[colors[a]] = 1;
+            }
+
+            u32 color = 0;
+            while (color < k && used[color]) color++;
+
+            if (color < k) {
+                colors[n] = color;
+                continue;
+            }
+
+            if (intervals[n].spillable) continue;
+
+            // vregs holding spilled values must get a register, spill the cheapest set of neighbors
+            // which share one instead
+            u32 best = NoColor;
+            f64 bestCost = 0.0;
+            for (u32 c = 0;c < k;c++) {
+                f64 cost = 0.0;
+                bool possible = true;
+                for (u32 a : adjacent[n]) {
+                    if (colors[a] != c) continue;
+                    if (!intervals[a].spillable) possible = false;
+                    cost += costs[a];
+                }
+
+                if (possible && (best == NoColor || cost < bestCost)) {
+                    best = c;
+                    bestCost = cost;
+                }
+            }
+
+            if (best == NoColor) continue;
+
+            for (u32 a : adjacent[n]) {
+                if (colors[a] == best) colors[a] = NoColor;
+            }
+
+            colors[n] = best;
+        }
+
+        for (u32 n = 0;n < nodeCount;n++) {
+            RegisterInterval& iv = intervals[n];
+            u32 color = colors[find(n)];
+            if (color == NoColor) iv.physical = NoPhysicalRegister;
+            else iv.physical = iv.is_fp ? m_registers.fprs[color] : m_registers.gprs[color];
+        }
+
+        log->logDebug("GraphColoringRegisterAllocatorStep: %u of %u moves coalesced", coalesced, moves.size());
+    }
+};
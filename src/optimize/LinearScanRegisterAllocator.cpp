@@ -0,0 +1,79 @@
+#include <codegen/optimize/LinearScanRegisterAllocator.h>
+#include <codegen/CodeHolder.h>
+#include <codegen/FunctionBuilder.h>
+#include <bind/Function.h>
+#include <utils/Exception.h>
+
+#include <utils/Array.hpp>
+
+namespace codegen {
+    constexpr u32 NoInterval = 0xFFFFFFFF;
+
+    LinearScanRegisterAllocatorStep::LinearScanRegisterAllocatorStep(const PhysicalRegisterSet& registers)
+        : RegisterAllocatorStep(registers)
+    {
+    }
+
+    LinearScanRegisterAllocatorStep::~LinearScanRegisterAllocatorStep() {
+    }
+
+    void LinearScanRegisterAllocatorStep::allocate(CodeHolder* ch, Array<RegisterInterval>& intervals) {
+        Array<u32> order;
+        for (u32 i = 0;i < intervals.size();i++) order.push(i);
+
+        order.sort([&intervals](u32 a, u32 b) {
+            if (intervals[a].begin != intervals[b].begin) return intervals[a].begin < intervals[b].begin;
+            return intervals[a].end < intervals[b].end;
+        });
+
+        // The interval which holds each register, by register index
+        Array<u32> gprHolders;
+        Array<u32> fprHolders;
+        for (u32 r = 0;r < m_registers.gprs.size();r++) gprHolders.push(NoInterval);
+        for (u32 r = 0;r < m_registers.fprs.size();r++) fprHolders.push(NoInterval);
+
+        for (u32 o = 0;o < order.size();o++) {
+            RegisterInterval& iv = intervals[order[o]];
+            Array<u32>& holders = iv.is_fp ? fprHolders : gprHolders;
+            const Array<u32>& ids = iv.is_fp ? m_registers.fprs : m_registers.gprs;
+
+            // Registers held by intervals which ended before this one began are free again
+            u32 free = NoInterval;
+            for (u32 r = 0;r < holders.size();r++) {
+                if (holders[r] != NoInterval && intervals[holders[r]].end < iv.begin) holders[r] = NoInterval;
+                if (holders[r] == NoInterval && free == NoInterval) free = r;
+            }
+
+            if (free != NoInterval) {
+                holders[free] = order[o];
+                iv.physical = ids[free];
+                continue;
+            }
+
+            // Every register is taken, spill whichever interval ends last
+            u32 victim = NoInterval;
+            for (u32 r = 0;r < holders.size();r++) {
+                const RegisterInterval& held = intervals[holders[r]];
+                if (!held.spillable) continue;
+                if (victim == NoInterval || held.end > intervals[holders[victim]].end) victim = r;
+            }
+
+            if (iv.spillable && (victim == NoInterval || intervals[holders[victim]].end <= iv.end)) {
+                iv.physical = NoPhysicalRegister;
+                continue;
+            }
+
+            if (victim == NoInterval) {
+                throw Exception(String::Format(
+                    "LinearScanRegisterAllocatorStep - Ran out of registers for vreg %u of '%s'",
+                    iv.reg_id,
+                    ch->owner->getFunction()->getSymbolName().c_str()
+                ));
+            }
+
+            intervals[holders[victim]].physical = NoPhysicalRegister;
+            holders[victim] = order[o];
+            iv.physical = ids[victim];
+        }
+    }
+};
@@ -0,0 +1,377 @@
+#include <codegen/optimize/RegisterAllocator.h>
+#include <codegen/CodeHolder.h>
+#include <codegen/IR.h>
+#include <codegen/Value.h>
+#include <codegen/FunctionBuilder.h>
+#include <bind/Function.h>
+#include <bind/DataType.h>
+#include <utils/Exception.h>
+
+#include <utils/Array.hpp>
+#include <unordered_map>
+
+namespace codegen {
+    bool RegisterInterval::isConcurrent(const RegisterInterval& o) const {
+        return begin <= o.end && o.begin <= end;
+    }
+
+    bool isReadModifyWrite(OpCode op) {
+        switch (op) {
+            case OpCode::iinc:
+            case OpCode::uinc:
+            case OpCode::finc:
+            case OpCode::dinc:
+            case OpCode::idec:
+            case OpCode::udec:
+            case OpCode::fdec:
+            case OpCode::ddec: return true;
+            default: return false;
+        }
+    }
+
+    // General purpose registers needed by an instruction once each of its operands is spilled. Every
+    // operand that's read is reloaded through a pointer to its stack slot, which is live along with
+    // the values that were reloaded before it
+    u32 spilledGprCount(const Instruction& i) {
+        u8 assignsIdx = Instruction::Info(i.op).assignsOperandIndex;
+        u32 operands = 0;
+        u32 reads = 0;
+
+        for (u32 o = 0;o < 3;o++) {
+            const Value& v = i.operands[o];
+            if (!v.isReg() || v.getRegisterId() == NullRegister || v.getType()->getInfo().is_floating_point) continue;
+
+            operands++;
+            bool assigned = o == assignsIdx || (i.op == OpCode::resolve && o == 0);
+            if (!assigned || isReadModifyWrite(i.op)) reads++;
+        }
+
+        return reads + 1 > operands ? reads + 1 : operands;
+    }
+
+    RegisterAllocatorStep::RegisterAllocatorStep(const PhysicalRegisterSet& registers)
+        : IPostProcessStep(), m_registers(registers), m_stats({ 0, 0, 0, 0, 0, 0 })
+    {
+    }
+
+    RegisterAllocatorStep::~RegisterAllocatorStep() {
+    }
+
+    bool RegisterAllocatorStep::execute(CodeHolder* ch, u32 mask) {
+        IWithLogging* log = ch->owner;
+
+        u32 requiredGprs = MinRegisters;
+        for (address c = 0;c < ch->code.size();c++) {
+            u32 required = spilledGprCount(ch->code[c]);
+            if (required > requiredGprs) requiredGprs = required;
+        }
+
+        if (m_registers.gprs.size() < requiredGprs || m_registers.fprs.size() < MinRegisters) {
+            throw Exception(String::Format(
+                "RegisterAllocatorStep - At least %u general purpose and %u floating point registers are required for '%s'",
+                requiredGprs,
+                MinRegisters,
+                ch->owner->getFunction()->getSymbolName().c_str()
+            ));
+        }
+
+        log->logDebug("RegisterAllocatorStep: Allocating registers for %s", ch->owner->getFunction()->getSymbolName().c_str());
+
+        RegisterAllocationStats stats = { 1, 0, 0, 0, 0, 0 };
+        Array<RegisterInterval> intervals;
+        m_spillTemps.clear();
+
+        while (true) {
+            stats.roundCount++;
+            computeIntervals(ch, intervals);
+            allocate(ch, intervals);
+
+            u32 spilled = 0;
+            for (u32 i = 0;i < intervals.size();i++) {
+                const RegisterInterval& iv = intervals[i];
+                if (iv.physical != NoPhysicalRegister) continue;
+
+                if (!iv.spillable) {
+                    m_spillTemps.clear();
+                    throw Exception(String::Format(
+                        "RegisterAllocatorStep - Failed to assign a register to vreg %u of '%s', which holds a spilled value",
+                        iv.reg_id,
+                        ch->owner->getFunction()->getSymbolName().c_str()
+                    ));
+                }
+
+                log->logDebug("spill: vreg %u [%u, %u]", iv.reg_id, iv.begin, iv.end);
+                spilled++;
+            }
+
+            if (spilled == 0) break;
+
+            stats.spilledCount += spilled;
+            spill(ch, intervals, stats);
+            ch->rebuildAll();
+        }
+
+        ch->registers.clear();
+        for (u32 i = 0;i < intervals.size();i++) {
+            const RegisterInterval& iv = intervals[i];
+            ch->registers.add({ iv.reg_id, iv.begin, iv.end, iv.is_fp, iv.physical });
+        }
+
+        stats.assignedCount = intervals.size();
+        ch->registers.stats = stats;
+        m_stats.add(stats);
+        m_spillTemps.clear();
+
+        log->logDebug(
+            "RegisterAllocatorStep: %u vregs assigned, %u spilled, %u stores and %u reloads inserted",
+            stats.assignedCount,
+            stats.spilledCount,
+            stats.spillStoreCount,
+            stats.reloadCount
+        );
+
+        return false;
+    }
+
+    const PhysicalRegisterSet& RegisterAllocatorStep::getRegisters() const {
+        return m_registers;
+    }
+
+    const RegisterAllocationStats& RegisterAllocatorStep::getStats() const {
+        return m_stats;
+    }
+
+    void RegisterAllocatorStep::resetStats() {
+        m_stats = { 0, 0, 0, 0, 0, 0 };
+    }
+
+    void RegisterAllocatorStep::computeIntervals(CodeHolder* ch, Array<RegisterInterval>& intervals) {
+        // Each vreg keeps one register for all of its live ranges, so its interval covers all of
+        // them along with every instruction that mentions it
+        intervals.clear();
+        std::unordered_map<vreg_id, u32> intervalMap;
+
+        auto extend = [this, &intervals, &intervalMap](vreg_id reg, address at, bool is_fp) {
+            if (reg == NullRegister) return;
+
+            auto it = intervalMap.find(reg);
+            if (it == intervalMap.end()) {
+                intervalMap[reg] = intervals.size();
+                intervals.push({ reg, at, at, is_fp, m_spillTemps.count(reg) == 0, NoPhysicalRegister });
+                return;
+            }
+
+            RegisterInterval& iv = intervals[it->second];
+            if (at < iv.begin) iv.begin = at;
+            if (at > iv.end) iv.end = at;
+        };
+
+        for (u32 l = 0;l < ch->liveness.lifetimes.size();l++) {
+            const RegisterLifetime& lt = ch->liveness.lifetimes[l];
+            extend(lt.reg_id, lt.begin, lt.is_fp);
+            extend(lt.reg_id, lt.end, lt.is_fp);
+        }
+
+        for (address c = 0;c < ch->code.size();c++) {
+            const Instruction& i = ch->code[c];
+            for (u32 o = 0;o < 3;o++) {
+                if (!i.operands[o].isReg()) continue;
+                extend(i.operands[o].getRegisterId(), c, i.operands[o].getType()->getInfo().is_floating_point == 1);
+            }
+        }
+
+        // A vreg that's live when a loop jumps back to its start, or which is assigned inside a
+        // loop and used after it, must hold its value for the whole loop
+        struct loop_range {
+            address begin;
+            address end;
+        };
+
+        Array<loop_range> loops;
+        for (address c = 0;c < ch->code.size();c++) {
+            const Instruction& i = ch->code[c];
+
+            address target = c + 1;
+            if (i.op == OpCode::jump) target = ch->labels.get(i.operands[0].getImm());
+            else if (i.op == OpCode::branch) target = ch->labels.get(i.operands[1].getImm());
+
+            if (target <= c) loops.push({ target, c });
+        }
+
+        bool changed = loops.size() > 0;
+        while (changed) {
+            changed = false;
+
+            for (u32 r = 0;r < intervals.size();r++) {
+                RegisterInterval& iv = intervals[r];
+
+                for (u32 l = 0;l < loops.size();l++) {
+                    const loop_range& loop = loops[l];
+
+                    if (iv.begin < loop.begin && iv.end >= loop.begin && iv.end < loop.end) {
+                        iv.end = loop.end;
+                        changed = true;
+                    }
+
+                    if (iv.begin > loop.begin && iv.begin <= loop.end && iv.end > loop.end) {
+                        iv.begin = loop.begin;
+                        changed = true;
+                    }
+                }
+            }
+        }
+    }
+
+    void RegisterAllocatorStep::spill(CodeHolder* ch, const Array<RegisterInterval>& intervals, RegisterAllocationStats& stats) {
+        FunctionBuilder* fb = ch->owner;
+
+        struct spill_slot {
+            stack_id id;
+            DataType* type;
+
+            // The slot is allocated before the first of these instructions and freed after the second
+            address allocAt;
+            address freeAt;
+        };
+
+        Array<vreg_id> spilled;
+        std::unordered_map<vreg_id, spill_slot> slots;
+        for (u32 i = 0;i < intervals.size();i++) {
+            const RegisterInterval& iv = intervals[i];
+            if (iv.physical != NoPhysicalRegister) continue;
+
+            spilled.push(iv.reg_id);
+            slots[iv.reg_id] = { fb->reserveAllocId(), nullptr, iv.begin, iv.end };
+        }
+
+        for (address c = 0;c < ch->code.size();c++) {
+            const Instruction& i = ch->code[c];
+            for (u32 o = 0;o < 3;o++) {
+                if (!i.operands[o].isReg()) continue;
+
+                auto it = slots.find(i.operands[o].getRegisterId());
+                if (it != slots.end() && !it->second.type) it->second.type = i.operands[o].getType();
+            }
+        }
+
+        Array<Instruction> code;
+        code.reserve(ch->code.size());
+
+        auto slotPtr = [fb, &code, this](const spill_slot& s) {
+            Value ptr = fb->val((DataType*)s.type->getPointerType());
+            m_spillTemps.insert(ptr.getRegisterId());
+
+            Instruction i(OpCode::stack_ptr);
+            i.operands[0].reset(ptr);
+            i.operands[1].reset(fb->val(s.id));
+            code.push(i);
+
+            return ptr;
+        };
+
+        auto reload = [fb, &code, &slotPtr, &stats](const spill_slot& s, const Value& dest) {
+            Value ptr = slotPtr(s);
+
+            Instruction i(OpCode::load);
+            i.operands[0].reset(dest);
+            i.operands[1].reset(ptr);
+            i.operands[2].reset(fb->val(u32(0)));
+            code.push(i);
+
+            stats.reloadCount++;
+        };
+
+        auto store = [fb, &code, &slotPtr, &stats](const spill_slot& s, const Value& src) {
+            Value ptr = slotPtr(s);
+
+            Instruction i(OpCode::store);
+            i.operands[0].reset(src);
+            i.operands[1].reset(ptr);
+            i.operands[2].reset(fb->val(u32(0)));
+            code.push(i);
+
+            stats.spillStoreCount++;
+        };
+
+        for (address c = 0;c < ch->code.size();c++) {
+            for (u32 s = 0;s < spilled.size();s++) {
+                spill_slot& slot = slots[spilled[s]];
+                if (slot.allocAt != c) continue;
+
+                Instruction i(OpCode::stack_alloc);
+                i.operands[0].reset(fb->val(u32(slot.type->getInfo().size)));
+                i.operands[1].reset(fb->val(slot.id));
+                code.push(i);
+            }
+
+            Instruction i = ch->code[c];
+            u8 assignsIdx = Instruction::Info(i.op).assignsOperandIndex;
+
+            // Backends find the arguments and 'this' by their vregs, so those keep theirs until
+            // they're stored
+            bool keepsRegs = i.op == OpCode::this_ptr || i.op == OpCode::argument;
+
+            // Each spilled vreg mentioned by the instruction is replaced by a new vreg
+            vreg_id regs[3];
+            Value temps[3];
+            bool reads[3] = { false, false, false };
+            bool writes[3] = { false, false, false };
+            u32 count = 0;
+            bool discard = false;
+
+            for (u32 o = 0;o < 3;o++) {
+                if (!i.operands[o].isReg()) continue;
+
+                vreg_id reg = i.operands[o].getRegisterId();
+                auto it = slots.find(reg);
+                if (it == slots.end()) continue;
+
+                // Nothing is stored by reserve, the slot will be written by the resolves
+                if (i.op == OpCode::reserve) {
+                    discard = true;
+                    break;
+                }
+
+                u32 t = 0;
+                while (t < count && regs[t] != reg) t++;
+                if (t == count) {
+                    regs[t] = reg;
+                    count++;
+
+                    if (keepsRegs) temps[t].reset(i.operands[o]);
+                    else temps[t].reset(fb->val(i.operands[o].getType()));
+                    m_spillTemps.insert(temps[t].getRegisterId());
+                }
+
+                bool assigned = o == assignsIdx || (i.op == OpCode::resolve && o == 0);
+                if (assigned) writes[t] = true;
+                if (!assigned || isReadModifyWrite(i.op)) reads[t] = true;
+
+                i.operands[o].reset(temps[t]);
+            }
+
+            if (!discard) {
+                for (u32 t = 0;t < count;t++) {
+                    if (reads[t]) reload(slots[regs[t]], temps[t]);
+                }
+
+                code.push(i);
+
+                for (u32 t = 0;t < count;t++) {
+                    if (writes[t]) store(slots[regs[t]], temps[t]);
+                }
+            }
+
+            for (u32 s = 0;s < spilled.size();s++) {
+                const spill_slot& slot = slots[spilled[s]];
+                if (slot.freeAt != c) continue;
+
+                Instruction f(OpCode::stack_free);
+                f.operands[0].reset(fb->val(slot.id));
+                code.push(f);
+            }
+        }
+
+        ch->code = code;
+    }
+};
@@ -0,0 +1,81 @@
+#include <codegen/optimize/TailCallElimination.h>
+#include <codegen/CodeHolder.h>
+#include <codegen/StackLayout.h>
+#include <codegen/IR.h>
+#include <codegen/Value.h>
+#include <codegen/FunctionBuilder.h>
+#include <bind/Function.h>
+#include <bind/FunctionType.h>
+#include <bind/DataType.h>
+
+#include <utils/Array.hpp>
+
+namespace codegen {
+    bool isTailCallReturnCompatible(DataType* callerRet, DataType* calleeRet) {
+        const type_meta& a = callerRet->getInfo();
+        const type_meta& b = calleeRet->getInfo();
+        if (a.size == 0 || b.size == 0) return a.size == b.size;
+
+        // Only values returned in a register, the callee writes its return value wherever the caller's goes
+        if (!(a.is_primitive || a.is_pointer) || !(b.is_primitive || b.is_pointer)) return false;
+        return a.size == b.size && a.is_floating_point == b.is_floating_point;
+    }
+
+    bool hasLiveStackAllocation(CodeHolder* ch, address at) {
+        const Array<StackAllocation>& allocs = ch->stackLayout.allocations;
+        for (u32 a = 0;a < allocs.size();a++) {
+            if (allocs[a].begin <= at && at <= allocs[a].end) return true;
+        }
+
+        return false;
+    }
+
+    TailCallEliminationStep::TailCallEliminationStep() : IPostProcessStep() {
+    }
+
+    TailCallEliminationStep::~TailCallEliminationStep() {
+    }
+
+    bool TailCallEliminationStep::execute(CodeHolder* ch, u32 mask) {
+        IWithLogging* log = ch->owner;
+        DataType* retTp = ch->owner->getFunction()->getSignature()->getReturnType();
+
+        log->logDebug("TailCallEliminationStep: Analyzing %s", ch->owner->getFunction()->getSymbolName().c_str());
+
+        Array<address> returns;
+        for (address c = 0;c < ch->code.size();c++) {
+            Instruction& i = ch->code[c];
+            if (i.op != OpCode::call) continue;
+
+            address r = c + 1;
+            while (r < ch->code.size() && ch->code[r].op == OpCode::noop) r++;
+            if (r == ch->code.size() || ch->code[r].op != OpCode::ret) continue;
+
+            // The returned value must be exactly what the call produced
+            const Value& result = i.operands[1];
+            const Value& returned = ch->code[r].operands[0];
+            if (result.isEmpty() != returned.isEmpty()) continue;
+            if (!result.isEmpty() && (!returned.isReg() || returned.getRegisterId() != result.getRegisterId())) continue;
+
+            FunctionType* sig = (FunctionType*)i.operands[0].getType();
+            if (!isTailCallReturnCompatible(retTp, sig->getReturnType())) continue;
+
+            // Parameters may point into the caller's stack space, which the callee would replace
+            if (hasLiveStackAllocation(ch, c)) continue;
+
+            log->logDebug("tail call: [%u] %s", c, i.toString().c_str());
+
+            i.op = OpCode::tail_call;
+            i.operands[1].reset(Value());
+            returns.push(r);
+        }
+
+        if (returns.size() == 0) return false;
+
+        // The returns are unreachable now
+        for (u32 r = returns.size();r > 0;r--) ch->code.remove(returns[r - 1]);
+        ch->rebuildAll();
+
+        return false;
+    }
+};
@@ -0,0 +1,43 @@
+#include <codegen/optimize/TieredRegisterAllocator.h>
+#include <codegen/CodeHolder.h>
+#include <codegen/FunctionBuilder.h>
+#include <bind/Function.h>
+
+namespace codegen {
+    TieredRegisterAllocatorStep::TieredRegisterAllocatorStep(RegisterAllocatorStep* defaultAllocator, RegisterAllocatorStep* optimizingAllocator)
+        : IPostProcessStep(), m_default(defaultAllocator), m_optimizing(optimizingAllocator)
+    {
+    }
+
+    TieredRegisterAllocatorStep::~TieredRegisterAllocatorStep() {
+    }
+
+    bool TieredRegisterAllocatorStep::execute(CodeHolder* ch, u32 mask) {
+        IWithLogging* log = ch->owner;
+        Function* fn = ch->owner->getFunction();
+
+        if (isOptimized(fn)) {
+            log->logDebug("TieredRegisterAllocatorStep: Using the optimizing allocator for %s", fn->getSymbolName().c_str());
+            return m_optimizing->execute(ch, mask);
+        }
+
+        return m_default->execute(ch, mask);
+    }
+
+    void TieredRegisterAllocatorStep::setOptimized(Function* fn, bool optimized) {
+        if (optimized) m_optimized.insert(fn);
+        else m_optimized.erase(fn);
+    }
+
+    bool TieredRegisterAllocatorStep::isOptimized(Function* fn) const {
+        return m_optimized.count(fn) > 0;
+    }
+
+    RegisterAllocatorStep* TieredRegisterAllocatorStep::getDefaultAllocator() const {
+        return m_default;
+    }
+
+    RegisterAllocatorStep* TieredRegisterAllocatorStep::getOptimizingAllocator() const {
+        return m_optimizing;
+    }
+};
@@ -0,0 +1,360 @@
+#pragma once
+#include "Common.h"
+#include <codegen/TestBackend.h>
+#include <codegen/Execute.h>
+#include <codegen/optimize/TailCallElimination.h>
+#include <math.h>
+
+// Tests which every backend that generates code must pass. Results are compared with the
+// interpreter's where possible
+namespace backend_tests {
+    template <typename Backend>
+    void testArithmetic() {
+        setupTest();
+        if (!Backend::IsSupported()) return;
+
+        SECTION("Integer arithmetic matches the interpreter") {
+            auto build = [](FunctionBuilder& fb) {
+                Value a = fb.getArg(0);
+                Value b = fb.getArg(1);
+                Value r = fb.val<i64>();
+                fb.assign(r, (a * b) - (a / b) + (a % b));
+                fb.assign(r, r + fb.val(i64(1000)));
+                fb.assign(r, fb.val(i64(3)) - r);
+                fb.assign(r, (r & fb.val(i64(0xFFFF))) | (a ^ b));
+                fb.assign(r, (r << fb.val(i64(3))) >> fb.val(i64(1)));
+                fb.ret(r);
+            };
+
+            REQUIRE(executeBoth<Backend, i64>(build, i64(1234), i64(-17)) != 0);
+            executeBoth<Backend, i64>(build, i64(-99999999999), i64(7));
+            executeBoth<Backend, i64>(build, i64(5), i64(5));
+        }
+
+        SECTION("Unsigned arithmetic wraps around") {
+            auto build = [](FunctionBuilder& fb) {
+                Value a = fb.getArg(0);
+                Value b = fb.getArg(1);
+                fb.ret((a - b) * b + a / b - a % b);
+            };
+
+            executeBoth<Backend, u64>(build, u64(3), u64(0xFFFFFFFFFFFF));
+            executeBoth<Backend, u32>(build, u32(3), u32(0xFFFFFFF0));
+            executeBoth<Backend, u8>(build, u8(200), u8(3));
+        }
+
+        SECTION("Floating point arithmetic matches the interpreter") {
+            auto build = [](FunctionBuilder& fb) {
+                Value a = fb.getArg(0);
+                Value b = fb.getArg(1);
+                Value r = fb.val<f64>();
+                fb.assign(r, (a * b) - (a / b));
+                fb.assign(r, r + fb.val(f64(1.5)));
+                fb.assign(r, fb.val(f64(2.0)) * r);
+                fb.assign(r, r % fb.val(f64(100.0)));
+                fb.assign(r, -r);
+                fb.ret(r);
+            };
+
+            REQUIRE(executeBoth<Backend, f64>(build, f64(6.0), f64(3.0)) == -fmod(2.0 * ((6.0 * 3.0) - (6.0 / 3.0) + 1.5), 100.0));
+            executeBoth<Backend, f64>(build, f64(-0.125), f64(1e10));
+
+            auto buildF32 = [](FunctionBuilder& fb) {
+                Value a = fb.getArg(0);
+                Value b = fb.getArg(1);
+                Value r = fb.val<f32>();
+                fb.assign(r, (a + b) * fb.val(f32(0.5f)) - b / a);
+                r++;
+                fb.ret(-r);
+            };
+
+            executeBoth<Backend, f32>(buildF32, f32(3.25f), f32(-8.0f));
+        }
+
+        SECTION("Logical operations produce 0 or 1") {
+            auto build = [](FunctionBuilder& fb) {
+                Value a = fb.getArg(0);
+                Value b = fb.getArg(1);
+                Value both = (a && b).convertedTo(Registry::GetType<i32>());
+                Value either = (a || b).convertedTo(Registry::GetType<i32>());
+                Value notA = (!a).convertedTo(Registry::GetType<i32>());
+                fb.ret(both * fb.val(i32(2)) + either + notA * fb.val(i32(4)));
+            };
+
+            REQUIRE(executeBoth<Backend, i32>(build, i32(0), i32(0)) == 4);
+            REQUIRE(executeBoth<Backend, i32>(build, i32(0x100), i32(0)) == 1);
+            REQUIRE(executeBoth<Backend, i32>(build, i32(-1), i32(5)) == 3);
+        }
+    }
+
+    template <typename Backend>
+    void testNarrowArithmetic() {
+        setupTest();
+        if (!Backend::IsSupported()) return;
+
+        auto lt = [](FunctionBuilder& fb) { fb.ret(fb.getArg(0) < fb.getArg(1)); };
+        auto gte = [](FunctionBuilder& fb) { fb.ret(fb.getArg(0) >= fb.getArg(1)); };
+        auto div = [](FunctionBuilder& fb) { fb.ret(fb.getArg(0) / fb.getArg(1)); };
+        auto mod = [](FunctionBuilder& fb) { fb.ret(fb.getArg(0) % fb.getArg(1)); };
+        auto halfSum = [](FunctionBuilder& fb) { fb.ret((fb.getArg(0) + fb.getArg(1)) / fb.getArg(1)); };
+        auto shiftedBack = [](FunctionBuilder& fb) { fb.ret((fb.getArg(0) << fb.getArg(1)) >> fb.getArg(1)); };
+
+        REQUIRE(executeBoth<Backend, bool>(lt, i8(-1), i8(1)) == true);
+        REQUIRE(executeBoth<Backend, bool>(lt, i16(-1), i16(1)) == true);
+        REQUIRE(executeBoth<Backend, bool>(lt, u32(0xFFFFFFFF), u32(1)) == false);
+        REQUIRE(executeBoth<Backend, bool>(gte, i8(-128), i8(127)) == false);
+        REQUIRE(executeBoth<Backend, u16>(div, u16(60000), u16(7)) == 60000 / 7);
+        REQUIRE(executeBoth<Backend, i32>(div, i32(-12), i32(5)) == -2);
+        REQUIRE(executeBoth<Backend, i16>(mod, i16(-12), i16(5)) == -2);
+        REQUIRE(executeBoth<Backend, i32>(div, i32(INT32_MIN), i32(-1)) == INT32_MIN);
+        REQUIRE(executeBoth<Backend, i32>(mod, i32(INT32_MIN), i32(-1)) == 0);
+        REQUIRE(executeBoth<Backend, u8>(halfSum, u8(254), u8(2)) == 0);
+        REQUIRE(executeBoth<Backend, u16>(shiftedBack, u16(0xFFFF), u16(8)) == 0xFF);
+    }
+
+    template <typename Backend>
+    void testComparisons() {
+        setupTest();
+        if (!Backend::IsSupported()) return;
+
+        SECTION("Loops and branches match the interpreter") {
+            // sum of [0, n)
+            auto build = [](FunctionBuilder& fb) {
+                Value n = fb.getArg(0);
+                Value acc = fb.val<i32>();
+                Value i = fb.val<i32>();
+                fb.assign(acc, fb.val(i32(0)));
+                fb.assign(i, fb.val(i32(0)));
+
+                fb.generateFor(
+                    [&]() { return i < n; },
+                    [&]() { i++; },
+                    [&]() { acc += i; }
+                );
+
+                fb.ret(acc);
+            };
+
+            REQUIRE(executeBoth<Backend, i32>(build, i32(100)) == 4950);
+            REQUIRE(executeBoth<Backend, i32>(build, i32(-5)) == 0);
+        }
+
+        SECTION("Floating point comparisons are false when either operand is NaN") {
+            // one bit per relation, in the order <, <=, >, >=, ==, !=
+            auto build = [](FunctionBuilder& fb) {
+                Value a = fb.getArg(0);
+                Value b = fb.getArg(1);
+                Value relations[] = { a < b, a <= b, a > b, a >= b, a == b, a != b };
+                Value r = fb.val<u32>();
+                fb.assign(r, fb.val(u32(0)));
+                for (u32 i = 0;i < 6;i++) {
+                    fb.generateIf(relations[i], [&]() {
+                        fb.assign(r, r | fb.val(u32(1 << i)));
+                    });
+                }
+                fb.ret(r);
+            };
+
+            REQUIRE(executeBoth<Backend, u32>(build, f64(1.0), f64(2.0)) == 0b100011);
+            REQUIRE(executeBoth<Backend, u32>(build, f64(2.0), f64(2.0)) == 0b011010);
+            REQUIRE(executeBoth<Backend, u32>(build, f32(3.0f), f32(2.0f)) == 0b101100);
+            REQUIRE(executeBoth<Backend, u32>(build, f64(NAN), f64(2.0)) == 0b100000);
+            REQUIRE(executeBoth<Backend, u32>(build, f32(1.0f), f32(NAN)) == 0b100000);
+        }
+    }
+
+    template <typename Backend>
+    void testConversionsAndVectors() {
+        setupTest();
+        if (!Backend::IsSupported()) return;
+
+        SECTION("Values are converted from the source type to the destination type") {
+            auto toF64 = [](FunctionBuilder& fb) { fb.ret(fb.getArg(0).convertedTo(Registry::GetType<f64>())); };
+            auto toI32 = [](FunctionBuilder& fb) { fb.ret(fb.getArg(0).convertedTo(Registry::GetType<i32>())); };
+            auto toU8 = [](FunctionBuilder& fb) { fb.ret(fb.getArg(0).convertedTo(Registry::GetType<u8>())); };
+
+            REQUIRE(executeBoth<Backend, f64>(toF64, i32(-7)) == -7.0);
+            REQUIRE(executeBoth<Backend, i32>(toI32, f64(3.75)) == 3);
+            REQUIRE(executeBoth<Backend, u8>(toU8, i32(300)) == u8(44));
+        }
+
+        SECTION("Vector operations update the memory they point to") {
+            Function fn("physics", Registry::Signature<f32, f32*, f32*>(), Registry::GlobalNamespace());
+            FunctionBuilder fb(&fn);
+            Value pos = fb.getArg(0);
+            Value vel = fb.getArg(1);
+            Value speed = fb.val<f32>();
+
+            fb.vadd(pos, vel, 3);
+            fb.vmul(vel, fb.val(f32(0.5f)), 3);
+            fb.vdot(speed, vel, vel, 3);
+            fb.ret(speed);
+
+            Backend backend;
+            REQUIRE(backend.process(&fb));
+
+            f32 p[3] = { 1.0f, 2.0f, 3.0f };
+            f32 v[3] = { 2.0f, 4.0f, 6.0f };
+            f32* pp = p;
+            f32* vp = v;
+            f32 result = 0.0f;
+            void* args[] = { &pp, &vp };
+            fn.call(&result, args);
+
+            REQUIRE(p[0] == 3.0f);
+            REQUIRE(p[1] == 6.0f);
+            REQUIRE(p[2] == 9.0f);
+            REQUIRE(v[0] == 1.0f);
+            REQUIRE(v[1] == 2.0f);
+            REQUIRE(v[2] == 3.0f);
+            REQUIRE(result == 14.0f);
+        }
+    }
+
+    template <typename Backend>
+    void testStack() {
+        setupTest();
+        if (!Backend::IsSupported()) return;
+
+        auto build = [](FunctionBuilder& fb) {
+            Value n = fb.getArg(0);
+
+            stack_id a = fb.stackAlloc(sizeof(i32));
+            stack_id b = fb.stackAlloc(sizeof(i16));
+            Value pa = fb.val<i32*>();
+            Value pb = fb.val<i16*>();
+            fb.stackPtr(pa, a);
+            fb.stackPtr(pb, b);
+            fb.store(n, pa);
+            fb.store((n + n).convertedTo(Registry::GetType<i16>()), pb);
+
+            Value x = fb.val<i32>();
+            Value y = fb.val<i16>();
+            fb.load(x, pa);
+            fb.load(y, pb);
+            fb.ret(x + y.convertedTo(Registry::GetType<i32>()));
+        };
+
+        REQUIRE(executeBoth<Backend, i32>(build, i32(7)) == 21);
+        REQUIRE(executeBoth<Backend, i32>(build, i32(20000)) == 20000 + i16(40000));
+    }
+
+    template <typename Backend>
+    void testCalls() {
+        setupTest();
+        if (!Backend::IsSupported()) return;
+
+        SECTION("Compiled functions can call themselves") {
+            Function fib("fib", Registry::Signature<i32, i32>(), Registry::GlobalNamespace());
+            FunctionBuilder fb(&fib);
+            Value n = fb.getArg(0);
+
+            fb.generateIf(n < fb.val(i32(2)), [&]() {
+                fb.generateReturn(n);
+            });
+
+            Value a = fb.generateCall(&fib, { n - fb.val(i32(1)) });
+            Value b = fb.generateCall(&fib, { n - fb.val(i32(2)) });
+            fb.generateReturn(a + b);
+
+            Backend backend;
+            REQUIRE(backend.process(&fb));
+
+            i32 input = 20;
+            i32 result = -1;
+            void* args[] = { &input };
+            fib.call(&result, args);
+
+            REQUIRE(result == 6765);
+            REQUIRE(TestFramePool::Get()->getUsedSize() == 0);
+        }
+
+        SECTION("Compiled functions can call host and interpreted functions") {
+            Function add("add", Registry::Signature<i32, i32, i32>(), Registry::GlobalNamespace());
+            add.setCallHandler(new HostAddHandler(&add));
+
+            Function mul("mul", Registry::Signature<i32, i32, i32>(), Registry::GlobalNamespace());
+            FunctionBuilder mfb(&mul);
+            mfb.generateReturn(mfb.getArg(0) * mfb.getArg(1));
+
+            TestBackend tb;
+            tb.process(&mfb);
+
+            Function fn("addMul", Registry::Signature<i32, i32, i32, i32>(), Registry::GlobalNamespace());
+            FunctionBuilder fb(&fn);
+            Value ab = fb.generateCall(&add, { fb.getArg(0), fb.getArg(1) });
+            fb.generateReturn(fb.generateCall(&mul, { ab, fb.getArg(2) }));
+
+            Backend backend;
+            REQUIRE(backend.process(&fb));
+
+            i32 a = 1;
+            i32 b = 20;
+            i32 c = 3;
+            i32 result = -1;
+            void* args[] = { &a, &b, &c };
+            fn.call(&result, args);
+
+            REQUIRE(result == 63);
+        }
+
+        SECTION("Function values and tail calls") {
+            Function add("add", Registry::Signature<i32, i32, i32>(), Registry::GlobalNamespace());
+            add.setCallHandler(new HostAddHandler(&add));
+
+            Function mul("mul", Registry::Signature<i32, i32, i32>(), Registry::GlobalNamespace());
+            FunctionBuilder mfb(&mul);
+            mfb.generateReturn(mfb.getArg(0) * mfb.getArg(1));
+
+            Function apply("apply", Registry::Signature<i32, u64, i32, i32>(), Registry::GlobalNamespace());
+            FunctionBuilder afb(&apply);
+            Value callback = afb.getArg(0);
+            callback.setType(Registry::Signature<i32, i32, i32>());
+            afb.generateReturn(afb.generateCall(callback, { afb.getArg(1), afb.getArg(2) }));
+
+            TailCallEliminationStep step;
+            Backend backend;
+            backend.addPostProcess(&step);
+            REQUIRE(backend.process(&mfb));
+            REQUIRE(backend.process(&afb));
+
+            Function* callbacks[] = { &mul, &add, &mul };
+            i32 expected[] = { 42, 13, 42 };
+            for (u32 c = 0;c < 3;c++) {
+                u64 cb = u64(callbacks[c]);
+                i32 a = 6;
+                i32 b = 7;
+                i32 result = -1;
+                void* args[] = { &cb, &a, &b };
+                apply.call(&result, args);
+                REQUIRE(result == expected[c]);
+            }
+        }
+
+        SECTION("Exceptions thrown by callees are propagated to the caller") {
+            Function fail("fail", Registry::Signature<i32, i32, i32>(), Registry::GlobalNamespace());
+            fail.setCallHandler(new ThrowingHandler(&fail));
+
+            Function fn("callsFail", Registry::Signature<i32, u64>(), Registry::GlobalNamespace());
+            FunctionBuilder fb(&fn);
+            Value callback = fb.getArg(0);
+            callback.setType(Registry::Signature<i32, i32, i32>());
+            Value r = fb.generateCall(callback, { fb.val(i32(1)), fb.val(i32(2)) });
+            fb.generateReturn(r + fb.val(i32(1)));
+
+            Backend backend;
+            REQUIRE(backend.process(&fb));
+
+            i32 result = -1;
+            u64 cb = u64(&fail);
+            void* args[] = { &cb };
+            REQUIRE_THROWS(fn.call(&result, args));
+
+            // calling a null function value fails the same way as when it's interpreted
+            cb = 0;
+            REQUIRE_THROWS(fn.call(&result, args));
+
+            REQUIRE(TestFramePool::Get()->getUsedSize() == 0);
+        }
+    }
+};
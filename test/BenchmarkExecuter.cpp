@@ -0,0 +1,418 @@
+#include "Common.h"
+#include <codegen/Execute.h>
+#include <codegen/TestBackend.h>
+#include <codegen/TestBytecode.h>
+#include <codegen/TestVectorKernels.h>
+#include <codegen/X86_64Backend.h>
+#include <codegen/CodeHolder.h>
+#include <chrono>
+#include <stdio.h>
+
+/*
+ * These are hidden by default, run them with:
+ *     codegen_test [benchmark]
+ */
+namespace benchmark {
+    typedef void (*LoopBuilderFn)(FunctionBuilder& fb);
+
+    void buildIntegerLoop(FunctionBuilder& fb) {
+        Value n = fb.getArg(0);
+        Value acc = fb.val<i32>();
+        Value i = fb.val<i32>();
+        fb.assign(acc, fb.val(i32(0)));
+        fb.assign(i, fb.val(i32(0)));
+
+        fb.generateFor(
+            [&]() { return i < n; },
+            [&]() { i++; },
+            [&]() {
+                acc += i;
+                acc ^= fb.val(i32(0x5555));
+            }
+        );
+
+        fb.ret(acc);
+    }
+
+    void buildFloatLoop(FunctionBuilder& fb) {
+        Value n = fb.getArg(0);
+        Value acc = fb.val<f64>();
+        Value x = fb.val<f64>();
+        Value i = fb.val<i32>();
+        fb.assign(acc, fb.val(f64(0.0)));
+        fb.assign(x, fb.val(f64(1.0)));
+        fb.assign(i, fb.val(i32(0)));
+
+        fb.generateFor(
+            [&]() { return i < n; },
+            [&]() { i++; },
+            [&]() {
+                acc += x * x - fb.val(f64(0.5));
+                x += fb.val(f64(0.001));
+            }
+        );
+
+        fb.ret(acc.convertedTo(Registry::GetType<i32>()));
+    }
+
+    // fib(n) = n < 2 ? n : fib(n - 1) + fib(n - 2)
+    void buildFib(FunctionBuilder& fb) {
+        Function* fib = fb.getFunction();
+        Value arg = fb.getArg(0);
+
+        fb.generateIf(arg < fb.val(i32(2)), [&]() {
+            fb.generateReturn(arg);
+        });
+
+        Value a = fb.generateCall(fib, { arg - fb.val(i32(1)) });
+        Value b = fb.generateCall(fib, { arg - fb.val(i32(2)) });
+        fb.generateReturn(a + b);
+    }
+
+    // Everything between the target of the loop's back edge and the back edge itself
+    u32 getInstructionsPerIteration(const TestBytecode& bc) {
+        for (u32 i = 0;i < bc.code.size();i++) {
+            const TestInstruction& inst = bc.code[i];
+            if (inst.op == TestOp::jump && inst.operands[0] <= i) return i - inst.operands[0] + 1;
+        }
+
+        return 0;
+    }
+
+    f64 timeExecution(const TestBytecode& bc, TestDispatchMode mode, i32 iterations, i32* result) {
+        TestExecuter exe(&bc);
+        exe.setDispatchMode(mode);
+        exe.setArg(0, iterations);
+        exe.setReturnValuePointer(result);
+
+        auto begin = std::chrono::high_resolution_clock::now();
+        exe.execute();
+        auto end = std::chrono::high_resolution_clock::now();
+
+        return std::chrono::duration<f64, std::nano>(end - begin).count();
+    }
+
+    void benchmarkLoop(const char* name, Function* fn, LoopBuilderFn build) {
+        constexpr i32 iterations = 2000000;
+        constexpr u32 samples = 5;
+
+        FunctionBuilder fb(fn);
+        build(fb);
+
+        CodeHolder ch(fb.getCode());
+        ch.owner = &fb;
+        ch.rebuildAll();
+
+        TestBytecode bc(&ch);
+        u32 perIteration = getInstructionsPerIteration(bc);
+        REQUIRE(perIteration > 0);
+
+        f64 instructionCount = f64(perIteration) * f64(iterations);
+
+        TestDispatchMode modes[] = { TestDispatchMode::Switch, TestDispatchMode::Threaded };
+        const char* modeNames[] = { "switch", "threaded" };
+        i32 results[2] = { 0, 0 };
+
+        for (u32 m = 0;m < 2;m++) {
+            if (modes[m] == TestDispatchMode::Threaded && !TestExecuter::IsThreadedDispatchAvailable()) {
+                printf("%-8s %-10s unavailable\n", name, modeNames[m]);
+                results[m] = results[0];
+                continue;
+            }
+
+            // best of N
+            f64 best = 0.0;
+            for (u32 s = 0;s < samples;s++) {
+                f64 ns = timeExecution(bc, modes[m], iterations, &results[m]);
+                if (s == 0 || ns < best) best = ns;
+            }
+
+            printf(
+                "%-8s %-10s %.3f ns/instruction, %.3f ns/iteration (%u instructions per iteration)\n",
+                name, modeNames[m], best / instructionCount, best / f64(iterations), perIteration
+            );
+        }
+
+        // both modes should compute the same thing
+        REQUIRE(results[0] == results[1]);
+    }
+
+    void benchmarkCalls() {
+        constexpr u32 calls = 1000000;
+        constexpr u32 samples = 5;
+
+        Function fn("add", Registry::Signature<i32, i32, i32>(), Registry::GlobalNamespace());
+        FunctionBuilder fb(&fn);
+        fb.ret(fb.getArg(0) + fb.getArg(1));
+
+        TestBackend tb;
+        tb.process(&fb);
+
+        i32 a = 0;
+        i32 b = 1;
+        i32 result = 0;
+        void* args[] = { &a, &b };
+
+        // best of N
+        f64 best = 0.0;
+        for (u32 s = 0;s < samples;s++) {
+            auto begin = std::chrono::high_resolution_clock::now();
+            for (u32 c = 0;c < calls;c++) {
+                fn.call(&result, args);
+                a = result;
+            }
+            auto end = std::chrono::high_resolution_clock::now();
+
+            f64 ns = std::chrono::duration<f64, std::nano>(end - begin).count();
+            if (s == 0 || ns < best) best = ns;
+        }
+
+        printf("%-8s %.3f ns/call\n", "host", best / f64(calls));
+        REQUIRE(a == i32(calls * samples));
+    }
+
+    void benchmarkRecursion() {
+        constexpr i32 n = 25;
+        constexpr u32 samples = 5;
+
+        Function fib("fib", Registry::Signature<i32, i32>(), Registry::GlobalNamespace());
+        FunctionBuilder fb(&fib);
+        buildFib(fb);
+
+        TestBackend tb;
+        tb.process(&fb);
+
+        i32 input = n;
+        i32 result = 0;
+        void* args[] = { &input };
+
+        // best of N
+        f64 best = 0.0;
+        for (u32 s = 0;s < samples;s++) {
+            auto begin = std::chrono::high_resolution_clock::now();
+            fib.call(&result, args);
+            auto end = std::chrono::high_resolution_clock::now();
+
+            f64 ns = std::chrono::duration<f64, std::nano>(end - begin).count();
+            if (s == 0 || ns < best) best = ns;
+        }
+
+        // fib(n) makes 2 * fib(n + 1) - 1 calls
+        f64 calls = 2.0 * 121393.0 - 1.0;
+        printf("%-8s %.3f ns/call (fib(%d) in %.3f ms)\n", "direct", best / calls, n, best / 1000000.0);
+        REQUIRE(result == 75025);
+    }
+
+    // Compares the interpreter with the native code generated by X86_64Backend for the same function
+    void benchmarkNative(const char* name, LoopBuilderFn build, i32 input) {
+        constexpr u32 samples = 5;
+
+        if (!X86_64Backend::IsSupported()) {
+            printf("%-8s native     unavailable\n", name);
+            return;
+        }
+
+        Function interpreted(name, Registry::Signature<i32, i32>(), Registry::GlobalNamespace());
+        FunctionBuilder ifb(&interpreted);
+        build(ifb);
+
+        Function native(name, Registry::Signature<i32, i32>(), Registry::GlobalNamespace());
+        FunctionBuilder nfb(&native);
+        build(nfb);
+
+        TestBackend tb;
+        REQUIRE(tb.process(&ifb));
+
+        X86_64Backend xb;
+        REQUIRE(xb.process(&nfb));
+
+        Function* fns[] = { &interpreted, &native };
+        const char* names[] = { "interpreted", "native" };
+        i32 results[2] = { 0, 0 };
+        f64 times[2] = { 0.0, 0.0 };
+        void* args[] = { &input };
+
+        for (u32 f = 0;f < 2;f++) {
+            // best of N
+            for (u32 s = 0;s < samples;s++) {
+                auto begin = std::chrono::high_resolution_clock::now();
+                fns[f]->call(&results[f], args);
+                auto end = std::chrono::high_resolution_clock::now();
+
+                f64 ns = std::chrono::duration<f64, std::nano>(end - begin).count();
+                if (s == 0 || ns < times[f]) times[f] = ns;
+            }
+
+            printf("%-8s %-11s %.3f ms\n", name, names[f], times[f] / 1000000.0);
+        }
+
+        printf("%-8s native code is %.2fx as fast\n", name, times[0] / times[1]);
+        REQUIRE(results[0] == results[1]);
+    }
+
+    void benchmarkBatch() {
+        constexpr u32 laneCount = 1000000;
+        constexpr u32 samples = 5;
+
+        Function fn("formula", Registry::Signature<f64, f64, f64>(), Registry::GlobalNamespace());
+        FunctionBuilder fb(&fn);
+        Value a = fb.getArg(0);
+        Value b = fb.getArg(1);
+        fb.ret((a * b) - (a / b) + fb.val(f64(1.0)));
+
+        CodeHolder ch(fb.getCode());
+        ch.owner = &fb;
+        ch.rebuildAll();
+
+        TestBytecode bc(&ch);
+
+        utils::Array<f64> x;
+        utils::Array<f64> y;
+        utils::Array<f64> batchResults;
+        utils::Array<f64> scalarResults;
+        for (u32 l = 0;l < laneCount;l++) {
+            x.push(f64(l));
+            y.push(f64(l % 7) + 1.0);
+            batchResults.push(0.0);
+            scalarResults.push(0.0);
+        }
+
+        TestExecuter exe(&bc);
+
+        // best of N
+        f64 scalarBest = 0.0;
+        f64 batchBest = 0.0;
+        for (u32 s = 0;s < samples;s++) {
+            auto begin = std::chrono::high_resolution_clock::now();
+            for (u32 l = 0;l < laneCount;l++) {
+                exe.setArg(0, x[l]);
+                exe.setArg(1, y[l]);
+                exe.setReturnValuePointer(&scalarResults[l]);
+                exe.execute();
+            }
+            auto end = std::chrono::high_resolution_clock::now();
+
+            f64 ns = std::chrono::duration<f64, std::nano>(end - begin).count();
+            if (s == 0 || ns < scalarBest) scalarBest = ns;
+
+            begin = std::chrono::high_resolution_clock::now();
+            exe.setBatchArg(0, &x[0]);
+            exe.setBatchArg(1, &y[0]);
+            exe.setBatchReturnValues(&batchResults[0]);
+            exe.executeBatch(laneCount);
+            end = std::chrono::high_resolution_clock::now();
+
+            ns = std::chrono::duration<f64, std::nano>(end - begin).count();
+            if (s == 0 || ns < batchBest) batchBest = ns;
+        }
+
+        printf("%-8s %.3f ns/invocation\n", "scalar", scalarBest / f64(laneCount));
+        printf("%-8s %.3f ns/invocation (%u lanes per group)\n", "batch", batchBest / f64(laneCount), TestExecuter::GetBatchWidth());
+
+        for (u32 l = 0;l < laneCount;l++) REQUIRE(batchResults[l] == scalarResults[l]);
+    }
+
+    void benchmarkVectors() {
+        constexpr i32 iterations = 1000000;
+        constexpr u32 samples = 5;
+
+        Function fn("integrate", Registry::Signature<f64, i32, f64*, f64*>(), Registry::GlobalNamespace());
+        FunctionBuilder fb(&fn);
+        Value n = fb.getArg(0);
+        Value pos = fb.getArg(1);
+        Value vel = fb.getArg(2);
+        Value energy = fb.val<f64>();
+        Value i = fb.val<i32>();
+        fb.assign(i, fb.val(i32(0)));
+
+        fb.generateFor(
+            [&]() { return i < n; },
+            [&]() { i++; },
+            [&]() {
+                fb.vadd(pos, vel, 3);
+                fb.vmul(vel, fb.val(f64(0.999)), 3);
+                fb.vdot(energy, vel, vel, 3);
+            }
+        );
+
+        fb.ret(energy);
+
+        CodeHolder ch(fb.getCode());
+        ch.owner = &fb;
+        ch.rebuildAll();
+
+        TestBytecode bc(&ch);
+
+        const char* modeNames[] = { "kernels", "generic" };
+        f64 results[2] = { 0.0, 0.0 };
+        f64 positions[2][3];
+
+        for (u32 m = 0;m < 2;m++) {
+            if (m == 1) {
+                // vector instructions without a kernel use the generic handlers
+                for (u32 c = 0;c < bc.code.size();c++) {
+                    if (bc.code[c].componentCount) bc.code[c].meta = nullptr;
+                }
+            }
+
+            // best of N
+            f64 best = 0.0;
+            for (u32 s = 0;s < samples;s++) {
+                f64 p[3] = { 0.0, 0.0, 0.0 };
+                f64 v[3] = { 1.0, 2.0, 3.0 };
+
+                TestExecuter exe(&bc);
+                exe.setArg(0, iterations);
+                exe.setArg(1, (void*)p);
+                exe.setArg(2, (void*)v);
+                exe.setReturnValuePointer(&results[m]);
+
+                auto begin = std::chrono::high_resolution_clock::now();
+                exe.execute();
+                auto end = std::chrono::high_resolution_clock::now();
+
+                f64 ns = std::chrono::duration<f64, std::nano>(end - begin).count();
+                if (s == 0 || ns < best) best = ns;
+
+                for (u32 c = 0;c < 3;c++) positions[m][c] = p[c];
+            }
+
+            printf("%-8s %.3f ns/iteration (f64x3)\n", modeNames[m], best / f64(iterations));
+        }
+
+        // the kernels only change the order that components are added in
+        REQUIRE(std::abs(results[0] - results[1]) <= 1e-9 * std::abs(results[1]));
+        for (u32 c = 0;c < 3;c++) REQUIRE(positions[0][c] == positions[1][c]);
+    }
+};
+
+TEST_CASE("Benchmark Executer", "[.][benchmark]") {
+    setupTest();
+
+    SECTION("Dispatch Modes") {
+        Function intLoop("intLoop", Registry::Signature<i32, i32>(), Registry::GlobalNamespace());
+        Function fltLoop("fltLoop", Registry::Signature<i32, i32>(), Registry::GlobalNamespace());
+
+        benchmark::benchmarkLoop("integer", &intLoop, benchmark::buildIntegerLoop);
+        benchmark::benchmarkLoop("float", &fltLoop, benchmark::buildFloatLoop);
+    }
+
+    SECTION("Calls") {
+        benchmark::benchmarkCalls();
+        benchmark::benchmarkRecursion();
+    }
+
+    SECTION("Native Code") {
+        benchmark::benchmarkNative("integer", benchmark::buildIntegerLoop, 2000000);
+        benchmark::benchmarkNative("float", benchmark::buildFloatLoop, 2000000);
+        benchmark::benchmarkNative("fib", benchmark::buildFib, 25);
+    }
+
+    SECTION("Batch Execution") {
+        benchmark::benchmarkBatch();
+    }
+
+    SECTION("Vector Kernels") {
+        benchmark::benchmarkVectors();
+    }
+}
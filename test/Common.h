@@ -1,9 +1,61 @@
+#pragma once
 #include <catch2/catch_test_macros.hpp>
 #include <bind/bind.h>
 #include <codegen/FunctionBuilder.h>
+#include <codegen/TestBackend.h>
+#include <utils/Exception.h>
+#include <string.h>
 
 using namespace bind;
 using namespace utils;
 using namespace codegen;
 
-void setupTest();
\ No newline at end of file
+void setupTest();
+
+// add(a, b) = a + b, as a host function
+class HostAddHandler : public ICallHandler {
+    public:
+        HostAddHandler(Function* target) : ICallHandler(target) {}
+
+        virtual void call(void* retDest, void** args) {
+            *(i32*)retDest = *(i32*)args[0] + *(i32*)args[1];
+        }
+};
+
+// Host function which always throws
+class ThrowingHandler : public ICallHandler {
+    public:
+        ThrowingHandler(Function* target) : ICallHandler(target) {}
+
+        virtual void call(void*, void**) {
+            throw Exception("ThrowingHandler - Failed");
+        }
+};
+
+// Builds the same function for the interpreter and for the specified backend, then calls both
+// with the same arguments. The results must be identical
+template <typename Backend, typename Ret, typename... Args, typename BuildFn>
+Ret executeBoth(BuildFn&& build, Args... args) {
+    Function interpreted("interpreted", Registry::Signature<Ret, Args...>(), Registry::GlobalNamespace());
+    FunctionBuilder ifb(&interpreted);
+    build(ifb);
+
+    Function compiled("compiled", Registry::Signature<Ret, Args...>(), Registry::GlobalNamespace());
+    FunctionBuilder cfb(&compiled);
+    build(cfb);
+
+    TestBackend tb;
+    REQUIRE(tb.process(&ifb));
+
+    Backend backend;
+    REQUIRE(backend.process(&cfb));
+
+    void* argPointers[] = { &args..., nullptr };
+    Ret expected = Ret(0);
+    Ret result = Ret(0);
+    interpreted.call(&expected, argPointers);
+    compiled.call(&result, argPointers);
+
+    REQUIRE(memcmp(&expected, &result, sizeof(Ret)) == 0);
+    return result;
+}
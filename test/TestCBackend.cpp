@@ -0,0 +1,116 @@
+#include "BackendTests.h"
+#include <codegen/CBackend.h>
+#include <codegen/optimize/TailCallElimination.h>
+
+namespace c_backend {
+    void testSelfTailCalls() {
+        setupTest();
+        if (!CBackend::IsSupported()) return;
+
+        SECTION("Tail calls of a function to itself run in constant stack space") {
+            // sum(n, acc) = n == 0 ? acc : sum(n - 1, acc + n)
+            Function sum("sum", Registry::Signature<u64, u64, u64>(), Registry::GlobalNamespace());
+            FunctionBuilder fb(&sum);
+            Value n = fb.getArg(0);
+            Value acc = fb.getArg(1);
+
+            fb.generateIf(n == fb.val(u64(0)), [&]() {
+                fb.generateReturn(acc);
+            });
+
+            fb.generateReturn(fb.generateCall(&sum, { n - fb.val(u64(1)), acc + n }));
+
+            TailCallEliminationStep step;
+            CBackend backend;
+            backend.addPostProcess(&step);
+            REQUIRE(backend.process(&fb));
+
+            const String& src = ((CCallHandler*)sum.getCallHandler())->getSource();
+            REQUIRE(strstr(src.c_str(), "goto cg_start;") != nullptr);
+
+            // deep enough to overflow the host stack if each call made a new one
+            u64 input = 5000000;
+            u64 initial = 0;
+            u64 result = 0;
+            void* args[] = { &input, &initial };
+            sum.call(&result, args);
+
+            REQUIRE(result == (input * (input + 1)) / 2);
+        }
+    }
+
+    void testSource() {
+        setupTest();
+        if (!CBackend::IsSupported()) return;
+
+        SECTION("Addresses are passed to the generated code rather than printed in it") {
+            Function add("add", Registry::Signature<i32, i32, i32>(), Registry::GlobalNamespace());
+            add.setCallHandler(new HostAddHandler(&add));
+
+            Function fn("addTwice", Registry::Signature<i32, i32>(), Registry::GlobalNamespace());
+            FunctionBuilder fb(&fn);
+            Value a = fb.generateCall(&add, { fb.getArg(0), fb.getArg(0) });
+            fb.generateReturn(fb.generateCall(&add, { a, fb.getArg(0) }));
+
+            CBackend backend;
+            REQUIRE(backend.process(&fb));
+
+            CCallHandler* handler = (CCallHandler*)fn.getCallHandler();
+            String address = String::Format("%llx", (unsigned long long)&add);
+            REQUIRE(strstr(handler->getSource().c_str(), "ctx->symbols[0]") != nullptr);
+            REQUIRE(strstr(handler->getSource().c_str(), "ctx->symbols[1]") == nullptr);
+            REQUIRE(strstr(handler->getSource().c_str(), address.c_str()) == nullptr);
+
+            i32 input = 5;
+            i32 result = -1;
+            void* args[] = { &input };
+            fn.call(&result, args);
+            REQUIRE(result == 15);
+        }
+
+        SECTION("Compiler failures are reported") {
+            Function fn("fails", Registry::Signature<i32, i32>(), Registry::GlobalNamespace());
+            FunctionBuilder fb(&fn);
+            fb.generateReturn(fb.getArg(0));
+
+            CBackend backend;
+            backend.setCompiler("false");
+            REQUIRE(backend.getCompiler() == "false");
+            REQUIRE_THROWS(backend.process(&fb));
+        }
+    }
+};
+
+TEST_CASE("Test C Backend", "[codegen]") {
+    SECTION("Arithmetic") {
+        backend_tests::testArithmetic<CBackend>();
+    }
+
+    SECTION("Narrow Arithmetic") {
+        backend_tests::testNarrowArithmetic<CBackend>();
+    }
+
+    SECTION("Comparisons") {
+        backend_tests::testComparisons<CBackend>();
+    }
+
+    SECTION("Conversions and Vectors") {
+        backend_tests::testConversionsAndVectors<CBackend>();
+    }
+
+    SECTION("Stack") {
+        backend_tests::testStack<CBackend>();
+    }
+
+    SECTION("Calls") {
+        backend_tests::testCalls<CBackend>();
+    }
+
+    SECTION("Self Tail Calls") {
+        c_backend::testSelfTailCalls();
+    }
+
+    SECTION("Source") {
+        c_backend::testSource();
+    }
+}
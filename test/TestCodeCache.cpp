@@ -0,0 +1,370 @@
+#include "Common.h"
+#include <codegen/CodeCache.h>
+#include <codegen/CBackend.h>
+#include <codegen/TestBackend.h>
+#include <codegen/interfaces/IPostProcessStep.h>
+#include <utils/Exception.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+namespace codecache {
+    class HostMulHandler : public ICallHandler {
+        public:
+            HostMulHandler(Function* target) : ICallHandler(target) {}
+
+            virtual void call(void* retDest, void** args) {
+                *(i32*)retDest = *(i32*)args[0] * *(i32*)args[1];
+            }
+    };
+
+    // (a * b) + c, through a call to 'mul'
+    void buildMulAdd(FunctionBuilder& fb, Function* mul, i32 c) {
+        Value ab = fb.generateCall(mul, { fb.getArg(0), fb.getArg(1) });
+        fb.generateReturn(ab + fb.val(c));
+    }
+
+    // Records the key of the code that reaches the backend
+    class KeyStep : public IPostProcessStep {
+        public:
+            KeyStep(const String& identity) : identity(identity) {}
+
+            virtual bool execute(CodeHolder* ch, u32 mask) {
+                key = CodeCache::Key(ch, identity);
+                cacheable = CodeCache::IsCacheable(ch);
+                return false;
+            }
+
+            String identity;
+            CodeKey key;
+            bool cacheable;
+    };
+
+    // *src + a, where src is an address in this process
+    void buildRead(FunctionBuilder& fb, i32* src) {
+        Value p = fb.val<i32*>();
+        fb.assign(p, fb.val((ptr)src));
+
+        Value x = fb.val<i32>();
+        fb.load(x, p);
+        fb.ret(x + fb.getArg(0));
+    }
+
+    CodeKey keyOf(Function* mul, i32 c, const String& identity) {
+        Function fn("mulAdd", Registry::Signature<i32, i32, i32>(), Registry::GlobalNamespace());
+        FunctionBuilder fb(&fn);
+        buildMulAdd(fb, mul, c);
+
+        KeyStep step(identity);
+        TestBackend tb;
+        tb.addPostProcess(&step);
+        REQUIRE(tb.process(&fb));
+
+        return step.key;
+    }
+
+    String makeCacheDirectory() {
+        const char* tmp = getenv("TMPDIR");
+        if (!tmp || !tmp[0]) tmp = "/tmp";
+
+        char dir[1024];
+        snprintf(dir, sizeof(dir), "%s/codegen-cache-test-XXXXXX", tmp);
+        REQUIRE(mkdtemp(dir) != nullptr);
+        return dir;
+    }
+
+    bool fileExists(const String& path) {
+        return access(path.c_str(), F_OK) == 0;
+    }
+
+    // Makes an entry look like it was stored for another key with the same hash
+    void copyFile(const String& from, const String& to) {
+        FILE* in = fopen(from.c_str(), "rb");
+        REQUIRE(in != nullptr);
+        FILE* out = fopen(to.c_str(), "wb");
+        REQUIRE(out != nullptr);
+
+        char buf[4096];
+        size_t count = 0;
+        while ((count = fread(buf, 1, sizeof(buf), in)) > 0) REQUIRE(fwrite(buf, 1, count, out) == count);
+
+        fclose(in);
+        fclose(out);
+    }
+
+    void testKeys() {
+        setupTest();
+
+        Function mul("mul", Registry::Signature<i32, i32, i32>(), Registry::GlobalNamespace());
+        mul.setCallHandler(new HostMulHandler(&mul));
+
+        SECTION("Identical code has the same key") {
+            REQUIRE(keyOf(&mul, 5, "backend") == keyOf(&mul, 5, "backend"));
+        }
+
+        SECTION("Keys depend on the immediates and the backend identity") {
+            CodeKey key = keyOf(&mul, 5, "backend");
+            REQUIRE(keyOf(&mul, 6, "backend") != key);
+            REQUIRE(keyOf(&mul, 5, "backend -O3") != key);
+        }
+
+        SECTION("Code which refers to addresses in the process can't be cached") {
+            i32 src = 0;
+            Function read("read", Registry::Signature<i32, i32>(), Registry::GlobalNamespace());
+            FunctionBuilder rfb(&read);
+            buildRead(rfb, &src);
+
+            Function mulAdd("mulAdd", Registry::Signature<i32, i32, i32>(), Registry::GlobalNamespace());
+            FunctionBuilder mfb(&mulAdd);
+            buildMulAdd(mfb, &mul, 5);
+
+            KeyStep step("backend");
+            TestBackend tb;
+            tb.addPostProcess(&step);
+
+            REQUIRE(tb.process(&rfb));
+            REQUIRE(!step.cacheable);
+            REQUIRE(tb.process(&mfb));
+            REQUIRE(step.cacheable);
+        }
+
+        SECTION("Callees are identified by name and signature rather than address") {
+            Function otherMul("mul", Registry::Signature<i32, i32, i32>(), Registry::GlobalNamespace());
+            otherMul.setCallHandler(new HostMulHandler(&otherMul));
+
+            Function add("add", Registry::Signature<i32, i32, i32>(), Registry::GlobalNamespace());
+            add.setCallHandler(new HostMulHandler(&add));
+
+            REQUIRE(keyOf(&otherMul, 5, "backend") == keyOf(&mul, 5, "backend"));
+            REQUIRE(keyOf(&add, 5, "backend") != keyOf(&mul, 5, "backend"));
+        }
+    }
+
+    void testStorage() {
+        setupTest();
+
+        String dir = makeCacheDirectory();
+        CodeCache cache(dir);
+
+        SECTION("Entries are stored and replaced") {
+            CodeKey key;
+            key.add(u64(0x1234abcd));
+            REQUIRE(!cache.lookup(key));
+
+            const char first[] = "first";
+            REQUIRE(cache.store(key, first, sizeof(first)));
+            REQUIRE(cache.lookup(key));
+
+            const char second[] = "second entry";
+            REQUIRE(cache.store(key, second, sizeof(second)));
+
+            char buf[64] = { 0 };
+            FILE* fp = fopen(cache.getPath(key).c_str(), "rb");
+            REQUIRE(fp != nullptr);
+            REQUIRE(fread(buf, 1, sizeof(second), fp) == sizeof(second));
+            fclose(fp);
+            REQUIRE(strcmp(buf, second) == 0);
+
+            REQUIRE(cache.getHitCount() == 1);
+            REQUIRE(cache.getMissCount() == 1);
+
+            cache.clear();
+            REQUIRE(!fileExists(cache.getPath(key)));
+        }
+
+        SECTION("Entries are only found with the key they were stored with") {
+            CodeKey key;
+            key.add(String("first"));
+
+            CodeKey other;
+            other.add(String("other"));
+            REQUIRE(key != other);
+
+            const char data[] = "data";
+            REQUIRE(cache.store(key, data, sizeof(data)));
+            copyFile(cache.getPath(key), cache.getPath(other));
+
+            // As if the keys had the same hash
+            REQUIRE(!cache.lookup(other));
+            REQUIRE(!cache.store(other, data, sizeof(data)));
+            REQUIRE(cache.lookup(key));
+
+            cache.clear();
+        }
+
+        cache.clear();
+        rmdir(dir.c_str());
+    }
+
+    void testCBackend() {
+        setupTest();
+        if (!CBackend::IsSupported()) return;
+
+        String dir = makeCacheDirectory();
+        CodeCache cache(dir);
+
+        Function mul("mul", Registry::Signature<i32, i32, i32>(), Registry::GlobalNamespace());
+        mul.setCallHandler(new HostMulHandler(&mul));
+
+        auto compile = [&cache](Function* mulFn, i32 c, const char* flags) {
+            Function* fn = new Function("mulAdd", Registry::Signature<i32, i32, i32>(), Registry::GlobalNamespace());
+            FunctionBuilder fb(fn);
+            buildMulAdd(fb, mulFn, c);
+
+            CBackend backend;
+            backend.setCompilerFlags(flags);
+            backend.setCodeCache(&cache);
+            REQUIRE(backend.getCodeCache() == &cache);
+            REQUIRE(backend.process(&fb));
+            return fn;
+        };
+
+        auto execute = [](Function* fn, i32 a, i32 b) {
+            i32 result = -1;
+            void* args[] = { &a, &b };
+            fn->call(&result, args);
+            return result;
+        };
+
+        SECTION("Compiled code is loaded from the cache instead of being compiled again") {
+            Function* first = compile(&mul, 5, "-O2");
+            REQUIRE(cache.getMissCount() == 1);
+            REQUIRE(((CCallHandler*)first->getCallHandler())->getSource().size() > 0);
+            REQUIRE(execute(first, 6, 7) == 47);
+
+            Function* second = compile(&mul, 5, "-O2");
+            REQUIRE(cache.getHitCount() == 1);
+            REQUIRE(((CCallHandler*)second->getCallHandler())->getSource().size() == 0);
+            REQUIRE(execute(second, 6, 7) == 47);
+
+            // Other code and other compiler options are compiled separately
+            Function* third = compile(&mul, 10, "-O2");
+            Function* fourth = compile(&mul, 5, "-O1");
+            REQUIRE(cache.getMissCount() == 3);
+            REQUIRE(execute(third, 6, 7) == 52);
+            REQUIRE(execute(fourth, 6, 7) == 47);
+
+            delete first;
+            delete second;
+            delete third;
+            delete fourth;
+        }
+
+        SECTION("Cached code calls the functions of the process that loads it") {
+            Function* first = compile(&mul, 1, "-O2");
+            REQUIRE(execute(first, 3, 4) == 13);
+            u32 hits = cache.getHitCount();
+
+            // Has the same name and signature, but adds
+            Function otherMul("mul", Registry::Signature<i32, i32, i32>(), Registry::GlobalNamespace());
+            otherMul.setCallHandler(new HostAddHandler(&otherMul));
+
+            Function* second = compile(&otherMul, 1, "-O2");
+            REQUIRE(cache.getHitCount() == hits + 1);
+            REQUIRE(execute(second, 3, 4) == 8);
+            REQUIRE(execute(first, 3, 4) == 13);
+
+            delete first;
+            delete second;
+        }
+
+        SECTION("Entries stored for other code are never loaded") {
+            Function* first = compile(&mul, 1, "-O2");
+            REQUIRE(execute(first, 3, 4) == 13);
+
+            CodeKey key = keyOf(&mul, 2, CBackend().getIdentity());
+            copyFile(cache.getPath(keyOf(&mul, 1, CBackend().getIdentity())), cache.getPath(key));
+            u32 hits = cache.getHitCount();
+
+            // The entry has the name of the new code's key, but not its key
+            Function* second = compile(&mul, 2, "-O2");
+            REQUIRE(cache.getHitCount() == hits);
+            REQUIRE(((CCallHandler*)second->getCallHandler())->getSource().size() > 0);
+            REQUIRE(execute(second, 3, 4) == 14);
+            REQUIRE(!cache.lookup(key));
+
+            delete first;
+            delete second;
+            cache.clear();
+        }
+
+        SECTION("Code which refers to addresses in the process is never loaded from the cache") {
+            auto compileRead = [&cache](i32* src) {
+                Function* fn = new Function("read", Registry::Signature<i32, i32>(), Registry::GlobalNamespace());
+                FunctionBuilder fb(fn);
+                buildRead(fb, src);
+
+                CBackend backend;
+                backend.setCodeCache(&cache);
+                REQUIRE(backend.process(&fb));
+                return fn;
+            };
+
+            auto executeRead = [](Function* fn, i32 a) {
+                i32 result = -1;
+                void* args[] = { &a };
+                fn->call(&result, args);
+                return result;
+            };
+
+            i32 a = 10;
+            i32 b = 20;
+            u32 hits = cache.getHitCount();
+            u32 misses = cache.getMissCount();
+
+            // The same code, but with a different address. Neither is looked up or stored
+            Function* first = compileRead(&a);
+            Function* second = compileRead(&b);
+            REQUIRE(cache.getHitCount() == hits);
+            REQUIRE(cache.getMissCount() == misses);
+            REQUIRE(((CCallHandler*)second->getCallHandler())->getSource().size() > 0);
+            REQUIRE(executeRead(first, 1) == 11);
+            REQUIRE(executeRead(second, 1) == 21);
+
+            delete first;
+            delete second;
+        }
+
+        SECTION("Entries which fail to load are compiled again") {
+            Function* first = compile(&mul, 2, "-O2");
+            delete first;
+
+            // The same entry, since the key only depends on the code
+            CodeKey key = keyOf(&mul, 2, CBackend().getIdentity());
+            REQUIRE(fileExists(cache.getPath(key)));
+
+            const char garbage[] = "not a shared object";
+            REQUIRE(cache.store(key, garbage, sizeof(garbage)));
+            u32 hits = cache.getHitCount();
+
+            Function* second = compile(&mul, 2, "-O2");
+            REQUIRE(cache.getHitCount() == hits + 1);
+            REQUIRE(((CCallHandler*)second->getCallHandler())->getSource().size() > 0);
+            REQUIRE(execute(second, 4, 5) == 22);
+            delete second;
+
+            Function* third = compile(&mul, 2, "-O2");
+            REQUIRE(cache.getHitCount() == hits + 2);
+            REQUIRE(((CCallHandler*)third->getCallHandler())->getSource().size() == 0);
+            REQUIRE(execute(third, 4, 5) == 22);
+            delete third;
+        }
+
+        cache.clear();
+        rmdir(dir.c_str());
+    }
+};
+
+TEST_CASE("Test Code Cache", "[codegen]") {
+    SECTION("Keys") {
+        codecache::testKeys();
+    }
+
+    SECTION("Storage") {
+        codecache::testStorage();
+    }
+
+    SECTION("C Backend") {
+        codecache::testCBackend();
+    }
+}
@@ -0,0 +1,83 @@
+#include "Common.h"
+#include <codegen/CodeHolder.h>
+#include <codegen/ControlFlowGraph.h>
+#include <codegen/IR.h>
+
+namespace cfg {
+    bool hasEdge(const ControlFlowGraph& g, u32 from, u32 to) {
+        bool out = false, in = false;
+        for (u32 i = 0;i < g.blocks[from].to.size();i++) out = out || g.blocks[from].to[i] == to;
+        for (u32 i = 0;i < g.blocks[to].from.size();i++) in = in || g.blocks[to].from[i] == from;
+        return out && in;
+    }
+
+    u32 blockEndingWith(CodeHolder& ch, OpCode op) {
+        for (u32 b = 0;b < ch.cfg.blocks.size();b++) {
+            if (ch.code[ch.cfg.blocks[b].end - 1].op == op) return b;
+        }
+
+        return u32(-1);
+    }
+
+    // f(a) = a > 0 ? 1 : 2
+    void buildIfReturn(FunctionBuilder& fb) {
+        fb.generateIf(fb.getArg(0) > fb.val(i32(0)), [&]() {
+            fb.generateReturn(fb.val(i32(1)));
+        });
+        fb.generateReturn(fb.val(i32(2)));
+    }
+
+    void testBranches() {
+        Function fn("f", Registry::Signature<i32, i32>(), Registry::GlobalNamespace());
+        FunctionBuilder fb(&fn);
+        buildIfReturn(fb);
+
+        CodeHolder ch(fb.getCode());
+        ch.owner = &fb;
+        ch.rebuildAll();
+
+        u32 b = blockEndingWith(ch, OpCode::branch);
+        REQUIRE(b != u32(-1));
+        REQUIRE(b + 1 < ch.cfg.blocks.size());
+
+        const Instruction& br = ch.code[ch.cfg.blocks[b].end - 1];
+        u32 target = ch.cfg.blockIdxAtAddr(ch.labels.get(br.operands[1].getImm()));
+        REQUIRE(target != u32(-1));
+        REQUIRE(target != b + 1);
+
+        // Taken when the condition is false, falls through when it's true
+        REQUIRE(ch.cfg.blocks[b].to.size() == 2);
+        REQUIRE(hasEdge(ch.cfg, b, target));
+        REQUIRE(hasEdge(ch.cfg, b, b + 1));
+    }
+
+    void testReturns() {
+        // The 'then' body returns, so the block before the label doesn't flow into it
+        Function fn("f", Registry::Signature<i32, i32>(), Registry::GlobalNamespace());
+        FunctionBuilder fb(&fn);
+        buildIfReturn(fb);
+
+        CodeHolder ch(fb.getCode());
+        ch.owner = &fb;
+        ch.rebuildAll();
+
+        u32 b = blockEndingWith(ch, OpCode::ret);
+        REQUIRE(b != u32(-1));
+        REQUIRE(b + 1 < ch.cfg.blocks.size());
+        REQUIRE(ch.cfg.blocks[b].to.size() == 0);
+
+        for (u32 i = 0;i < ch.cfg.blocks[b + 1].from.size();i++) {
+            REQUIRE(ch.cfg.blocks[b + 1].from[i] != b);
+        }
+    }
+};
+
+TEST_CASE("Test Control Flow Graph", "[codegen]") {
+    SECTION("Branches flow to their label and to the next block") {
+        cfg::testBranches();
+    }
+
+    SECTION("Blocks which return don't flow to the next block") {
+        cfg::testReturns();
+    }
+}
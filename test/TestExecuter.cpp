@@ -0,0 +1,2285 @@
+#include "Common.h"
+#include <codegen/TestBackend.h>
+#include <codegen/TestBytecode.h>
+#include <codegen/TestProfiler.h>
+#include <codegen/TestVectorKernels.h>
+#include <codegen/CodeHolder.h>
+#include <codegen/IR.h>
+#include <codegen/optimize/TailCallElimination.h>
+#include <thread>
+#include <atomic>
+
+namespace execution {
+    // sum of [0, n)
+    void buildSumLoop(FunctionBuilder& fb) {
+        Value n = fb.getArg(0);
+        Value acc = fb.val<i32>();
+        Value i = fb.val<i32>();
+        fb.assign(acc, fb.val(i32(0)));
+        fb.assign(i, fb.val(i32(0)));
+
+        fb.generateFor(
+            [&]() { return i < n; },
+            [&]() { i++; },
+            [&]() { acc += i; }
+        );
+
+        fb.ret(acc);
+    }
+
+    void testLowering() {
+        setupTest();
+
+        Function fn("sum", Registry::Signature<i32, i32>(), Registry::GlobalNamespace());
+        FunctionBuilder fb(&fn);
+        buildSumLoop(fb);
+
+        CodeHolder ch(fb.getCode());
+        ch.owner = &fb;
+        ch.rebuildAll();
+
+        TestBytecode bc(&ch);
+
+        REQUIRE(bc.function == &fn);
+        REQUIRE(bc.argRegisters.size() == 1);
+        REQUIRE(bc.argRegisters[0] == bc.registerMap[fb.getArg(0).getRegisterId()]);
+        REQUIRE(bc.thisRegister == NullRegister);
+        REQUIRE(bc.code.size() > 0);
+
+        // falling off the end of the function returns
+        REQUIRE(bc.code[bc.code.size() - 1].op == TestOp::ret);
+
+        for (u32 i = 0;i < bc.code.size();i++) {
+            const TestInstruction& inst = bc.code[i];
+            CAPTURE(TestBytecode::OpName(inst.op));
+
+            // labels are resolved to instruction indices
+            if (inst.op == TestOp::jump || inst.op == TestOp::ilt32_rr_br) REQUIRE(inst.operands[0] < bc.code.size());
+            else REQUIRE(inst.operands[0] < bc.registerCount);
+
+            if (inst.op == TestOp::branch8) REQUIRE(inst.operands[1] < bc.code.size());
+
+            // instructions with no effect at runtime are not lowered
+            REQUIRE(inst.op != TestOp::noop);
+        }
+
+        // immediates are encoded in the instruction that uses them
+        bool foundImmediateMove = false;
+        bool foundReturn = false;
+        for (u32 i = 0;i < bc.code.size();i++) {
+            if (bc.code[i].op == TestOp::mov_i && bc.code[i].imm.i == 0) foundImmediateMove = true;
+            if (bc.code[i].op == TestOp::ret32_r) foundReturn = true;
+        }
+
+        REQUIRE(foundImmediateMove);
+        REQUIRE(foundReturn);
+    }
+
+    void testLoops() {
+        setupTest();
+
+        Function fn("sum", Registry::Signature<i32, i32>(), Registry::GlobalNamespace());
+        FunctionBuilder fb(&fn);
+        buildSumLoop(fb);
+
+        TestBackend tb;
+        tb.process(&fb);
+
+        i32 n = 0;
+        i32 result = -1;
+        void* args[] = { &n };
+
+        fn.call(&result, args);
+        REQUIRE(result == 0);
+
+        n = 10;
+        fn.call(&result, args);
+        REQUIRE(result == 45);
+
+        n = 1000;
+        fn.call(&result, args);
+        REQUIRE(result == 499500);
+    }
+
+    void testDispatchModes() {
+        setupTest();
+
+        Function fn("sum", Registry::Signature<i32, i32>(), Registry::GlobalNamespace());
+        FunctionBuilder fb(&fn);
+        buildSumLoop(fb);
+
+        CodeHolder ch(fb.getCode());
+        ch.owner = &fb;
+        ch.rebuildAll();
+
+        TestBytecode bc(&ch);
+
+        TestDispatchMode modes[] = { TestDispatchMode::Switch, TestDispatchMode::Threaded };
+        for (TestDispatchMode mode : modes) {
+            i32 result = -1;
+
+            TestExecuter exe(&bc);
+            exe.setDispatchMode(mode);
+            exe.setArg(0, i32(100));
+            exe.setReturnValuePointer(&result);
+            exe.execute();
+
+            REQUIRE(result == 4950);
+        }
+    }
+
+    void testArithmetic() {
+        setupTest();
+
+        Function fn("arith", Registry::Signature<f64, f64, f64>(), Registry::GlobalNamespace());
+        FunctionBuilder fb(&fn);
+        Value a = fb.getArg(0);
+        Value b = fb.getArg(1);
+        Value r = fb.val<f64>();
+        fb.assign(r, (a * b) - (a / b));
+
+        // immediate on the left and right
+        fb.assign(r, r + fb.val(f64(1.0)));
+        fb.assign(r, fb.val(f64(2.0)) * r);
+        fb.ret(r);
+
+        TestBackend tb;
+        tb.process(&fb);
+
+        f64 x = 6.0;
+        f64 y = 3.0;
+        f64 result = 0.0;
+        void* args[] = { &x, &y };
+        fn.call(&result, args);
+
+        REQUIRE(result == 2.0 * ((6.0 * 3.0) - (6.0 / 3.0) + 1.0));
+    }
+
+    template <typename Ret, typename A, typename B, typename BuildFn>
+    Ret executeBinary(A a, B b, BuildFn&& build, TestOp expectedOp = TestOp::noop) {
+        Function fn("binary", Registry::Signature<Ret, A, B>(), Registry::GlobalNamespace());
+        FunctionBuilder fb(&fn);
+        fb.ret(build(fb.getArg(0), fb.getArg(1)));
+
+        CodeHolder ch(fb.getCode());
+        ch.owner = &fb;
+        ch.rebuildAll();
+
+        TestBytecode bc(&ch);
+
+        if (expectedOp != TestOp::noop) {
+            bool found = false;
+            for (u32 i = 0;i < bc.code.size();i++) found = found || bc.code[i].op == expectedOp;
+            REQUIRE(found);
+        }
+
+        Ret result = Ret(0);
+        TestExecuter exe(&bc);
+        exe.setArg(0, a);
+        exe.setArg(1, b);
+        exe.setReturnValuePointer(&result);
+        exe.execute();
+
+        return result;
+    }
+
+    void testNarrowArithmetic() {
+        setupTest();
+
+        SECTION("Narrow operations are lowered to forms for their width") {
+            auto lt = [](const Value& a, const Value& b) { return a < b; };
+            auto div = [](const Value& a, const Value& b) { return a / b; };
+
+            REQUIRE(executeBinary<bool>(i8(-1), i8(1), lt, TestOp::ilt8_rr) == true);
+            REQUIRE(executeBinary<bool>(i16(-1), i16(1), lt, TestOp::ilt16_rr) == true);
+            REQUIRE(executeBinary<bool>(i32(-1), i32(1), lt, TestOp::ilt32_rr) == true);
+            REQUIRE(executeBinary<bool>(i64(-1), i64(1), lt, TestOp::ilt_rr) == true);
+            REQUIRE(executeBinary<bool>(u32(0xFFFFFFFF), u32(1), lt, TestOp::ult32_rr) == false);
+            REQUIRE(executeBinary<u16>(u16(60000), u16(7), div, TestOp::udiv16_rr) == 60000 / 7);
+        }
+
+        SECTION("Negative narrow values compare and divide correctly") {
+            auto gte = [](const Value& a, const Value& b) { return a >= b; };
+            auto div = [](const Value& a, const Value& b) { return a / b; };
+            auto mod = [](const Value& a, const Value& b) { return a % b; };
+
+            REQUIRE(executeBinary<bool>(i32(-5), i32(3), gte) == false);
+            REQUIRE(executeBinary<bool>(i8(-128), i8(127), gte) == false);
+            REQUIRE(executeBinary<i32>(i32(-12), i32(5), div) == -2);
+            REQUIRE(executeBinary<i16>(i16(-12), i16(5), mod) == -2);
+
+            // the minimum value divided by -1 wraps rather than trapping
+            REQUIRE(executeBinary<i32>(i32(INT32_MIN), i32(-1), div) == INT32_MIN);
+            REQUIRE(executeBinary<i32>(i32(INT32_MIN), i32(-1), mod) == 0);
+        }
+
+        SECTION("Narrow results wrap around") {
+            auto halfSum = [](const Value& a, const Value& b) { return (a + b) / b; };
+            auto sumIsNegative = [](const Value& a, const Value& b) { return (a + b) < b; };
+            auto shiftedBack = [](const Value& a, const Value& b) { return (a << b) >> b; };
+
+            REQUIRE(executeBinary<u8>(u8(254), u8(2), halfSum) == 0);
+            REQUIRE(executeBinary<u32>(u32(0xFFFFFFFF), u32(1), halfSum) == 0);
+            REQUIRE(executeBinary<bool>(i8(127), i8(1), sumIsNegative) == true);
+            REQUIRE(executeBinary<bool>(i32(INT32_MAX), i32(1), sumIsNegative) == true);
+            REQUIRE(executeBinary<u16>(u16(0xFFFF), u16(8), shiftedBack) == 0xFF);
+        }
+
+        SECTION("Narrow conditions are tested at their width") {
+            Function fn("positive", Registry::Signature<i32, i32>(), Registry::GlobalNamespace());
+            FunctionBuilder fb(&fn);
+            Value a = fb.getArg(0);
+            Value isPositive = a > fb.val(i32(0));
+            Value sign = fb.val<i32>();
+            fb.assign(sign, fb.val(i32(-1)));
+            fb.generateIf(isPositive, [&]() {
+                fb.assign(sign, fb.val(i32(1)));
+            });
+            fb.ret(sign);
+
+            TestBackend tb;
+            tb.process(&fb);
+
+            i32 result = 0;
+            i32 x = -7;
+            void* args[] = { &x };
+            fn.call(&result, args);
+            REQUIRE(result == -1);
+
+            x = 7;
+            fn.call(&result, args);
+            REQUIRE(result == 1);
+        }
+    }
+
+    template <typename From, typename To>
+    To executeConversion(From input) {
+        Function fn("convert", Registry::Signature<To, From>(), Registry::GlobalNamespace());
+        FunctionBuilder fb(&fn);
+        fb.ret(fb.getArg(0).convertedTo(Registry::GetType<To>()));
+
+        CodeHolder ch(fb.getCode());
+        ch.owner = &fb;
+        ch.rebuildAll();
+
+        TestBytecode bc(&ch);
+
+        To result = To(0);
+        TestExecuter exe(&bc);
+        exe.setArg(0, input);
+        exe.setReturnValuePointer(&result);
+        exe.execute();
+
+        return result;
+    }
+
+    void testConversions() {
+        setupTest();
+
+        SECTION("Conversions are lowered to a handler for their pair of types") {
+            Function fn("convert", Registry::Signature<f64, i32>(), Registry::GlobalNamespace());
+            FunctionBuilder fb(&fn);
+            fb.ret(fb.getArg(0).convertedTo(Registry::GetType<f64>()));
+
+            CodeHolder ch(fb.getCode());
+            ch.owner = &fb;
+            ch.rebuildAll();
+
+            TestBytecode bc(&ch);
+
+            u32 cvtCount = 0;
+            for (u32 i = 0;i < bc.code.size();i++) {
+                if (bc.code[i].op == TestOp::cvt_i32_f64) cvtCount++;
+            }
+
+            REQUIRE(cvtCount == 1);
+        }
+
+        SECTION("Values are converted from the source type to the destination type") {
+            REQUIRE(executeConversion<i32, f64>(i32(-7)) == -7.0);
+            REQUIRE(executeConversion<f64, i32>(f64(3.75)) == 3);
+            REQUIRE(executeConversion<f32, f64>(f32(0.5f)) == 0.5);
+            REQUIRE(executeConversion<f64, f32>(f64(0.25)) == 0.25f);
+            REQUIRE(executeConversion<i32, i64>(i32(-5)) == -5);
+            REQUIRE(executeConversion<i32, u8>(i32(300)) == u8(44));
+            REQUIRE(executeConversion<u8, i32>(u8(200)) == 200);
+            REQUIRE(executeConversion<u64, f32>(u64(1) << 40) == f32(u64(1) << 40));
+        }
+    }
+
+    // Runs every kernel for T vectors with N components and compares them to the obvious loops.
+    // The inputs are small integers, so the results are exact whatever order they're added in
+    template <typename T, u8 N>
+    void checkVectorKernels(TestSimdLevel level) {
+        TestValueType type = sizeof(T) == sizeof(f32) ? TestValueType::Float32 : TestValueType::Float64;
+        CAPTURE(sizeof(T), N, u32(level));
+
+        // one extra component, which must never be written
+        T a[N + 1];
+        T b[N + 1];
+        T expected[N + 1];
+        auto reset = [&]() {
+            for (u8 c = 0;c <= N;c++) {
+                a[c] = T(c + 1);
+                b[c] = T(2 * c + 3);
+                expected[c] = a[c];
+            }
+        };
+
+        auto run = [&](TestOp op, u64 op0, u64 op1, u64 op2) {
+            CAPTURE(TestBytecode::OpName(op));
+            TestVectorKernel kernel = TestVectorKernels::Get(op, type, N, level);
+            REQUIRE(kernel != nullptr);
+            kernel(op0, op1, op2);
+            return op0;
+        };
+
+        T scalar = T(4);
+        u64 scalarBits = 0;
+        *((T*)&scalarBits) = scalar;
+
+        TestOp vectorOps[] = { TestOp::vset_v, TestOp::vadd_v, TestOp::vsub_v, TestOp::vmul_v, TestOp::vdiv_v };
+        TestOp scalarOps[] = { TestOp::vset_s, TestOp::vadd_s, TestOp::vsub_s, TestOp::vmul_s, TestOp::vdiv_s };
+        for (u32 o = 0;o < 5;o++) {
+            for (u32 form = 0;form < 2;form++) {
+                reset();
+                for (u8 c = 0;c < N;c++) {
+                    T rhs = form == 0 ? b[c] : scalar;
+                    if (o == 0) expected[c] = rhs;
+                    else if (o == 1) expected[c] += rhs;
+                    else if (o == 2) expected[c] -= rhs;
+                    else if (o == 3) expected[c] *= rhs;
+                    else expected[c] /= rhs;
+                }
+
+                if (form == 0) run(vectorOps[o], u64(a), u64(b), 0);
+                else run(scalarOps[o], u64(a), scalarBits, 0);
+
+                for (u8 c = 0;c <= N;c++) REQUIRE(a[c] == expected[c]);
+            }
+        }
+
+        reset();
+        for (u8 c = 0;c < N;c++) expected[c] = -a[c];
+        run(TestOp::vneg, u64(a), 0, 0);
+        for (u8 c = 0;c <= N;c++) REQUIRE(a[c] == expected[c]);
+
+        reset();
+        T dot = T(0);
+        T magSq = T(0);
+        for (u8 c = 0;c < N;c++) {
+            dot += a[c] * b[c];
+            magSq += a[c] * a[c];
+        }
+
+        u64 result = run(TestOp::vdot, 0, u64(a), u64(b));
+        REQUIRE(*((T*)&result) == dot);
+
+        result = run(TestOp::vmagsq, 0, u64(a), 0);
+        REQUIRE(*((T*)&result) == magSq);
+
+        result = run(TestOp::vmag, 0, u64(a), 0);
+        REQUIRE(*((T*)&result) == T(std::sqrt(magSq)));
+
+        T f = T(1) / T(std::sqrt(magSq));
+        for (u8 c = 0;c < N;c++) expected[c] = a[c] * f;
+        run(TestOp::vnorm, u64(a), 0, 0);
+        for (u8 c = 0;c <= N;c++) REQUIRE(a[c] == expected[c]);
+
+        if constexpr (N == 3) {
+            if (TestVectorKernels::Get(TestOp::vcross, type, N, level)) {
+                reset();
+                T r[4] = { T(0), T(0), T(0), T(-1) };
+                run(TestOp::vcross, u64(r), u64(a), u64(b));
+                REQUIRE(r[0] == a[1] * b[2] - a[2] * b[1]);
+                REQUIRE(r[1] == a[2] * b[0] - a[0] * b[2]);
+                REQUIRE(r[2] == a[0] * b[1] - a[1] * b[0]);
+                REQUIRE(r[3] == T(-1));
+            }
+        }
+    }
+
+    void testVectorKernels() {
+        setupTest();
+
+        SECTION("Kernels match the generic implementations at every supported level") {
+            TestSimdLevel supported = TestVectorKernels::GetSupportedLevel();
+            TestSimdLevel levels[] = { TestSimdLevel::SSE2, TestSimdLevel::AVX2 };
+
+            for (TestSimdLevel level : levels) {
+                if (u8(level) > u8(supported)) break;
+
+                checkVectorKernels<f32, 2>(level);
+                checkVectorKernels<f32, 3>(level);
+                checkVectorKernels<f32, 4>(level);
+                checkVectorKernels<f64, 2>(level);
+                checkVectorKernels<f64, 3>(level);
+                checkVectorKernels<f64, 4>(level);
+            }
+
+            // only floating point vectors of 2 to 4 components have kernels
+            REQUIRE(TestVectorKernels::Get(TestOp::vadd_v, TestValueType::Int32, 3, supported) == nullptr);
+            REQUIRE(TestVectorKernels::Get(TestOp::vadd_v, TestValueType::Float32, 8, supported) == nullptr);
+            REQUIRE(TestVectorKernels::Get(TestOp::vmod_v, TestValueType::Float32, 3, supported) == nullptr);
+            REQUIRE(TestVectorKernels::Get(TestOp::vadd_v, TestValueType::Float32, 3, TestSimdLevel::None) == nullptr);
+        }
+
+        SECTION("Kernels are selected when the code is lowered") {
+            Function fn("physics", Registry::Signature<f32, f32*, f32*>(), Registry::GlobalNamespace());
+            FunctionBuilder fb(&fn);
+            Value pos = fb.getArg(0);
+            Value vel = fb.getArg(1);
+            Value speed = fb.val<f32>();
+
+            fb.vadd(pos, vel, 3);
+            fb.vmul(vel, fb.val(f32(0.5f)), 3);
+            fb.vdot(speed, vel, vel, 3);
+            fb.ret(speed);
+
+            CodeHolder ch(fb.getCode());
+            ch.owner = &fb;
+            ch.rebuildAll();
+
+            TestBytecode bc(&ch);
+
+            bool expectKernels = TestVectorKernels::GetSupportedLevel() != TestSimdLevel::None;
+            u32 vectorOpCount = 0;
+            for (u32 i = 0;i < bc.code.size();i++) {
+                const TestInstruction& inst = bc.code[i];
+                if (inst.op != TestOp::vadd_v && inst.op != TestOp::vmul_s && inst.op != TestOp::vdot) continue;
+
+                REQUIRE((inst.meta != nullptr) == expectKernels);
+                vectorOpCount++;
+            }
+
+            REQUIRE(vectorOpCount == 3);
+
+            f32 p[3] = { 1.0f, 2.0f, 3.0f };
+            f32 v[3] = { 2.0f, 4.0f, 6.0f };
+            f32 result = 0.0f;
+
+            TestExecuter exe(&bc);
+            exe.setArg(0, (void*)p);
+            exe.setArg(1, (void*)v);
+            exe.setReturnValuePointer(&result);
+            exe.execute();
+
+            REQUIRE(p[0] == 3.0f);
+            REQUIRE(p[1] == 6.0f);
+            REQUIRE(p[2] == 9.0f);
+            REQUIRE(v[0] == 1.0f);
+            REQUIRE(v[1] == 2.0f);
+            REQUIRE(v[2] == 3.0f);
+            REQUIRE(result == 14.0f);
+        }
+    }
+
+    void testStack() {
+        setupTest();
+
+        Function fn("stack", Registry::Signature<i32, i32>(), Registry::GlobalNamespace());
+        FunctionBuilder fb(&fn);
+        Value n = fb.getArg(0);
+
+        stack_id a = fb.stackAlloc(sizeof(i32));
+        stack_id b = fb.stackAlloc(sizeof(i32));
+        Value pa = fb.val<i32*>();
+        Value pb = fb.val<i32*>();
+        fb.stackPtr(pa, a);
+        fb.stackPtr(pb, b);
+        fb.store(n, pa);
+        fb.store(n + n, pb);
+
+        Value x = fb.val<i32>();
+        Value y = fb.val<i32>();
+        fb.load(x, pa);
+        fb.load(y, pb);
+        fb.ret(x + y);
+
+        CodeHolder ch(fb.getCode());
+        ch.owner = &fb;
+        ch.rebuildAll();
+
+        TestBytecode bc(&ch);
+
+        // stack IDs index a flat table of offsets
+        REQUIRE(bc.stackSize == sizeof(i32) * 2);
+        REQUIRE(bc.stackOffsets.size() > b);
+        REQUIRE(bc.stackOffsets[a] != bc.stackOffsets[b]);
+
+        // offsets are baked into the instructions that use them
+        u32 stackPtrCount = 0;
+        for (u32 i = 0;i < bc.code.size();i++) {
+            const TestInstruction& inst = bc.code[i];
+            if (inst.op != TestOp::stack_ptr) continue;
+
+            if (inst.operands[0] == bc.registerMap[pa.getRegisterId()]) REQUIRE(inst.operands[1] == bc.stackOffsets[a]);
+            else REQUIRE(inst.operands[1] == bc.stackOffsets[b]);
+            stackPtrCount++;
+        }
+
+        REQUIRE(stackPtrCount == 2);
+
+        i32 result = -1;
+        TestExecuter exe(&bc);
+        exe.setArg(0, i32(7));
+        exe.setReturnValuePointer(&result);
+        exe.execute();
+
+        REQUIRE(result == 21);
+    }
+
+    void testStackSlotSharing() {
+        setupTest();
+
+        SECTION("Allocations which are freed before the next is made share space") {
+            Function fn("scopes", Registry::Signature<i32, i32>(), Registry::GlobalNamespace());
+            FunctionBuilder fb(&fn);
+            Value n = fb.getArg(0);
+            Value x = fb.val<i32>();
+            Value y = fb.val<i32>();
+
+            stack_id a = fb.stackAlloc(16);
+            Value pa = fb.val<i32*>();
+            fb.stackPtr(pa, a);
+            fb.store(n, pa);
+            fb.load(x, pa);
+            fb.stackFree(a);
+
+            stack_id b = fb.stackAlloc(16);
+            Value pb = fb.val<i32*>();
+            fb.stackPtr(pb, b);
+            fb.store(n + n, pb);
+            fb.load(y, pb);
+            fb.stackFree(b);
+
+            fb.ret(x + y);
+
+            CodeHolder ch(fb.getCode());
+            ch.owner = &fb;
+            ch.rebuildAll();
+
+            REQUIRE(ch.stackLayout.allocations.size() == 2);
+            REQUIRE(ch.stackLayout.get(a) != nullptr);
+            REQUIRE(ch.stackLayout.get(b) != nullptr);
+            REQUIRE(!ch.stackLayout.get(a)->isConcurrent(*ch.stackLayout.get(b)));
+            REQUIRE(ch.stackLayout.getSize() == 16);
+
+            TestBytecode bc(&ch);
+            REQUIRE(bc.stackSize == 16);
+            REQUIRE(bc.stackOffsets[a] == bc.stackOffsets[b]);
+
+            i32 result = -1;
+            TestExecuter exe(&bc);
+            exe.setArg(0, i32(7));
+            exe.setReturnValuePointer(&result);
+            exe.execute();
+
+            REQUIRE(result == 21);
+        }
+
+        SECTION("Allocations which are live across a loop don't share space with those inside it") {
+            Function fn("loop", Registry::Signature<i32, i32>(), Registry::GlobalNamespace());
+            FunctionBuilder fb(&fn);
+            Value n = fb.getArg(0);
+            Value acc = fb.val<i32>();
+            Value i = fb.val<i32>();
+            fb.assign(acc, fb.val(i32(0)));
+            fb.assign(i, fb.val(i32(0)));
+
+            stack_id outer = fb.stackAlloc(sizeof(i32));
+            Value po = fb.val<i32*>();
+            fb.stackPtr(po, outer);
+            fb.store(fb.val(i32(100)), po);
+
+            stack_id inner = 0;
+            fb.generateFor(
+                [&]() { return i < n; },
+                [&]() { i++; },
+                [&]() {
+                    inner = fb.stackAlloc(sizeof(i32));
+                    Value pi = fb.val<i32*>();
+                    fb.stackPtr(pi, inner);
+                    fb.store(i, pi);
+
+                    Value a = fb.val<i32>();
+                    Value b = fb.val<i32>();
+                    fb.load(a, pi);
+                    fb.load(b, po);
+                    acc += a + b;
+                    fb.stackFree(inner);
+                }
+            );
+
+            Value last = fb.val<i32>();
+            fb.load(last, po);
+            fb.stackFree(outer);
+            fb.ret(acc + last);
+
+            CodeHolder ch(fb.getCode());
+            ch.owner = &fb;
+            ch.rebuildAll();
+
+            REQUIRE(ch.stackLayout.get(outer)->isConcurrent(*ch.stackLayout.get(inner)));
+
+            TestBytecode bc(&ch);
+            REQUIRE(bc.stackOffsets[outer] != bc.stackOffsets[inner]);
+
+            i32 result = -1;
+            TestExecuter exe(&bc);
+            exe.setArg(0, i32(10));
+            exe.setReturnValuePointer(&result);
+            exe.execute();
+
+            // 45 from the loop counter, 100 per iteration and 100 after the loop
+            REQUIRE(result == 45 + 1000 + 100);
+        }
+
+        SECTION("Allocations freed on one path are still live on the others") {
+            Function fn("paths", Registry::Signature<i32, i32>(), Registry::GlobalNamespace());
+            FunctionBuilder fb(&fn);
+            Value n = fb.getArg(0);
+
+            stack_id a = fb.stackAlloc(sizeof(i32));
+            Value pa = fb.val<i32*>();
+            fb.stackPtr(pa, a);
+            fb.store(n, pa);
+
+            fb.generateIf(n > fb.val(i32(100)), [&]() {
+                fb.stackFree(a);
+                fb.generateReturn(fb.val(i32(-1)));
+            });
+
+            stack_id b = fb.stackAlloc(sizeof(i32));
+            Value pb = fb.val<i32*>();
+            fb.stackPtr(pb, b);
+            fb.store(n * fb.val(i32(3)), pb);
+
+            Value x = fb.val<i32>();
+            Value y = fb.val<i32>();
+            fb.load(x, pa);
+            fb.load(y, pb);
+            fb.stackFree(b);
+            fb.stackFree(a);
+            fb.ret(x + y);
+
+            CodeHolder ch(fb.getCode());
+            ch.owner = &fb;
+            ch.rebuildAll();
+
+            TestBytecode bc(&ch);
+            REQUIRE(bc.stackOffsets[a] != bc.stackOffsets[b]);
+
+            i32 result = 0;
+            TestExecuter exe(&bc);
+            exe.setArg(0, i32(5));
+            exe.setReturnValuePointer(&result);
+            exe.execute();
+            REQUIRE(result == 20);
+
+            exe.setArg(0, i32(500));
+            exe.execute();
+            REQUIRE(result == -1);
+        }
+    }
+
+    void testFusion() {
+        setupTest();
+
+        SECTION("Comparisons are fused with the branches that follow them") {
+            Function fn("sum", Registry::Signature<i32, i32>(), Registry::GlobalNamespace());
+            FunctionBuilder fb(&fn);
+            buildSumLoop(fb);
+
+            CodeHolder ch(fb.getCode());
+            ch.owner = &fb;
+            ch.rebuildAll();
+
+            TestBytecode bc(&ch);
+
+            bool foundFusedBranch = false;
+            for (u32 i = 0;i < bc.code.size();i++) {
+                const TestInstruction& inst = bc.code[i];
+                REQUIRE(inst.op != TestOp::branch8);
+                REQUIRE(inst.op != TestOp::ilt32_rr);
+
+                if (inst.op == TestOp::ilt32_rr_br) {
+                    foundFusedBranch = true;
+                    REQUIRE(inst.operands[0] < bc.code.size());
+                }
+            }
+
+            REQUIRE(foundFusedBranch);
+        }
+
+        SECTION("Pointer offsets are fused with the loads and stores that use them") {
+            Function fn("fields", Registry::Signature<void, i32*, u64>(), Registry::GlobalNamespace());
+            FunctionBuilder fb(&fn);
+            Value p = fb.getArg(0);
+            Value offset = fb.getArg(1);
+            Value a = fb.val<i32>();
+            Value b = fb.val<i32>();
+
+            // p[1] += 1
+            Value p1 = fb.ptrOffset(p, 4);
+            fb.load(a, p1);
+            fb.store(a + fb.val(i32(1)), p1);
+
+            // *(p + offset) = p[1] + p[2]
+            fb.load(b, fb.ptrOffset(p, 8));
+            Value sum = a + b;
+            fb.store(sum, fb.ptrOffset(p, offset));
+
+            CodeHolder ch(fb.getCode());
+            ch.owner = &fb;
+            ch.rebuildAll();
+
+            TestBytecode bc(&ch);
+
+            u32 loadCount = 0;
+            u32 storeCount = 0;
+            for (u32 i = 0;i < bc.code.size();i++) {
+                const TestInstruction& inst = bc.code[i];
+                CAPTURE(TestBytecode::OpName(inst.op));
+
+                // constant offsets are folded into the loads and stores
+                REQUIRE(inst.op != TestOp::uadd_ri);
+                REQUIRE(inst.op != TestOp::uadd_rr);
+
+                if (inst.op == TestOp::load32) {
+                    REQUIRE(inst.operands[1] == bc.registerMap[p.getRegisterId()]);
+                    REQUIRE((inst.operands[2] == 4 || inst.operands[2] == 8));
+                    loadCount++;
+                }
+
+                if (inst.op == TestOp::store32_r) {
+                    REQUIRE(inst.operands[1] == bc.registerMap[p.getRegisterId()]);
+                    REQUIRE(inst.operands[2] == 4);
+                    storeCount++;
+                }
+
+                if (inst.op == TestOp::store32_x) {
+                    REQUIRE(inst.operands[1] == bc.registerMap[p.getRegisterId()]);
+                    REQUIRE(inst.operands[2] == bc.registerMap[offset.getRegisterId()]);
+                    storeCount++;
+                }
+            }
+
+            REQUIRE(loadCount == 2);
+            REQUIRE(storeCount == 2);
+
+            i32 data[] = { 0, 3, 4, 0 };
+            i32* ptr = data;
+            u64 off = sizeof(i32) * 3;
+
+            TestExecuter exe(&bc);
+            exe.setArg(0, (void*)ptr);
+            exe.setArg(1, off);
+            exe.execute();
+
+            REQUIRE(data[0] == 0);
+            REQUIRE(data[1] == 4);
+            REQUIRE(data[2] == 4);
+            REQUIRE(data[3] == 7);
+        }
+    }
+
+    void testFramePooling() {
+        setupTest();
+
+        Function fn("sum", Registry::Signature<i32, i32>(), Registry::GlobalNamespace());
+        FunctionBuilder fb(&fn);
+        buildSumLoop(fb);
+
+        CodeHolder ch(fb.getCode());
+        ch.owner = &fb;
+        ch.rebuildAll();
+
+        TestBytecode bc(&ch);
+        REQUIRE(bc.frameSize >= bc.registerCount * sizeof(u64));
+        REQUIRE(bc.frameSize % 16 == 0);
+
+        TestFramePool* pool = TestFramePool::Get();
+
+        auto run = [&bc](i32 n) {
+            i32 result = -1;
+            TestExecuter exe(&bc);
+            exe.setArg(0, n);
+            exe.setReturnValuePointer(&result);
+            exe.execute();
+            return result;
+        };
+
+        // warm up
+        REQUIRE(run(10) == 45);
+        REQUIRE(pool->getUsedSize() == 0);
+
+        u64 capacity = pool->getCapacity();
+        REQUIRE(capacity > 0);
+
+        // warm calls reuse the memory of earlier frames
+        for (u32 i = 0;i < 100;i++) REQUIRE(run(i32(i)) == i32((i * (i - 1)) / 2));
+        REQUIRE(pool->getCapacity() == capacity);
+        REQUIRE(pool->getUsedSize() == 0);
+
+        // frames which are released early are reclaimed once the frames above them are released
+        TestExecuter* a = new TestExecuter(&bc);
+        TestExecuter* b = new TestExecuter(&bc);
+        u64 used = pool->getUsedSize();
+        REQUIRE(used >= bc.frameSize * 2);
+
+        delete a;
+        REQUIRE(pool->getUsedSize() == used);
+
+        delete b;
+        REQUIRE(pool->getUsedSize() == 0);
+
+        // exchange(n) returns what its stack space held before storing n there
+        Function exchange("exchange", Registry::Signature<u64, u64>(), Registry::GlobalNamespace());
+        FunctionBuilder efb(&exchange);
+        {
+            stack_id slot = efb.stackAlloc(sizeof(u64));
+            Value ptr = efb.val<u64*>();
+            efb.stackPtr(ptr, slot);
+
+            Value previous = efb.val<u64>();
+            efb.load(previous, ptr);
+            efb.store(efb.getArg(0), ptr);
+            efb.ret(previous);
+        }
+
+        TestBackend tb;
+        tb.process(&efb);
+
+        // stack space starts out cleared, even though each frame reuses the memory of the last one
+        u64 input = 0x1234;
+        u64 previous = 1;
+        void* args[] = { &input };
+        for (u32 i = 0;i < 3;i++) {
+            exchange.call(&previous, args);
+            REQUIRE(previous == 0);
+        }
+
+        // including the frames of interpreted callees
+        Function caller("caller", Registry::Signature<u64, u64>(), Registry::GlobalNamespace());
+        FunctionBuilder cfb(&caller);
+        {
+            Value first = cfb.generateCall(&exchange, { cfb.getArg(0) });
+            Value second = cfb.generateCall(&exchange, { cfb.getArg(0) });
+            cfb.generateReturn(first + second);
+        }
+
+        tb.process(&cfb);
+
+        previous = 1;
+        caller.call(&previous, args);
+        REQUIRE(previous == 0);
+    }
+
+    void testCalls() {
+        setupTest();
+
+        Function fib("fib", Registry::Signature<i32, i32>(), Registry::GlobalNamespace());
+        FunctionBuilder fb(&fib);
+        Value n = fb.getArg(0);
+
+        fb.generateIf(n < fb.val(i32(2)), [&]() {
+            fb.generateReturn(n);
+        });
+
+        Value a = fb.generateCall(&fib, { n - fb.val(i32(1)) });
+        Value b = fb.generateCall(&fib, { n - fb.val(i32(2)) });
+        fb.generateReturn(a + b);
+
+        TestBackend tb;
+        tb.process(&fb);
+
+        i32 input = 15;
+        i32 result = -1;
+        void* args[] = { &input };
+        fib.call(&result, args);
+
+        REQUIRE(result == 610);
+
+        // every frame is released once the outermost call returns
+        REQUIRE(TestFramePool::Get()->getUsedSize() == 0);
+
+        // recursive calls don't go through bind::Function::call
+        const TestBytecode* code = TestExecuterCallHandler::GetCode(&fib);
+        REQUIRE(code != nullptr);
+        REQUIRE(code->callSiteCount == 2);
+        for (u32 i = 0;i < code->callSiteCount;i++) {
+            const TestCallTarget* target = code->callSites[i].cachedTarget.load();
+            REQUIRE(target != nullptr);
+            REQUIRE(target->kind == TestCallKind::Direct);
+            REQUIRE(target->code == code);
+        }
+    }
+
+    void testHostCalls() {
+        setupTest();
+
+        SECTION("Host calls are marshaled with a plan made when the code is lowered") {
+            Function add("add", Registry::Signature<i32, i32, i32>(), Registry::GlobalNamespace());
+            add.setCallHandler(new HostAddHandler(&add));
+
+            Function fn("addThree", Registry::Signature<i32, i32, i32, i32>(), Registry::GlobalNamespace());
+            FunctionBuilder fb(&fn);
+            Value ab = fb.generateCall(&add, { fb.getArg(0), fb.getArg(1) });
+            fb.generateReturn(fb.generateCall(&add, { ab, fb.getArg(2) }));
+
+            CodeHolder ch(fb.getCode());
+            ch.owner = &fb;
+            ch.rebuildAll();
+
+            TestBytecode bc(&ch);
+            REQUIRE(bc.callSiteCount == 2);
+            REQUIRE(bc.maxCallParams == 2);
+
+            i32 result = -1;
+            TestExecuter exe(&bc);
+            exe.setArg(0, i32(1));
+            exe.setArg(1, i32(20));
+            exe.setArg(2, i32(300));
+            exe.setReturnValuePointer(&result);
+            exe.execute();
+
+            REQUIRE(result == 321);
+
+            // the marshaling plan is fixed when the code is lowered
+            for (u32 i = 0;i < bc.callSiteCount;i++) {
+                const TestCallSite& site = bc.callSites[i];
+                REQUIRE(site.cachedTarget.load()->kind == TestCallKind::Host);
+                REQUIRE(site.function == &add);
+                REQUIRE(site.returnsInRegister);
+                REQUIRE(!site.passesThis);
+            }
+        }
+
+        SECTION("Arguments are written to their registers with a plan made when the code is lowered") {
+            Function fn("mixed", Registry::Signature<i64, u8, i16, f64>(), Registry::GlobalNamespace());
+            FunctionBuilder fb(&fn);
+            DataType* i64Type = Registry::GetType<i64>();
+            Value sum = fb.getArg(0).convertedTo(i64Type) + fb.getArg(1).convertedTo(i64Type);
+            fb.generateReturn(sum + fb.getArg(2).convertedTo(i64Type));
+
+            CodeHolder ch(fb.getCode());
+            ch.owner = &fb;
+            ch.rebuildAll();
+
+            TestBytecode bc(&ch);
+            REQUIRE(!bc.takesThis);
+            REQUIRE(bc.argSizes.size() == 3);
+            REQUIRE(bc.argSizes[0] == sizeof(u8));
+            REQUIRE(bc.argSizes[1] == sizeof(i16));
+            REQUIRE(bc.argSizes[2] == sizeof(f64));
+
+            u8 a = 200;
+            i16 b = -300;
+            f64 c = 1000.0;
+            void* args[] = { &a, &b, &c };
+
+            i64 result = 0;
+            TestExecuter exe(&bc);
+            exe.setArgs(args);
+            exe.setReturnValuePointer(&result);
+            exe.execute();
+
+            REQUIRE(result == 900);
+        }
+
+        SECTION("Arguments which don't fit in a register are rejected when the code is lowered") {
+            type<long double>("f80");
+
+            Function fn("wide", Registry::Signature<void, long double>(), Registry::GlobalNamespace());
+            FunctionBuilder fb(&fn);
+            fb.generateReturn();
+
+            CodeHolder ch(fb.getCode());
+            ch.owner = &fb;
+            ch.rebuildAll();
+
+            REQUIRE_THROWS([&]() { TestBytecode bc(&ch); }());
+        }
+    }
+
+    class HostAddTwoHandler : public ICallHandler {
+        public:
+            HostAddTwoHandler(Function* target) : ICallHandler(target) {}
+
+            virtual void call(void* retDest, void** args) {
+                *(i32*)retDest = *(i32*)args[0] + 2;
+            }
+    };
+
+    void testDirectCalls() {
+        setupTest();
+
+        SECTION("Recursion depth is not limited by the host stack") {
+            // sum of [0, n], recursively
+            Function sum("sum", Registry::Signature<i32, i32>(), Registry::GlobalNamespace());
+            FunctionBuilder fb(&sum);
+            Value n = fb.getArg(0);
+
+            fb.generateIf(n == fb.val(i32(0)), [&]() {
+                fb.generateReturn(n);
+            });
+
+            fb.generateReturn(n + fb.generateCall(&sum, { n - fb.val(i32(1)) }));
+
+            TestBackend tb;
+            tb.process(&fb);
+
+            i32 input = 200000;
+            i32 result = -1;
+            void* args[] = { &input };
+            sum.call(&result, args);
+
+            REQUIRE(result == i32((i64(input) * i64(input + 1)) / 2));
+            REQUIRE(TestFramePool::Get()->getUsedSize() == 0);
+        }
+
+        SECTION("Recursion can be a million levels deep") {
+            // depth(n) = n, by recursing n times
+            Function depth("depth", Registry::Signature<u32, u32>(), Registry::GlobalNamespace());
+            FunctionBuilder fb(&depth);
+            Value n = fb.getArg(0);
+
+            fb.generateIf(n == fb.val(u32(0)), [&]() {
+                fb.generateReturn(n);
+            });
+
+            fb.generateReturn(fb.generateCall(&depth, { n - fb.val(u32(1)) }) + fb.val(u32(1)));
+
+            TestBackend tb;
+            tb.process(&fb);
+
+            TestFramePool* pool = TestFramePool::Get();
+            pool->trim();
+            u64 initialCapacity = pool->getCapacity();
+
+            u32 input = 1000000;
+            u32 result = 0;
+            void* args[] = { &input };
+            depth.call(&result, args);
+
+            REQUIRE(result == input);
+            REQUIRE(pool->getUsedSize() == 0);
+
+            // the memory is kept for the next deep recursion until the pool is trimmed
+            u64 capacity = pool->getCapacity();
+            REQUIRE(capacity > initialCapacity);
+
+            depth.call(&result, args);
+            REQUIRE(result == input);
+            REQUIRE(pool->getCapacity() == capacity);
+
+            pool->trim();
+            REQUIRE(pool->getCapacity() <= initialCapacity);
+        }
+
+        SECTION("Calls between interpreted functions are resolved the first time they're made") {
+            Function isEven("isEven", Registry::Signature<bool, u32>(), Registry::GlobalNamespace());
+            Function isOdd("isOdd", Registry::Signature<bool, u32>(), Registry::GlobalNamespace());
+
+            // isEven calls isOdd before isOdd has been compiled
+            FunctionBuilder efb(&isEven);
+            {
+                Value n = efb.getArg(0);
+                efb.generateIf(n == efb.val(u32(0)), [&]() {
+                    efb.generateReturn(efb.val(true));
+                });
+                efb.generateReturn(efb.generateCall(&isOdd, { n - efb.val(u32(1)) }));
+            }
+
+            TestBackend tb;
+            tb.process(&efb);
+
+            FunctionBuilder ofb(&isOdd);
+            {
+                Value n = ofb.getArg(0);
+                ofb.generateIf(n == ofb.val(u32(0)), [&]() {
+                    ofb.generateReturn(ofb.val(false));
+                });
+                ofb.generateReturn(ofb.generateCall(&isEven, { n - ofb.val(u32(1)) }));
+            }
+
+            tb.process(&ofb);
+
+            const TestBytecode* code = TestExecuterCallHandler::GetCode(&isEven);
+            REQUIRE(code != nullptr);
+            REQUIRE(code->callSiteCount == 1);
+            REQUIRE(code->callSites[0].cachedTarget.load() == nullptr);
+
+            u32 input = 1001;
+            bool result = true;
+            void* args[] = { &input };
+            isEven.call(&result, args);
+            REQUIRE(result == false);
+
+            input = 1000;
+            isEven.call(&result, args);
+            REQUIRE(result == true);
+
+            const TestCallTarget* target = code->callSites[0].cachedTarget.load();
+            REQUIRE(target->kind == TestCallKind::Direct);
+            REQUIRE(target->code == TestExecuterCallHandler::GetCode(&isOdd));
+        }
+
+        SECTION("Calls are made with the callee's current call handler") {
+            Function f("f", Registry::Signature<i32, i32>(), Registry::GlobalNamespace());
+            Function g("g", Registry::Signature<i32, i32>(), Registry::GlobalNamespace());
+
+            FunctionBuilder ffb(&f);
+            ffb.generateReturn(ffb.getArg(0) + ffb.val(i32(1)));
+
+            FunctionBuilder gfb(&g);
+            gfb.generateReturn(gfb.generateCall(&f, { gfb.getArg(0) }) * gfb.val(i32(10)));
+
+            TestBackend tb;
+            tb.process(&ffb);
+            tb.process(&gfb);
+
+            auto callG = [&g](i32 x) {
+                i32 result = -1;
+                void* args[] = { &x };
+                g.call(&result, args);
+                return result;
+            };
+
+            REQUIRE(callG(5) == 60);
+
+            // replaced by a host function
+            f.setCallHandler(new HostAddTwoHandler(&f));
+            REQUIRE(callG(5) == 70);
+
+            // replaced by other interpreted code, which may be allocated where the old code was
+            FunctionBuilder ffb2(&f);
+            ffb2.generateReturn(ffb2.getArg(0) + ffb2.val(i32(3)));
+            tb.process(&ffb2);
+            REQUIRE(callG(5) == 80);
+
+            const TestCallSite& site = TestExecuterCallHandler::GetCode(&g)->callSites[0];
+            const TestCallTarget* target = site.cachedTarget.load();
+            REQUIRE(target->kind == TestCallKind::Direct);
+            REQUIRE(target->code == TestExecuterCallHandler::GetCode(&f));
+
+            // the site's target for f is updated in place rather than replaced
+            for (i32 i = 0;i < 10;i++) {
+                FunctionBuilder ffb3(&f);
+                ffb3.generateReturn(ffb3.getArg(0) + ffb3.val(i));
+                tb.process(&ffb3);
+                REQUIRE(callG(5) == (5 + i) * 10);
+            }
+
+            REQUIRE(site.knownTargets.size() == 1);
+            REQUIRE(site.cachedTarget == target);
+
+            // creating and destroying the handlers of other functions doesn't add targets either
+            for (i32 i = 0;i < 10;i++) {
+                Function other("other", Registry::Signature<i32, i32>(), Registry::GlobalNamespace());
+                FunctionBuilder ofb(&other);
+                ofb.generateReturn(ofb.getArg(0));
+                tb.process(&ofb);
+                REQUIRE(callG(5) == 140);
+            }
+
+            REQUIRE(site.knownTargets.size() == 1);
+        }
+    }
+
+    void testFunctionValues() {
+        setupTest();
+
+        FunctionType* binop = Registry::Signature<i32, i32, i32>();
+
+        Function add("add", Registry::Signature<i32, i32, i32>(), Registry::GlobalNamespace());
+        add.setCallHandler(new HostAddHandler(&add));
+
+        Function mul("mul", Registry::Signature<i32, i32, i32>(), Registry::GlobalNamespace());
+        FunctionBuilder mfb(&mul);
+        mfb.generateReturn(mfb.getArg(0) * mfb.getArg(1));
+
+        TestBackend tb;
+        tb.process(&mfb);
+
+        // apply(callback, a, b) = callback(a, b), where the callback is passed as a u64
+        Function apply("apply", Registry::Signature<i32, u64, i32, i32>(), Registry::GlobalNamespace());
+        FunctionBuilder fb(&apply);
+        Value callback = fb.getArg(0);
+        callback.setType(binop);
+        fb.generateReturn(fb.generateCall(callback, { fb.getArg(1), fb.getArg(2) }));
+
+        CodeHolder ch(fb.getCode());
+        ch.owner = &fb;
+        ch.rebuildAll();
+
+        TestBytecode bc(&ch);
+        REQUIRE(bc.callSiteCount == 1);
+
+        const TestCallSite& site = bc.callSites[0];
+        REQUIRE(site.function == nullptr);
+        REQUIRE(site.returnsInRegister);
+        REQUIRE(site.cachedTarget == nullptr);
+
+        auto execute = [&bc](Function* callback, i32 a, i32 b) {
+            i32 result = -1;
+            TestExecuter exe(&bc);
+            exe.setArg(0, u64(callback));
+            exe.setArg(1, a);
+            exe.setArg(2, b);
+            exe.setReturnValuePointer(&result);
+            exe.execute();
+            return result;
+        };
+
+        SECTION("Function values can refer to interpreted or host functions") {
+            REQUIRE(execute(&mul, 6, 7) == 42);
+            REQUIRE(site.cachedTarget.load()->kind == TestCallKind::Direct);
+            REQUIRE(site.cachedTarget.load()->code == TestExecuterCallHandler::GetCode(&mul));
+
+            REQUIRE(execute(&add, 6, 7) == 13);
+            REQUIRE(site.cachedTarget.load()->kind == TestCallKind::Host);
+            REQUIRE(site.cachedTarget.load()->code == nullptr);
+
+            REQUIRE(TestFramePool::Get()->getUsedSize() == 0);
+        }
+
+        SECTION("The target of the most recent call is cached by the call site") {
+            for (i32 i = 0;i < 10;i++) REQUIRE(execute(&mul, i, 3) == i * 3);
+
+            const TestCallTarget* mulTarget = site.cachedTarget;
+            REQUIRE(mulTarget->function == &mul);
+            REQUIRE(site.knownTargets.size() == 1);
+
+            REQUIRE(execute(&add, 1, 2) == 3);
+            REQUIRE(site.cachedTarget.load()->function == &add);
+
+            // switching back reuses the target that was created for the first function
+            REQUIRE(execute(&mul, 4, 5) == 20);
+            REQUIRE(site.cachedTarget == mulTarget);
+            REQUIRE(site.knownTargets.size() == 2);
+        }
+    }
+
+    void testConcurrency() {
+        setupTest();
+
+        Function isEven("isEven", Registry::Signature<bool, u32>(), Registry::GlobalNamespace());
+        Function isOdd("isOdd", Registry::Signature<bool, u32>(), Registry::GlobalNamespace());
+        Function add("add", Registry::Signature<i32, i32, i32>(), Registry::GlobalNamespace());
+        Function mul("mul", Registry::Signature<i32, i32, i32>(), Registry::GlobalNamespace());
+        Function apply("apply", Registry::Signature<i32, u64, i32, i32>(), Registry::GlobalNamespace());
+        Function sum("sum", Registry::Signature<i32, i32>(), Registry::GlobalNamespace());
+        add.setCallHandler(new HostAddHandler(&add));
+
+        FunctionBuilder efb(&isEven);
+        {
+            Value n = efb.getArg(0);
+            efb.generateIf(n == efb.val(u32(0)), [&]() {
+                efb.generateReturn(efb.val(true));
+            });
+            efb.generateReturn(efb.generateCall(&isOdd, { n - efb.val(u32(1)) }));
+        }
+
+        FunctionBuilder ofb(&isOdd);
+        {
+            Value n = ofb.getArg(0);
+            ofb.generateIf(n == ofb.val(u32(0)), [&]() {
+                ofb.generateReturn(ofb.val(false));
+            });
+            ofb.generateReturn(ofb.generateCall(&isEven, { n - ofb.val(u32(1)) }));
+        }
+
+        FunctionBuilder mfb(&mul);
+        mfb.generateReturn(mfb.getArg(0) * mfb.getArg(1));
+
+        FunctionBuilder afb(&apply);
+        {
+            Value callback = afb.getArg(0);
+            callback.setType(Registry::Signature<i32, i32, i32>());
+            afb.generateReturn(afb.generateCall(callback, { afb.getArg(1), afb.getArg(2) }));
+        }
+
+        FunctionBuilder sfb(&sum);
+        buildSumLoop(sfb);
+
+        TestBackend tb;
+        tb.process(&efb);
+        tb.process(&ofb);
+        tb.process(&mfb);
+        tb.process(&afb);
+        tb.process(&sfb);
+
+        const TestBytecode* sumCode = TestExecuterCallHandler::GetCode(&sum);
+        REQUIRE(sumCode != nullptr);
+
+        SECTION("Compiled functions can be called from many threads at once") {
+            constexpr u32 threadCount = 8;
+            constexpr u32 iterations = 200;
+
+            // Every call site is still unresolved when the threads start, so they race to resolve them
+            std::atomic<bool> start = false;
+            std::atomic<u32> failures = 0;
+            std::thread threads[threadCount];
+
+            for (u32 t = 0;t < threadCount;t++) {
+                threads[t] = std::thread([&, t]() {
+                    while (!start.load()) std::this_thread::yield();
+
+                    for (u32 k = 0;k < iterations;k++) {
+                        u32 n = t * 31 + k;
+                        bool even = false;
+                        void* eargs[] = { &n };
+                        isEven.call(&even, eargs);
+                        if (even != (n % 2 == 0)) failures++;
+
+                        // Threads disagree about the callback, so the call site's cache keeps changing
+                        Function* callback = (t + k) % 2 ? &mul : &add;
+                        u64 cb = u64(callback);
+                        i32 a = i32(k);
+                        i32 b = i32(t + 1);
+                        i32 result = -1;
+                        void* aargs[] = { &cb, &a, &b };
+                        apply.call(&result, aargs);
+                        if (result != (callback == &mul ? a * b : a + b)) failures++;
+
+                        // Executers share the code, but each suspends and resumes with its own state
+                        i32 count = i32(k % 50);
+                        result = -1;
+                        TestExecuter exe(sumCode);
+                        exe.setArg(0, count);
+                        exe.setReturnValuePointer(&result);
+                        TestExecutionStatus status = exe.execute(u64(7));
+                        while (status == TestExecutionStatus::Suspended) status = exe.resume(7);
+                        if (result != (count * (count - 1)) / 2) failures++;
+                    }
+
+                    if (TestFramePool::Get()->getUsedSize() != 0) failures++;
+                });
+            }
+
+            // Meanwhile handlers are created and destroyed, which changes the generations of the
+            // functions they're for. Sites which share a generation with one of them resolve their
+            // targets again while the other threads are using them
+            std::atomic<bool> stop = false;
+            std::thread churn([&]() {
+                while (!start.load()) std::this_thread::yield();
+
+                for (i32 k = 0;!stop.load();k++) {
+                    Function other("other", Registry::Signature<i32, i32>(), Registry::GlobalNamespace());
+                    FunctionBuilder fb(&other);
+                    fb.generateReturn(fb.getArg(0) + fb.val(k));
+
+                    TestBackend backend;
+                    backend.process(&fb);
+
+                    i32 result = -1;
+                    void* args[] = { &k };
+                    other.call(&result, args);
+                    if (result != k + k) failures++;
+                }
+            });
+
+            start = true;
+            for (u32 t = 0;t < threadCount;t++) threads[t].join();
+            stop = true;
+            churn.join();
+
+            REQUIRE(failures == 0);
+
+            const TestBytecode* evenCode = TestExecuterCallHandler::GetCode(&isEven);
+            const TestCallTarget* evenTarget = evenCode->callSites[0].cachedTarget.load();
+            REQUIRE(evenTarget->kind == TestCallKind::Direct);
+            REQUIRE(evenTarget->code == TestExecuterCallHandler::GetCode(&isOdd));
+
+            // No matter how the threads interleaved, each callback was only looked up once
+            const TestBytecode* applyCode = TestExecuterCallHandler::GetCode(&apply);
+            REQUIRE(applyCode->callSites[0].knownTargets.size() == 2);
+        }
+    }
+
+    u32 countOps(const Array<Instruction>& code, OpCode op) {
+        u32 count = 0;
+        for (u32 i = 0;i < code.size();i++) {
+            if (code[i].op == op) count++;
+        }
+
+        return count;
+    }
+
+    void testTailCalls() {
+        setupTest();
+
+        SECTION("Calls followed by a return of their result become tail calls") {
+            Function fib("fib", Registry::Signature<i32, i32>(), Registry::GlobalNamespace());
+            FunctionBuilder ffb(&fib);
+            {
+                Value n = ffb.getArg(0);
+                ffb.generateIf(n < ffb.val(i32(2)), [&]() {
+                    ffb.generateReturn(n);
+                });
+                ffb.generateReturn(ffb.generateCall(&fib, { n - ffb.val(i32(1)) }) + ffb.generateCall(&fib, { n - ffb.val(i32(2)) }));
+            }
+
+            Function twice("twice", Registry::Signature<i32, i32>(), Registry::GlobalNamespace());
+            FunctionBuilder tfb(&twice);
+            tfb.generateReturn(tfb.generateCall(&fib, { tfb.generateCall(&fib, { tfb.getArg(0) }) }));
+
+            TailCallEliminationStep step;
+
+            // the results of fib's calls are added together before being returned
+            CodeHolder fch(ffb.getCode());
+            fch.owner = &ffb;
+            fch.rebuildAll();
+            step.execute(&fch);
+            REQUIRE(countOps(fch.code, OpCode::tail_call) == 0);
+
+            // only the outer call is returned directly
+            CodeHolder tch(tfb.getCode());
+            tch.owner = &tfb;
+            tch.rebuildAll();
+            step.execute(&tch);
+            REQUIRE(countOps(tch.code, OpCode::call) == 1);
+            REQUIRE(countOps(tch.code, OpCode::tail_call) == 1);
+            REQUIRE(countOps(tch.code, OpCode::ret) == 0);
+        }
+
+        SECTION("Tail recursion runs in constant stack space") {
+            // sum(n, acc) = n == 0 ? acc : sum(n - 1, acc + n)
+            Function sum("sum", Registry::Signature<u64, u64, u64>(), Registry::GlobalNamespace());
+            FunctionBuilder fb(&sum);
+            Value n = fb.getArg(0);
+            Value acc = fb.getArg(1);
+
+            fb.generateIf(n == fb.val(u64(0)), [&]() {
+                fb.generateReturn(acc);
+            });
+
+            fb.generateReturn(fb.generateCall(&sum, { n - fb.val(u64(1)), acc + n }));
+
+            TailCallEliminationStep step;
+            TestBackend tb;
+            tb.addPostProcess(&step);
+            tb.process(&fb);
+
+            TestFramePool* pool = TestFramePool::Get();
+            pool->trim();
+            u64 capacity = pool->getCapacity();
+
+            u64 input = 5000000;
+            u64 initial = 0;
+            u64 result = 0;
+            void* args[] = { &input, &initial };
+            sum.call(&result, args);
+
+            REQUIRE(result == (input * (input + 1)) / 2);
+            REQUIRE(pool->getUsedSize() == 0);
+            REQUIRE(pool->getCapacity() == capacity);
+        }
+
+        SECTION("Mutually recursive functions can tail call each other") {
+            Function isEven("isEven", Registry::Signature<bool, u32>(), Registry::GlobalNamespace());
+            Function isOdd("isOdd", Registry::Signature<bool, u32>(), Registry::GlobalNamespace());
+
+            FunctionBuilder efb(&isEven);
+            {
+                Value n = efb.getArg(0);
+                efb.generateIf(n == efb.val(u32(0)), [&]() {
+                    efb.generateReturn(efb.val(true));
+                });
+                efb.generateReturn(efb.generateCall(&isOdd, { n - efb.val(u32(1)) }));
+            }
+
+            FunctionBuilder ofb(&isOdd);
+            {
+                Value n = ofb.getArg(0);
+                ofb.generateIf(n == ofb.val(u32(0)), [&]() {
+                    ofb.generateReturn(ofb.val(false));
+                });
+                ofb.generateReturn(ofb.generateCall(&isEven, { n - ofb.val(u32(1)) }));
+            }
+
+            TailCallEliminationStep step;
+            TestBackend tb;
+            tb.addPostProcess(&step);
+            tb.process(&efb);
+            tb.process(&ofb);
+
+            TestFramePool* pool = TestFramePool::Get();
+            pool->trim();
+            u64 capacity = pool->getCapacity();
+
+            u32 input = 3000001;
+            bool result = true;
+            void* args[] = { &input };
+            isEven.call(&result, args);
+            REQUIRE(result == false);
+            REQUIRE(pool->getCapacity() == capacity);
+
+            // the executer's own frame is kept when it's executing the code directly
+            const TestBytecode* code = TestExecuterCallHandler::GetCode(&isOdd);
+            TestExecuter exe(code);
+            input = 1000;
+            exe.setArg(0, input);
+            exe.setReturnValuePointer(&result);
+            exe.execute();
+            REQUIRE(result == false);
+            REQUIRE(pool->getCapacity() == capacity);
+        }
+
+        SECTION("Function values and host functions can be tail called") {
+            Function add("add", Registry::Signature<i32, i32, i32>(), Registry::GlobalNamespace());
+            add.setCallHandler(new HostAddHandler(&add));
+
+            Function mul("mul", Registry::Signature<i32, i32, i32>(), Registry::GlobalNamespace());
+            FunctionBuilder mfb(&mul);
+            mfb.generateReturn(mfb.getArg(0) * mfb.getArg(1));
+
+            Function apply("apply", Registry::Signature<i32, u64, i32, i32>(), Registry::GlobalNamespace());
+            FunctionBuilder afb(&apply);
+            Value callback = afb.getArg(0);
+            callback.setType(Registry::Signature<i32, i32, i32>());
+            afb.generateReturn(afb.generateCall(callback, { afb.getArg(1), afb.getArg(2) }));
+
+            TailCallEliminationStep step;
+            TestBackend tb;
+            tb.addPostProcess(&step);
+            tb.process(&mfb);
+            tb.process(&afb);
+
+            const TestBytecode* code = TestExecuterCallHandler::GetCode(&apply);
+            REQUIRE(code->callSiteCount == 1);
+
+            bool hasTailCall = false;
+            for (u32 i = 0;i < code->code.size();i++) {
+                if (code->code[i].op == TestOp::tail_call_r) hasTailCall = true;
+            }
+            REQUIRE(hasTailCall);
+
+            Function* callbacks[] = { &mul, &add, &mul };
+            i32 expected[] = { 42, 13, 42 };
+            for (u32 c = 0;c < 3;c++) {
+                u64 cb = u64(callbacks[c]);
+                i32 a = 6;
+                i32 b = 7;
+                i32 result = -1;
+                void* args[] = { &cb, &a, &b };
+                apply.call(&result, args);
+                REQUIRE(result == expected[c]);
+            }
+
+            REQUIRE(TestFramePool::Get()->getUsedSize() == 0);
+        }
+    }
+
+    class CountingBackend : public TestBackend {
+        public:
+            CountingBackend() : transformCount(0) {}
+
+            virtual bool transform(CodeHolder* processedCode) {
+                transformCount++;
+                return TestBackend::transform(processedCode);
+            }
+
+            std::atomic<u32> transformCount;
+    };
+
+    void testLazyCompilation() {
+        setupTest();
+
+        SECTION("Lazily processed functions are compiled on their first call") {
+            Function fn("sum", Registry::Signature<i32, i32>(), Registry::GlobalNamespace());
+            FunctionBuilder fb(&fn);
+            buildSumLoop(fb);
+
+            CountingBackend tb;
+            tb.setLazyCompilation(true);
+            REQUIRE(tb.process(&fb));
+            REQUIRE(tb.transformCount == 0);
+
+            LazyCallHandler* stub = dynamic_cast<LazyCallHandler*>(fn.getCallHandler());
+            REQUIRE(stub != nullptr);
+            REQUIRE(!stub->isCompiled());
+            REQUIRE(TestExecuterCallHandler::GetCode(&fn) == nullptr);
+
+            for (i32 n = 0;n < 3;n++) {
+                i32 x = 10 + n;
+                i32 result = 0;
+                void* args[] = { &x };
+                fn.call(&result, args);
+                REQUIRE(result == x * (x - 1) / 2);
+            }
+
+            // compiled once, and calls still go through the stub
+            REQUIRE(tb.transformCount == 1);
+            REQUIRE(stub->isCompiled());
+            REQUIRE(fn.getCallHandler() == stub);
+            REQUIRE(dynamic_cast<TestExecuterCallHandler*>(stub->getCompiledHandler()) != nullptr);
+            REQUIRE(TestExecuterCallHandler::GetCode(&fn) != nullptr);
+        }
+
+        SECTION("Interpreted code can call functions which haven't been compiled yet") {
+            Function square("square", Registry::Signature<i32, i32>(), Registry::GlobalNamespace());
+            Function caller("caller", Registry::Signature<i32, i32>(), Registry::GlobalNamespace());
+
+            FunctionBuilder sfb(&square);
+            sfb.generateReturn(sfb.getArg(0) * sfb.getArg(0));
+
+            FunctionBuilder cfb(&caller);
+            cfb.generateReturn(cfb.generateCall(&square, { cfb.getArg(0) }) + cfb.val(i32(1)));
+
+            CountingBackend tb;
+            tb.setLazyCompilation(true);
+            tb.process(&sfb);
+            tb.process(&cfb);
+
+            i32 x = 7;
+            i32 result = 0;
+            void* args[] = { &x };
+            caller.call(&result, args);
+            REQUIRE(result == 50);
+            REQUIRE(tb.transformCount == 2);
+        }
+
+        SECTION("Calls between lazily compiled functions are resolved once the callee is compiled") {
+            Function isEven("isEven", Registry::Signature<bool, u32>(), Registry::GlobalNamespace());
+            Function isOdd("isOdd", Registry::Signature<bool, u32>(), Registry::GlobalNamespace());
+
+            FunctionBuilder efb(&isEven);
+            {
+                Value n = efb.getArg(0);
+                efb.generateIf(n == efb.val(u32(0)), [&]() {
+                    efb.generateReturn(efb.val(true));
+                });
+                efb.generateReturn(efb.generateCall(&isOdd, { n - efb.val(u32(1)) }));
+            }
+
+            FunctionBuilder ofb(&isOdd);
+            {
+                Value n = ofb.getArg(0);
+                ofb.generateIf(n == ofb.val(u32(0)), [&]() {
+                    ofb.generateReturn(ofb.val(false));
+                });
+                ofb.generateReturn(ofb.generateCall(&isEven, { n - ofb.val(u32(1)) }));
+            }
+
+            CountingBackend tb;
+            tb.setLazyCompilation(true);
+            tb.process(&efb);
+            tb.process(&ofb);
+
+            // isOdd is compiled by the first call that isEven makes to it, and the calls which
+            // follow it don't go through the host stack
+            u32 input = 1000001;
+            bool result = true;
+            void* args[] = { &input };
+            isEven.call(&result, args);
+            REQUIRE(result == false);
+            REQUIRE(tb.transformCount == 2);
+
+            const TestCallTarget* target = TestExecuterCallHandler::GetCode(&isEven)->callSites[0].cachedTarget.load();
+            REQUIRE(target->kind == TestCallKind::Direct);
+            REQUIRE(target->code == TestExecuterCallHandler::GetCode(&isOdd));
+        }
+
+        SECTION("Concurrent first calls compile the function once") {
+            Function fn("sum", Registry::Signature<i32, i32>(), Registry::GlobalNamespace());
+            FunctionBuilder fb(&fn);
+            buildSumLoop(fb);
+
+            CountingBackend tb;
+            tb.setLazyCompilation(true);
+            tb.process(&fb);
+
+            constexpr u32 threadCount = 8;
+            std::atomic<bool> start = false;
+            std::atomic<u32> failures = 0;
+            std::thread threads[threadCount];
+
+            for (u32 t = 0;t < threadCount;t++) {
+                threads[t] = std::thread([&, t]() {
+                    while (!start.load()) std::this_thread::yield();
+
+                    i32 x = i32(100 + t);
+                    i32 result = 0;
+                    void* args[] = { &x };
+                    fn.call(&result, args);
+                    if (result != x * (x - 1) / 2) failures++;
+                });
+            }
+
+            // Meanwhile handlers are created and destroyed, which changes the generations of the
+            // functions they're for. Sites which share a generation with one of them resolve their
+            // targets again while the other threads are using them
+            std::atomic<bool> stop = false;
+            std::thread churn([&]() {
+                while (!start.load()) std::this_thread::yield();
+
+                for (i32 k = 0;!stop.load();k++) {
+                    Function other("other", Registry::Signature<i32, i32>(), Registry::GlobalNamespace());
+                    FunctionBuilder fb(&other);
+                    fb.generateReturn(fb.getArg(0) + fb.val(k));
+
+                    TestBackend backend;
+                    backend.process(&fb);
+
+                    i32 result = -1;
+                    void* args[] = { &k };
+                    other.call(&result, args);
+                    if (result != k + k) failures++;
+                }
+            });
+
+            start = true;
+            for (u32 t = 0;t < threadCount;t++) threads[t].join();
+            stop = true;
+            churn.join();
+
+            REQUIRE(failures == 0);
+            REQUIRE(tb.transformCount == 1);
+        }
+    }
+
+    void testRegisterCompaction() {
+        setupTest();
+
+        SECTION("Vregs with disjoint lifetimes share register slots") {
+            Function fn("chain", Registry::Signature<i32, i32>(), Registry::GlobalNamespace());
+            FunctionBuilder fb(&fn);
+
+            // every step produces temporaries which are dead after the next one
+            Value acc = fb.getArg(0);
+            for (i32 s = 1;s <= 50;s++) acc = (acc * fb.val(i32(3))) ^ fb.val(s);
+            fb.ret(acc);
+
+            CodeHolder ch(fb.getCode());
+            ch.owner = &fb;
+            ch.rebuildAll();
+
+            TestBytecode bc(&ch);
+            REQUIRE(bc.registerCount < 10);
+            REQUIRE(bc.registerCount < bc.registerMap.size() / 10);
+
+            i32 result = 0;
+            TestExecuter exe(&bc);
+            exe.setArg(0, i32(7));
+            exe.setReturnValuePointer(&result);
+            exe.execute();
+
+            i32 expected = 7;
+            for (i32 s = 1;s <= 50;s++) expected = i32(u32(expected) * 3u) ^ s;
+            REQUIRE(result == expected);
+        }
+
+        SECTION("Values which are live across a loop keep their slots for the whole loop") {
+            Function fn("loop", Registry::Signature<i32, i32>(), Registry::GlobalNamespace());
+            FunctionBuilder fb(&fn);
+
+            Value n = fb.getArg(0);
+            Value before = fb.val<i32>();
+            Value acc = fb.val<i32>();
+            Value i = fb.val<i32>();
+            fb.assign(before, n * fb.val(i32(1000)));
+            fb.assign(acc, fb.val(i32(0)));
+            fb.assign(i, fb.val(i32(0)));
+
+            fb.generateFor(
+                [&]() { return i < n; },
+                [&]() { i++; },
+                [&]() {
+                    // temporaries inside the loop must not reuse the slot of 'before'
+                    Value t = (i * fb.val(i32(2))) + fb.val(i32(1));
+                    acc += t;
+                }
+            );
+
+            fb.ret(acc + before);
+
+            TestBackend tb;
+            tb.process(&fb);
+
+            i32 input = 10;
+            i32 result = 0;
+            void* args[] = { &input };
+            fn.call(&result, args);
+
+            // sum of 2i + 1 over [0, 10) is 100
+            REQUIRE(result == 100 + 10000);
+        }
+
+        SECTION("Vregs which were removed or never existed can't be accessed") {
+            Function fn("unused", Registry::Signature<i32, i32>(), Registry::GlobalNamespace());
+            FunctionBuilder fb(&fn);
+
+            // never referred to by any instruction, so it doesn't get a slot
+            Value unused = fb.val<i32>();
+            Value arg = fb.getArg(0);
+            fb.ret(arg + fb.val(i32(1)));
+
+            CodeHolder ch(fb.getCode());
+            ch.owner = &fb;
+            ch.rebuildAll();
+
+            TestBytecode bc(&ch);
+            TestExecuter exe(&bc);
+            exe.setArg(0, i32(5));
+            REQUIRE(exe.getRegister<i32>(arg) == 5);
+
+            REQUIRE_THROWS(exe.getRegister<i32>(unused));
+            REQUIRE_THROWS(exe.setRegister<i32>(unused.getRegisterId(), 1));
+            REQUIRE_THROWS(exe.getRegister<i32>(vreg_id(bc.registerMap.size())));
+            REQUIRE_THROWS(exe.setRegister<i32>(vreg_id(0xFFFFFFF0), 1));
+        }
+    }
+
+    void testBatch() {
+        setupTest();
+
+        SECTION("Lanes which agree on every branch are executed together") {
+            Function fn("formula", Registry::Signature<f64, f64, f64>(), Registry::GlobalNamespace());
+            FunctionBuilder fb(&fn);
+            Value a = fb.getArg(0);
+            Value b = fb.getArg(1);
+            fb.ret((a * b) - (a / b) + fb.val(f64(1.0)));
+
+            CodeHolder ch(fb.getCode());
+            ch.owner = &fb;
+            ch.rebuildAll();
+
+            TestBytecode bc(&ch);
+
+            // not a multiple of the batch width
+            constexpr u32 laneCount = 150;
+            f64 x[laneCount];
+            f64 y[laneCount];
+            f64 results[laneCount];
+            for (u32 l = 0;l < laneCount;l++) {
+                x[l] = f64(l);
+                y[l] = f64(l % 7) + 1.0;
+                results[l] = -1.0;
+            }
+
+            TestExecuter exe(&bc);
+            u32 usedSize = TestFramePool::Get()->getUsedSize();
+            exe.setBatchArg(0, x);
+            exe.setBatchArg(1, y);
+            exe.setBatchReturnValues(results);
+            exe.executeBatch(laneCount);
+
+            for (u32 l = 0;l < laneCount;l++) {
+                REQUIRE(results[l] == (x[l] * y[l]) - (x[l] / y[l]) + 1.0);
+            }
+
+            // arguments without a column take the same value for every lane
+            exe.setArg(1, f64(2.0));
+            exe.setBatchArg(1, (const f64*)nullptr);
+            exe.executeBatch(laneCount);
+
+            for (u32 l = 0;l < laneCount;l++) {
+                REQUIRE(results[l] == (x[l] * 2.0) - (x[l] / 2.0) + 1.0);
+            }
+
+            // the batch register file is returned to the pool
+            REQUIRE(TestFramePool::Get()->getUsedSize() == usedSize);
+        }
+
+        SECTION("Lanes which disagree about a branch are finished separately") {
+            Function fn("sum", Registry::Signature<i32, i32>(), Registry::GlobalNamespace());
+            FunctionBuilder fb(&fn);
+            buildSumLoop(fb);
+
+            CodeHolder ch(fb.getCode());
+            ch.owner = &fb;
+            ch.rebuildAll();
+
+            TestBytecode bc(&ch);
+
+            constexpr u32 laneCount = 100;
+            i32 n[laneCount];
+            i32 results[laneCount];
+            for (u32 l = 0;l < laneCount;l++) {
+                n[l] = i32(l % 10) * 3;
+                results[l] = -1;
+            }
+
+            TestExecuter exe(&bc);
+            u32 usedSize = TestFramePool::Get()->getUsedSize();
+            exe.setBatchArg(0, n);
+            exe.setBatchReturnValues(results);
+            exe.executeBatch(laneCount);
+
+            for (u32 l = 0;l < laneCount;l++) {
+                i32 expected = -1;
+                TestExecuter scalar(&bc);
+                scalar.setArg(0, n[l]);
+                scalar.setReturnValuePointer(&expected);
+                scalar.execute();
+
+                REQUIRE(results[l] == expected);
+            }
+
+            REQUIRE(TestFramePool::Get()->getUsedSize() == usedSize);
+        }
+    }
+
+    void testProfiling() {
+        setupTest();
+
+        SECTION("Instructions and blocks are counted each time they're executed") {
+            Function fn("sum", Registry::Signature<i32, i32>(), Registry::GlobalNamespace());
+            FunctionBuilder fb(&fn);
+
+            fb.setCurrentSourceLocation({ 1, 0, 10, 1, 1, 1, 11 });
+            Value n = fb.getArg(0);
+            Value acc = fb.val<i32>();
+            Value i = fb.val<i32>();
+            fb.assign(acc, fb.val(i32(0)));
+            fb.assign(i, fb.val(i32(0)));
+
+            fb.setCurrentSourceLocation({ 1, 11, 20, 2, 2, 1, 10 });
+            fb.generateFor(
+                [&]() { return i < n; },
+                [&]() { i++; },
+                [&]() {
+                    fb.setCurrentSourceLocation({ 1, 21, 30, 3, 3, 5, 14 });
+                    acc += i;
+                }
+            );
+
+            fb.setCurrentSourceLocation({ 1, 31, 40, 4, 4, 1, 10 });
+            fb.ret(acc);
+
+            CodeHolder ch(fb.getCode());
+            ch.owner = &fb;
+            ch.rebuildAll();
+
+            TestBytecode bc(&ch);
+            REQUIRE(bc.sourceIndices.size() == bc.code.size());
+            REQUIRE(bc.blockIndices.size() == bc.code.size());
+            REQUIRE(bc.blocks.size() == ch.cfg.blocks.size());
+
+            TestProfiler profiler;
+            TestDispatchMode modes[] = { TestDispatchMode::Switch, TestDispatchMode::Threaded };
+            for (TestDispatchMode mode : modes) {
+                profiler.reset();
+
+                i32 result = -1;
+                TestExecuter exe(&bc);
+                exe.setDispatchMode(mode);
+                exe.setProfiler(&profiler);
+                exe.setArg(0, i32(10));
+                exe.setReturnValuePointer(&result);
+                exe.execute();
+                REQUIRE(result == 45);
+
+                const TestFunctionProfile* profile = profiler.findProfile(&bc);
+                REQUIRE(profile != nullptr);
+                REQUIRE(profiler.getProfiles().size() == 1);
+
+                u64 total = 0;
+                u32 bodyInstructions = 0;
+                for (u32 c = 0;c < bc.code.size();c++) {
+                    total += profile->instructionCounts[c];
+
+                    // the loop body is mapped back to line 3
+                    const SourceLocation* src = profile->getSourceLocation(c);
+                    if (!src || src->startLine != 3) continue;
+
+                    bodyInstructions++;
+                    REQUIRE(profile->instructionCounts[c] == 10);
+                    REQUIRE(profile->getBlockCount(bc.blockIndices[c]) == 10);
+                }
+
+                REQUIRE(bodyInstructions > 0);
+                REQUIRE(total == profile->totalCount);
+
+                // the entry block is only entered once
+                REQUIRE(profile->instructionCounts[0] == 1);
+                REQUIRE(profile->getBlockCount(bc.blockIndices[0]) == 1);
+            }
+        }
+
+        SECTION("Direct calls are profiled with the caller") {
+            Function fib("fib", Registry::Signature<i32, i32>(), Registry::GlobalNamespace());
+            FunctionBuilder fb(&fib);
+            Value arg = fb.getArg(0);
+
+            fb.generateIf(arg < fb.val(i32(2)), [&]() {
+                fb.generateReturn(arg);
+            });
+
+            Value a = fb.generateCall(&fib, { arg - fb.val(i32(1)) });
+            Value b = fb.generateCall(&fib, { arg - fb.val(i32(2)) });
+            fb.generateReturn(a + b);
+
+            TestBackend tb;
+            tb.process(&fb);
+
+            const TestBytecode* code = TestExecuterCallHandler::GetCode(&fib);
+            REQUIRE(code != nullptr);
+
+            TestProfiler profiler;
+            profiler.setTimingEnabled(true);
+
+            i32 result = -1;
+            TestExecuter exe(code);
+            exe.setProfiler(&profiler);
+            exe.setArg(0, i32(10));
+            exe.setReturnValuePointer(&result);
+            exe.execute();
+            REQUIRE(result == 55);
+
+            // fib(n) makes 2 * fib(n + 1) - 1 calls
+            const TestFunctionProfile* profile = profiler.findProfile(code);
+            REQUIRE(profile != nullptr);
+            REQUIRE(profile->instructionCounts[0] == 2 * 89 - 1);
+
+            u64 time = 0;
+            for (u32 b = 0;b < profile->blockTimes.size();b++) time += profile->blockTimes[b];
+            REQUIRE(time > 0);
+
+            String report = profiler.generateReport();
+            REQUIRE(report.size() > 0);
+        }
+    }
+
+    void testBudgets() {
+        setupTest();
+
+        Function sum("sum", Registry::Signature<i32, i32>(), Registry::GlobalNamespace());
+        FunctionBuilder sfb(&sum);
+        buildSumLoop(sfb);
+
+        CodeHolder ch(sfb.getCode());
+        ch.owner = &sfb;
+        ch.rebuildAll();
+
+        TestBytecode bc(&ch);
+
+        SECTION("Execution stops after exactly the number of instructions in the budget") {
+            // count the instructions that a full execution takes
+            TestProfiler profiler;
+            i32 result = -1;
+            {
+                TestExecuter exe(&bc);
+                exe.setProfiler(&profiler);
+                exe.setArg(0, i32(100));
+                exe.setReturnValuePointer(&result);
+                exe.execute();
+            }
+
+            u64 instructionCount = profiler.findProfile(&bc)->totalCount;
+            REQUIRE(result == 4950);
+
+            TestDispatchMode modes[] = { TestDispatchMode::Switch, TestDispatchMode::Threaded };
+            for (TestDispatchMode mode : modes) {
+                TestExecuter exe(&bc);
+                exe.setDispatchMode(mode);
+                exe.setArg(0, i32(100));
+                exe.setReturnValuePointer(&result);
+
+                result = -1;
+                REQUIRE(exe.execute(instructionCount - 1) == TestExecutionStatus::Suspended);
+                REQUIRE(exe.isSuspended());
+                REQUIRE(result == -1);
+
+                // only the last instruction is left
+                REQUIRE(exe.resume(1) == TestExecutionStatus::Completed);
+                REQUIRE(!exe.isSuspended());
+                REQUIRE(result == 4950);
+
+                result = -1;
+                REQUIRE(exe.execute(instructionCount) == TestExecutionStatus::Completed);
+                REQUIRE(result == 4950);
+
+                // a budget of 0 doesn't execute anything
+                result = -1;
+                REQUIRE(exe.execute(0) == TestExecutionStatus::Suspended);
+
+                u32 resumeCount = 0;
+                while (exe.resume(7) == TestExecutionStatus::Suspended) resumeCount++;
+                REQUIRE(resumeCount == (instructionCount - 1) / 7);
+                REQUIRE(result == 4950);
+            }
+        }
+
+        SECTION("Suspended executions can be interleaved on one thread") {
+            Function fib("fib", Registry::Signature<i32, i32>(), Registry::GlobalNamespace());
+            FunctionBuilder ffb(&fib);
+            Value arg = ffb.getArg(0);
+
+            ffb.generateIf(arg < ffb.val(i32(2)), [&]() {
+                ffb.generateReturn(arg);
+            });
+
+            Value a = ffb.generateCall(&fib, { arg - ffb.val(i32(1)) });
+            Value b = ffb.generateCall(&fib, { arg - ffb.val(i32(2)) });
+            ffb.generateReturn(a + b);
+
+            TestBackend tb;
+            tb.process(&ffb);
+
+            u32 usedSize = TestFramePool::Get()->getUsedSize();
+
+            {
+                i32 fibResult = -1;
+                TestExecuter fibExe(TestExecuterCallHandler::GetCode(&fib));
+                fibExe.setArg(0, i32(15));
+                fibExe.setReturnValuePointer(&fibResult);
+
+                i32 sumResult = -1;
+                TestExecuter sumExe(&bc);
+                sumExe.setArg(0, i32(1000));
+                sumExe.setReturnValuePointer(&sumResult);
+
+                TestExecutionStatus fibStatus = fibExe.execute(50);
+                TestExecutionStatus sumStatus = sumExe.execute(50);
+                u32 rounds = 1;
+
+                // the recursion is suspended part way through, with calls that haven't returned yet
+                REQUIRE(fibStatus == TestExecutionStatus::Suspended);
+                REQUIRE(TestFramePool::Get()->getUsedSize() > usedSize);
+
+                while (fibStatus == TestExecutionStatus::Suspended || sumStatus == TestExecutionStatus::Suspended) {
+                    fibStatus = fibExe.resume(50);
+                    sumStatus = sumExe.resume(50);
+                    rounds++;
+                }
+
+                REQUIRE(rounds > 10);
+                REQUIRE(fibResult == 610);
+                REQUIRE(sumResult == 499500);
+            }
+
+            REQUIRE(TestFramePool::Get()->getUsedSize() == usedSize);
+
+            {
+                i32 fibResult = -1;
+                TestExecuter fibExe(TestExecuterCallHandler::GetCode(&fib));
+                fibExe.setArg(0, i32(15));
+                fibExe.setReturnValuePointer(&fibResult);
+
+                // discarding a suspended execution releases the frames of the calls in progress
+                REQUIRE(fibExe.execute(500) == TestExecutionStatus::Suspended);
+                fibExe.cancel();
+                REQUIRE(!fibExe.isSuspended());
+                REQUIRE(fibExe.resume(500) == TestExecutionStatus::Completed);
+                REQUIRE(fibResult == -1);
+
+                // and a new execution starts from the beginning
+                fibExe.execute();
+                REQUIRE(fibResult == 610);
+            }
+
+            REQUIRE(TestFramePool::Get()->getUsedSize() == usedSize);
+        }
+
+        SECTION("Execution stops when the time budget runs out") {
+            i32 result = -1;
+            TestExecuter exe(&bc);
+            exe.setArg(0, i32(10000000));
+            exe.setReturnValuePointer(&result);
+
+            REQUIRE(exe.executeFor(1000) == TestExecutionStatus::Suspended);
+            REQUIRE(result == -1);
+
+            // 10 seconds is plenty
+            REQUIRE(exe.resumeFor(10000000000ull) == TestExecutionStatus::Completed);
+
+            i32 expected = 0;
+            for (i32 i = 0;i < 10000000;i++) expected = i32(u32(expected) + u32(i));
+            REQUIRE(result == expected);
+        }
+    }
+};
+
+TEST_CASE("Test Executer", "[codegen]") {
+    SECTION("Bytecode Lowering") {
+        execution::testLowering();
+    }
+
+    SECTION("Loops") {
+        execution::testLoops();
+    }
+
+    SECTION("Dispatch Modes") {
+        execution::testDispatchModes();
+    }
+
+    SECTION("Arithmetic") {
+        execution::testArithmetic();
+    }
+
+    SECTION("Narrow Arithmetic") {
+        execution::testNarrowArithmetic();
+    }
+
+    SECTION("Conversions") {
+        execution::testConversions();
+    }
+
+    SECTION("Vector Kernels") {
+        execution::testVectorKernels();
+    }
+
+    SECTION("Stack") {
+        execution::testStack();
+    }
+
+    SECTION("Stack Slot Sharing") {
+        execution::testStackSlotSharing();
+    }
+
+    SECTION("Superinstructions") {
+        execution::testFusion();
+    }
+
+    SECTION("Frame Pooling") {
+        execution::testFramePooling();
+    }
+
+    SECTION("Calls") {
+        execution::testCalls();
+    }
+
+    SECTION("Host Calls") {
+        execution::testHostCalls();
+    }
+
+    SECTION("Direct Calls") {
+        execution::testDirectCalls();
+    }
+
+    SECTION("Function Values") {
+        execution::testFunctionValues();
+    }
+
+    SECTION("Concurrency") {
+        execution::testConcurrency();
+    }
+
+    SECTION("Tail Calls") {
+        execution::testTailCalls();
+    }
+
+    SECTION("Lazy Compilation") {
+        execution::testLazyCompilation();
+    }
+
+    SECTION("Register Compaction") {
+        execution::testRegisterCompaction();
+    }
+
+    SECTION("Batch Execution") {
+        execution::testBatch();
+    }
+
+    SECTION("Profiling") {
+        execution::testProfiling();
+    }
+
+    SECTION("Budgets") {
+        execution::testBudgets();
+    }
+}
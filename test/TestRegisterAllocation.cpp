@@ -0,0 +1,499 @@
+#include "Common.h"
+#include <codegen/TestBackend.h>
+#include <codegen/CodeHolder.h>
+#include <codegen/IR.h>
+#include <codegen/optimize/LinearScanRegisterAllocator.h>
+#include <codegen/optimize/GraphColoringRegisterAllocator.h>
+#include <codegen/optimize/TieredRegisterAllocator.h>
+#include <utils/Exception.h>
+
+namespace regalloc {
+    PhysicalRegisterSet registerSet(u32 gprCount, u32 fprCount) {
+        PhysicalRegisterSet set;
+        for (u32 r = 0;r < gprCount;r++) set.gprs.push(r);
+        for (u32 r = 0;r < fprCount;r++) set.fprs.push(100 + r);
+        return set;
+    }
+
+    // Vregs may share a register where one is copied to the other as it dies
+    bool isCoalescedMove(CodeHolder& ch, const RegisterAssignment& src, const RegisterAssignment& dst) {
+        if (src.end != dst.begin) return false;
+
+        const Instruction& i = ch.code[src.end];
+        if (i.op != OpCode::assign && i.op != OpCode::resolve) return false;
+        return i.operands[0].getRegisterId() == dst.reg_id && i.operands[1].getRegisterId() == src.reg_id;
+    }
+
+    // Every vreg referred to by the code must have a register of its own kind, which isn't held by
+    // any other vreg that's live at the same time
+    void checkAllocation(CodeHolder& ch, const PhysicalRegisterSet& set) {
+        REQUIRE(ch.registers.isAllocated());
+
+        for (u32 c = 0;c < ch.code.size();c++) {
+            const Instruction& i = ch.code[c];
+            for (u32 o = 0;o < 3;o++) {
+                if (!i.operands[o].isReg() || i.operands[o].getRegisterId() == NullRegister) continue;
+
+                const RegisterAssignment* a = ch.registers.get(i.operands[o].getRegisterId());
+                REQUIRE(a != nullptr);
+                REQUIRE(a->begin <= c);
+                REQUIRE(a->end >= c);
+            }
+        }
+
+        const Array<RegisterAssignment>& assignments = ch.registers.assignments;
+        for (u32 a = 0;a < assignments.size();a++) {
+            const RegisterAssignment& ra = assignments[a];
+            const Array<u32>& ids = ra.is_fp ? set.fprs : set.gprs;
+
+            bool inSet = false;
+            for (u32 r = 0;r < ids.size();r++) inSet = inSet || ids[r] == ra.physical;
+            REQUIRE(inSet);
+
+            for (u32 b = a + 1;b < assignments.size();b++) {
+                const RegisterAssignment& rb = assignments[b];
+                if (ra.physical != rb.physical) continue;
+                if (isCoalescedMove(ch, ra, rb) || isCoalescedMove(ch, rb, ra)) continue;
+                REQUIRE((ra.end < rb.begin || rb.end < ra.begin));
+            }
+        }
+    }
+
+    u32 countOps(const Array<Instruction>& code, OpCode op) {
+        u32 count = 0;
+        for (u32 i = 0;i < code.size();i++) {
+            if (code[i].op == op) count++;
+        }
+
+        return count;
+    }
+
+    // Computes products of the argument which are all live until they're summed at the end
+    void buildProducts(FunctionBuilder& fb, u32 count) {
+        Value x = fb.getArg(0);
+        Array<Value> products;
+        for (u32 i = 0;i < count;i++) products.push(x * fb.val(i32(i + 1)));
+
+        Value sum = fb.val<i32>();
+        fb.assign(sum, fb.val(i32(0)));
+        for (u32 i = 0;i < count;i++) fb.assign(sum, sum + products[i]);
+        fb.ret(sum);
+    }
+
+    // Weighted sum of the arguments, which are all live until the end
+    void buildWeightedSum(FunctionBuilder& fb, u32 argCount) {
+        Array<Value> products;
+        for (u32 a = 0;a < argCount;a++) products.push(fb.getArg(a) * fb.val(i32(a + 1)));
+
+        Value sum = fb.val<i32>();
+        fb.assign(sum, fb.val(i32(0)));
+        for (u32 a = 0;a < argCount;a++) fb.assign(sum, sum + products[a] + fb.getArg(a));
+        fb.ret(sum);
+    }
+
+    template <typename Step>
+    void checkWeightedSum() {
+        Function fn("weightedSum", Registry::Signature<i32, i32, i32, i32, i32>(), Registry::GlobalNamespace());
+        FunctionBuilder fb(&fn);
+        buildWeightedSum(fb, 4);
+
+        PhysicalRegisterSet set = registerSet(3, 3);
+        Step step(set);
+
+        CodeHolder ch(fb.getCode());
+        ch.owner = &fb;
+        ch.rebuildAll();
+        step.execute(&ch);
+        checkAllocation(ch, set);
+        REQUIRE(ch.registers.stats.spilledCount > 0);
+
+        TestBackend tb;
+        tb.addPostProcess(&step);
+        REQUIRE(tb.process(&fb));
+
+        i32 x[] = { 1, 2, 3, 4 };
+        i32 result = 0;
+        void* args[] = { &x[0], &x[1], &x[2], &x[3] };
+        fn.call(&result, args);
+
+        REQUIRE(result == 2 * 1 + 3 * 2 + 4 * 3 + 5 * 4);
+    }
+
+    // sum of [0, n) * scale, with values that live across the loop
+    void buildScaledSum(FunctionBuilder& fb) {
+        Value n = fb.getArg(0);
+        Value scale = fb.getArg(1);
+        Value acc = fb.val<f64>();
+        Value i = fb.val<i32>();
+        Value step = fb.val<i32>();
+        Value bias = fb.val<f64>();
+        fb.assign(acc, fb.val(f64(0.0)));
+        fb.assign(i, fb.val(i32(0)));
+        fb.assign(step, fb.val(i32(1)));
+        fb.assign(bias, fb.val(f64(0.5)));
+
+        fb.generateFor(
+            [&]() { return i < n; },
+            [&]() { fb.assign(i, i + step); },
+            [&]() { acc += (i.convertedTo(Registry::GetType<f64>()) * scale) + bias; }
+        );
+
+        fb.ret(acc - (bias * n.convertedTo(Registry::GetType<f64>())));
+    }
+
+    void testLinearScan() {
+        setupTest();
+
+        SECTION("Concurrent vregs are never given the same register") {
+            Function fn("products", Registry::Signature<i32, i32>(), Registry::GlobalNamespace());
+            FunctionBuilder fb(&fn);
+            buildProducts(fb, 6);
+
+            PhysicalRegisterSet set = registerSet(16, 16);
+            LinearScanRegisterAllocatorStep step(set);
+
+            CodeHolder ch(fb.getCode());
+            ch.owner = &fb;
+            ch.rebuildAll();
+            u32 codeSize = ch.code.size();
+
+            step.execute(&ch);
+            checkAllocation(ch, set);
+
+            // Nothing needs to be spilled
+            REQUIRE(ch.code.size() == codeSize);
+            REQUIRE(ch.registers.stats.spilledCount == 0);
+            REQUIRE(ch.registers.stats.roundCount == 1);
+            REQUIRE(ch.registers.stats.assignedCount == ch.registers.assignments.size());
+        }
+
+        SECTION("Vregs which don't fit are spilled to the stack") {
+            Function fn("products", Registry::Signature<i32, i32>(), Registry::GlobalNamespace());
+            FunctionBuilder fb(&fn);
+            buildProducts(fb, 8);
+
+            PhysicalRegisterSet set = registerSet(4, 3);
+            LinearScanRegisterAllocatorStep step(set);
+
+            CodeHolder ch(fb.getCode());
+            ch.owner = &fb;
+            ch.rebuildAll();
+
+            step.execute(&ch);
+            checkAllocation(ch, set);
+
+            const RegisterAllocationStats& stats = ch.registers.stats;
+            REQUIRE(stats.spilledCount > 0);
+            REQUIRE(stats.roundCount > 1);
+            REQUIRE(stats.spillStoreCount >= stats.spilledCount);
+            REQUIRE(stats.reloadCount >= stats.spilledCount);
+            REQUIRE(countOps(ch.code, OpCode::stack_alloc) == stats.spilledCount);
+            REQUIRE(countOps(ch.code, OpCode::store) == stats.spillStoreCount);
+            REQUIRE(countOps(ch.code, OpCode::load) == stats.reloadCount);
+
+            // The totals are kept by the step
+            REQUIRE(step.getStats().functionCount == 1);
+            REQUIRE(step.getStats().spilledCount == stats.spilledCount);
+
+            step.resetStats();
+            REQUIRE(step.getStats().spilledCount == 0);
+        }
+
+        SECTION("Spilled code computes the same results") {
+            for (u32 count = 1;count <= 10;count++) {
+                Function fn("products", Registry::Signature<i32, i32>(), Registry::GlobalNamespace());
+                FunctionBuilder fb(&fn);
+                buildProducts(fb, count);
+
+                LinearScanRegisterAllocatorStep step(registerSet(3, 3));
+                TestBackend tb;
+                tb.addPostProcess(&step);
+                REQUIRE(tb.process(&fb));
+
+                i32 x = 7;
+                i32 result = 0;
+                void* args[] = { &x };
+                fn.call(&result, args);
+
+                REQUIRE(result == 7 * i32(count * (count + 1)) / 2);
+                REQUIRE(step.getStats().functionCount == 1);
+                if (count > 3) REQUIRE(step.getStats().spilledCount > 0);
+            }
+        }
+
+        SECTION("Values live across loops are spilled and reloaded correctly") {
+            Function fn("scaledSum", Registry::Signature<f64, i32, f64>(), Registry::GlobalNamespace());
+            FunctionBuilder fb(&fn);
+            buildScaledSum(fb);
+
+            PhysicalRegisterSet set = registerSet(3, 3);
+            LinearScanRegisterAllocatorStep step(set);
+
+            CodeHolder ch(fb.getCode());
+            ch.owner = &fb;
+            ch.rebuildAll();
+            step.execute(&ch);
+            checkAllocation(ch, set);
+            REQUIRE(ch.registers.stats.spilledCount > 0);
+
+            TestBackend tb;
+            tb.addPostProcess(&step);
+            REQUIRE(tb.process(&fb));
+
+            i32 n = 100;
+            f64 scale = 2.0;
+            f64 result = 0.0;
+            void* args[] = { &n, &scale };
+            fn.call(&result, args);
+
+            REQUIRE(result == 9900.0);
+        }
+
+        SECTION("Register sets which are too small are rejected") {
+            Function fn("products", Registry::Signature<i32, i32>(), Registry::GlobalNamespace());
+            FunctionBuilder fb(&fn);
+            buildProducts(fb, 2);
+
+            LinearScanRegisterAllocatorStep step(registerSet(2, 8));
+
+            CodeHolder ch(fb.getCode());
+            ch.owner = &fb;
+            ch.rebuildAll();
+            REQUIRE_THROWS(step.execute(&ch));
+        }
+
+        SECTION("Instructions which read three pointers need another register") {
+            Function fn("cross", Registry::Signature<i32, f32*, f32*, f32*, i32>(), Registry::GlobalNamespace());
+            FunctionBuilder fb(&fn);
+            {
+                Value x = fb.getArg(3);
+                Value y0 = x * fb.val(i32(2));
+                Value y1 = x * fb.val(i32(3));
+                fb.vcross(fb.getArg(0), fb.getArg(1), fb.getArg(2), 3);
+                fb.ret(y0 + y1);
+            }
+
+            LinearScanRegisterAllocatorStep small(registerSet(3, 3));
+            CodeHolder sch(fb.getCode());
+            sch.owner = &fb;
+            sch.rebuildAll();
+            REQUIRE_THROWS(small.execute(&sch));
+
+            PhysicalRegisterSet set = registerSet(4, 3);
+            LinearScanRegisterAllocatorStep step(set);
+
+            CodeHolder ch(fb.getCode());
+            ch.owner = &fb;
+            ch.rebuildAll();
+            step.execute(&ch);
+            checkAllocation(ch, set);
+            REQUIRE(ch.registers.stats.spilledCount > 0);
+
+            TestBackend tb;
+            tb.addPostProcess(&step);
+            REQUIRE(tb.process(&fb));
+
+            f32 r[4] = { 0.0f, 0.0f, 0.0f, -1.0f };
+            f32 a[4] = { 1.0f, 0.0f, 0.0f, 0.0f };
+            f32 b[4] = { 0.0f, 1.0f, 0.0f, 0.0f };
+            f32* rp = r;
+            f32* ap = a;
+            f32* bp = b;
+            i32 x = 4;
+            i32 result = 0;
+            void* args[] = { &rp, &ap, &bp, &x };
+            fn.call(&result, args);
+
+            REQUIRE(result == 20);
+            REQUIRE(r[0] == 0.0f);
+            REQUIRE(r[1] == 0.0f);
+            REQUIRE(r[2] == 1.0f);
+            REQUIRE(r[3] == -1.0f);
+        }
+
+        SECTION("Functions with more arguments than registers are allocated") {
+            checkWeightedSum<LinearScanRegisterAllocatorStep>();
+        }
+    }
+
+    void testGraphColoring() {
+        setupTest();
+
+        SECTION("Moves from vregs which die are coalesced") {
+            Function fn("copy", Registry::Signature<i32, i32>(), Registry::GlobalNamespace());
+            FunctionBuilder fb(&fn);
+            Value x = fb.getArg(0);
+            Value product = x * fb.val(i32(3));
+            Value copy = fb.val<i32>();
+            fb.assign(copy, product);
+            fb.ret(copy + x);
+
+            PhysicalRegisterSet set = registerSet(8, 8);
+
+            LinearScanRegisterAllocatorStep linear(set);
+            CodeHolder lch(fb.getCode());
+            lch.owner = &fb;
+            lch.rebuildAll();
+            linear.execute(&lch);
+            checkAllocation(lch, set);
+            REQUIRE(lch.registers.getPhysicalRegister(product.getRegisterId()) != lch.registers.getPhysicalRegister(copy.getRegisterId()));
+
+            GraphColoringRegisterAllocatorStep coloring(set);
+            CodeHolder gch(fb.getCode());
+            gch.owner = &fb;
+            gch.rebuildAll();
+            coloring.execute(&gch);
+            checkAllocation(gch, set);
+            REQUIRE(gch.registers.getPhysicalRegister(product.getRegisterId()) == gch.registers.getPhysicalRegister(copy.getRegisterId()));
+
+            // x is still live after the move, so it can't share
+            REQUIRE(gch.registers.getPhysicalRegister(x.getRegisterId()) != gch.registers.getPhysicalRegister(copy.getRegisterId()));
+        }
+
+        SECTION("Spilled code computes the same results") {
+            for (u32 count = 1;count <= 10;count++) {
+                Function fn("products", Registry::Signature<i32, i32>(), Registry::GlobalNamespace());
+                FunctionBuilder fb(&fn);
+                buildProducts(fb, count);
+
+                PhysicalRegisterSet set = registerSet(3, 3);
+                GraphColoringRegisterAllocatorStep step(set);
+
+                CodeHolder ch(fb.getCode());
+                ch.owner = &fb;
+                ch.rebuildAll();
+                step.execute(&ch);
+                checkAllocation(ch, set);
+
+                TestBackend tb;
+                tb.addPostProcess(&step);
+                REQUIRE(tb.process(&fb));
+
+                i32 x = -5;
+                i32 result = 0;
+                void* args[] = { &x };
+                fn.call(&result, args);
+
+                REQUIRE(result == -5 * i32(count * (count + 1)) / 2);
+            }
+        }
+
+        SECTION("Values live across loops are spilled and reloaded correctly") {
+            Function fn("scaledSum", Registry::Signature<f64, i32, f64>(), Registry::GlobalNamespace());
+            FunctionBuilder fb(&fn);
+            buildScaledSum(fb);
+
+            PhysicalRegisterSet set = registerSet(3, 3);
+            GraphColoringRegisterAllocatorStep step(set);
+
+            CodeHolder ch(fb.getCode());
+            ch.owner = &fb;
+            ch.rebuildAll();
+            step.execute(&ch);
+            checkAllocation(ch, set);
+
+            TestBackend tb;
+            tb.addPostProcess(&step);
+            REQUIRE(tb.process(&fb));
+
+            i32 n = 100;
+            f64 scale = 2.0;
+            f64 result = 0.0;
+            void* args[] = { &n, &scale };
+            fn.call(&result, args);
+
+            REQUIRE(result == 9900.0);
+        }
+
+        SECTION("Functions with more arguments than registers are allocated") {
+            checkWeightedSum<GraphColoringRegisterAllocatorStep>();
+        }
+
+        SECTION("Values used in loops are kept in registers over those which aren't") {
+            Function fn("scaledSum", Registry::Signature<f64, i32, f64>(), Registry::GlobalNamespace());
+            FunctionBuilder fb(&fn);
+            buildScaledSum(fb);
+
+            PhysicalRegisterSet set = registerSet(3, 3);
+            LinearScanRegisterAllocatorStep linear(set);
+            GraphColoringRegisterAllocatorStep coloring(set);
+
+            CodeHolder lch(fb.getCode());
+            lch.owner = &fb;
+            lch.rebuildAll();
+            linear.execute(&lch);
+
+            CodeHolder gch(fb.getCode());
+            gch.owner = &fb;
+            gch.rebuildAll();
+            coloring.execute(&gch);
+
+            // Count the reloads which are executed by each iteration of the loop
+            auto loopReloads = [](CodeHolder& ch) {
+                u32 count = 0;
+                for (u32 c = 0;c < ch.code.size();c++) {
+                    const Instruction& i = ch.code[c];
+                    if (i.op != OpCode::jump || ch.labels.get(i.operands[0].getImm()) > c) continue;
+
+                    for (u32 l = ch.labels.get(i.operands[0].getImm());l < c;l++) {
+                        if (ch.code[l].op == OpCode::load) count++;
+                    }
+                }
+
+                return count;
+            };
+
+            REQUIRE(loopReloads(gch) < loopReloads(lch));
+        }
+
+        SECTION("The allocator is selected per function") {
+            Function hot("hot", Registry::Signature<i32, i32>(), Registry::GlobalNamespace());
+            FunctionBuilder hfb(&hot);
+            buildProducts(hfb, 4);
+
+            Function cold("cold", Registry::Signature<i32, i32>(), Registry::GlobalNamespace());
+            FunctionBuilder cfb(&cold);
+            buildProducts(cfb, 4);
+
+            PhysicalRegisterSet set = registerSet(8, 8);
+            LinearScanRegisterAllocatorStep linear(set);
+            GraphColoringRegisterAllocatorStep coloring(set);
+            TieredRegisterAllocatorStep tiered(&linear, &coloring);
+            tiered.setOptimized(&hot);
+            REQUIRE(tiered.isOptimized(&hot));
+            REQUIRE(!tiered.isOptimized(&cold));
+
+            TestBackend tb;
+            tb.addPostProcess(&tiered);
+            REQUIRE(tb.process(&hfb));
+            REQUIRE(coloring.getStats().functionCount == 1);
+            REQUIRE(linear.getStats().functionCount == 0);
+
+            REQUIRE(tb.process(&cfb));
+            REQUIRE(coloring.getStats().functionCount == 1);
+            REQUIRE(linear.getStats().functionCount == 1);
+
+            i32 x = 3;
+            i32 hr = 0;
+            i32 cr = 0;
+            void* args[] = { &x };
+            hot.call(&hr, args);
+            cold.call(&cr, args);
+            REQUIRE(hr == 30);
+            REQUIRE(cr == 30);
+
+            tiered.setOptimized(&hot, false);
+            REQUIRE(!tiered.isOptimized(&hot));
+        }
+    }
+};
+
+TEST_CASE("Test Register Allocation", "[codegen]") {
+    SECTION("Linear Scan") {
+        regalloc::testLinearScan();
+    }
+
+    SECTION("Graph Coloring") {
+        regalloc::testGraphColoring();
+    }
+}
@@ -0,0 +1,265 @@
+#include "BackendTests.h"
+#include <codegen/X86_64Backend.h>
+
+namespace x86_64 {
+    void testNarrowWrites() {
+        setupTest();
+        if (!X86_64Backend::IsSupported()) return;
+
+        // Narrow operations only write the bytes of their type, like the interpreter does
+        auto narrowInPlace = [](FunctionBuilder& fb) {
+            Value wide = fb.val<u64>();
+            fb.assign(wide, fb.getArg(0));
+
+            Value narrow = wide;
+            narrow.setType(Registry::GetType<u8>());
+
+            Instruction div(OpCode::udiv);
+            div.operands[0].reset(narrow);
+            div.operands[1].reset(narrow);
+            div.operands[2].reset(fb.val(u8(2)));
+            fb.add(div);
+
+            fb.ret(wide);
+        };
+
+        REQUIRE(executeBoth<X86_64Backend, u64>(narrowInPlace, u64(0x1122334455667788)) == 0x1122334455667744);
+
+        auto negateInPlace = [](FunctionBuilder& fb) {
+            Value wide = fb.val<u64>();
+            fb.assign(wide, fb.getArg(0));
+
+            Value narrow = wide;
+            narrow.setType(Registry::GetType<f32>());
+
+            Instruction neg(OpCode::fneg);
+            neg.operands[0].reset(narrow);
+            neg.operands[1].reset(fb.val(f32(1.0f)));
+            fb.add(neg);
+
+            fb.ret(wide);
+        };
+
+        REQUIRE(executeBoth<X86_64Backend, u64>(negateInPlace, u64(0x1122334455667788)) == 0x11223344BF800000);
+
+        // Like the interpreter, '_not' writes the whole register whatever the width of its operand
+        auto notInPlace = [](FunctionBuilder& fb) {
+            Value wide = fb.val<u64>();
+            fb.assign(wide, fb.getArg(0));
+
+            Value narrow = wide;
+            narrow.setType(Registry::GetType<u8>());
+
+            Instruction inst(OpCode::_not);
+            inst.operands[0].reset(narrow);
+            inst.operands[1].reset(narrow);
+            fb.add(inst);
+
+            fb.ret(wide);
+        };
+
+        REQUIRE(executeBoth<X86_64Backend, u64>(notInPlace, u64(0x1122334455667700)) == 1);
+    }
+
+    template <typename From, typename To>
+    void checkConversion(From value) {
+        auto convert = [](FunctionBuilder& fb) { fb.ret(fb.getArg(0).convertedTo(Registry::GetType<To>())); };
+        REQUIRE(executeBoth<X86_64Backend, To>(convert, value) == To(value));
+    }
+
+    template <typename From>
+    void checkConversionsTo(From value, bool toUnsigned) {
+        checkConversion<From, i8>(value);
+        checkConversion<From, i16>(value);
+        checkConversion<From, i32>(value);
+        checkConversion<From, i64>(value);
+        checkConversion<From, f32>(value);
+        checkConversion<From, f64>(value);
+        if (!toUnsigned) return;
+
+        checkConversion<From, u8>(value);
+        checkConversion<From, u16>(value);
+        checkConversion<From, u32>(value);
+        checkConversion<From, u64>(value);
+    }
+
+    void testConversions() {
+        setupTest();
+        if (!X86_64Backend::IsSupported()) return;
+
+        // Every pair of types, with a value that all of them can hold
+        checkConversionsTo<i8>(100, true);
+        checkConversionsTo<i16>(100, true);
+        checkConversionsTo<i32>(100, true);
+        checkConversionsTo<i64>(100, true);
+        checkConversionsTo<u8>(100, true);
+        checkConversionsTo<u16>(100, true);
+        checkConversionsTo<u32>(100, true);
+        checkConversionsTo<u64>(100, true);
+        checkConversionsTo<f32>(100.75f, true);
+        checkConversionsTo<f64>(100.75, true);
+
+        // Negative values are only converted to signed and floating point types
+        checkConversionsTo<i8>(-7, false);
+        checkConversionsTo<i16>(-7, false);
+        checkConversionsTo<i32>(-7, false);
+        checkConversionsTo<i64>(-7, false);
+        checkConversionsTo<f32>(-7.5f, false);
+        checkConversionsTo<f64>(-7.5, false);
+
+        // Values which need all of the bits of the wider types
+        checkConversion<u64, f64>(0x8000000000000801ull);
+        checkConversion<f64, u64>(18446744073709549568.0);
+        checkConversion<i64, f32>(0x7FFFFFFFFFFFFF01ll);
+        checkConversion<u32, f64>(0xFFFFFFFFu);
+        checkConversion<f64, u32>(4294967295.0);
+        checkConversion<f64, f32>(0.1);
+    }
+
+    void testCalls() {
+        setupTest();
+        if (!X86_64Backend::IsSupported()) return;
+
+        SECTION("Tail recursion runs in constant stack space") {
+            // count(n, acc) = n == 0 ? acc : count(n - 1, acc + 1)
+            Function count("count", Registry::Signature<i32, i32, i32>(), Registry::GlobalNamespace());
+            FunctionBuilder fb(&count);
+            Value n = fb.getArg(0);
+            Value acc = fb.getArg(1);
+
+            fb.generateIf(n == fb.val(i32(0)), [&]() {
+                fb.generateReturn(acc);
+            });
+
+            fb.generateReturn(fb.generateCall(&count, { n - fb.val(i32(1)), acc + fb.val(i32(1)) }));
+
+            TailCallEliminationStep step;
+            X86_64Backend backend;
+            backend.addPostProcess(&step);
+            REQUIRE(backend.process(&fb));
+
+            // Deep enough to overflow the host stack if each call had a frame of its own
+            i32 depth = 10000000;
+            i32 start = 0;
+            i32 result = -1;
+            void* args[] = { &depth, &start };
+            count.call(&result, args);
+
+            REQUIRE(result == depth);
+        }
+
+        SECTION("Frames can be larger than a page") {
+            // big(n) = n == 0 ? 0 : n + big(n - 1), with a cleared 64 KB buffer in each frame
+            constexpr u32 size = 65536;
+            Function big("big", Registry::Signature<i32, i32>(), Registry::GlobalNamespace());
+            FunctionBuilder fb(&big);
+            Value n = fb.getArg(0);
+
+            stack_id buf = fb.stackAlloc(size);
+            Value p = fb.val<i32*>();
+            fb.stackPtr(p, buf);
+
+            fb.generateIf(n == fb.val(i32(0)), [&]() {
+                fb.generateReturn(fb.val(i32(0)));
+            });
+
+            Value first = fb.val<i32>();
+            Value last = fb.val<i32>();
+            fb.load(first, p);
+            fb.load(last, p, size - sizeof(i32));
+            fb.store(n, p);
+            fb.store(n, p, size - sizeof(i32));
+
+            Value rest = fb.generateCall(&big, { n - fb.val(i32(1)) });
+            fb.generateReturn(rest + n + first + last);
+
+            X86_64Backend backend;
+            REQUIRE(backend.process(&fb));
+
+            i32 input = 10;
+            i32 result = -1;
+            void* args[] = { &input };
+            big.call(&result, args);
+            REQUIRE(result == 55);
+        }
+
+        SECTION("Exceptions are propagated through calls between compiled functions") {
+            Function thrower("thrower", Registry::Signature<i32, i32>(), Registry::GlobalNamespace());
+            thrower.setCallHandler(new ThrowingHandler(&thrower));
+
+            // leaf(n) = n == 1 ? thrower(n) : n
+            Function leaf("leaf", Registry::Signature<i32, i32>(), Registry::GlobalNamespace());
+            FunctionBuilder lfb(&leaf);
+            lfb.generateIf(lfb.getArg(0) == lfb.val(i32(1)), [&]() {
+                lfb.generateReturn(lfb.generateCall(&thrower, { lfb.getArg(0) }));
+            });
+            lfb.generateReturn(lfb.getArg(0));
+
+            // depth(n) = n == 0 ? 0 : depth(n - 1) + leaf(n)
+            Function depth("depth", Registry::Signature<i32, i32>(), Registry::GlobalNamespace());
+            FunctionBuilder dfb(&depth);
+            Value n = dfb.getArg(0);
+            dfb.generateIf(n == dfb.val(i32(0)), [&]() {
+                dfb.generateReturn(dfb.val(i32(0)));
+            });
+            Value inner = dfb.generateCall(&depth, { n - dfb.val(i32(1)) });
+            dfb.generateReturn(inner + dfb.generateCall(&leaf, { n }));
+
+            X86_64Backend backend;
+            REQUIRE(backend.process(&lfb));
+            REQUIRE(backend.process(&dfb));
+
+            i32 input = 50;
+            i32 result = -1;
+            void* args[] = { &input };
+            REQUIRE_THROWS(depth.call(&result, args));
+
+            // Nothing is left behind, so the functions can still be called
+            input = 0;
+            depth.call(&result, args);
+            REQUIRE(result == 0);
+
+            input = 2;
+            leaf.call(&result, args);
+            REQUIRE(result == 2);
+        }
+    }
+};
+
+TEST_CASE("Test X86_64 Backend", "[codegen]") {
+    SECTION("Arithmetic") {
+        backend_tests::testArithmetic<X86_64Backend>();
+    }
+
+    SECTION("Narrow Arithmetic") {
+        backend_tests::testNarrowArithmetic<X86_64Backend>();
+    }
+
+    SECTION("Narrow Writes") {
+        x86_64::testNarrowWrites();
+    }
+
+    SECTION("Comparisons") {
+        backend_tests::testComparisons<X86_64Backend>();
+    }
+
+    SECTION("Conversions and Vectors") {
+        backend_tests::testConversionsAndVectors<X86_64Backend>();
+    }
+
+    SECTION("Stack") {
+        backend_tests::testStack<X86_64Backend>();
+    }
+
+    SECTION("Calls") {
+        backend_tests::testCalls<X86_64Backend>();
+    }
+
+    SECTION("Inline Conversions") {
+        x86_64::testConversions();
+    }
+
+    SECTION("Direct Calls") {
+        x86_64::testCalls();
+    }
+}